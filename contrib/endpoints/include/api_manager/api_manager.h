@@ -29,11 +29,24 @@
 namespace google {
 namespace api_manager {
 
+// Statistics of the cache of validated JWTs.
+struct JwtCacheStatistics {
+  // Lookups that found a valid cached JWT.
+  uint64_t hits;
+  // Lookups that found no entry or an expired one.
+  uint64_t misses;
+  // Entries evicted to make room for new ones.
+  uint64_t evictions;
+  // Expired entries removed by lookups.
+  uint64_t expirations;
+};
+
 // Data to summarize the API Manager statistics.
 // Important note: please don't use std::string. These fields are directly
 // copied into a shared memory.
 struct ApiManagerStatistics {
   service_control::Statistics service_control_statistics;
+  JwtCacheStatistics jwt_cache_statistics;
 };
 
 class ApiManager {
@@ -46,9 +59,22 @@ class ApiManager {
   // Gets the service name.
   virtual const std::string &service_name() const = 0;
 
-  // Gets the service config
+  // Gets the service config the API Manager was created with.
   virtual const ::google::api::Service &service() const = 0;
 
+  // Gets the version of the service config in use. The config the API
+  // Manager was created with is version 1; every successful UpdateConfig()
+  // increments it.
+  virtual uint64_t config_version() const = 0;
+
+  // Builds a new service config from service_config and server_config on the
+  // calling thread and atomically swaps it in. Requests already in flight
+  // keep using the config they started with. The service name must not
+  // change. Service control, cloud trace and the auth force-disable switch
+  // keep using the server config the API Manager was created with.
+  virtual utils::Status UpdateConfig(const std::string &service_config,
+                                     const std::string &server_config) = 0;
+
   // Set the metadata server for GCP platforms.
   virtual void SetMetadataServer(const std::string &server) = 0;
 
@@ -107,6 +133,8 @@ class ApiManagerFactory {
 
   // Gets or creates an ApiManager instance. Service configurations with the
   // same service names will resolve to the same live ApiManager instance.
+  // If that instance was created with a different service config, the new
+  // config is swapped into it.
   // The environment is used iff the instance needs to be created;
   // otherwise, it's deleted. This means that the returned ApiManager may
   // use a different environment than the one provided.
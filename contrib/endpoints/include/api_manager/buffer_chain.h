@@ -0,0 +1,73 @@
+/* Copyright 2017 Google Inc. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef API_MANAGER_BUFFER_CHAIN_H_
+#define API_MANAGER_BUFFER_CHAIN_H_
+
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace google {
+namespace api_manager {
+
+// A sequence of immutable, reference counted buffers holding a message body.
+// Copying a chain shares its buffers, so that a body can be handed from the
+// API Manager to the environment, or kept for retries, without copying its
+// bytes.
+class BufferChain {
+ public:
+  typedef std::shared_ptr<const std::string> Buffer;
+
+  BufferChain() : size_(0) {}
+
+  // Appends the buffer to the chain. Empty buffers are skipped.
+  void Append(Buffer buffer) {
+    if (buffer && !buffer->empty()) {
+      size_ += buffer->size();
+      buffers_.push_back(std::move(buffer));
+    }
+  }
+
+  // Appends the data to the chain, without copying it.
+  void Append(std::string&& data) {
+    Append(std::make_shared<const std::string>(std::move(data)));
+  }
+
+  const std::vector<Buffer>& buffers() const { return buffers_; }
+
+  // The total size of the buffers.
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  // Copies the buffers into a contiguous string.
+  std::string ToString() const {
+    std::string result;
+    result.reserve(size_);
+    for (const Buffer& buffer : buffers_) {
+      result.append(*buffer);
+    }
+    return result;
+  }
+
+ private:
+  std::vector<Buffer> buffers_;
+  size_t size_;
+};
+
+}  // namespace api_manager
+}  // namespace google
+
+#endif  // API_MANAGER_BUFFER_CHAIN_H_
@@ -60,6 +60,11 @@ class ApiManagerEnvInterface {
   // (possibly before returning).
   virtual void RunHTTPRequest(std::unique_ptr<HTTPRequest> request) = 0;
 
+  // Environment support for issuing unary gRPC calls from the API Manager.
+  // The environment takes ownership of the request, and eventually invokes
+  // request->OnComplete() with the status and the serialized response. Calls
+  // to the same server should be multiplexed on a long-lived channel, rather
+  // than each opening its own connection.
   virtual void RunGRPCRequest(std::unique_ptr<GRPCRequest> request) = 0;
 };
 
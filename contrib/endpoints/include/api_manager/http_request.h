@@ -16,8 +16,10 @@
 #define API_MANAGER_HTTP_REQUEST_H_
 
 #include <functional>
+#include <map>
 #include <string>
 
+#include "contrib/endpoints/include/api_manager/buffer_chain.h"
 #include "contrib/endpoints/include/api_manager/utils/status.h"
 
 namespace google {
@@ -27,6 +29,13 @@ namespace api_manager {
 // processed by the environment.
 class HTTPRequest {
  public:
+  // The callback of a request whose response body is delivered as a buffer
+  // chain, so that it can be parsed without being copied into a string.
+  typedef std::function<void(utils::Status,
+                             std::map<std::string, std::string>&&,
+                             BufferChain&&)>
+      BufferChainCallback;
+
   // HTTPRequest constructor without headers in the callback function.
   // Callback receives NGX_ERROR status code if the request fails to initiate or
   // complete.
@@ -40,7 +49,18 @@ class HTTPRequest {
         requires_response_headers_(false),
         timeout_ms_(0),
         max_retries_(0),
-        timeout_backoff_factor_(2.0) {}
+        timeout_backoff_factor_(2.0),
+        http2_(false) {}
+
+  // HTTPRequest constructor with the response body delivered as a buffer
+  // chain. Otherwise the same as above.
+  HTTPRequest(BufferChainCallback callback)
+      : buffer_chain_callback_(callback),
+        requires_response_headers_(false),
+        timeout_ms_(0),
+        max_retries_(0),
+        timeout_backoff_factor_(2.0),
+        http2_(false) {}
 
   // A callback for the environment to invoke when the request is
   // complete.  This will be invoked by the environment exactly once,
@@ -51,7 +71,26 @@ class HTTPRequest {
   void OnComplete(utils::Status status,
                   std::map<std::string, std::string>&& headers,
                   std::string&& body) {
-    callback_(status, std::move(headers), std::move(body));
+    if (buffer_chain_callback_) {
+      BufferChain chain;
+      chain.Append(std::move(body));
+      buffer_chain_callback_(status, std::move(headers), std::move(chain));
+    } else {
+      callback_(status, std::move(headers), std::move(body));
+    }
+  }
+
+  // The same as above, for environments receiving the response body in
+  // several buffers. They are only copied into a string if the request was
+  // not created with a BufferChainCallback.
+  void OnComplete(utils::Status status,
+                  std::map<std::string, std::string>&& headers,
+                  BufferChain&& body) {
+    if (buffer_chain_callback_) {
+      buffer_chain_callback_(status, std::move(headers), std::move(body));
+    } else {
+      callback_(status, std::move(headers), body.ToString());
+    }
   }
 
   // Request properties.
@@ -75,13 +114,34 @@ class HTTPRequest {
     return *this;
   }
 
-  const std::string& body() const { return body_; }
+  // The body as a string. It is only copied if it has several buffers;
+  // environments able to send them one by one should use body_chain().
+  const std::string& body() const {
+    const auto& buffers = body_.buffers();
+    if (buffers.size() == 1) {
+      return *buffers[0];
+    }
+    if (buffers.empty()) {
+      static const std::string* empty = new std::string;
+      return *empty;
+    }
+    if (flat_body_.size() != body_.size()) {
+      flat_body_ = body_.ToString();
+    }
+    return flat_body_;
+  }
+  const BufferChain& body_chain() const { return body_; }
   HTTPRequest& set_body(const std::string& value) {
-    body_ = value;
-    return *this;
+    return set_body(std::string(value));
   }
   HTTPRequest& set_body(std::string&& value) {
+    BufferChain body;
+    body.Append(std::move(value));
+    return set_body(std::move(body));
+  }
+  HTTPRequest& set_body(BufferChain&& value) {
     body_ = std::move(value);
+    flat_body_.clear();
     return *this;
   }
 
@@ -124,13 +184,34 @@ class HTTPRequest {
     return *this;
   }
 
+  // A hint for environments keeping persistent connections: requests with
+  // the same non-empty key may be sent on the same connections, which are
+  // kept alive between them. An empty key lets the environment pick the
+  // connection.
+  const std::string& connection_key() const { return connection_key_; }
+  HTTPRequest& set_connection_key(const std::string& value) {
+    connection_key_ = value;
+    return *this;
+  }
+
+  // A hint that the request may be sent as an HTTP/2 stream, multiplexed
+  // with the other requests on its connection.
+  bool http2() const { return http2_; }
+  HTTPRequest& set_http2(bool value) {
+    http2_ = value;
+    return *this;
+  }
+
  private:
   std::function<void(utils::Status, std::map<std::string, std::string>&&,
                      std::string&&)>
       callback_;
+  BufferChainCallback buffer_chain_callback_;
   std::string method_;
   std::string url_;
-  std::string body_;
+  BufferChain body_;
+  // The body copied into a string by body(), if it has several buffers.
+  mutable std::string flat_body_;
   std::map<std::string, std::string> headers_;
 
   // Indicates whether to extract headers from the response
@@ -144,6 +225,9 @@ class HTTPRequest {
 
   // Exponential back-off for the retries
   double timeout_backoff_factor_;
+
+  std::string connection_key_;
+  bool http2_;
 };
 
 }  // namespace api_manager
@@ -45,6 +45,19 @@ struct Statistics {
 
   // Maximum report request size send to server.
   uint64_t max_report_size;
+  // The additional report requests sent by splitting the report requests
+  // larger than the maximum size.
+  uint64_t send_report_splits;
+  // The total size of the report requests, before and after compression.
+  uint64_t send_report_bytes;
+  uint64_t send_report_compressed_bytes;
+
+  // The current interval between flushes of the locally aggregated reports,
+  // as adapted to the load. 0 if local aggregation is disabled.
+  uint64_t report_flush_interval_ms;
+  // The current number of locally aggregated operations which triggers a
+  // flush before the interval. 0 if local aggregation is disabled.
+  uint64_t report_flush_entries;
 };
 
 // Per request latency statistics.
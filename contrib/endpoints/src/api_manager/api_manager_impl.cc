@@ -20,6 +20,7 @@
 #include "contrib/endpoints/src/api_manager/request_handler.h"
 
 using ::google::api_manager::proto::ServerConfig;
+using ::google::protobuf::util::error::Code;
 
 namespace google {
 namespace api_manager {
@@ -49,6 +50,36 @@ std::unique_ptr<RequestHandlerInterface> ApiManagerImpl::CreateRequestHandler(
       check_workflow_, service_context_, std::move(request_data)));
 }
 
+utils::Status ApiManagerImpl::UpdateConfig(const std::string& service_config,
+                                           const std::string& server_config) {
+  std::unique_ptr<Config> config =
+      Config::Create(service_context_->env(), service_config, server_config);
+  if (config == nullptr) {
+    return utils::Status(Code::INVALID_ARGUMENT, "Invalid service config");
+  }
+  return UpdateConfig(std::move(config));
+}
+
+utils::Status ApiManagerImpl::UpdateConfig(std::unique_ptr<Config> config) {
+  return service_context_->UpdateConfig(std::move(config), nullptr);
+}
+
+utils::Status ApiManagerImpl::GetStatistics(
+    ApiManagerStatistics* statistics) const {
+  auth::JwtCache::Statistics jwt_cache_stat;
+  service_context_->jwt_cache().GetStatistics(&jwt_cache_stat);
+  statistics->jwt_cache_statistics.hits = jwt_cache_stat.hits;
+  statistics->jwt_cache_statistics.misses = jwt_cache_stat.misses;
+  statistics->jwt_cache_statistics.evictions = jwt_cache_stat.evictions;
+  statistics->jwt_cache_statistics.expirations = jwt_cache_stat.expirations;
+
+  if (service_control()) {
+    return service_control()->GetStatistics(
+        &statistics->service_control_statistics);
+  }
+  return utils::Status::OK;
+}
+
 std::shared_ptr<ApiManager> ApiManagerFactory::GetOrCreateApiManager(
     std::unique_ptr<ApiManagerEnvInterface> env,
     const std::string& service_config, const std::string& server_config) {
@@ -64,10 +95,20 @@ std::shared_ptr<ApiManager> ApiManagerFactory::GetOrCreateApiManager(
   std::shared_ptr<ApiManager> result = it->second.lock();
 
   if (!result) {
-    // TODO: Handle the case where the caller gives us a different
-    // config with the same service name.
     result = CreateApiManager(std::move(env), std::move(config));
     it->second = result;
+  } else {
+    // The caller gives us a config for the same service. Swap it in unless
+    // it is known to be the config already in use.
+    ApiManagerImpl* impl = static_cast<ApiManagerImpl*>(result.get());
+    if (config->service().id().empty() ||
+        config->service().id() != impl->config_id()) {
+      utils::Status status = impl->UpdateConfig(std::move(config));
+      if (!status.ok()) {
+        env->LogError("Failed to update service config: " +
+                      status.ToString());
+      }
+    }
   }
 
   return result;
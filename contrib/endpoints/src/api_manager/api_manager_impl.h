@@ -40,6 +40,21 @@ class ApiManagerImpl : public ApiManager {
     return service_context_->service();
   }
 
+  virtual uint64_t config_version() const {
+    return service_context_->config_version();
+  }
+
+  virtual utils::Status UpdateConfig(const std::string &service_config,
+                                     const std::string &server_config);
+
+  // Swaps in an already built config.
+  utils::Status UpdateConfig(std::unique_ptr<Config> config);
+
+  // Returns the id of the service config in use.
+  std::string config_id() const {
+    return service_context_->config()->service().id();
+  }
+
   virtual void SetMetadataServer(const std::string &server) {
     service_context_->SetMetadataServer(server);
   }
@@ -74,14 +89,7 @@ class ApiManagerImpl : public ApiManager {
   virtual std::unique_ptr<RequestHandlerInterface> CreateRequestHandler(
       std::unique_ptr<Request> request);
 
-  virtual utils::Status GetStatistics(ApiManagerStatistics *statistics) const {
-    if (service_control()) {
-      return service_control()->GetStatistics(
-          &statistics->service_control_statistics);
-    } else {
-      return utils::Status::OK;
-    }
-  }
+  virtual utils::Status GetStatistics(ApiManagerStatistics *statistics) const;
 
   virtual bool get_logging_status_disabled() {
     return service_context_->DisableLogStatus();
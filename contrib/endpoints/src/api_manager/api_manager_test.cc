@@ -80,6 +80,57 @@ TEST_F(ApiManagerTest, SameServiceNameYieldsSameApiManager) {
   ASSERT_EQ(esp1.get(), esp2.get());
 }
 
+const char service_one_v2[] =
+    "name: \"service-one\"\n"
+    "id: \"2017-01-01r0\"\n";
+const char service_one_v3[] =
+    "name: \"service-one\"\n"
+    "id: \"2017-01-02r0\"\n";
+
+TEST_F(ApiManagerTest, UpdateConfigSwapsSnapshot) {
+  std::unique_ptr<ApiManagerEnvInterface> env(
+      new ::testing::NiceMock<MockApiManagerEnvironment>());
+
+  std::shared_ptr<ApiManager> esp(MakeApiManager(std::move(env), service_one));
+  ASSERT_TRUE(esp);
+  EXPECT_EQ(1u, esp->config_version());
+
+  EXPECT_TRUE(esp->UpdateConfig(service_one_v2, "").ok());
+  EXPECT_EQ(2u, esp->config_version());
+  EXPECT_EQ("service-one", esp->service_name());
+
+  // Neither an invalid config nor a config for a different service is
+  // swapped in.
+  EXPECT_FALSE(esp->UpdateConfig("", "").ok());
+  EXPECT_FALSE(esp->UpdateConfig(service_two, "").ok());
+  EXPECT_EQ(2u, esp->config_version());
+}
+
+TEST_F(ApiManagerTest, SameServiceNameWithNewConfigUpdatesApiManager) {
+  std::unique_ptr<ApiManagerEnvInterface> env_one(
+      new ::testing::NiceMock<MockApiManagerEnvironment>());
+  std::unique_ptr<ApiManagerEnvInterface> env_two(
+      new ::testing::NiceMock<MockApiManagerEnvironment>());
+  std::unique_ptr<ApiManagerEnvInterface> env_three(
+      new ::testing::NiceMock<MockApiManagerEnvironment>());
+
+  std::shared_ptr<ApiManager> esp1(
+      MakeApiManager(std::move(env_one), service_one_v2));
+  ASSERT_TRUE(esp1);
+  EXPECT_EQ(1u, esp1->config_version());
+
+  // The same config is not swapped in again.
+  std::shared_ptr<ApiManager> esp2(
+      MakeApiManager(std::move(env_two), service_one_v2));
+  ASSERT_EQ(esp1.get(), esp2.get());
+  EXPECT_EQ(1u, esp1->config_version());
+
+  std::shared_ptr<ApiManager> esp3(
+      MakeApiManager(std::move(env_three), service_one_v3));
+  ASSERT_EQ(esp1.get(), esp3.get());
+  EXPECT_EQ(2u, esp1->config_version());
+}
+
 const char kServiceForStatistics[] =
     "name: \"service-name\"\n"
     "control: {\n"
@@ -106,6 +157,11 @@ TEST_F(ApiManagerTest, CorrectStatistics) {
   EXPECT_EQ(0, service_control_stat.send_reports_by_flush);
   EXPECT_EQ(0, service_control_stat.send_reports_in_flight);
   EXPECT_EQ(0, service_control_stat.send_report_operations);
+  const JwtCacheStatistics &jwt_cache_stat = statistics.jwt_cache_statistics;
+  EXPECT_EQ(0, jwt_cache_stat.hits);
+  EXPECT_EQ(0, jwt_cache_stat.misses);
+  EXPECT_EQ(0, jwt_cache_stat.evictions);
+  EXPECT_EQ(0, jwt_cache_stat.expirations);
 }
 
 TEST_F(ApiManagerTest, DifferentServiceNameYieldsDifferentApiManager) {
@@ -17,32 +17,38 @@
 
 #include <chrono>
 #include <map>
+#include <memory>
 #include <string>
 
+#include "contrib/endpoints/src/api_manager/auth/lib/auth_jwt_validator.h"
+
 namespace google {
 namespace api_manager {
 namespace auth {
 
-// A class to manage certs for token validation.
+// A class to manage certs for token validation. The certs are parsed once
+// when they are updated, so validating a token can use them directly.
 class Certs {
  public:
+  typedef std::pair<std::shared_ptr<const JwtKeySet>,
+                    std::chrono::system_clock::time_point>
+      Entry;
+
   void Update(const std::string& issuer, const std::string& cert,
               std::chrono::system_clock::time_point expiration) {
-    issuer_cert_map_[issuer] = std::make_pair(cert, expiration);
+    issuer_cert_map_[issuer] =
+        std::make_pair(JwtKeySet::Create(cert.data(), cert.size()), expiration);
   }
 
-  const std::pair<std::string, std::chrono::system_clock::time_point>* GetCert(
-      const std::string& iss) {
-    return issuer_cert_map_.find(iss) == issuer_cert_map_.end()
-               ? nullptr
-               : &(issuer_cert_map_[iss]);
+  const Entry* GetCert(const std::string& iss) const {
+    auto it = issuer_cert_map_.find(iss);
+    return it == issuer_cert_map_.end() ? nullptr : &it->second;
   }
 
  private:
-  // Map from issuer to a verification key and its absolute expiration time.
-  std::map<std::string,
-           std::pair<std::string, std::chrono::system_clock::time_point> >
-      issuer_cert_map_;
+  // Map from issuer to its parsed verification keys and their absolute
+  // expiration time.
+  std::map<std::string, Entry> issuer_cert_map_;
 };
 
 }  // namespace auth
@@ -0,0 +1,59 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+#include "contrib/endpoints/src/api_manager/auth/inflight_key_fetches.h"
+
+namespace google {
+namespace api_manager {
+namespace auth {
+
+bool InflightKeyFetches::Enqueue(const std::string& issuer,
+                                 Callback callback) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto result = waiters_.emplace(issuer, std::vector<Callback>());
+  if (callback) {
+    result.first->second.push_back(std::move(callback));
+  }
+  return result.second;
+}
+
+void InflightKeyFetches::Complete(const std::string& issuer,
+                                  const utils::Status& status) {
+  std::vector<Callback> callbacks;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = waiters_.find(issuer);
+    if (it == waiters_.end()) {
+      return;
+    }
+    callbacks.swap(it->second);
+    waiters_.erase(it);
+  }
+  // Callbacks are called without holding the lock; they may start another
+  // fetch for the same issuer.
+  for (const auto& callback : callbacks) {
+    callback(status);
+  }
+}
+
+bool InflightKeyFetches::InFlight(const std::string& issuer) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return waiters_.find(issuer) != waiters_.end();
+}
+
+}  // namespace auth
+}  // namespace api_manager
+}  // namespace google
@@ -0,0 +1,60 @@
+/* Copyright 2016 Google Inc. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef API_MANAGER_AUTH_INFLIGHT_KEY_FETCHES_H_
+#define API_MANAGER_AUTH_INFLIGHT_KEY_FETCHES_H_
+
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "contrib/endpoints/include/api_manager/utils/status.h"
+
+namespace google {
+namespace api_manager {
+namespace auth {
+
+// Tracks the verification key fetches in flight, so that concurrent requests
+// for the keys of the same issuer share a single fetch instead of each
+// sending its own HTTP requests.
+class InflightKeyFetches {
+ public:
+  typedef std::function<void(const utils::Status& status)> Callback;
+
+  // Queues callback to be called when the fetch of the issuer keys completes.
+  // An empty callback is allowed and registers no waiter. Returns true if no
+  // fetch for the issuer was in flight: the caller must then start one and
+  // call Complete() when it is done.
+  bool Enqueue(const std::string& issuer, Callback callback);
+
+  // Completes the fetch for the issuer and calls all the queued callbacks
+  // with status, in the order they were queued.
+  void Complete(const std::string& issuer, const utils::Status& status);
+
+  // Returns true if a fetch for the issuer is in flight.
+  bool InFlight(const std::string& issuer) const;
+
+ private:
+  mutable std::mutex mutex_;
+  // Maps issuer to the callbacks waiting on its fetch.
+  std::map<std::string, std::vector<Callback>> waiters_;
+};
+
+}  // namespace auth
+}  // namespace api_manager
+}  // namespace google
+
+#endif  // API_MANAGER_AUTH_INFLIGHT_KEY_FETCHES_H_
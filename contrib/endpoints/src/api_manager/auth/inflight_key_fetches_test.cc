@@ -0,0 +1,103 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+#include "contrib/endpoints/src/api_manager/auth/inflight_key_fetches.h"
+#include <vector>
+#include "gtest/gtest.h"
+
+using ::google::api_manager::utils::Status;
+using ::google::protobuf::util::error::Code;
+
+namespace google {
+namespace api_manager {
+namespace auth {
+
+namespace {
+
+const char kIssuer1[] = "https://issuer1.com";
+const char kIssuer2[] = "https://issuer2.com";
+
+TEST(InflightKeyFetches, FirstCallerStartsFetch) {
+  InflightKeyFetches fetches;
+  std::vector<int> called;
+  EXPECT_FALSE(fetches.InFlight(kIssuer1));
+  EXPECT_TRUE(fetches.Enqueue(kIssuer1, [&called](const Status& status) {
+    EXPECT_TRUE(status.ok());
+    called.push_back(1);
+  }));
+  EXPECT_TRUE(fetches.InFlight(kIssuer1));
+  EXPECT_FALSE(fetches.Enqueue(kIssuer1, [&called](const Status& status) {
+    EXPECT_TRUE(status.ok());
+    called.push_back(2);
+  }));
+  // Other issuers are fetched independently.
+  EXPECT_TRUE(fetches.Enqueue(kIssuer2, [&called](const Status& status) {
+    called.push_back(3);
+  }));
+
+  fetches.Complete(kIssuer1, Status::OK);
+  EXPECT_EQ(std::vector<int>({1, 2}), called);
+  EXPECT_FALSE(fetches.InFlight(kIssuer1));
+  EXPECT_TRUE(fetches.InFlight(kIssuer2));
+
+  // Completing again is a no-op.
+  fetches.Complete(kIssuer1, Status::OK);
+  EXPECT_EQ(std::vector<int>({1, 2}), called);
+}
+
+TEST(InflightKeyFetches, FailurePassedToAllWaiters) {
+  InflightKeyFetches fetches;
+  int failed = 0;
+  auto callback = [&failed](const Status& status) {
+    EXPECT_EQ(Code::UNAUTHENTICATED, status.code());
+    ++failed;
+  };
+  EXPECT_TRUE(fetches.Enqueue(kIssuer1, callback));
+  EXPECT_FALSE(fetches.Enqueue(kIssuer1, callback));
+  EXPECT_FALSE(fetches.Enqueue(kIssuer1, callback));
+  fetches.Complete(kIssuer1, Status(Code::UNAUTHENTICATED, "failed"));
+  EXPECT_EQ(3, failed);
+}
+
+TEST(InflightKeyFetches, EmptyCallback) {
+  InflightKeyFetches fetches;
+  // A background refresh registers no waiter but still marks the fetch as
+  // in flight.
+  EXPECT_TRUE(fetches.Enqueue(kIssuer1, nullptr));
+  bool called = false;
+  EXPECT_FALSE(fetches.Enqueue(kIssuer1,
+                               [&called](const Status&) { called = true; }));
+  fetches.Complete(kIssuer1, Status::OK);
+  EXPECT_TRUE(called);
+}
+
+TEST(InflightKeyFetches, CallbackStartsNewFetch) {
+  InflightKeyFetches fetches;
+  bool restarted = false;
+  EXPECT_TRUE(fetches.Enqueue(
+      kIssuer1, [&fetches, &restarted](const Status&) {
+        restarted = fetches.Enqueue(kIssuer1, nullptr);
+      }));
+  fetches.Complete(kIssuer1, Status::OK);
+  EXPECT_TRUE(restarted);
+  EXPECT_TRUE(fetches.InFlight(kIssuer1));
+}
+
+}  // namespace
+
+}  // namespace auth
+}  // namespace api_manager
+}  // namespace google
@@ -16,7 +16,10 @@
 //
 #include "contrib/endpoints/src/api_manager/auth/jwt_cache.h"
 
-using ::google::service_control_client::SimpleLRUCache;
+#include <openssl/sha.h>
+#include <algorithm>
+#include <cstring>
+
 using std::chrono::system_clock;
 
 namespace google {
@@ -24,26 +27,138 @@ namespace api_manager {
 namespace auth {
 
 namespace {
-// The maximum lifetime of a cache entry. Unit: seconds.
-// TODO: This value should be configurable via server config.
+// The default maximum lifetime of a cache entry. Unit: seconds.
 const int kJwtCacheTimeout = 300;
-// The number of entries in JWT cache.
-// TODO: This value should be configurable via server config.
-const int kJwtCacheSize = 100;
+// The default number of entries in JWT cache.
+const size_t kJwtCacheSize = 100;
+// The default number of shards in JWT cache.
+const size_t kJwtCacheShards = 8;
 }  // namespace
 
-JwtCache::JwtCache() : SimpleLRUCache<std::string, JwtValue>(kJwtCacheSize) {}
+JwtCache::JwtCache(size_t cache_size, std::chrono::seconds expiration,
+                   size_t num_shards)
+    : expiration_(expiration.count() > 0
+                      ? expiration
+                      : std::chrono::seconds(kJwtCacheTimeout)),
+      hits_(0),
+      misses_(0),
+      evictions_(0),
+      expirations_(0) {
+  if (cache_size == 0) {
+    cache_size = kJwtCacheSize;
+  }
+  if (num_shards == 0) {
+    num_shards = kJwtCacheShards;
+  }
+  // Every shard holds at least one entry.
+  num_shards = std::min(num_shards, cache_size);
+  shard_capacity_ = (cache_size + num_shards - 1) / num_shards;
+  for (size_t i = 0; i < num_shards; ++i) {
+    shards_.emplace_back(new Shard);
+  }
+}
+
+JwtCache::JwtCache() : JwtCache(0, std::chrono::seconds(0), 0) {}
 
 JwtCache::~JwtCache() { Clear(); }
 
-void JwtCache::Insert(const std::string& jwt, const UserInfo& user_info,
+std::string JwtCache::Key(const std::string& jwt) {
+  unsigned char digest[SHA256_DIGEST_LENGTH];
+  SHA256(reinterpret_cast<const unsigned char*>(jwt.data()), jwt.size(),
+         digest);
+  return std::string(reinterpret_cast<const char*>(digest), sizeof(digest));
+}
+
+JwtCache::Shard* JwtCache::GetShard(const std::string& key) const {
+  // The key is a cryptographic digest, so its leading bytes are uniformly
+  // distributed.
+  uint64_t h;
+  memcpy(&h, key.data(), sizeof(h));
+  return shards_[h % shards_.size()].get();
+}
+
+bool JwtCache::Lookup(const std::string& jwt,
+                      const system_clock::time_point& now,
+                      JwtValue* value) {
+  std::string key = Key(jwt);
+  Shard* shard = GetShard(key);
+  std::lock_guard<std::mutex> lock(shard->mutex);
+  auto it = shard->index.find(key);
+  if (it == shard->index.end()) {
+    ++misses_;
+    return false;
+  }
+  if (now > it->second->second.exp) {
+    shard->lru.erase(it->second);
+    shard->index.erase(it);
+    ++expirations_;
+    ++misses_;
+    return false;
+  }
+  // Moves the entry to the front of the LRU list.
+  shard->lru.splice(shard->lru.begin(), shard->lru, it->second);
+  *value = it->second->second;
+  ++hits_;
+  return true;
+}
+
+void JwtCache::Insert(const std::string& jwt, const JwtValue& value,
                       const system_clock::time_point& token_exp,
                       const system_clock::time_point& now) {
-  JwtValue* newval = new JwtValue();
-  newval->user_info = user_info;
-  newval->exp =
-      std::min(token_exp, now + std::chrono::seconds(kJwtCacheTimeout));
-  SimpleLRUCache::Insert(jwt, newval, 1);
+  std::string key = Key(jwt);
+  JwtValue entry(value);
+  entry.exp = std::min(token_exp, now + expiration_);
+
+  Shard* shard = GetShard(key);
+  std::lock_guard<std::mutex> lock(shard->mutex);
+  auto it = shard->index.find(key);
+  if (it != shard->index.end()) {
+    it->second->second = std::move(entry);
+    shard->lru.splice(shard->lru.begin(), shard->lru, it->second);
+    return;
+  }
+  if (shard->lru.size() >= shard_capacity_) {
+    shard->index.erase(shard->lru.back().first);
+    shard->lru.pop_back();
+    ++evictions_;
+  }
+  shard->lru.emplace_front(key, std::move(entry));
+  shard->index.emplace(std::move(key), shard->lru.begin());
+}
+
+void JwtCache::Remove(const std::string& jwt) {
+  std::string key = Key(jwt);
+  Shard* shard = GetShard(key);
+  std::lock_guard<std::mutex> lock(shard->mutex);
+  auto it = shard->index.find(key);
+  if (it != shard->index.end()) {
+    shard->lru.erase(it->second);
+    shard->index.erase(it);
+  }
+}
+
+void JwtCache::Clear() {
+  for (auto& shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard->mutex);
+    shard->index.clear();
+    shard->lru.clear();
+  }
+}
+
+size_t JwtCache::Size() const {
+  size_t size = 0;
+  for (auto& shard : shards_) {
+    std::lock_guard<std::mutex> lock(shard->mutex);
+    size += shard->lru.size();
+  }
+  return size;
+}
+
+void JwtCache::GetStatistics(Statistics* stat) const {
+  stat->hits = hits_;
+  stat->misses = misses_;
+  stat->evictions = evictions_;
+  stat->expirations = expirations_;
 }
 
 }  // namespace auth
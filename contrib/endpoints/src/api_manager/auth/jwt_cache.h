@@ -15,11 +15,18 @@
 #ifndef API_MANAGER_AUTH_JWT_CACHE_H_
 #define API_MANAGER_AUTH_JWT_CACHE_H_
 
+#include <stdint.h>
+#include <atomic>
 #include <chrono>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <set>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 #include "contrib/endpoints/src/api_manager/auth.h"
-#include "utils/simple_lru_cache_inl.h"
 
 namespace google {
 namespace api_manager {
@@ -30,23 +37,99 @@ struct JwtValue {
   // User info extracted from the JWT.
   UserInfo user_info;
 
+  // The user info header forwarded to the backend, already JSON and base64
+  // encoded, so that cache hits need not encode it again.
+  std::string user_info_header;
+
+  // The issuer and the audiences of the JWT, normalized with
+  // utils::GetUrlContent() for the checks against the service config.
+  std::string issuer;
+  std::set<std::string> audiences;
+
   // Expiration time of the cache entry. This is the minimum of "exp" field in
-  // the JWT and [the time this cache entry is added + kJwtCacheTimeout].
+  // the JWT and [the time this cache entry is added + cache expiration].
   std::chrono::system_clock::time_point exp;
 };
 
-// A local cache that resides in ESP. The key of the cache is a JWT,
-// and the value is of type JwtValue.
-class JwtCache
-    : public google::service_control_client::SimpleLRUCache<std::string,
-                                                            JwtValue> {
+// A local cache of validated JWTs that resides in ESP. Entries are keyed by
+// the SHA-256 digest of the JWT and spread over a number of shards, each
+// with its own lock and LRU list, so concurrent lookups of different tokens
+// rarely contend.
+class JwtCache {
  public:
+  // Cache statistics.
+  struct Statistics {
+    // Lookups that found a valid entry.
+    uint64_t hits;
+    // Lookups that found no entry or an expired one.
+    uint64_t misses;
+    // Entries evicted to make room for new ones.
+    uint64_t evictions;
+    // Expired entries removed by lookups.
+    uint64_t expirations;
+  };
+
+  // Creates a cache holding up to cache_size entries, each for at most
+  // expiration, split into num_shards shards. Zero values select the
+  // defaults: 100 entries, 300 seconds and 8 shards.
+  JwtCache(size_t cache_size, std::chrono::seconds expiration,
+           size_t num_shards);
   JwtCache();
   ~JwtCache();
 
-  void Insert(const std::string& jwt, const UserInfo& user_info,
+  // Looks up the jwt. Returns true and fills value if it is cached and not
+  // expired at now. An expired entry is removed by the same lookup.
+  bool Lookup(const std::string& jwt,
+              const std::chrono::system_clock::time_point& now,
+              JwtValue* value);
+
+  // Inserts the jwt, evicting the least recently used entry of its shard if
+  // the shard is full. The expiration time of the entry is computed from
+  // token_exp and now, value.exp is ignored.
+  void Insert(const std::string& jwt, const JwtValue& value,
               const std::chrono::system_clock::time_point& token_exp,
               const std::chrono::system_clock::time_point& now);
+
+  // Removes the jwt if it is cached.
+  void Remove(const std::string& jwt);
+
+  // Removes all entries.
+  void Clear();
+
+  // Gets the number of cached entries.
+  size_t Size() const;
+
+  // Gets the cache statistics.
+  void GetStatistics(Statistics* stat) const;
+
+ private:
+  // An independently locked LRU cache.
+  struct Shard {
+    typedef std::list<std::pair<std::string, JwtValue>> List;
+
+    std::mutex mutex;
+    // The entries, most recently used first.
+    List lru;
+    // Maps key to its entry in lru.
+    std::unordered_map<std::string, List::iterator> index;
+  };
+
+  // Returns the cache key of the jwt.
+  static std::string Key(const std::string& jwt);
+
+  // Returns the shard of the key.
+  Shard* GetShard(const std::string& key) const;
+
+  // The maximum number of entries in each shard.
+  size_t shard_capacity_;
+  // The maximum lifetime of an entry.
+  std::chrono::seconds expiration_;
+  std::vector<std::unique_ptr<Shard>> shards_;
+
+  std::atomic<uint64_t> hits_;
+  std::atomic<uint64_t> misses_;
+  std::atomic<uint64_t> evictions_;
+  std::atomic<uint64_t> expirations_;
 };
 
 }  // namespace auth
@@ -16,6 +16,8 @@
 //
 #include "contrib/endpoints/src/api_manager/auth/jwt_cache.h"
 #include <memory>
+#include <thread>
+#include <vector>
 #include "gtest/gtest.h"
 
 using std::chrono::system_clock;
@@ -30,6 +32,7 @@ const char kId[] = "user1";
 const char kEmail[] = "user1@gmail.com";
 const char kConsumer[] = "consumer1";
 const char kIssuer[] = "iss1";
+const char kHeader[] = "eyJpc3N1ZXIiOiJpc3MxIn0=";
 const char kJwt[] =
     "eyJhbGciOiJSUzI1NiIsInR5cCI6IkpXVCJ9.eyJpc3MiOiI2Mjg2NDU3NDE4ODEtbm9hYml1M"
     "jNmNWE4bThvdmQ4dWN2Njk4bGo3OHZ2MGxAZGV2ZWxvcGVyLmdzZXJ2aWNlYWNjb3VudC5jb20"
@@ -49,18 +52,25 @@ class TestJwtCache : public ::testing::Test {
   std::unique_ptr<JwtCache> cache_;
 };
 
+JwtValue MakeValue() {
+  JwtValue value;
+  value.user_info.id = kId;
+  value.user_info.email = kEmail;
+  value.user_info.consumer_id = kConsumer;
+  value.user_info.issuer = kIssuer;
+  value.user_info.audiences.insert("aud1");
+  value.user_info.audiences.insert("aud2");
+  value.user_info_header = kHeader;
+  value.issuer = kIssuer;
+  value.audiences = value.user_info.audiences;
+  return value;
+}
+
 // Test the Insert function in JwtCache class.
 void InsertAndLookupImpl(JwtCache *cache, bool token_exp_earlier) {
-  ASSERT_EQ(nullptr, cache->Lookup(kJwt));
-
-  UserInfo user_info;
-  user_info.id = kId;
-  user_info.email = kEmail;
-  user_info.consumer_id = kConsumer;
-  user_info.issuer = kIssuer;
-  user_info.audiences.insert("aud1");
-  user_info.audiences.insert("aud2");
   system_clock::time_point now = system_clock::now();
+  JwtValue val;
+  ASSERT_FALSE(cache->Lookup(kJwt, now, &val));
 
   system_clock::time_point token_exp;
   if (token_exp_earlier) {
@@ -68,23 +78,26 @@ void InsertAndLookupImpl(JwtCache *cache, bool token_exp_earlier) {
   } else {
     token_exp = now + std::chrono::seconds(kJwtCacheTimeout + 1);
   }
-  cache->Insert(kJwt, user_info, token_exp, now);
-  JwtValue *val = cache->Lookup(kJwt);
-  ASSERT_NE(nullptr, val);
-  ASSERT_EQ(val->user_info.id, kId);
-  ASSERT_EQ(val->user_info.email, kEmail);
-  ASSERT_EQ(val->user_info.consumer_id, kConsumer);
-  ASSERT_EQ(val->user_info.issuer, kIssuer);
-  ASSERT_EQ(val->user_info.AudiencesAsString(), "aud1,aud2");
-  if (token_exp_earlier) {
-    ASSERT_EQ(val->exp, token_exp);
-  } else {
-    ASSERT_EQ(val->exp, now + std::chrono::seconds(kJwtCacheTimeout));
-  }
+  cache->Insert(kJwt, MakeValue(), token_exp, now);
+  ASSERT_TRUE(cache->Lookup(kJwt, now, &val));
+  ASSERT_EQ(val.user_info.id, kId);
+  ASSERT_EQ(val.user_info.email, kEmail);
+  ASSERT_EQ(val.user_info.consumer_id, kConsumer);
+  ASSERT_EQ(val.user_info.issuer, kIssuer);
+  ASSERT_EQ(val.user_info.AudiencesAsString(), "aud1,aud2");
+  ASSERT_EQ(val.user_info_header, kHeader);
+  ASSERT_EQ(val.issuer, kIssuer);
+  ASSERT_EQ(val.audiences, (std::set<std::string>{"aud1", "aud2"}));
 
-  cache->Release(kJwt, val);
-  cache->Remove(kJwt);
-  ASSERT_EQ(nullptr, cache->Lookup(kJwt));
+  // The entry expires at the earlier of the token expiration and the cache
+  // expiration.
+  system_clock::time_point exp =
+      token_exp_earlier ? token_exp
+                        : now + std::chrono::seconds(kJwtCacheTimeout);
+  ASSERT_TRUE(cache->Lookup(kJwt, exp, &val));
+  ASSERT_FALSE(cache->Lookup(kJwt, exp + std::chrono::seconds(1), &val));
+  // The expired entry was removed by the lookup.
+  ASSERT_EQ(0, cache->Size());
 }
 
 TEST_F(TestJwtCache, InsertAndLookUp) {
@@ -93,6 +106,78 @@ TEST_F(TestJwtCache, InsertAndLookUp) {
 
   // case 2: token lifetime is 5 minutes.
   InsertAndLookupImpl(cache_.get(), false);
+
+  JwtCache::Statistics stat;
+  cache_->GetStatistics(&stat);
+  EXPECT_EQ(4, stat.hits);
+  EXPECT_EQ(4, stat.misses);
+  EXPECT_EQ(0, stat.evictions);
+  EXPECT_EQ(2, stat.expirations);
+}
+
+TEST_F(TestJwtCache, Remove) {
+  system_clock::time_point now = system_clock::now();
+  cache_->Insert(kJwt, MakeValue(), now + std::chrono::seconds(10), now);
+  cache_->Remove(kJwt);
+  JwtValue val;
+  ASSERT_FALSE(cache_->Lookup(kJwt, now, &val));
+}
+
+TEST(JwtCacheConfig, CustomExpiration) {
+  JwtCache cache(10, std::chrono::seconds(5), 2);
+  system_clock::time_point now = system_clock::now();
+  cache.Insert(kJwt, MakeValue(), now + std::chrono::seconds(60), now);
+  JwtValue val;
+  ASSERT_TRUE(cache.Lookup(kJwt, now + std::chrono::seconds(5), &val));
+  ASSERT_FALSE(cache.Lookup(kJwt, now + std::chrono::seconds(6), &val));
+}
+
+TEST(JwtCacheConfig, Eviction) {
+  const int kSize = 64;
+  JwtCache cache(kSize, std::chrono::seconds(0), 4);
+  system_clock::time_point now = system_clock::now();
+  system_clock::time_point exp = now + std::chrono::seconds(60);
+  for (int i = 0; i < 4 * kSize; ++i) {
+    cache.Insert(std::to_string(i), MakeValue(), exp, now);
+  }
+  // Each shard holds at most kSize / 4 entries.
+  EXPECT_GE(kSize, cache.Size());
+
+  JwtCache::Statistics stat;
+  cache.GetStatistics(&stat);
+  EXPECT_EQ(4 * kSize - cache.Size(), stat.evictions);
+
+  // The most recently inserted token is always kept.
+  JwtValue val;
+  EXPECT_TRUE(cache.Lookup(std::to_string(4 * kSize - 1), now, &val));
+  EXPECT_FALSE(cache.Lookup("0", now, &val));
+}
+
+TEST(JwtCacheConfig, Concurrent) {
+  JwtCache cache(1000, std::chrono::seconds(0), 0);
+  system_clock::time_point now = system_clock::now();
+  system_clock::time_point exp = now + std::chrono::seconds(60);
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; ++t) {
+    threads.emplace_back([&cache, t, now, exp]() {
+      for (int i = 0; i < 1000; ++i) {
+        std::string jwt = std::to_string(t * 1000 + i % 100);
+        JwtValue val;
+        if (!cache.Lookup(jwt, now, &val)) {
+          cache.Insert(jwt, MakeValue(), exp, now);
+        }
+      }
+    });
+  }
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(400, cache.Size());
+
+  JwtCache::Statistics stat;
+  cache.GetStatistics(&stat);
+  EXPECT_EQ(400, stat.misses);
+  EXPECT_EQ(3600, stat.hits);
 }
 
 }  // namespace
@@ -62,11 +62,14 @@ extern "C" {
 
 #include <openssl/hmac.h>
 #include <openssl/pem.h>
+#include <cctype>
 #include <cstring>
 #include <set>
 #include <string>
+#include <vector>
 
 #include "contrib/endpoints/src/api_manager/auth/lib/json_util.h"
+#include "contrib/endpoints/src/api_manager/auth/lib/jwt_parser.h"
 
 using std::string;
 using std::chrono::system_clock;
@@ -77,10 +80,56 @@ namespace api_manager {
 namespace auth {
 namespace {
 
-// JOSE header. see http://tools.ietf.org/html/rfc7515#section-4
-struct JoseHeader {
-  const char *alg;
-  const char *kid;
+// An implementation of JwtKeySet.
+class JwtKeySetImpl : public JwtKeySet {
+ public:
+  // The format of the public keys.
+  enum Format {
+    // The keys are not valid JSON, or not a valid JWK or X509 key set.
+    INVALID,
+    // A JSON object mapping kid to X509 certificate.
+    X509,
+    // A JWK set, see https://tools.ietf.org/html/rfc7517#section-5.
+    JWKS,
+  };
+
+  // A parsed public key.
+  struct Key {
+    std::string kid;
+    // Empty for X509 keys.
+    std::string alg;
+    // nullptr if the X509 certificate could not be parsed. JWKs which cannot
+    // be parsed are dropped.
+    EVP_PKEY *pkey;
+  };
+
+  JwtKeySetImpl(const char *pkey, size_t pkey_len);
+  ~JwtKeySetImpl();
+
+  size_t size() const;
+
+  // Returns true if the raw keys were empty.
+  bool empty() const { return empty_; }
+  Format format() const { return format_; }
+  const std::vector<Key> &keys() const { return keys_; }
+  // The base64 decoded secret for HS algorithms. Empty if the keys are not
+  // valid base64.
+  const std::string &secret() const { return secret_; }
+
+  // Finds the first key with kid, and with alg unless alg is nullptr.
+  // Returns nullptr if there is none.
+  const Key *Find(const char *kid, const char *alg) const;
+
+ private:
+  // Parses a JSON object mapping kid to X509 certificate.
+  void ParseX509Keys(const grpc_json *json);
+  // Parses the keys array of a JWK set.
+  void ParseJwkKeys(grpc_exec_ctx *exec_ctx, const grpc_json *jwk_keys);
+
+  bool empty_;
+  Format format_;
+  std::vector<Key> keys_;
+  std::string secret_;
 };
 
 // An implementation of JwtValidator, hold ALL allocated memory data.
@@ -89,66 +138,65 @@ class JwtValidatorImpl : public JwtValidator {
   JwtValidatorImpl(const char *jwt, size_t jwt_len);
   Status Parse(UserInfo *user_info);
   Status VerifySignature(const char *pkey, size_t pkey_len);
+  Status VerifySignature(const JwtKeySet &keys);
   system_clock::time_point &GetExpirationTime() { return exp_; }
   ~JwtValidatorImpl();
 
  private:
-  // Validates given JWT with pkey.
-  grpc_jwt_verifier_status Validate(const char *jwt, size_t jwt_len,
-                                    const char *pkey, size_t pkey_len,
-                                    const char *aud);
+  // Parses the JWT with the lean parser and fills user_info. Returns false
+  // if the JWT must be parsed by ParseImpl() instead.
+  bool ParseLean(UserInfo *user_info);
   grpc_jwt_verifier_status ParseImpl();
-  grpc_jwt_verifier_status VerifySignatureImpl(const char *pkey,
-                                               size_t pkey_len);
+  grpc_jwt_verifier_status VerifySignatureImpl(const JwtKeySetImpl &keys);
   // Parses the audiences and removes the audiences from the json object.
-  void UpdateAudience(grpc_json *json);
-
-  // Creates header_ from header_json_.
-  void CreateJoseHeader();
+  static void UpdateAudience(grpc_json *json, std::set<std::string> *audiences);
+  // Sets claims to the decoded payload as FillUserInfoAndSetExp() dumps it,
+  // so that both parsers produce the same claims. Returns false if the
+  // payload is not valid JSON.
+  static bool DumpClaims(::google::protobuf::StringPiece payload,
+                         std::string *claims);
+
+  // Sets alg_ and kid_ from header_json_. Returns false if alg is missing or
+  // invalid.
+  bool CreateJoseHeader();
   // Checks required fields and fills User Info from claims_.
   // And sets expiration time to exp_.
   grpc_jwt_verifier_status FillUserInfoAndSetExp(UserInfo *user_info);
-  // Finds the public key and verifies JWT signature with it.
-  grpc_jwt_verifier_status FindAndVerifySignature();
-  // Extracts the public key from x509 string (key) and sets it to pkey_.
-  // Returns true if successful.
-  bool ExtractPubkeyFromX509(const char *key);
-  // Extracts the public key from a jwk key (jkey) and sets it to pkey_.
-  // Returns true if successful.
-  bool ExtractPubkeyFromJwk(const grpc_json *jkey);
-  // Extracts the public key from jwk key set and verifies JWT signature with
+  // Finds the public key in a JWK set and verifies JWT signature with it.
+  grpc_jwt_verifier_status VerifyJwkKeys(const JwtKeySetImpl &keys);
+  // Finds the public key in a X509 key set and verifies JWT signature with
   // it.
-  grpc_jwt_verifier_status ExtractAndVerifyJwkKeys(const grpc_json *jwt_keys);
-  // Extracts the public key from pkey_json_ and verifies JWT signature with
-  // it.
-  grpc_jwt_verifier_status ExtractAndVerifyX509Keys();
-  // Verifies signature with pkey_.
-  grpc_jwt_verifier_status VerifyPubkey();
+  grpc_jwt_verifier_status VerifyX509Keys(const JwtKeySetImpl &keys);
+  // Verifies signature with pkey.
+  grpc_jwt_verifier_status VerifyPubkey(EVP_PKEY *pkey);
   // Verifies RS (asymmetric) signature.
-  grpc_jwt_verifier_status VerifyRsSignature(const char *pkey, size_t pkey_len);
+  grpc_jwt_verifier_status VerifyRsSignature(const JwtKeySetImpl &keys);
   // Verifies HS (symmetric) signature.
-  grpc_jwt_verifier_status VerifyHsSignature(const char *pkey, size_t pkey_len);
+  grpc_jwt_verifier_status VerifyHsSignature(const JwtKeySetImpl &keys);
 
   // Not owned.
   const char *jwt;
   int jwt_len;
 
-  JoseHeader *header_;
+  // JOSE header. see http://tools.ietf.org/html/rfc7515#section-4
+  std::string alg_;
+  bool has_kid_;
+  std::string kid_;
+
+  // Only used by ParseImpl().
   grpc_json *header_json_;
   gpr_slice header_buffer_;
   grpc_jwt_claims *claims_;
-  gpr_slice sig_buffer_;
-  gpr_slice signed_buffer_;
+
+  // The signed part of jwt, "<header>.<payload>".
+  const char *signed_data_;
+  size_t signed_len_;
+  // The decoded signature.
+  std::string signature_;
 
   std::set<std::string> audiences_;
   system_clock::time_point exp_;
 
-  grpc_json *pkey_json_;
-  gpr_slice pkey_buffer_;
-  BIO *bio_;
-  X509 *x509_;
-  RSA *rsa_;
-  EVP_PKEY *pkey_;
   EVP_MD_CTX *md_ctx_;
 
   grpc_exec_ctx exec_ctx_;
@@ -165,9 +213,17 @@ grpc_json *DecodeBase64AndParseJson(grpc_exec_ctx *exec_ctx, const char *str,
                                     size_t len, gpr_slice *buffer);
 
 // Gets BIGNUM from b64 string, used for extracting pkey from jwk.
-// Result owned by rsa_.
 BIGNUM *BigNumFromBase64String(grpc_exec_ctx *exec_ctx, const char *b64);
 
+// Extracts the public key from x509 string (key). Returns nullptr on failure.
+EVP_PKEY *ExtractPubkeyFromX509(const char *key);
+
+// Returns true if the key is PEM encoded.
+bool IsPem(const char *key, size_t key_len);
+
+// Extracts the public key from a jwk key (jkey). Returns nullptr on failure.
+EVP_PKEY *ExtractPubkeyFromJwk(grpc_exec_ctx *exec_ctx, const grpc_json *jkey);
+
 }  // namespace
 
 std::unique_ptr<JwtValidator> JwtValidator::Create(const char *jwt,
@@ -175,70 +231,47 @@ std::unique_ptr<JwtValidator> JwtValidator::Create(const char *jwt,
   return std::unique_ptr<JwtValidator>(new JwtValidatorImpl(jwt, jwt_len));
 }
 
+std::shared_ptr<const JwtKeySet> JwtKeySet::Create(const char *pkey,
+                                                   size_t pkey_len) {
+  return std::shared_ptr<const JwtKeySet>(new JwtKeySetImpl(pkey, pkey_len));
+}
+
 namespace {
 JwtValidatorImpl::JwtValidatorImpl(const char *jwt, size_t jwt_len)
     : jwt(jwt),
       jwt_len(jwt_len),
-      header_(nullptr),
+      has_kid_(false),
       header_json_(nullptr),
       claims_(nullptr),
-      pkey_json_(nullptr),
-      bio_(nullptr),
-      x509_(nullptr),
-      rsa_(nullptr),
-      pkey_(nullptr),
+      signed_data_(nullptr),
+      signed_len_(0),
       md_ctx_(nullptr),
       exec_ctx_(GRPC_EXEC_CTX_INIT) {
   header_buffer_ = gpr_empty_slice();
-  signed_buffer_ = gpr_empty_slice();
-  sig_buffer_ = gpr_empty_slice();
-  pkey_buffer_ = gpr_empty_slice();
 }
 
 // Makes sure all data are cleaned up, both success and failure case.
 JwtValidatorImpl::~JwtValidatorImpl() {
-  if (header_ != nullptr) {
-    gpr_free(header_);
-  }
   if (header_json_ != nullptr) {
     grpc_json_destroy(header_json_);
   }
-  if (pkey_json_ != nullptr) {
-    grpc_json_destroy(pkey_json_);
-  }
   if (claims_ != nullptr) {
     grpc_jwt_claims_destroy(&exec_ctx_, claims_);
   }
   if (!GPR_SLICE_IS_EMPTY(header_buffer_)) {
     gpr_slice_unref(header_buffer_);
   }
-  if (!GPR_SLICE_IS_EMPTY(signed_buffer_)) {
-    gpr_slice_unref(signed_buffer_);
-  }
-  if (!GPR_SLICE_IS_EMPTY(sig_buffer_)) {
-    gpr_slice_unref(sig_buffer_);
-  }
-  if (!GPR_SLICE_IS_EMPTY(pkey_buffer_)) {
-    gpr_slice_unref(pkey_buffer_);
-  }
-  if (bio_ != nullptr) {
-    BIO_free(bio_);
-  }
-  if (x509_ != nullptr) {
-    X509_free(x509_);
-  }
-  if (rsa_ != nullptr) {
-    RSA_free(rsa_);
-  }
-  if (pkey_ != nullptr) {
-    EVP_PKEY_free(pkey_);
-  }
   if (md_ctx_ != nullptr) {
     EVP_MD_CTX_destroy(md_ctx_);
   }
 }
 
 Status JwtValidatorImpl::Parse(UserInfo *user_info) {
+  // Most tokens are handled by the lean parser. The full parser handles the
+  // others, and reports the errors.
+  if (ParseLean(user_info)) {
+    return Status::OK;
+  }
   grpc_jwt_verifier_status status = ParseImpl();
   if (status == GRPC_JWT_VERIFIER_OK) {
     status = FillUserInfoAndSetExp(user_info);
@@ -251,10 +284,61 @@ Status JwtValidatorImpl::Parse(UserInfo *user_info) {
                 grpc_jwt_verifier_status_to_string(status));
 }
 
+bool JwtValidatorImpl::ParseLean(UserInfo *user_info) {
+  JwtParts parts;
+  if (jwt_len <= 0 || !ParseJwt(jwt, jwt_len, &parts)) {
+    return false;
+  }
+  std::string alg = parts.alg.ToString();
+  if (EvpMdFromAlg(alg.c_str()) == nullptr) {
+    return false;
+  }
+  // The checks of grpc_jwt_claims_check(). Tokens failing them are left to
+  // the full parser, which reports the error.
+  int64_t now = system_clock::to_time_t(system_clock::now());
+  int64_t skew = grpc_jwt_verifier_clock_skew.tv_sec;
+  if (now - skew >= parts.exp || (parts.has_nbf && now + skew < parts.nbf)) {
+    return false;
+  }
+  // Email issuers must be their own subject.
+  if (parts.iss.find('@') != ::google::protobuf::StringPiece::npos &&
+      parts.iss != parts.sub) {
+    return false;
+  }
+  std::string signature;
+  if (!Base64UrlDecode(parts.signature, &signature) || signature.empty()) {
+    return false;
+  }
+  std::string claims;
+  if (!DumpClaims(parts.payload, &claims)) {
+    return false;
+  }
+
+  alg_.swap(alg);
+  has_kid_ = parts.has_kid;
+  kid_ = parts.kid.ToString();
+  signed_data_ = parts.signed_data.data();
+  signed_len_ = parts.signed_data.size();
+  signature_.swap(signature);
+
+  user_info->issuer = parts.iss.ToString();
+  user_info->audiences.clear();
+  for (const auto &aud : parts.aud) {
+    user_info->audiences.insert(aud.ToString());
+  }
+  user_info->id = parts.sub.ToString();
+  user_info->claims.swap(claims);
+  user_info->email = parts.email.ToString();
+  user_info->authorized_party = parts.azp.ToString();
+  exp_ = system_clock::from_time_t(parts.exp);
+  return true;
+}
+
 // Extracts and removes the audiences from the token.
 // This is a workaround to deal with GRPC library not accepting
 // multiple audiences.
-void JwtValidatorImpl::UpdateAudience(grpc_json *json) {
+void JwtValidatorImpl::UpdateAudience(grpc_json *json,
+                                      std::set<std::string> *audiences) {
   grpc_json *cur;
   for (cur = json->child; cur != nullptr; cur = cur->next) {
     if (strcmp(cur->key, "aud") == 0) {
@@ -262,7 +346,7 @@ void JwtValidatorImpl::UpdateAudience(grpc_json *json) {
         grpc_json *aud;
         for (aud = cur->child; aud != nullptr; aud = aud->next) {
           if (aud->type == GRPC_JSON_STRING && aud->value != nullptr) {
-            audiences_.insert(aud->value);
+            audiences->insert(aud->value);
           }
         }
         // Replaces the array of audiences with an empty string.
@@ -284,13 +368,34 @@ void JwtValidatorImpl::UpdateAudience(grpc_json *json) {
           next->prev = fake_audience;
         }
       } else if (cur->type == GRPC_JSON_STRING && cur->value != nullptr) {
-        audiences_.insert(cur->value);
+        audiences->insert(cur->value);
       }
       return;
     }
   }
 }
 
+bool JwtValidatorImpl::DumpClaims(::google::protobuf::StringPiece payload,
+                                  std::string *claims) {
+  // The JSON parser works in place, and the payload is only valid until the
+  // next lean parse.
+  std::string buffer = payload.ToString();
+  grpc_json *json = grpc_json_parse_string_with_len(&buffer[0], buffer.size());
+  if (json == nullptr) {
+    return false;
+  }
+  std::set<std::string> audiences;
+  UpdateAudience(json, &audiences);
+  char *json_str = grpc_json_dump_to_string(json, 0);
+  grpc_json_destroy(json);
+  if (json_str == nullptr) {
+    return false;
+  }
+  *claims = json_str;
+  gpr_free(json_str);
+  return true;
+}
+
 grpc_jwt_verifier_status JwtValidatorImpl::ParseImpl() {
   // ====================
   // Basic check.
@@ -309,8 +414,7 @@ grpc_jwt_verifier_status JwtValidatorImpl::ParseImpl() {
   }
   header_json_ =
       DecodeBase64AndParseJson(&exec_ctx_, cur, dot - cur, &header_buffer_);
-  CreateJoseHeader();
-  if (header_ == nullptr) {
+  if (!CreateJoseHeader()) {
     return GRPC_JWT_VERIFIER_BAD_FORMAT;
   }
 
@@ -334,7 +438,7 @@ grpc_jwt_verifier_status JwtValidatorImpl::ParseImpl() {
     }
     return GRPC_JWT_VERIFIER_BAD_FORMAT;
   }
-  UpdateAudience(claims_json);
+  UpdateAudience(claims_json, &audiences_);
   // Takes ownershp of claims_json and claims_buffer.
   claims_ = grpc_jwt_claims_from_json(&exec_ctx_, claims_json, claims_buffer);
 
@@ -356,22 +460,30 @@ grpc_jwt_verifier_status JwtValidatorImpl::ParseImpl() {
   // Creates Buffer for signature check
   // =============================
   size_t signed_jwt_len = (size_t)(dot - jwt);
-  signed_buffer_ = gpr_slice_from_copied_buffer(jwt, signed_jwt_len);
-  if (GPR_SLICE_IS_EMPTY(signed_buffer_)) {
-    return GRPC_JWT_VERIFIER_BAD_FORMAT;
-  }
   cur = dot + 1;
-  sig_buffer_ = grpc_base64_decode_with_len(&exec_ctx_, cur,
-                                            jwt_len - signed_jwt_len - 1, 1);
-  if (GPR_SLICE_IS_EMPTY(sig_buffer_)) {
+  gpr_slice sig_buffer = grpc_base64_decode_with_len(
+      &exec_ctx_, cur, jwt_len - signed_jwt_len - 1, 1);
+  if (GPR_SLICE_IS_EMPTY(sig_buffer)) {
     return GRPC_JWT_VERIFIER_BAD_FORMAT;
   }
+  signature_.assign(
+      reinterpret_cast<const char *>(GPR_SLICE_START_PTR(sig_buffer)),
+      GPR_SLICE_LENGTH(sig_buffer));
+  gpr_slice_unref(sig_buffer);
+  signed_data_ = jwt;
+  signed_len_ = signed_jwt_len;
 
   return GRPC_JWT_VERIFIER_OK;
 }
 
 Status JwtValidatorImpl::VerifySignature(const char *pkey, size_t pkey_len) {
-  grpc_jwt_verifier_status status = VerifySignatureImpl(pkey, pkey_len);
+  JwtKeySetImpl keys(pkey, pkey_len);
+  return VerifySignature(keys);
+}
+
+Status JwtValidatorImpl::VerifySignature(const JwtKeySet &keys) {
+  grpc_jwt_verifier_status status =
+      VerifySignatureImpl(static_cast<const JwtKeySetImpl &>(keys));
   if (status == GRPC_JWT_VERIFIER_OK) {
     return Status::OK;
   } else {
@@ -381,248 +493,120 @@ Status JwtValidatorImpl::VerifySignature(const char *pkey, size_t pkey_len) {
 }
 
 grpc_jwt_verifier_status JwtValidatorImpl::VerifySignatureImpl(
-    const char *pkey, size_t pkey_len) {
-  if (pkey == nullptr || pkey_len <= 0) {
+    const JwtKeySetImpl &keys) {
+  if (keys.empty()) {
     return GRPC_JWT_VERIFIER_KEY_RETRIEVAL_ERROR;
   }
   if (jwt == nullptr || jwt_len <= 0) {
     return GRPC_JWT_VERIFIER_BAD_FORMAT;
   }
-  if (GPR_SLICE_IS_EMPTY(signed_buffer_) || GPR_SLICE_IS_EMPTY(sig_buffer_)) {
+  if (signed_len_ == 0 || signature_.empty()) {
     return GRPC_JWT_VERIFIER_BAD_FORMAT;
   }
-  if (strncmp(header_->alg, "RS", 2) == 0) {  // Asymmetric keys.
-    return VerifyRsSignature(pkey, pkey_len);
+  if (alg_.compare(0, 2, "RS") == 0) {  // Asymmetric keys.
+    return VerifyRsSignature(keys);
   } else {  // Symmetric key.
-    return VerifyHsSignature(pkey, pkey_len);
+    return VerifyHsSignature(keys);
   }
 }
 
-void JwtValidatorImpl::CreateJoseHeader() {
+bool JwtValidatorImpl::CreateJoseHeader() {
   if (header_json_ == nullptr) {
-    return;
+    return false;
   }
   const char *alg = GetStringValue(header_json_, "alg");
   if (alg == nullptr) {
     gpr_log(GPR_ERROR, "Missing alg field.");
-    return;
+    return false;
   }
   if (EvpMdFromAlg(alg) == nullptr) {
     gpr_log(GPR_ERROR, "Invalid alg field [%s].", alg);
-    return;
+    return false;
   }
 
-  header_ = reinterpret_cast<JoseHeader *>(gpr_malloc(sizeof(JoseHeader)));
-  if (header_ == nullptr) {
-    gpr_log(GPR_ERROR, "Jose header creation failed");
-  }
-  header_->alg = alg;
-  header_->kid = GetStringValue(header_json_, "kid");
+  alg_ = alg;
+  const char *kid = GetStringValue(header_json_, "kid");
+  has_kid_ = kid != nullptr;
+  kid_ = has_kid_ ? kid : "";
+  return true;
 }
 
-grpc_jwt_verifier_status JwtValidatorImpl::FindAndVerifySignature() {
-  if (pkey_json_ == nullptr) {
-    gpr_log(GPR_ERROR, "The public keys are empty.");
-    return GRPC_JWT_VERIFIER_KEY_RETRIEVAL_ERROR;
-  }
-  if (header_ == nullptr) {
-    gpr_log(GPR_ERROR, "JWT header is empty.");
-    return GRPC_JWT_VERIFIER_BAD_FORMAT;
-  }
-  // JWK set https://tools.ietf.org/html/rfc7517#section-5.
-  const grpc_json *jwk_keys = GetProperty(pkey_json_, "keys");
-  if (jwk_keys == nullptr) {
-    // Try x509 format.
-    return ExtractAndVerifyX509Keys();
-  } else {
-    // JWK format.
-    return ExtractAndVerifyJwkKeys(jwk_keys);
+grpc_jwt_verifier_status JwtValidatorImpl::VerifyRsSignature(
+    const JwtKeySetImpl &keys) {
+  switch (keys.format()) {
+    case JwtKeySetImpl::JWKS:
+      return VerifyJwkKeys(keys);
+    case JwtKeySetImpl::X509:
+      return VerifyX509Keys(keys);
+    default:
+      gpr_log(GPR_ERROR, "The public keys are empty.");
+      return GRPC_JWT_VERIFIER_KEY_RETRIEVAL_ERROR;
   }
 }
 
-grpc_jwt_verifier_status JwtValidatorImpl::ExtractAndVerifyX509Keys() {
-  // Precondition (checked by caller): pkey_json_ and header_ are not nullptr.
-  if (header_->kid != nullptr) {
-    const char *value = GetStringValue(pkey_json_, header_->kid);
-    if (value == nullptr) {
+grpc_jwt_verifier_status JwtValidatorImpl::VerifyX509Keys(
+    const JwtKeySetImpl &keys) {
+  if (has_kid_) {
+    const JwtKeySetImpl::Key *key = keys.Find(kid_.c_str(), nullptr);
+    if (key == nullptr) {
       gpr_log(GPR_ERROR,
               "Cannot find matching key in key set for kid=%s and alg=%s",
-              header_->kid, header_->alg);
+              kid_.c_str(), alg_.c_str());
       return GRPC_JWT_VERIFIER_KEY_RETRIEVAL_ERROR;
     }
-    if (!ExtractPubkeyFromX509(value)) {
+    if (key->pkey == nullptr) {
       gpr_log(GPR_ERROR, "Failed to extract public key from X509 key (%s)",
-              header_->kid);
+              kid_.c_str());
       return GRPC_JWT_VERIFIER_KEY_RETRIEVAL_ERROR;
     }
-    return VerifyPubkey();
+    return VerifyPubkey(key->pkey);
   }
   // If kid is not specified in the header, try all keys. If the JWT can be
   // validated with any of the keys, the request is successful.
-  const grpc_json *cur;
-  if (pkey_json_->child == nullptr) {
-    gpr_log(GPR_ERROR, "Failed to extract public key from X509 key (%s)",
-            header_->kid);
-    return GRPC_JWT_VERIFIER_KEY_RETRIEVAL_ERROR;
-  }
-  for (cur = pkey_json_->child; cur != nullptr; cur = cur->next) {
-    if (cur->value == nullptr || !ExtractPubkeyFromX509(cur->value)) {
-      // Failed to extract public key from current X509 key, try next one.
+  for (const auto &key : keys.keys()) {
+    if (key.pkey == nullptr) {
+      // Failed to extract public key from this X509 key, try next one.
       continue;
     }
-    if (VerifyPubkey() == GRPC_JWT_VERIFIER_OK) {
+    if (VerifyPubkey(key.pkey) == GRPC_JWT_VERIFIER_OK) {
       return GRPC_JWT_VERIFIER_OK;
     }
   }
-  // header_->kid is nullptr. The JWT cannot be validated with any of the keys.
+  // The JWT has no kid, and cannot be validated with any of the keys.
   // Return error.
   gpr_log(GPR_ERROR,
           "The JWT cannot be validated with any of the public keys.");
   return GRPC_JWT_VERIFIER_BAD_SIGNATURE;
 }
 
-bool JwtValidatorImpl::ExtractPubkeyFromX509(const char *key) {
-  if (bio_ != nullptr) {
-    BIO_free(bio_);
-  }
-  bio_ = BIO_new(BIO_s_mem());
-  if (bio_ == nullptr) {
-    gpr_log(GPR_ERROR, "Unable to allocate a BIO object.");
-    return false;
-  }
-  if (BIO_write(bio_, key, strlen(key)) <= 0) {
-    gpr_log(GPR_ERROR, "BIO write error for key (%s).", key);
-    return false;
-  }
-  if (x509_ != nullptr) {
-    X509_free(x509_);
-  }
-  x509_ = PEM_read_bio_X509(bio_, nullptr, nullptr, nullptr);
-  if (x509_ == nullptr) {
-    gpr_log(GPR_ERROR, "Unable to parse x509 cert for key (%s).", key);
-    return false;
-  }
-  if (pkey_ != nullptr) {
-    EVP_PKEY_free(pkey_);
-  }
-  pkey_ = X509_get_pubkey(x509_);
-  if (pkey_ == nullptr) {
-    gpr_log(GPR_ERROR, "X509_get_pubkey failed");
-    return false;
-  }
-  return true;
-}
-
-grpc_jwt_verifier_status JwtValidatorImpl::ExtractAndVerifyJwkKeys(
-    const grpc_json *jwk_keys) {
-  // Precondition (checked by caller): jwk_keys and header_ are not nullptr.
-  if (jwk_keys->type != GRPC_JSON_ARRAY) {
-    gpr_log(GPR_ERROR,
-            "Unexpected value type of keys property in jwks key set.");
-    return GRPC_JWT_VERIFIER_KEY_RETRIEVAL_ERROR;
-  }
-
-  const grpc_json *jkey = nullptr;
-
-  if (jwk_keys->child == nullptr) {
-    gpr_log(GPR_ERROR, "The jwks key set is empty");
-    return GRPC_JWT_VERIFIER_KEY_RETRIEVAL_ERROR;
-  }
-  // JWK format from https://tools.ietf.org/html/rfc7518#section-6.
-  for (jkey = jwk_keys->child; jkey != nullptr; jkey = jkey->next) {
-    if (jkey->type != GRPC_JSON_OBJECT) continue;
-    const char *alg = GetStringValue(jkey, "alg");
-    if (alg == nullptr || strcmp(alg, header_->alg) != 0) {
-      continue;
-    }
-    const char *kid = GetStringValue(jkey, "kid");
-    if (kid == nullptr ||
-        (header_->kid != nullptr && strcmp(kid, header_->kid) != 0)) {
-      continue;
-    }
-    const char *kty = GetStringValue(jkey, "kty");
-    if (kty == nullptr || strcmp(kty, "RSA") != 0) {
-      gpr_log(GPR_ERROR, "Missing or unsupported key type %s.", kty);
-      continue;
-    }
-    if (!ExtractPubkeyFromJwk(jkey)) {
-      // Failed to extract public key from this Jwk key.
-      continue;
-    }
-    if (header_->kid != nullptr) {
-      return VerifyPubkey();
+grpc_jwt_verifier_status JwtValidatorImpl::VerifyJwkKeys(
+    const JwtKeySetImpl &keys) {
+  if (has_kid_) {
+    const JwtKeySetImpl::Key *key = keys.Find(kid_.c_str(), alg_.c_str());
+    if (key == nullptr) {
+      gpr_log(GPR_ERROR,
+              "Cannot find matching key in key set for kid=%s and alg=%s",
+              kid_.c_str(), alg_.c_str());
+      return GRPC_JWT_VERIFIER_KEY_RETRIEVAL_ERROR;
     }
-    // If kid is not specified in the header, try all keys. If the JWT can be
-    // validated with any of the keys, the request is successful.
-    if (VerifyPubkey() == GRPC_JWT_VERIFIER_OK) {
+    return VerifyPubkey(key->pkey);
+  }
+  // If kid is not specified in the header, try all keys. If the JWT can be
+  // validated with any of the keys, the request is successful.
+  for (const auto &key : keys.keys()) {
+    if (key.alg == alg_ && VerifyPubkey(key.pkey) == GRPC_JWT_VERIFIER_OK) {
       return GRPC_JWT_VERIFIER_OK;
     }
   }
-
-  if (header_->kid != nullptr) {
-    gpr_log(GPR_ERROR,
-            "Cannot find matching key in key set for kid=%s and alg=%s",
-            header_->kid, header_->alg);
-    return GRPC_JWT_VERIFIER_KEY_RETRIEVAL_ERROR;
-  }
-  // header_->kid is nullptr. The JWT cannot be validated with any of the keys.
+  // The JWT has no kid, and cannot be validated with any of the keys.
   // Return error.
   gpr_log(GPR_ERROR,
           "The JWT cannot be validated with any of the public keys.");
   return GRPC_JWT_VERIFIER_BAD_SIGNATURE;
 }
 
-bool JwtValidatorImpl::ExtractPubkeyFromJwk(const grpc_json *jkey) {
-  if (rsa_ != nullptr) {
-    RSA_free(rsa_);
-  }
-  rsa_ = RSA_new();
-  if (rsa_ == nullptr) {
-    gpr_log(GPR_ERROR, "Could not create rsa key.");
-    return false;
-  }
-
-  const char *rsa_n = GetStringValue(jkey, "n");
-  rsa_->n =
-      rsa_n == nullptr ? nullptr : BigNumFromBase64String(&exec_ctx_, rsa_n);
-  const char *rsa_e = GetStringValue(jkey, "e");
-  rsa_->e =
-      rsa_e == nullptr ? nullptr : BigNumFromBase64String(&exec_ctx_, rsa_e);
-
-  if (rsa_->e == nullptr || rsa_->n == nullptr) {
-    gpr_log(GPR_ERROR, "Missing RSA public key field.");
-    return false;
-  }
-
-  if (pkey_ != nullptr) {
-    EVP_PKEY_free(pkey_);
-  }
-  pkey_ = EVP_PKEY_new();
-  if (EVP_PKEY_set1_RSA(pkey_, rsa_) == 0) {
-    gpr_log(GPR_ERROR, "EVP_PKEY_ste1_RSA failed");
-    return false;
-  }
-  return true;
-}
-
-grpc_jwt_verifier_status JwtValidatorImpl::VerifyRsSignature(const char *pkey,
-                                                             size_t pkey_len) {
-  pkey_buffer_ = gpr_slice_from_copied_buffer(pkey, pkey_len);
-  if (GPR_SLICE_IS_EMPTY(pkey_buffer_)) {
-    return GRPC_JWT_VERIFIER_KEY_RETRIEVAL_ERROR;
-  }
-  pkey_json_ = grpc_json_parse_string_with_len(
-      reinterpret_cast<char *>(GPR_SLICE_START_PTR(pkey_buffer_)),
-      GPR_SLICE_LENGTH(pkey_buffer_));
-  if (pkey_json_ == nullptr) {
-    return GRPC_JWT_VERIFIER_KEY_RETRIEVAL_ERROR;
-  }
-
-  return FindAndVerifySignature();
-}
-
-grpc_jwt_verifier_status JwtValidatorImpl::VerifyPubkey() {
-  if (pkey_ == nullptr) {
+grpc_jwt_verifier_status JwtValidatorImpl::VerifyPubkey(EVP_PKEY *pkey) {
+  if (pkey == nullptr) {
     gpr_log(GPR_ERROR, "Cannot find public key.");
     return GRPC_JWT_VERIFIER_KEY_RETRIEVAL_ERROR;
   }
@@ -634,51 +618,50 @@ grpc_jwt_verifier_status JwtValidatorImpl::VerifyPubkey() {
     gpr_log(GPR_ERROR, "Could not create EVP_MD_CTX.");
     return GRPC_JWT_VERIFIER_BAD_SIGNATURE;
   }
-  const EVP_MD *md = EvpMdFromAlg(header_->alg);
+  const EVP_MD *md = EvpMdFromAlg(alg_.c_str());
 
   GPR_ASSERT(md != nullptr);  // Checked before.
 
-  if (EVP_DigestVerifyInit(md_ctx_, nullptr, md, nullptr, pkey_) != 1) {
+  if (EVP_DigestVerifyInit(md_ctx_, nullptr, md, nullptr, pkey) != 1) {
     gpr_log(GPR_ERROR, "EVP_DigestVerifyInit failed.");
     return GRPC_JWT_VERIFIER_BAD_SIGNATURE;
   }
-  if (EVP_DigestVerifyUpdate(md_ctx_, GPR_SLICE_START_PTR(signed_buffer_),
-                             GPR_SLICE_LENGTH(signed_buffer_)) != 1) {
+  if (EVP_DigestVerifyUpdate(md_ctx_, signed_data_, signed_len_) != 1) {
     gpr_log(GPR_ERROR, "EVP_DigestVerifyUpdate failed.");
     return GRPC_JWT_VERIFIER_BAD_SIGNATURE;
   }
-  if (EVP_DigestVerifyFinal(md_ctx_, GPR_SLICE_START_PTR(sig_buffer_),
-                            GPR_SLICE_LENGTH(sig_buffer_)) != 1) {
+  if (EVP_DigestVerifyFinal(
+          md_ctx_, reinterpret_cast<const unsigned char *>(signature_.data()),
+          signature_.size()) != 1) {
     gpr_log(GPR_ERROR, "JWT signature verification failed.");
     return GRPC_JWT_VERIFIER_BAD_SIGNATURE;
   }
   return GRPC_JWT_VERIFIER_OK;
 }
 
-grpc_jwt_verifier_status JwtValidatorImpl::VerifyHsSignature(const char *pkey,
-                                                             size_t pkey_len) {
-  const EVP_MD *md = EvpMdFromAlg(header_->alg);
+grpc_jwt_verifier_status JwtValidatorImpl::VerifyHsSignature(
+    const JwtKeySetImpl &keys) {
+  const EVP_MD *md = EvpMdFromAlg(alg_.c_str());
   GPR_ASSERT(md != nullptr);  // Checked before.
 
-  pkey_buffer_ = grpc_base64_decode_with_len(&exec_ctx_, pkey, pkey_len, 1);
-  if (GPR_SLICE_IS_EMPTY(pkey_buffer_)) {
+  const std::string &secret = keys.secret();
+  if (secret.empty()) {
     gpr_log(GPR_ERROR, "Unable to decode base64 of secret");
     return GRPC_JWT_VERIFIER_KEY_RETRIEVAL_ERROR;
   }
 
-  unsigned char res[HashSizeFromAlg(header_->alg)];
+  unsigned char res[HashSizeFromAlg(alg_.c_str())];
   unsigned int res_len = 0;
-  HMAC(md, GPR_SLICE_START_PTR(pkey_buffer_), GPR_SLICE_LENGTH(pkey_buffer_),
-       GPR_SLICE_START_PTR(signed_buffer_), GPR_SLICE_LENGTH(signed_buffer_),
-       res, &res_len);
+  HMAC(md, secret.data(), secret.size(),
+       reinterpret_cast<const unsigned char *>(signed_data_), signed_len_, res,
+       &res_len);
   if (res_len == 0) {
     gpr_log(GPR_ERROR, "Cannot compute HMAC from secret.");
     return GRPC_JWT_VERIFIER_BAD_SIGNATURE;
   }
 
-  if (res_len != GPR_SLICE_LENGTH(sig_buffer_) ||
-      CRYPTO_memcmp(reinterpret_cast<void *>(GPR_SLICE_START_PTR(sig_buffer_)),
-                    reinterpret_cast<void *>(res), res_len) != 0) {
+  if (res_len != signature_.size() ||
+      CRYPTO_memcmp(signature_.data(), res, res_len) != 0) {
     gpr_log(GPR_ERROR, "JWT signature verification failed.");
     return GRPC_JWT_VERIFIER_BAD_SIGNATURE;
   }
@@ -726,6 +709,134 @@ grpc_jwt_verifier_status JwtValidatorImpl::FillUserInfoAndSetExp(
   return GRPC_JWT_VERIFIER_OK;
 }
 
+JwtKeySetImpl::JwtKeySetImpl(const char *pkey, size_t pkey_len)
+    : empty_(pkey == nullptr || pkey_len == 0), format_(INVALID) {
+  if (empty_) {
+    return;
+  }
+  grpc_exec_ctx exec_ctx = GRPC_EXEC_CTX_INIT;
+
+  // The public keys for RS algorithms. grpc_json_parse_string_with_len
+  // modifies the buffer, and the parsed json points into it.
+  std::vector<char> buffer(pkey, pkey + pkey_len);
+  grpc_json *json = grpc_json_parse_string_with_len(buffer.data(), pkey_len);
+  if (json != nullptr && json->type == GRPC_JSON_OBJECT) {
+    // JWK set https://tools.ietf.org/html/rfc7517#section-5.
+    const grpc_json *jwk_keys = GetProperty(json, "keys");
+    if (jwk_keys == nullptr) {
+      // Try x509 format.
+      ParseX509Keys(json);
+    } else {
+      // JWK format.
+      ParseJwkKeys(&exec_ctx, jwk_keys);
+    }
+  } else if (!IsPem(pkey, pkey_len)) {
+    // The secret for HS algorithms. JSON key sets and PEM keys are not
+    // decoded, so that they are not logged as invalid base64.
+    gpr_slice secret_buffer =
+        grpc_base64_decode_with_len(&exec_ctx, pkey, pkey_len, 1);
+    if (!GPR_SLICE_IS_EMPTY(secret_buffer)) {
+      secret_.assign(
+          reinterpret_cast<const char *>(GPR_SLICE_START_PTR(secret_buffer)),
+          GPR_SLICE_LENGTH(secret_buffer));
+      gpr_slice_unref(secret_buffer);
+    }
+  }
+  if (json != nullptr) {
+    grpc_json_destroy(json);
+  }
+  grpc_exec_ctx_finish(&exec_ctx);
+}
+
+JwtKeySetImpl::~JwtKeySetImpl() {
+  for (auto &key : keys_) {
+    if (key.pkey != nullptr) {
+      EVP_PKEY_free(key.pkey);
+    }
+  }
+}
+
+size_t JwtKeySetImpl::size() const {
+  size_t size = 0;
+  for (const auto &key : keys_) {
+    if (key.pkey != nullptr) {
+      ++size;
+    }
+  }
+  return size;
+}
+
+const JwtKeySetImpl::Key *JwtKeySetImpl::Find(const char *kid,
+                                              const char *alg) const {
+  for (const auto &key : keys_) {
+    if (key.kid == kid && (alg == nullptr || key.alg == alg)) {
+      return &key;
+    }
+  }
+  return nullptr;
+}
+
+void JwtKeySetImpl::ParseX509Keys(const grpc_json *json) {
+  if (json->child == nullptr) {
+    gpr_log(GPR_ERROR, "The X509 key set is empty");
+    return;
+  }
+  for (const grpc_json *cur = json->child; cur != nullptr; cur = cur->next) {
+    if (cur->key == nullptr) {
+      continue;
+    }
+    Key key;
+    key.kid = cur->key;
+    key.pkey = nullptr;
+    if (cur->type == GRPC_JSON_STRING && cur->value != nullptr) {
+      key.pkey = ExtractPubkeyFromX509(cur->value);
+    }
+    keys_.push_back(key);
+  }
+  format_ = X509;
+}
+
+void JwtKeySetImpl::ParseJwkKeys(grpc_exec_ctx *exec_ctx,
+                                 const grpc_json *jwk_keys) {
+  if (jwk_keys->type != GRPC_JSON_ARRAY) {
+    gpr_log(GPR_ERROR,
+            "Unexpected value type of keys property in jwks key set.");
+    return;
+  }
+  if (jwk_keys->child == nullptr) {
+    gpr_log(GPR_ERROR, "The jwks key set is empty");
+    return;
+  }
+  // JWK format from https://tools.ietf.org/html/rfc7518#section-6.
+  for (const grpc_json *jkey = jwk_keys->child; jkey != nullptr;
+       jkey = jkey->next) {
+    if (jkey->type != GRPC_JSON_OBJECT) continue;
+    const char *alg = GetStringValue(jkey, "alg");
+    if (alg == nullptr || EvpMdFromAlg(alg) == nullptr) {
+      continue;
+    }
+    const char *kid = GetStringValue(jkey, "kid");
+    if (kid == nullptr) {
+      continue;
+    }
+    const char *kty = GetStringValue(jkey, "kty");
+    if (kty == nullptr || strcmp(kty, "RSA") != 0) {
+      gpr_log(GPR_ERROR, "Missing or unsupported key type %s.", kty);
+      continue;
+    }
+    Key key;
+    key.pkey = ExtractPubkeyFromJwk(exec_ctx, jkey);
+    if (key.pkey == nullptr) {
+      // Failed to extract public key from this Jwk key.
+      continue;
+    }
+    key.kid = kid;
+    key.alg = alg;
+    keys_.push_back(key);
+  }
+  format_ = JWKS;
+}
+
 const EVP_MD *EvpMdFromAlg(const char *alg) {
   if (strcmp(alg, "RS256") == 0 || strcmp(alg, "HS256") == 0) {
     return EVP_sha256();
@@ -784,6 +895,72 @@ BIGNUM *BigNumFromBase64String(grpc_exec_ctx *exec_ctx, const char *b64) {
   return result;
 }
 
+bool IsPem(const char *key, size_t key_len) {
+  static const char kPemBegin[] = "-----BEGIN ";
+  const size_t begin_len = sizeof(kPemBegin) - 1;
+  while (key_len > 0 && isspace(static_cast<unsigned char>(*key))) {
+    ++key;
+    --key_len;
+  }
+  return key_len >= begin_len && strncmp(key, kPemBegin, begin_len) == 0;
+}
+
+EVP_PKEY *ExtractPubkeyFromX509(const char *key) {
+  BIO *bio = BIO_new(BIO_s_mem());
+  if (bio == nullptr) {
+    gpr_log(GPR_ERROR, "Unable to allocate a BIO object.");
+    return nullptr;
+  }
+  if (BIO_write(bio, key, strlen(key)) <= 0) {
+    gpr_log(GPR_ERROR, "BIO write error for key (%s).", key);
+    BIO_free(bio);
+    return nullptr;
+  }
+  X509 *x509 = PEM_read_bio_X509(bio, nullptr, nullptr, nullptr);
+  BIO_free(bio);
+  if (x509 == nullptr) {
+    gpr_log(GPR_ERROR, "Unable to parse x509 cert for key (%s).", key);
+    return nullptr;
+  }
+  EVP_PKEY *pkey = X509_get_pubkey(x509);
+  X509_free(x509);
+  if (pkey == nullptr) {
+    gpr_log(GPR_ERROR, "X509_get_pubkey failed");
+  }
+  return pkey;
+}
+
+EVP_PKEY *ExtractPubkeyFromJwk(grpc_exec_ctx *exec_ctx, const grpc_json *jkey) {
+  RSA *rsa = RSA_new();
+  if (rsa == nullptr) {
+    gpr_log(GPR_ERROR, "Could not create rsa key.");
+    return nullptr;
+  }
+
+  const char *rsa_n = GetStringValue(jkey, "n");
+  rsa->n = rsa_n == nullptr ? nullptr : BigNumFromBase64String(exec_ctx, rsa_n);
+  const char *rsa_e = GetStringValue(jkey, "e");
+  rsa->e = rsa_e == nullptr ? nullptr : BigNumFromBase64String(exec_ctx, rsa_e);
+
+  if (rsa->e == nullptr || rsa->n == nullptr) {
+    gpr_log(GPR_ERROR, "Missing RSA public key field.");
+    RSA_free(rsa);
+    return nullptr;
+  }
+
+  EVP_PKEY *pkey = EVP_PKEY_new();
+  // EVP_PKEY_set1_RSA takes its own reference of rsa.
+  if (pkey == nullptr || EVP_PKEY_set1_RSA(pkey, rsa) == 0) {
+    gpr_log(GPR_ERROR, "EVP_PKEY_ste1_RSA failed");
+    if (pkey != nullptr) {
+      EVP_PKEY_free(pkey);
+      pkey = nullptr;
+    }
+  }
+  RSA_free(rsa);
+  return pkey;
+}
+
 }  // namespace
 }  // namespace auth
 }  // namespace api_manager
@@ -28,6 +28,24 @@ namespace google {
 namespace api_manager {
 namespace auth {
 
+// The verification keys of an issuer, parsed once when they are fetched so
+// that verifying a JWT signature does not need to parse them again. The keys
+// are either a JWK set, a JSON object mapping kid to X509 certificate, or a
+// base64 encoded secret for HS algorithms. Public keys are indexed by
+// (kid, alg). A JwtKeySet is immutable and can be shared by validators.
+class JwtKeySet {
+ public:
+  // Parses pkey. Never returns nullptr: if pkey cannot be parsed, signature
+  // verification with the key set fails with KEY_RETRIEVAL_ERROR.
+  static std::shared_ptr<const JwtKeySet> Create(const char *pkey,
+                                                 size_t pkey_len);
+
+  // Returns the number of public keys parsed successfully.
+  virtual size_t size() const = 0;
+
+  virtual ~JwtKeySet() {}
+};
+
 class JwtValidator {
  public:
   // Create JwtValidator with JWT.
@@ -43,6 +61,9 @@ class JwtValidator {
   // Otherwise, produces a status error message.
   virtual Status VerifySignature(const char *pkey, size_t pkey_len) = 0;
 
+  // Same as above, with keys parsed in advance.
+  virtual Status VerifySignature(const JwtKeySet &keys) = 0;
+
   // Returns the expiration time of the JWT.
   virtual std::chrono::system_clock::time_point &GetExpirationTime() = 0;
 
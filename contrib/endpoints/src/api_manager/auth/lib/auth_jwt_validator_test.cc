@@ -20,6 +20,7 @@
 #include "gtest/gtest.h"
 
 #include <cstring>
+#include <string>
 
 namespace google {
 namespace api_manager {
@@ -285,6 +286,29 @@ const char kTokenMultiAud[] =
     "qGuAjFES_t6LmmSgi31nI5R6frO98k0DQgAv2m16qC2CidhzStwFIaFVYWBaOwkoB-RQaH8Zr"
     "wgOlvF_7CgLuva1bhuYfDDc8jjgqU-vGKdctc87KK4tkc_OQiwe-RLH6o8sF5vw==";
 
+// kTokenMultiAud with escaped slashes in the first audience, which the lean
+// parser leaves to the full parser.
+// Payload:
+// {
+//   "iss": "628645741881-"
+//     "noabiu23f5a8m8ovd8ucv698lj78vv0l@developer.gserviceaccount.com",
+//   "sub": "628645741881-"
+//     "noabiu23f5a8m8ovd8ucv698lj78vv0l@developer.gserviceaccount.com",
+//   "aud": ["http:\/\/myservice.com\/myapi", "https://accounts.google.com"],
+//   "exp": 2462324020
+// }
+const char kTokenMultiAudEscaped[] =
+    "eyJhbGciOiJSUzI1NiIsInR5cCI6IkpXVCJ9.eyJpc3MiOiI2Mjg2NDU3NDE4ODEtbm9hYml1M"
+    "jNmNWE4bThvdmQ4dWN2Njk4bGo3OHZ2MGxAZGV2ZWxvcGVyLmdzZXJ2aWNlYWNjb3VudC5jb20"
+    "iLCJzdWIiOiI2Mjg2NDU3NDE4ODEtbm9hYml1MjNmNWE4bThvdmQ4dWN2Njk4bGo3OHZ2MGxAZ"
+    "GV2ZWxvcGVyLmdzZXJ2aWNlYWNjb3VudC5jb20iLCJhdWQiOlsiaHR0cDpcL1wvbXlzZXJ2aWN"
+    "lLmNvbVwvbXlhcGkiLCJodHRwczovL2FjY291bnRzLmdvb2dsZS5jb20iXSwiZXhwIjoyNDYyM"
+    "zI0MDIwfQ.Arx-W6LPwK74u9Wndg85TPGDGuJysyGe3ApqcA905kR0fzKYS8sH8lKdzbk6xGYS"
+    "1VMNIWpTrjM9Nf28ZB_r-1j_iYfjS4VREAbFlv4MGionYQDI7eDIpeh-CqeKFs3yPRJHVnviZ5"
+    "wRE-16qT3wvxdib3oIimWrnq6MVLL6WTXvz4OLTAJr74Oak88fF48KcCZKQ9Ffg1DF81qGuAjF"
+    "ES_t6LmmSgi31nI5R6frO98k0DQgAv2m16qC2CidhzStwFIaFVYWBaOwkoB-RQaH8ZrwgOlvF_"
+    "7CgLuva1bhuYfDDc8jjgqU-vGKdctc87KK4tkc_OQiwe-RLH6o8sF5vw==";
+
 // Token with the "azp" claim.
 // Payload:
 // {
@@ -455,6 +479,26 @@ TEST_F(JwtValidatorTest, ParseToken) {
   ASSERT_EQ(status.message(), "BAD_FORMAT") << status.message();
 }
 
+TEST_F(JwtValidatorTest, SameClaimsFromBothParsers) {
+  // kTokenMultiAud is parsed by the lean parser, kTokenMultiAudEscaped by the
+  // full parser. Both have the same claims once unescaped.
+  UserInfo lean_info;
+  std::unique_ptr<JwtValidator> validator =
+      JwtValidator::Create(kTokenMultiAud, strlen(kTokenMultiAud));
+  ASSERT_TRUE(validator->Parse(&lean_info).ok());
+
+  UserInfo full_info;
+  validator = JwtValidator::Create(kTokenMultiAudEscaped,
+                                   strlen(kTokenMultiAudEscaped));
+  ASSERT_TRUE(validator->Parse(&full_info).ok());
+
+  ASSERT_EQ(full_info.audiences, lean_info.audiences);
+  ASSERT_EQ(full_info.claims, lean_info.claims);
+  // The audiences are replaced with an empty string in the claims.
+  ASSERT_NE(std::string::npos, lean_info.claims.find("\"aud\":\"\""))
+      << lean_info.claims;
+}
+
 TEST_F(JwtValidatorTest, WrongKey) {
   char *token = esp_get_auth_token(kWrongPrivateKey, kAudience);
   ASSERT_TRUE(token != nullptr);
@@ -474,6 +518,54 @@ TEST_F(JwtValidatorTest, WrongKey) {
   ASSERT_EQ(status.message(), "KEY_RETRIEVAL_ERROR") << status.message();
 }
 
+TEST_F(JwtValidatorTest, ParsedKeySet) {
+  std::shared_ptr<const JwtKeySet> x509_keys =
+      JwtKeySet::Create(kPublicKeyX509, strlen(kPublicKeyX509));
+  std::shared_ptr<const JwtKeySet> jwk_keys =
+      JwtKeySet::Create(kPublicKeyJwk, strlen(kPublicKeyJwk));
+  ASSERT_EQ(2U, x509_keys->size());
+  ASSERT_EQ(2U, jwk_keys->size());
+
+  char *token = esp_get_auth_token(kOkPrivateKey, kAudience);
+  ASSERT_TRUE(token != nullptr);
+  // The same parsed keys are reused by several validators.
+  for (int i = 0; i < 2; ++i) {
+    for (const char *jwt : {static_cast<const char *>(token), kTokenNoKid}) {
+      UserInfo user_info;
+      std::unique_ptr<JwtValidator> validator =
+          JwtValidator::Create(jwt, strlen(jwt));
+      ASSERT_TRUE(validator->Parse(&user_info).ok());
+      Status status = validator->VerifySignature(*x509_keys);
+      ASSERT_TRUE(status.ok()) << status.message();
+      status = validator->VerifySignature(*jwk_keys);
+      ASSERT_TRUE(status.ok()) << status.message();
+    }
+  }
+  esp_grpc_free(token);
+
+  // Keys of the wrong private key.
+  token = esp_get_auth_token(kWrongPrivateKey, kAudience);
+  ASSERT_TRUE(token != nullptr);
+  UserInfo user_info;
+  std::unique_ptr<JwtValidator> validator =
+      JwtValidator::Create(token, strlen(token));
+  ASSERT_TRUE(validator->Parse(&user_info).ok());
+  Status status = validator->VerifySignature(*x509_keys);
+  ASSERT_EQ(status.message(), "KEY_RETRIEVAL_ERROR") << status.message();
+  status = validator->VerifySignature(*jwk_keys);
+  ASSERT_EQ(status.message(), "KEY_RETRIEVAL_ERROR") << status.message();
+  esp_grpc_free(token);
+
+  // Keys which cannot be parsed.
+  std::shared_ptr<const JwtKeySet> invalid_keys =
+      JwtKeySet::Create(kPublicKeyJwk, strlen(kPublicKeyJwk) - 1);
+  ASSERT_EQ(0U, invalid_keys->size());
+  validator = JwtValidator::Create(kTokenNoKid, strlen(kTokenNoKid));
+  ASSERT_TRUE(validator->Parse(&user_info).ok());
+  status = validator->VerifySignature(*invalid_keys);
+  ASSERT_EQ(status.message(), "KEY_RETRIEVAL_ERROR") << status.message();
+}
+
 TEST_F(JwtValidatorTest, TokenWithAuthorizedParty) {
   UserInfo user_info;
 
@@ -25,6 +25,7 @@
 
 extern "C" {
 
+#include "src/core/lib/iomgr/exec_ctx.h"
 #include "src/core/lib/json/json.h"
 #include "src/core/lib/json/json_common.h"
 #include "src/core/lib/security/credentials/jwt/json_token.h"
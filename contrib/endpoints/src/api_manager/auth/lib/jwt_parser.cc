@@ -0,0 +1,442 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+#include "contrib/endpoints/src/api_manager/auth/lib/jwt_parser.h"
+
+#include <cstring>
+
+using ::google::protobuf::StringPiece;
+
+namespace google {
+namespace api_manager {
+namespace auth {
+
+namespace {
+
+// The maximum nesting of JSON values skipped by the parser.
+const int kMaxDepth = 32;
+
+// Maps a base64url character to its value, or -1.
+int Base64UrlValue(char c) {
+  if (c >= 'A' && c <= 'Z') return c - 'A';
+  if (c >= 'a' && c <= 'z') return c - 'a' + 26;
+  if (c >= '0' && c <= '9') return c - '0' + 52;
+  if (c == '-') return 62;
+  if (c == '_') return 63;
+  return -1;
+}
+
+// Decodes base64url [src, src + len) into out, which must have room for
+// len * 3 / 4 bytes. Returns the number of decoded bytes, or -1 on error.
+int64_t DecodeBase64Url(const char *src, size_t len, char *out) {
+  while (len > 0 && src[len - 1] == '=') {
+    --len;
+  }
+  if (len % 4 == 1) {
+    return -1;
+  }
+  char *p = out;
+  uint32_t bits = 0;
+  int num_bits = 0;
+  for (size_t i = 0; i < len; ++i) {
+    int value = Base64UrlValue(src[i]);
+    if (value < 0) {
+      return -1;
+    }
+    bits = (bits << 6) | value;
+    num_bits += 6;
+    if (num_bits >= 8) {
+      num_bits -= 8;
+      *p++ = static_cast<char>((bits >> num_bits) & 0xff);
+    }
+  }
+  return p - out;
+}
+
+// Returns the thread's scratch buffer for the decoded header and payload.
+std::string &ScratchBuffer() {
+  static thread_local std::string buffer;
+  return buffer;
+}
+
+// A single pass scanner over a JSON object.
+class JsonScanner {
+ public:
+  JsonScanner(const char *begin, const char *end) : p_(begin), end_(end) {}
+
+  // Skips white space and returns true if the next character is c, which is
+  // then consumed.
+  bool Consume(char c) {
+    SkipSpace();
+    if (p_ < end_ && *p_ == c) {
+      ++p_;
+      return true;
+    }
+    return false;
+  }
+
+  // Returns true if only white space is left.
+  bool AtEnd() {
+    SkipSpace();
+    return p_ == end_;
+  }
+
+  // Returns the next character after white space, or '\0' at the end.
+  char Peek() {
+    SkipSpace();
+    return p_ < end_ ? *p_ : '\0';
+  }
+
+  // Reads a string without escapes into value. Returns false for escaped or
+  // malformed strings.
+  bool ReadString(StringPiece *value) {
+    bool escaped = false;
+    const char *begin = nullptr;
+    if (!ScanString(&begin, &escaped) || escaped) {
+      return false;
+    }
+    *value = StringPiece(begin, p_ - 1 - begin);
+    return true;
+  }
+
+  // Reads an integer of at most 18 digits into value. Returns false for
+  // fractions, exponents and anything else.
+  bool ReadInteger(int64_t *value) {
+    SkipSpace();
+    bool negative = p_ < end_ && *p_ == '-';
+    if (negative) {
+      ++p_;
+    }
+    const char *begin = p_;
+    int64_t result = 0;
+    while (p_ < end_ && *p_ >= '0' && *p_ <= '9') {
+      if (p_ - begin >= 18) {
+        return false;
+      }
+      result = result * 10 + (*p_ - '0');
+      ++p_;
+    }
+    // Rejects leading zeros, fractions and exponents.
+    if (p_ == begin || (*begin == '0' && p_ - begin > 1) ||
+        (p_ < end_ && (*p_ == '.' || *p_ == 'e' || *p_ == 'E'))) {
+      return false;
+    }
+    *value = negative ? -result : result;
+    return true;
+  }
+
+  // Skips a JSON value of any type.
+  bool SkipValue(int depth) {
+    if (depth > kMaxDepth) {
+      return false;
+    }
+    switch (Peek()) {
+      case '"': {
+        const char *begin = nullptr;
+        bool escaped = false;
+        return ScanString(&begin, &escaped);
+      }
+      case '{':
+        ++p_;
+        if (Consume('}')) {
+          return true;
+        }
+        do {
+          const char *begin = nullptr;
+          bool escaped = false;
+          if (Peek() != '"' || !ScanString(&begin, &escaped) ||
+              !Consume(':') || !SkipValue(depth + 1)) {
+            return false;
+          }
+        } while (Consume(','));
+        return Consume('}');
+      case '[':
+        ++p_;
+        if (Consume(']')) {
+          return true;
+        }
+        do {
+          if (!SkipValue(depth + 1)) {
+            return false;
+          }
+        } while (Consume(','));
+        return Consume(']');
+      case 't':
+        return SkipLiteral("true");
+      case 'f':
+        return SkipLiteral("false");
+      case 'n':
+        return SkipLiteral("null");
+      default:
+        return SkipNumber();
+    }
+  }
+
+ private:
+  void SkipSpace() {
+    while (p_ < end_ &&
+           (*p_ == ' ' || *p_ == '\t' || *p_ == '\n' || *p_ == '\r')) {
+      ++p_;
+    }
+  }
+
+  // Scans a string, setting begin to its first character and escaped if it
+  // has escape sequences. Control characters are rejected.
+  bool ScanString(const char **begin, bool *escaped) {
+    if (!Consume('"')) {
+      return false;
+    }
+    *begin = p_;
+    while (p_ < end_) {
+      unsigned char c = static_cast<unsigned char>(*p_++);
+      if (c == '"') {
+        return true;
+      }
+      if (c < 0x20) {
+        return false;
+      }
+      if (c == '\\') {
+        *escaped = true;
+        if (p_ == end_) {
+          return false;
+        }
+        ++p_;
+      }
+    }
+    return false;
+  }
+
+  bool SkipLiteral(const char *literal) {
+    size_t len = strlen(literal);
+    if (static_cast<size_t>(end_ - p_) < len || strncmp(p_, literal, len)) {
+      return false;
+    }
+    p_ += len;
+    return true;
+  }
+
+  // Skips the digits at p_. Returns false if there are none.
+  bool SkipDigits() {
+    const char *begin = p_;
+    while (p_ < end_ && *p_ >= '0' && *p_ <= '9') {
+      ++p_;
+    }
+    return p_ != begin;
+  }
+
+  // Skips a number: -?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?[0-9]+)?
+  bool SkipNumber() {
+    if (p_ < end_ && *p_ == '-') {
+      ++p_;
+    }
+    if (p_ < end_ && *p_ == '0') {
+      ++p_;
+    } else if (!SkipDigits()) {
+      return false;
+    }
+    if (p_ < end_ && *p_ == '.') {
+      ++p_;
+      if (!SkipDigits()) {
+        return false;
+      }
+    }
+    if (p_ < end_ && (*p_ == 'e' || *p_ == 'E')) {
+      ++p_;
+      if (p_ < end_ && (*p_ == '+' || *p_ == '-')) {
+        ++p_;
+      }
+      if (!SkipDigits()) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  const char *p_;
+  const char *end_;
+};
+
+// Parses the JOSE header.
+bool ParseHeader(StringPiece header, JwtParts *parts) {
+  JsonScanner json(header.data(), header.data() + header.size());
+  bool has_alg = false;
+  parts->has_kid = false;
+  if (!json.Consume('{')) {
+    return false;
+  }
+  if (!json.Consume('}')) {
+    do {
+      StringPiece key;
+      if (!json.ReadString(&key) || !json.Consume(':')) {
+        return false;
+      }
+      bool ok;
+      if (key == "alg") {
+        ok = !has_alg && json.ReadString(&parts->alg);
+        has_alg = true;
+      } else if (key == "kid") {
+        ok = !parts->has_kid && json.ReadString(&parts->kid);
+        parts->has_kid = true;
+      } else {
+        ok = json.SkipValue(0);
+      }
+      if (!ok) {
+        return false;
+      }
+    } while (json.Consume(','));
+    if (!json.Consume('}')) {
+      return false;
+    }
+  }
+  return has_alg && json.AtEnd();
+}
+
+// Parses the claims.
+bool ParsePayload(StringPiece payload, JwtParts *parts) {
+  JsonScanner json(payload.data(), payload.data() + payload.size());
+  bool has_iss = false, has_sub = false, has_aud = false, has_exp = false;
+  bool has_email = false, has_azp = false, has_jti = false, has_iat = false;
+  parts->has_nbf = false;
+  parts->aud.clear();
+  if (!json.Consume('{') || json.Consume('}')) {
+    return false;
+  }
+  do {
+    StringPiece key;
+    if (!json.ReadString(&key) || !json.Consume(':')) {
+      return false;
+    }
+    // Any claim seen twice sends the token to the full parser.
+    bool ok = true;
+    if (key == "iss") {
+      ok = !has_iss && json.ReadString(&parts->iss);
+      has_iss = true;
+    } else if (key == "sub") {
+      ok = !has_sub && json.ReadString(&parts->sub);
+      has_sub = true;
+    } else if (key == "aud") {
+      if (has_aud) {
+        return false;
+      }
+      has_aud = true;
+      StringPiece aud;
+      if (json.Peek() == '[') {
+        json.Consume('[');
+        if (!json.Consume(']')) {
+          do {
+            ok = json.ReadString(&aud);
+            parts->aud.push_back(aud);
+          } while (ok && json.Consume(','));
+          ok = ok && json.Consume(']');
+        }
+      } else {
+        ok = json.ReadString(&aud);
+        parts->aud.push_back(aud);
+      }
+    } else if (key == "exp") {
+      ok = !has_exp && json.ReadInteger(&parts->exp);
+      has_exp = true;
+    } else if (key == "nbf") {
+      ok = !parts->has_nbf && json.ReadInteger(&parts->nbf);
+      parts->has_nbf = true;
+    } else if (key == "iat") {
+      int64_t iat;
+      ok = !has_iat && json.ReadInteger(&iat);
+      has_iat = true;
+    } else if (key == "jti") {
+      StringPiece jti;
+      ok = !has_jti && json.ReadString(&jti);
+      has_jti = true;
+    } else if (key == "email") {
+      ok = !has_email && json.ReadString(&parts->email);
+      has_email = true;
+    } else if (key == "azp") {
+      ok = !has_azp && json.ReadString(&parts->azp);
+      has_azp = true;
+    } else {
+      ok = json.SkipValue(0);
+    }
+    if (!ok) {
+      return false;
+    }
+  } while (json.Consume(','));
+  if (!json.Consume('}') || !json.AtEnd()) {
+    return false;
+  }
+  if (!has_email) {
+    parts->email = StringPiece();
+  }
+  if (!has_azp) {
+    parts->azp = StringPiece();
+  }
+  return has_iss && has_sub && !parts->aud.empty() && has_exp;
+}
+
+}  // namespace
+
+bool ParseJwt(const char *jwt, size_t jwt_len, JwtParts *parts) {
+  if (jwt == nullptr) {
+    return false;
+  }
+  const char *end = jwt + jwt_len;
+  const char *dot1 = static_cast<const char *>(memchr(jwt, '.', jwt_len));
+  if (dot1 == nullptr) {
+    return false;
+  }
+  const char *dot2 =
+      static_cast<const char *>(memchr(dot1 + 1, '.', end - dot1 - 1));
+  if (dot2 == nullptr || dot2 + 1 == end) {
+    return false;
+  }
+  size_t header_len = dot1 - jwt;
+  size_t payload_len = dot2 - dot1 - 1;
+
+  // Decodes the header and the payload next to each other in the scratch
+  // buffer. It is sized up front so that the pieces stay valid.
+  std::string &buffer = ScratchBuffer();
+  size_t header_max = header_len / 4 * 3 + 3;
+  buffer.resize(header_max + payload_len / 4 * 3 + 3);
+  char *header = &buffer[0];
+  char *payload = header + header_max;
+  int64_t header_size = DecodeBase64Url(jwt, header_len, header);
+  int64_t payload_size = DecodeBase64Url(dot1 + 1, payload_len, payload);
+  if (header_size <= 0 || payload_size <= 0) {
+    return false;
+  }
+
+  if (!ParseHeader(StringPiece(header, header_size), parts) ||
+      !ParsePayload(StringPiece(payload, payload_size), parts)) {
+    return false;
+  }
+  parts->payload = StringPiece(payload, payload_size);
+  parts->signed_data = StringPiece(jwt, dot2 - jwt);
+  parts->signature = StringPiece(dot2 + 1, end - dot2 - 1);
+  return true;
+}
+
+bool Base64UrlDecode(StringPiece src, std::string *dst) {
+  dst->resize(src.size() / 4 * 3 + 3);
+  int64_t size = DecodeBase64Url(src.data(), src.size(), &(*dst)[0]);
+  if (size < 0) {
+    return false;
+  }
+  dst->resize(size);
+  return true;
+}
+
+}  // namespace auth
+}  // namespace api_manager
+}  // namespace google
@@ -0,0 +1,78 @@
+/* Copyright 2016 Google Inc. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef API_MANAGER_AUTH_LIB_JWT_PARSER_H_
+#define API_MANAGER_AUTH_LIB_JWT_PARSER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+#include "google/protobuf/stubs/stringpiece.h"
+
+namespace google {
+namespace api_manager {
+namespace auth {
+
+// The parts of a JWT needed to authenticate a request. The StringPieces
+// point either into the token, or into a per-thread scratch buffer that is
+// overwritten by the next ParseJwt() call on the same thread; copy whatever
+// must outlive that.
+struct JwtParts {
+  // JOSE header.
+  ::google::protobuf::StringPiece alg;
+  bool has_kid;
+  ::google::protobuf::StringPiece kid;
+
+  // Claims. Optional claims which are absent are empty.
+  ::google::protobuf::StringPiece iss;
+  ::google::protobuf::StringPiece sub;
+  std::vector<::google::protobuf::StringPiece> aud;
+  ::google::protobuf::StringPiece email;
+  ::google::protobuf::StringPiece azp;
+  int64_t exp;
+  bool has_nbf;
+  int64_t nbf;
+
+  // The decoded payload, i.e. the JSON object of all the claims.
+  ::google::protobuf::StringPiece payload;
+  // The signed part of the token, "<header>.<payload>".
+  ::google::protobuf::StringPiece signed_data;
+  // The base64url encoded signature.
+  ::google::protobuf::StringPiece signature;
+};
+
+// A lean JWT parser for the common case: it decodes the header and the
+// payload into a reused per-thread buffer and scans them once for the alg,
+// kid, iss, sub, aud, exp, nbf, email and azp fields, without building JSON
+// trees or copying strings.
+//
+// Returns true and fills parts if the token is well formed, has iss, sub,
+// aud and an integer exp, and uses only the JSON the lean parser handles.
+// Returns false otherwise, e.g. for escaped strings in the fields above or
+// non integer times; the token must then be parsed by the full parser,
+// which also reports the precise error for malformed tokens. It does not
+// check the signature or the time constraints.
+bool ParseJwt(const char *jwt, size_t jwt_len, JwtParts *parts);
+
+// Decodes the base64url string src into dst. Padding is optional. Returns
+// false if src is not valid base64url.
+bool Base64UrlDecode(::google::protobuf::StringPiece src, std::string *dst);
+
+}  // namespace auth
+}  // namespace api_manager
+}  // namespace google
+
+#endif  // API_MANAGER_AUTH_LIB_JWT_PARSER_H_
@@ -0,0 +1,199 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+#include "contrib/endpoints/src/api_manager/auth/lib/jwt_parser.h"
+
+#include <string>
+
+#include "gtest/gtest.h"
+
+using ::google::protobuf::StringPiece;
+
+namespace google {
+namespace api_manager {
+namespace auth {
+namespace {
+
+std::string Base64UrlEncode(const std::string &src) {
+  static const char kChars[] =
+      "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+  std::string dst;
+  uint32_t bits = 0;
+  int num_bits = 0;
+  for (unsigned char c : src) {
+    bits = (bits << 8) | c;
+    num_bits += 8;
+    while (num_bits >= 6) {
+      num_bits -= 6;
+      dst += kChars[(bits >> num_bits) & 0x3f];
+    }
+  }
+  if (num_bits > 0) {
+    dst += kChars[(bits << (6 - num_bits)) & 0x3f];
+  }
+  return dst;
+}
+
+std::string MakeJwt(const std::string &header, const std::string &payload) {
+  return Base64UrlEncode(header) + "." + Base64UrlEncode(payload) + ".c2ln";
+}
+
+const char kHeader[] = "{\"alg\":\"RS256\",\"kid\":\"key1\"}";
+
+bool Parse(const std::string &jwt, JwtParts *parts) {
+  return ParseJwt(jwt.data(), jwt.size(), parts);
+}
+
+bool ParsePayload(const std::string &payload) {
+  JwtParts parts;
+  return Parse(MakeJwt(kHeader, payload), &parts);
+}
+
+TEST(JwtParser, ParseClaims) {
+  const std::string payload =
+      "{ \"iss\": \"https://issuer.com\", \"sub\": \"user1\",\n"
+      "  \"aud\": [\"aud1\", \"aud2\"], \"exp\": 1500000000,\n"
+      "  \"nbf\": 1400000000, \"iat\": 1400000000, \"jti\": \"id\",\n"
+      "  \"email\": \"user1@example.com\", \"azp\": \"party\",\n"
+      "  \"custom\": {\"a\": [1, -2.5e3, true, false, null, \"\\\"q\\\"\"],"
+      "  \"b\": {}, \"c\": []} }";
+  std::string jwt = MakeJwt(kHeader, payload);
+  JwtParts parts;
+  ASSERT_TRUE(Parse(jwt, &parts));
+  EXPECT_EQ("RS256", parts.alg);
+  EXPECT_TRUE(parts.has_kid);
+  EXPECT_EQ("key1", parts.kid);
+  EXPECT_EQ("https://issuer.com", parts.iss);
+  EXPECT_EQ("user1", parts.sub);
+  ASSERT_EQ(2U, parts.aud.size());
+  EXPECT_EQ("aud1", parts.aud[0]);
+  EXPECT_EQ("aud2", parts.aud[1]);
+  EXPECT_EQ(1500000000, parts.exp);
+  EXPECT_TRUE(parts.has_nbf);
+  EXPECT_EQ(1400000000, parts.nbf);
+  EXPECT_EQ("user1@example.com", parts.email);
+  EXPECT_EQ("party", parts.azp);
+  EXPECT_EQ(payload, parts.payload);
+  EXPECT_EQ(jwt.substr(0, jwt.rfind('.')), parts.signed_data);
+  EXPECT_EQ("c2ln", parts.signature);
+}
+
+TEST(JwtParser, OptionalFields) {
+  JwtParts parts;
+  ASSERT_TRUE(Parse(MakeJwt("{\"alg\":\"RS256\"}",
+                            "{\"iss\":\"iss1\",\"sub\":\"sub1\","
+                            "\"aud\":\"aud1\",\"exp\":0}"),
+                    &parts));
+  EXPECT_FALSE(parts.has_kid);
+  EXPECT_FALSE(parts.has_nbf);
+  ASSERT_EQ(1U, parts.aud.size());
+  EXPECT_EQ("aud1", parts.aud[0]);
+  EXPECT_EQ(0, parts.exp);
+  EXPECT_TRUE(parts.email.empty());
+  EXPECT_TRUE(parts.azp.empty());
+}
+
+TEST(JwtParser, ReusesScratchBuffer) {
+  JwtParts parts1;
+  ASSERT_TRUE(Parse(MakeJwt(kHeader,
+                            "{\"iss\":\"iss1\",\"sub\":\"sub1\","
+                            "\"aud\":\"aud1\",\"exp\":1}"),
+                    &parts1));
+  std::string iss1 = parts1.iss.ToString();
+  JwtParts parts2;
+  ASSERT_TRUE(Parse(MakeJwt(kHeader,
+                            "{\"iss\":\"iss2\",\"sub\":\"sub2\","
+                            "\"aud\":\"aud2\",\"exp\":2}"),
+                    &parts2));
+  EXPECT_EQ("iss1", iss1);
+  EXPECT_EQ("iss2", parts2.iss);
+  EXPECT_EQ("sub2", parts2.sub);
+  EXPECT_EQ(2, parts2.exp);
+}
+
+TEST(JwtParser, LeftToFullParser) {
+  const char kClaims[] = "\"sub\":\"sub1\",\"aud\":\"aud1\",\"exp\":1";
+  auto with = [&kClaims](const std::string &claim) {
+    return "{" + claim + "," + kClaims + "}";
+  };
+  ASSERT_TRUE(ParsePayload(with("\"iss\":\"iss1\"")));
+
+  // Escaped strings.
+  EXPECT_FALSE(ParsePayload(with("\"iss\":\"is\\u0073\"")));
+  EXPECT_FALSE(ParsePayload(with("\"i\\u0073s\":\"iss1\"")));
+  // Duplicate claims.
+  EXPECT_FALSE(ParsePayload(with("\"iss\":\"iss1\",\"iss\":\"iss2\"")));
+  // Claims of unexpected types.
+  EXPECT_FALSE(ParsePayload(with("\"iss\":1")));
+  EXPECT_FALSE(ParsePayload(with("\"iss\":\"iss1\",\"nbf\":1.5")));
+  EXPECT_FALSE(ParsePayload(with("\"iss\":\"iss1\",\"nbf\":1e3")));
+  EXPECT_FALSE(ParsePayload(with("\"iss\":\"iss1\",\"nbf\":01")));
+  EXPECT_FALSE(ParsePayload(with("\"iss\":\"iss1\",\"iat\":\"1\"")));
+  EXPECT_FALSE(ParsePayload(with("\"iss\":\"iss1\",\"jti\":1")));
+  EXPECT_FALSE(ParsePayload(with("\"iss\":\"iss1\",\"email\":null")));
+  EXPECT_FALSE(ParsePayload(
+      "{\"iss\":\"iss1\",\"sub\":\"sub1\",\"aud\":[\"a\",1],\"exp\":1}"));
+  // Missing claims.
+  EXPECT_FALSE(ParsePayload("{\"sub\":\"sub1\",\"aud\":\"aud1\",\"exp\":1}"));
+  EXPECT_FALSE(ParsePayload("{\"iss\":\"iss1\",\"aud\":\"aud1\",\"exp\":1}"));
+  EXPECT_FALSE(ParsePayload("{\"iss\":\"iss1\",\"sub\":\"sub1\",\"exp\":1}"));
+  EXPECT_FALSE(
+      ParsePayload("{\"iss\":\"iss1\",\"sub\":\"sub1\",\"aud\":[],\"exp\":1}"));
+  EXPECT_FALSE(
+      ParsePayload("{\"iss\":\"iss1\",\"sub\":\"sub1\",\"aud\":\"a\"}"));
+  // Malformed JSON.
+  EXPECT_FALSE(ParsePayload(with("\"iss\":\"iss1\"") + "x"));
+  EXPECT_FALSE(ParsePayload(with("\"iss\":\"iss1\",\"x\":tru")));
+  EXPECT_FALSE(ParsePayload(with("\"iss\":\"iss1\",\"x\":[1,]")));
+  EXPECT_FALSE(ParsePayload(with("\"iss\":\"iss1\",\"x\":--1")));
+  EXPECT_FALSE(ParsePayload(with("\"iss\":\"iss1\",\"x\":\"a\nb\"")));
+  EXPECT_FALSE(ParsePayload("[]"));
+}
+
+TEST(JwtParser, MalformedTokens) {
+  const std::string payload =
+      "{\"iss\":\"iss1\",\"sub\":\"sub1\",\"aud\":\"aud1\",\"exp\":1}";
+  JwtParts parts;
+  std::string jwt = MakeJwt(kHeader, payload);
+  ASSERT_TRUE(Parse(jwt, &parts));
+
+  EXPECT_FALSE(Parse(jwt.substr(0, jwt.rfind('.')), &parts));
+  EXPECT_FALSE(Parse(jwt.substr(0, jwt.rfind('.') + 1), &parts));
+  EXPECT_FALSE(Parse("!" + jwt, &parts));
+  EXPECT_FALSE(Parse(MakeJwt("{\"kid\":\"key1\"}", payload), &parts));
+  EXPECT_FALSE(
+      Parse(MakeJwt("{\"alg\":\"RS256\",\"kid\":1}", payload), &parts));
+  EXPECT_FALSE(ParseJwt(nullptr, 0, &parts));
+}
+
+TEST(JwtParser, Base64UrlDecode) {
+  std::string decoded;
+  ASSERT_TRUE(Base64UrlDecode("c2ln", &decoded));
+  EXPECT_EQ("sig", decoded);
+  ASSERT_TRUE(Base64UrlDecode("c2lnYQ", &decoded));
+  EXPECT_EQ("siga", decoded);
+  ASSERT_TRUE(Base64UrlDecode("c2lnYQ==", &decoded));
+  EXPECT_EQ("siga", decoded);
+  ASSERT_TRUE(Base64UrlDecode("_-8", &decoded));
+  EXPECT_EQ("\xff\xef", decoded);
+  EXPECT_FALSE(Base64UrlDecode("c2lnY", &decoded));
+  EXPECT_FALSE(Base64UrlDecode("c2l+", &decoded));
+}
+
+}  // namespace
+}  // namespace auth
+}  // namespace api_manager
+}  // namespace google
@@ -0,0 +1,155 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+// Microbenchmark for RS256 JWT validation: parses and verifies a burst of
+// requests carrying a small set of tokens with a parsed JWK set, as
+// AuthChecker does for tokens missing from the JWT cache.
+//
+// Usage:
+//   bazel run -c opt //contrib/endpoints/src/api_manager/auth/lib:jwt_verify_benchmark
+//
+#include "contrib/endpoints/src/api_manager/auth/lib/auth_jwt_validator.h"
+
+#include <openssl/bn.h>
+#include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <openssl/rsa.h>
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "contrib/endpoints/src/api_manager/auth/lib/auth_token.h"
+#include "contrib/endpoints/src/api_manager/auth/lib/base64.h"
+
+using ::google::api_manager::UserInfo;
+using ::google::api_manager::auth::JwtKeySet;
+using ::google::api_manager::auth::JwtValidator;
+using ::google::api_manager::auth::esp_base64_encode;
+using ::google::api_manager::auth::esp_get_auth_token;
+using ::google::api_manager::auth::esp_grpc_free;
+
+namespace {
+
+const int kIterations = 20;
+// The number of distinct tokens in a burst.
+const int kTokens = 100;
+const char kKid[] = "b3319a147514df7ee5e4bcdee51350cc890cc89e";
+
+// Returns the base64url encoding of bn.
+std::string Base64UrlBigNum(const BIGNUM *bn) {
+  std::vector<unsigned char> bytes(BN_num_bytes(bn));
+  BN_bn2bin(bn, bytes.data());
+  char *encoded = esp_base64_encode(bytes.data(), bytes.size(), true, false,
+                                    false /*padding*/);
+  std::string result(encoded);
+  esp_grpc_free(encoded);
+  return result;
+}
+
+// Generates an RSA key, and returns the service account secret to sign
+// tokens with and the JWK set to verify them.
+bool GenerateKeys(std::string *secret, std::string *jwks) {
+  RSA *rsa = RSA_new();
+  BIGNUM *e = BN_new();
+  BN_set_word(e, RSA_F4);
+  bool ok = RSA_generate_key_ex(rsa, 2048, e, nullptr) == 1;
+  BN_free(e);
+  if (!ok) {
+    RSA_free(rsa);
+    return false;
+  }
+
+  EVP_PKEY *pkey = EVP_PKEY_new();
+  EVP_PKEY_set1_RSA(pkey, rsa);
+  BIO *bio = BIO_new(BIO_s_mem());
+  PEM_write_bio_PrivateKey(bio, pkey, nullptr, nullptr, 0, nullptr, nullptr);
+  char *pem_data = nullptr;
+  long pem_len = BIO_get_mem_data(bio, &pem_data);
+  std::string pem;
+  for (long i = 0; i < pem_len; ++i) {
+    if (pem_data[i] == '\n') {
+      pem += "\\n";
+    } else {
+      pem += pem_data[i];
+    }
+  }
+  BIO_free(bio);
+  EVP_PKEY_free(pkey);
+
+  *secret = std::string("{\"type\": \"service_account\",") +
+            "\"private_key_id\": \"" + kKid + "\"," + "\"private_key\": \"" +
+            pem + "\"," + "\"client_email\": \"benchmark@example.com\"," +
+            "\"client_id\": \"benchmark.example.com\"}";
+  *jwks = std::string("{\"keys\": [{\"kty\": \"RSA\", \"alg\": \"RS256\",") +
+          "\"kid\": \"" + kKid + "\", \"n\": \"" + Base64UrlBigNum(rsa->n) +
+          "\", \"e\": \"" + Base64UrlBigNum(rsa->e) + "\"}]}";
+  RSA_free(rsa);
+  return true;
+}
+
+// Validates every token kIterations times with keys, and returns the
+// average time per token.
+double Run(const std::vector<std::string> &tokens, const JwtKeySet &keys) {
+  int failures = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < kIterations; ++i) {
+    for (const auto &token : tokens) {
+      UserInfo user_info;
+      std::unique_ptr<JwtValidator> validator =
+          JwtValidator::Create(token.c_str(), token.size());
+      if (!validator->Parse(&user_info).ok() ||
+          !validator->VerifySignature(keys).ok()) {
+        ++failures;
+      }
+    }
+  }
+  auto end = std::chrono::steady_clock::now();
+  if (failures > 0) {
+    fprintf(stderr, "%d tokens failed validation\n", failures);
+  }
+  return std::chrono::duration<double, std::micro>(end - start).count() /
+         (static_cast<double>(kIterations) * tokens.size());
+}
+
+}  // namespace
+
+int main() {
+  std::string secret;
+  std::string jwks;
+  if (!GenerateKeys(&secret, &jwks)) {
+    fprintf(stderr, "failed to generate the keys\n");
+    return 1;
+  }
+
+  std::vector<std::string> tokens;
+  for (int i = 0; i < kTokens; ++i) {
+    std::string audience = "https://service" + std::to_string(i) + ".com";
+    char *token = esp_get_auth_token(secret.c_str(), audience.c_str());
+    if (token == nullptr) {
+      fprintf(stderr, "failed to sign a token\n");
+      return 1;
+    }
+    tokens.push_back(token);
+    esp_grpc_free(token);
+  }
+
+  std::shared_ptr<const JwtKeySet> keys =
+      JwtKeySet::Create(jwks.data(), jwks.size());
+  printf("verify every signature: %8.2f us/token\n", Run(tokens, *keys));
+  return 0;
+}
@@ -34,14 +34,30 @@ namespace {
 // Token expired in 1 hour, reduce 100 seconds for grace buffer.
 const int kClientSecretAuthTokenExpiration(3600 - 100);
 
+// JWT tokens are minted again by the refresh timer once they expire within
+// this window. Unit: seconds.
+const int kJwtTokenRefreshWindow = 600;
+
+// The interval of the refresh timer.
+const std::chrono::seconds kJwtTokenRefreshInterval(60);
+
 }  // namespace
 
+ServiceAccountToken::~ServiceAccountToken() {
+  if (refresh_timer_) {
+    refresh_timer_->Stop();
+  }
+}
+
 Status ServiceAccountToken::SetClientAuthSecret(const std::string& secret) {
   client_auth_secret_ = secret;
+  jwt_tokens_.clear();
 
   for (unsigned int i = 0; i < JWT_TOKEN_TYPE_MAX; i++) {
-    if (!jwt_tokens_[i].audience().empty()) {
-      Status status = jwt_tokens_[i].GenerateJwtToken(client_auth_secret_);
+    const std::string& audience = audiences_[i];
+    if (!audience.empty()) {
+      Status status =
+          jwt_tokens_[audience].GenerateJwtToken(client_auth_secret_, audience);
       if (!status.ok()) {
         if (env_) {
           env_->LogError("Failed to generate auth token.");
@@ -56,49 +72,90 @@ Status ServiceAccountToken::SetClientAuthSecret(const std::string& secret) {
 void ServiceAccountToken::SetAudience(JWT_TOKEN_TYPE type,
                                       const std::string& audience) {
   GOOGLE_CHECK(type >= 0 && type < JWT_TOKEN_TYPE_MAX);
-  if (jwt_tokens_[type].audience() != audience) {
-    jwt_tokens_[type].set_token("", 0);
-    jwt_tokens_[type].set_audience(audience);
-  }
+  audiences_[type] = audience;
 }
 
-const std::string& ServiceAccountToken::GetAuthToken(JWT_TOKEN_TYPE type) {
-  return GetAuthToken(type, jwt_tokens_[type].audience());
+std::string ServiceAccountToken::GetAuthToken(JWT_TOKEN_TYPE type) {
+  GOOGLE_CHECK(type >= 0 && type < JWT_TOKEN_TYPE_MAX);
+  return GetAuthToken(type, audiences_[type]);
 }
 
-const std::string& ServiceAccountToken::GetAuthToken(
-    JWT_TOKEN_TYPE type, const std::string& audience) {
+std::string ServiceAccountToken::GetAuthToken(JWT_TOKEN_TYPE type,
+                                              const std::string& audience) {
   SetAudience(type, audience);
 
   // Uses authentication secret if available.
   if (!client_auth_secret_.empty()) {
-    GOOGLE_CHECK(type >= 0 && type < JWT_TOKEN_TYPE_MAX);
-    if (!jwt_tokens_[type].is_valid(0)) {
-      Status status = jwt_tokens_[type].GenerateJwtToken(client_auth_secret_);
+    StartRefreshTimer();
+    JwtTokenInfo& jwt_token = jwt_tokens_[audience];
+    if (!jwt_token.is_valid(0)) {
+      // Only happens for the first token of an audience, or if the refresh
+      // timer failed to mint a new token in time.
+      Status status = jwt_token.GenerateJwtToken(client_auth_secret_, audience);
       if (!status.ok()) {
         if (env_) {
           env_->LogError("Failed to generate auth token.");
         }
-        static std::string empty;
-        return empty;
+        return std::string();
       }
     }
-    return jwt_tokens_[type].token();
+    jwt_token.set_used();
+    return jwt_token.token();
   }
   return access_token_.token();
 }
 
+void ServiceAccountToken::RefreshJwtTokens() {
+  if (client_auth_secret_.empty()) {
+    return;
+  }
+  for (auto it = jwt_tokens_.begin(); it != jwt_tokens_.end();) {
+    JwtTokenInfo& jwt_token = it->second;
+    if (jwt_token.is_valid(kJwtTokenRefreshWindow)) {
+      ++it;
+      continue;
+    }
+    if (!jwt_token.used() && !IsAudienceSet(it->first)) {
+      it = jwt_tokens_.erase(it);
+      continue;
+    }
+    Status status = jwt_token.GenerateJwtToken(client_auth_secret_, it->first);
+    if (!status.ok() && env_) {
+      env_->LogError("Failed to refresh auth token.");
+    }
+    ++it;
+  }
+}
+
+void ServiceAccountToken::StartRefreshTimer() {
+  if (refresh_timer_ || env_ == nullptr) {
+    return;
+  }
+  refresh_timer_ = env_->StartPeriodicTimer(
+      kJwtTokenRefreshInterval, [this]() { RefreshJwtTokens(); });
+}
+
+bool ServiceAccountToken::IsAudienceSet(const std::string& audience) const {
+  for (unsigned int i = 0; i < JWT_TOKEN_TYPE_MAX; i++) {
+    if (audiences_[i] == audience) {
+      return true;
+    }
+  }
+  return false;
+}
+
 Status ServiceAccountToken::JwtTokenInfo::GenerateJwtToken(
-    const std::string& client_auth_secret) {
+    const std::string& client_auth_secret, const std::string& audience) {
   // Make sure audience is set.
-  GOOGLE_CHECK(!audience_.empty());
+  GOOGLE_CHECK(!audience.empty());
   char* token =
-      auth::esp_get_auth_token(client_auth_secret.c_str(), audience_.c_str());
+      auth::esp_get_auth_token(client_auth_secret.c_str(), audience.c_str());
   if (token == nullptr) {
     return Status(Code::INVALID_ARGUMENT,
                   "Invalid client auth secret, the file may be corrupted.");
   }
   set_token(token, kClientSecretAuthTokenExpiration);
+  used_ = false;
   auth::esp_grpc_free(token);
   return Status::OK;
 }
@@ -16,6 +16,8 @@
 #define API_MANAGER_AUTH_SERVICE_ACCOUNT_TOKEN_H_
 
 #include <time.h>
+#include <map>
+#include <memory>
 
 #include "contrib/endpoints/include/api_manager/env_interface.h"
 
@@ -30,9 +32,14 @@ namespace auth {
 // JWT token for each service with its audience.
 // 2) GCE service account token is fetched from GCP metadata server.
 // This auth token can be used for any Google services.
+//
+// JWT tokens are cached per audience, and minted again by a periodic timer
+// before they expire, so that callers of GetAuthToken() do not pay for the
+// RSA signing. Only the first token for an audience is minted by the caller.
 class ServiceAccountToken {
  public:
   ServiceAccountToken(ApiManagerEnvInterface* env) : env_(env), state_(NONE) {}
+  ~ServiceAccountToken();
 
   // Sets the client auth secret and it can be used to generate JWT token.
   utils::Status SetClientAuthSecret(const std::string& secret);
@@ -77,14 +84,20 @@ class ServiceAccountToken {
   // Gets the auth token to access Google services.
   // If client auth secret is specified, use it to calcualte JWT token.
   // Otherwise, use the access token fetched from metadata server.
-  const std::string& GetAuthToken(JWT_TOKEN_TYPE type);
+  // The token is returned by value, since it is replaced when refreshed.
+  std::string GetAuthToken(JWT_TOKEN_TYPE type);
 
   // Gets the auth token to access Google services. This method accepts an
   // audience parameter to set when generating JWT token.
   // If client auth secret is specified, use it to calcualte JWT token.
   // Otherwise, use the access token fetched from metadata server.
-  const std::string& GetAuthToken(JWT_TOKEN_TYPE type,
-                                  const std::string& audience);
+  std::string GetAuthToken(JWT_TOKEN_TYPE type, const std::string& audience);
+
+  // Mints again the JWT tokens which expire soon. The tokens in use stay
+  // valid until their replacements are minted. Tokens for audiences that
+  // are neither set by SetAudience() nor used since they were minted are
+  // dropped instead. Called by the refresh timer started by GetAuthToken().
+  void RefreshJwtTokens();
 
  private:
   // Stores base token info. Used for both OAuth and JWT tokens.
@@ -117,25 +130,41 @@ class ServiceAccountToken {
   // Stores JWT token info
   class JwtTokenInfo : public TokenInfo {
    public:
-    void set_audience(const std::string audience) { audience_ = audience; }
-    const std::string& audience() const { return audience_; }
+    JwtTokenInfo() : used_(false) {}
+
+    // Whether the token was returned by GetAuthToken() since it was minted.
+    bool used() const { return used_; }
+    void set_used() { used_ = true; }
 
-    // Generates auth JWT token from client auth secret.
-    utils::Status GenerateJwtToken(const std::string& client_auth_secret);
+    // Generates auth JWT token for the audience from client auth secret.
+    // Keeps the current token if it fails.
+    utils::Status GenerateJwtToken(const std::string& client_auth_secret,
+                                   const std::string& audience);
 
    private:
-    // The audiences.
-    std::string audience_;
+    bool used_;
   };
 
+  // Starts the timer calling RefreshJwtTokens() if not started yet.
+  void StartRefreshTimer();
+
+  // Returns true if the audience is set for any JWT token type.
+  bool IsAudienceSet(const std::string& audience) const;
+
   // environment interface.
   ApiManagerEnvInterface* env_;
 
   // The client auth secret which can be used to generate JWT auth token.
   std::string client_auth_secret_;
 
-  // JWT tokens calcualted from client auth secrect.
-  JwtTokenInfo jwt_tokens_[JWT_TOKEN_TYPE_MAX];
+  // The audiences of JWT token types.
+  std::string audiences_[JWT_TOKEN_TYPE_MAX];
+
+  // JWT tokens calcualted from client auth secrect, keyed by audience.
+  std::map<std::string, JwtTokenInfo> jwt_tokens_;
+
+  // The timer refreshing the JWT tokens.
+  std::unique_ptr<PeriodicTimer> refresh_timer_;
 
   // GCE service account access token fetched from GCE metadata server.
   TokenInfo access_token_;
@@ -21,6 +21,8 @@
 
 using ::google::api_manager::utils::Status;
 using ::google::protobuf::util::error::Code;
+using ::testing::_;
+using ::testing::Invoke;
 
 namespace google {
 namespace api_manager {
@@ -28,6 +30,57 @@ namespace auth {
 
 namespace {
 
+// A client auth secret with a valid private key.
+const char kClientSecret[] =
+    "{\"private_key_id\": "
+    "\"b3319a147514df7ee5e4bcdee51350cc890cc89e\",\"private_key\": "
+    "\"-----BEGIN PRIVATE "
+    "KEY-----"
+    "\\nMIIEvQIBADANBgkqhkiG9w0BAQEFAASCBKcwggSjAgEAAoIBAQCoOLtPHgOE289C\\nyXWh"
+    "/HFzZ49AVyz4vSZdijpMZLrgJj/ZaY629iVws1mOG511lVXZfzybQx/"
+    "BpIDX\\nrAT5GIoz2GqjkRjwE9ePnsIyJgDKIe5A+nXJrKMyCgTU/"
+    "aO+"
+    "nh6oX4FOKWUYm3lb\\nlG5e2L26p8y0JB1qAHwQLcw1G5T8p14uAHLeVLeijgs5h37viREFVlu"
+    "TbCeaZvsi\\nE/"
+    "06gtzX7v72pTW6GkPGYTonAFq7SYNLAydgNLgb8wvXt0L5kO0t3WLbhJNTDf0o\\nfSlxJ18Vs"
+    "vY20Rl015qbUMN2TSJS0lI9mWJQckEj+mPwz7Yyf+"
+    "gDyMG4jxgrAGpi\\nRkI3Uj3lAgMBAAECggEAOuaaVyp4KvXYDVeC07QTeUgCdZHQkkuQemIi5"
+    "YrDkCZ0\\nZsi6CsAG/f4eVk6/"
+    "BGPEioItk2OeY+wYnOuDVkDMazjUpe7xH2ajLIt3DZ4W2q+"
+    "k\\nv6WyxmmnPqcZaAZjZiPxMh02pkqCNmqBxJolRxp23DtSxqR6lBoVVojinpnIwem6\\nxyU"
+    "l65u0mvlluMLCbKeGW/"
+    "K9bGxT+"
+    "qd3qWtYFLo5C3qQscXH4L0m96AjGgHUYW6M\\nFfs94ETNfHjqICbyvXOklabSVYenXVRL24TO"
+    "KIHWkywhi1wW+"
+    "Q6zHDADSdDVYw5l\\nDaXz7nMzJ2X7cuRP9zrPpxByCYUZeJDqej0Pi7h7ZQKBgQDdI7Yb3xFX"
+    "pbuPd1VS\\ntNMltMKzEp5uQ7FXyDNI6C8+"
+    "9TrjNMduTQ3REGqEcfdWA79FTJq95IM7RjXX9Aae\\np6cLekyH8MDH/"
+    "SI744vCedkD2bjpA6MNQrzNkaubzGJgzNiZhjIAqnDAD3ljHI61\\nNbADc32SQMejb6zlEh8h"
+    "ssSsXwKBgQDCvXhTIO/EuE/y5Kyb/"
+    "4RGMtVaQ2cpPCoB\\nGPASbEAHcsRk+4E7RtaoDQC1cBRy+"
+    "zmiHUA9iI9XZyqD2xwwM89fzqMj5Yhgukvo\\nXMxvMh8NrTneK9q3/"
+    "M3mV1AVg71FJQ2oBr8KOXSEbnF25V6/ara2+EpH2C2GDMAo\\npgEnZ0/"
+    "8OwKBgFB58IoQEdWdwLYjLW/"
+    "d0oGEWN6mRfXGuMFDYDaGGLuGrxmEWZdw\\nfzi4CquMdgBdeLwVdrLoeEGX+XxPmCEgzg/"
+    "FQBiwqtec7VpyIqhxg2J9V2elJS9s\\nPB1rh9I4/QxRP/"
+    "oO9h9753BdsUU6XUzg7t8ypl4VKRH3UCpFAANZdW1tAoGAK4ad\\ntjbOYHGxrOBflB5wOiByf"
+    "1JBZH4GBWjFf9iiFwgXzVpJcC5NHBKL7gG3EFwGba2M\\nBjTXlPmCDyaSDlQGLavJ2uQar0P0"
+    "Y2MabmANgMkO/hFfOXBPtQQe6jAfxayaeMvJ\\nN0fQOylUQvbRTodTf2HPeG9g/"
+    "W0sJem0qFH3FrECgYEAnwixjpd1Zm/diJuP0+Lb\\nYUzDP+Afy78IP3mXlbaQ/"
+    "RVd7fJzMx6HOc8s4rQo1m0Y84Ztot0vwm9+S54mxVSo\\n6tvh9q0D7VLDgf+"
+    "2NpnrDW7eMB3n0SrLJ83Mjc5rZ+wv7m033EPaWSr/TFtc/"
+    "MaF\\naOI20MEe3be96HHuWD3lTK0\u003d\\n-----END PRIVATE "
+    "KEY-----\\n\",\"client_email\": "
+    "\"628645741881-noabiu23f5a8m8ovd8ucv698lj78vv0l@developer.gserviceaccount."
+    "com\",\"client_id\": "
+    "\"628645741881-noabiu23f5a8m8ovd8ucv698lj78vv0l.apps.googleusercontent."
+    "com\",\"type\": \"service_account\"}";
+
+class NoopPeriodicTimer : public PeriodicTimer {
+ public:
+  void Stop() {}
+};
+
 class ServiceAccountTokenTest : public ::testing::Test {
  public:
   void SetUp() {
@@ -76,6 +129,45 @@ TEST_F(ServiceAccountTokenTest, TestClientAuthSecret) {
                     ServiceAccountToken::JWT_TOKEN_FOR_SERVICE_CONTROL));
 }
 
+TEST(ServiceAccountTokenRefreshTest, TestJwtTokenRefresh) {
+  ::testing::NiceMock<MockApiManagerEnvironment> env;
+  std::function<void()> refresh;
+  EXPECT_CALL(env, StartPeriodicTimer(_, _))
+      .WillOnce(Invoke([&refresh](std::chrono::milliseconds,
+                                  std::function<void()> continuation) {
+        refresh = continuation;
+        return std::unique_ptr<PeriodicTimer>(new NoopPeriodicTimer);
+      }));
+
+  ServiceAccountToken sa_token(&env);
+  sa_token.SetAudience(ServiceAccountToken::JWT_TOKEN_FOR_SERVICE_CONTROL,
+                       "audience1");
+  ASSERT_TRUE(sa_token.SetClientAuthSecret(kClientSecret).ok());
+  // The refresh timer is started by the first GetAuthToken() call.
+  ASSERT_FALSE(refresh);
+
+  std::string token1 = sa_token.GetAuthToken(
+      ServiceAccountToken::JWT_TOKEN_FOR_SERVICE_CONTROL);
+  ASSERT_FALSE(token1.empty());
+  ASSERT_TRUE(refresh);
+
+  // Tokens are cached per audience.
+  std::string token2 = sa_token.GetAuthToken(
+      ServiceAccountToken::JWT_TOKEN_FOR_FIREBASE, "audience2");
+  ASSERT_FALSE(token2.empty());
+  ASSERT_NE(token1, token2);
+  ASSERT_EQ(token1, sa_token.GetAuthToken(
+                        ServiceAccountToken::JWT_TOKEN_FOR_SERVICE_CONTROL,
+                        "audience1"));
+
+  // Tokens far from their expiration are kept by the refresh.
+  refresh();
+  ASSERT_EQ(token1, sa_token.GetAuthToken(
+                        ServiceAccountToken::JWT_TOKEN_FOR_SERVICE_CONTROL));
+  ASSERT_EQ(token2, sa_token.GetAuthToken(
+                        ServiceAccountToken::JWT_TOKEN_FOR_FIREBASE));
+}
+
 }  // namespace
 
 }  // namespace auth
@@ -31,7 +31,6 @@
 
 using ::google::api_manager::auth::Certs;
 using ::google::api_manager::auth::JwtCache;
-using ::google::api_manager::auth::JwtValue;
 using ::google::api_manager::auth::GetStringValue;
 using ::google::api_manager::auth::JwtValidator;
 using ::google::api_manager::utils::Status;
@@ -47,10 +46,202 @@ const char kAuthHeader[] = "authorization";
 const char kBearer[] = "Bearer ";
 // The lifetime of a public key cache entry. Unit: seconds.
 const int kPubKeyCacheDuration = 300;
+// A public key cache entry is refreshed in the background once less than
+// this is left of its lifetime. Unit: seconds.
+const int kPubKeyRefreshWindow = 60;
 
 // The header key to send endpoint api user info.
 const char kEndpointApiUserInfo[] = "X-Endpoint-API-UserInfo";
 
+// Returns the status to fail the request with for an auth error.
+Status AuthFailure(Code code, const std::string &error) {
+  return Status(code, std::string("JWT validation failed: ") + error,
+                Status::AUTH);
+}
+
+// Returns the status to fail the request with for a key fetch error. Appends
+// the HTTP response code for the upstream statuses.
+Status FetchFailure(const std::string &error, const Status &status) {
+  return AuthFailure(
+      Code::UNAUTHENTICATED,
+      error + (status.code() >= 300
+                   ? ". HTTP response code: " + std::to_string(status.code())
+                   : ""));
+}
+
+// Returns the value of the user info header sent to the backend: the JSON
+// encoded user info, base64 encoded. Returns an empty string on failure.
+std::string EncodeUserInfoHeader(const UserInfo &user_info) {
+  char *json_buf = auth::WriteUserInfoToJson(user_info);
+  if (json_buf == nullptr) {
+    return std::string();
+  }
+  char *base64_json_buf = auth::esp_base64_encode(
+      json_buf, strlen(json_buf), true, false, true /*padding*/);
+  auth::esp_grpc_free(json_buf);
+  if (base64_json_buf == nullptr) {
+    return std::string();
+  }
+  std::string header(base64_json_buf);
+  auth::esp_grpc_free(base64_json_buf);
+  return header;
+}
+
+// A KeyFetcher fetches the verification keys of an issuer, using OpenID
+// discovery to find them if needed, and stores them in the key cache. At most
+// one KeyFetcher per issuer runs at a time: requests that need the keys while
+// it runs wait on it through InflightKeyFetches, and are all resumed when it
+// calls InflightKeyFetches::Complete().
+class KeyFetcher : public std::enable_shared_from_this<KeyFetcher> {
+ public:
+  // parent_span may be null, e.g. for a background refresh. Otherwise it
+  // must outlive the fetch. Only the service context is kept, so that a
+  // background refresh does not keep the request that started it alive.
+  KeyFetcher(std::shared_ptr<context::ServiceContext> service_context,
+             const std::string &issuer,
+             cloud_trace::CloudTraceSpan *parent_span);
+
+  // Fetches the keys from url. If try_open_id is true, url is the OpenID
+  // discovery doc of the issuer, and the keys are fetched from the jwks_uri
+  // it refers to.
+  void Fetch(const std::string &url, bool try_open_id);
+
+ private:
+  void DiscoverJwksUri(const std::string &url);
+
+  // Callback function for open ID discovery http fetch.
+  void PostFetchJwksUri(Status status, std::string &&body);
+
+  void FetchPubKey(const std::string &url);
+
+  // Callback function for public key http fetch.
+  void PostFetchPubKey(Status status, std::string &&body);
+
+  // Helper function to send a http GET request.
+  void HttpFetch(const std::string &url,
+                 std::function<void(Status, std::string &&)> continuation);
+
+  // Completes the fetch and resumes the requests waiting on it.
+  void Done(const Status &status);
+
+  // The service context whose key cache is updated.
+  std::shared_ptr<context::ServiceContext> service_context_;
+
+  // The issuer whose keys are fetched.
+  std::string issuer_;
+
+  // Pointer to access ESP running environment.
+  ApiManagerEnvInterface *env_;
+
+  // Trace span of the request that started the fetch.
+  cloud_trace::CloudTraceSpan *parent_span_;
+};
+
+KeyFetcher::KeyFetcher(
+    std::shared_ptr<context::ServiceContext> service_context,
+    const std::string &issuer, cloud_trace::CloudTraceSpan *parent_span)
+    : service_context_(service_context),
+      issuer_(issuer),
+      env_(service_context_->env()),
+      parent_span_(parent_span) {}
+
+void KeyFetcher::Fetch(const std::string &url, bool try_open_id) {
+  if (try_open_id) {
+    DiscoverJwksUri(url);
+  } else {
+    // JwksUri is available. No need to try openID discovery.
+    FetchPubKey(url);
+  }
+}
+
+void KeyFetcher::DiscoverJwksUri(const std::string &url) {
+  auto pFetcher = shared_from_this();
+  HttpFetch(url, [pFetcher](Status status, std::string &&body) {
+    pFetcher->PostFetchJwksUri(status, std::move(body));
+  });
+}
+
+void KeyFetcher::PostFetchJwksUri(Status status, std::string &&body) {
+  if (!status.ok()) {
+    service_context_->SetJwksUri(issuer_, std::string(), false);
+    Done(FetchFailure("Unable to fetch URI of the key via OpenID discovery",
+                      status));
+    return;
+  }
+
+  // Parse discovery doc and extract jwks_uri
+  grpc_json *discovery_json = grpc_json_parse_string_with_len(
+      const_cast<char *>(body.c_str()), body.size());
+  const char *jwks_uri;
+  if (discovery_json != nullptr) {
+    jwks_uri = GetStringValue(discovery_json, "jwks_uri");
+    grpc_json_destroy(discovery_json);
+  } else {
+    jwks_uri = nullptr;
+  }
+
+  if (jwks_uri == nullptr) {
+    env_->LogError("OpenID discovery failed due to invalid doc format");
+    service_context_->SetJwksUri(issuer_, std::string(), false);
+    Done(AuthFailure(Code::UNAUTHENTICATED,
+                     "Unable to parse URI of the key via OpenID discovery"));
+    return;
+  }
+
+  // OpenID discovery completed. Set jwks_uri for the issuer in cache.
+  service_context_->SetJwksUri(issuer_, jwks_uri, false);
+
+  FetchPubKey(jwks_uri);
+}
+
+void KeyFetcher::FetchPubKey(const std::string &url) {
+  auto pFetcher = shared_from_this();
+  HttpFetch(url, [pFetcher](Status status, std::string &&body) {
+    pFetcher->PostFetchPubKey(status, std::move(body));
+  });
+}
+
+void KeyFetcher::PostFetchPubKey(Status status, std::string &&body) {
+  if (!status.ok() || body.empty()) {
+    Done(FetchFailure("Unable to fetch verification key", status));
+    return;
+  }
+
+  Certs &key_cache = service_context_->certs();
+  key_cache.Update(
+      issuer_, std::move(body),
+      system_clock::now() + std::chrono::seconds(kPubKeyCacheDuration));
+  Done(Status::OK);
+}
+
+void KeyFetcher::Done(const Status &status) {
+  service_context_->key_fetches().Complete(issuer_, status);
+}
+
+void KeyFetcher::HttpFetch(
+    const std::string &url,
+    std::function<void(Status, std::string &&)> continuation) {
+  std::shared_ptr<cloud_trace::CloudTraceSpan> fetch_span(
+      CreateChildSpan(parent_span_, "HttpFetch"));
+  env_->LogDebug(std::string("http fetch: ") + url);
+  TRACE(fetch_span) << "Http request URL: " << url;
+
+  std::unique_ptr<HTTPRequest> request(
+      new HTTPRequest([continuation, fetch_span](
+          Status status, std::map<std::string, std::string> &&,
+          std::string &&body) {
+        TRACE(fetch_span) << "Http response status: " << status.ToString();
+        continuation(status, std::move(body));
+      }));
+  if (!request) {
+    continuation(Status(Code::INTERNAL, "Out of memory"), "");
+    return;
+  }
+
+  request->set_method("GET").set_url(url);
+  env_->RunHTTPRequest(std::move(request));
+}
+
 // An AuthChecker object is created for every incoming request. It authenticates
 // the request, extracts user info from the auth token and sets it to the
 // request context.
@@ -72,6 +263,9 @@ class AuthChecker : public std::enable_shared_from_this<AuthChecker> {
   // In the case of a JWT cache miss, but a key cache hit, the steps are:
   // GetAuthToken() --> LookupJwtCache() --> ParseJwt() --> CheckAudience() -->
   // InitKey() --> VerifySignature() --> PassUserInfo()
+  // In the case of a key cache miss, InitKey() starts a KeyFetcher, or waits
+  // on the one in flight for the issuer, which then resumes the request with
+  // PostFetchKey() --> VerifySignature() --> PassUserInfo()
   void GetAuthToken();
 
   void LookupJwtCache();
@@ -82,15 +276,8 @@ class AuthChecker : public std::enable_shared_from_this<AuthChecker> {
 
   void InitKey();
 
-  void DiscoverJwksUri(const std::string &url);
-
-  // Callback function for open ID discovery http fetch.
-  void PostFetchJwksUri(Status status, std::string &&body);
-
-  void FetchPubKey(const std::string &url);
-
-  // Callback function for public key http fetch.
-  void PostFetchPubKey(Status status, std::string &&body);
+  // Callback function for the key fetch of the issuer.
+  void PostFetchKey(const Status &status);
 
   void VerifySignature();
 
@@ -101,9 +288,8 @@ class AuthChecker : public std::enable_shared_from_this<AuthChecker> {
   // Returns a shared pointer of this AuthChecker object.
   std::shared_ptr<AuthChecker> GetPtr() { return shared_from_this(); }
 
-  // Helper function to send a http GET request.
-  void HttpFetch(const std::string &url,
-                 std::function<void(Status, std::string &&)> continuation);
+  // Starts a background fetch of the issuer keys unless one is in flight.
+  void RefreshKey();
 
   // Authentication error
   void Unauthenticated(const std::string &error);
@@ -111,9 +297,6 @@ class AuthChecker : public std::enable_shared_from_this<AuthChecker> {
   // Authorization error
   void Unauthorized(const std::string &error);
 
-  // Fetch error, takes upstream error
-  void FetchFailure(const std::string &error, Status status);
-
   /*** Member Variables. ***/
 
   // Request context.
@@ -125,6 +308,15 @@ class AuthChecker : public std::enable_shared_from_this<AuthChecker> {
   // User info extracted from auth token.
   UserInfo user_info_;
 
+  // The encoded user info header, taken from the JwtCache on a cache hit.
+  std::string user_info_header_;
+
+  // The issuer and the audiences of the auth token, normalized with
+  // utils::GetUrlContent(). Computed once per token, and then kept in the
+  // JwtCache.
+  std::string issuer_;
+  std::set<std::string> audiences_;
+
   // Pointer to access ESP running environment.
   ApiManagerEnvInterface *env_;
 
@@ -189,28 +381,14 @@ void AuthChecker::GetAuthToken() {
 }
 
 void AuthChecker::LookupJwtCache() {
-  bool remove = false;  // whether or not need to remove an expired entry.
-  bool cache_hit = false;
-  JwtCache &jwt_cache = context_->service_context()->jwt_cache();
-  {
-    JwtCache::ScopedLookup lookup(&jwt_cache, auth_token_);
-    if (lookup.Found()) {
-      JwtValue *val = lookup.value();
-      if (system_clock::now() <= val->exp) {
-        // Cache hit and cache entry is not expired.
-        user_info_ = val->user_info;
-        cache_hit = true;
-      } else {
-        // Need to removes the expired cache entry.
-        remove = true;
-      }
-    }
-  }
-  if (remove) {
-    jwt_cache.Remove(auth_token_);
-  }
-
-  if (cache_hit) {
+  // An expired entry is removed by the lookup itself.
+  auth::JwtValue value;
+  if (context_->service_context()->jwt_cache().Lookup(
+          auth_token_, system_clock::now(), &value)) {
+    user_info_ = std::move(value.user_info);
+    user_info_header_ = std::move(value.user_info_header);
+    issuer_ = std::move(value.issuer);
+    audiences_ = std::move(value.audiences);
     CheckAudience(true);
   } else {
     ParseJwt();
@@ -232,6 +410,12 @@ void AuthChecker::ParseJwt() {
     return;
   }
 
+  // Remove http/s header and trailing '/' for issuer and audiences.
+  issuer_ = utils::GetUrlContent(user_info_.issuer);
+  for (const auto &it : user_info_.audiences) {
+    audiences_.insert(utils::GetUrlContent(it));
+  }
+
   CheckAudience(false);
 }
 
@@ -245,9 +429,7 @@ void AuthChecker::CheckAudience(bool cache_hit) {
 
   context_->set_auth_claims(user_info_.claims);
 
-  // Remove http/s header and trailing '/' for issuer.
-  std::string issuer = utils::GetUrlContent(user_info_.issuer);
-  if (!context_->method()->isIssuerAllowed(issuer)) {
+  if (!context_->method()->isIssuerAllowed(issuer_)) {
     Unauthenticated("Issuer not allowed");
     return;
   }
@@ -257,13 +439,8 @@ void AuthChecker::CheckAudience(bool cache_hit) {
   //   - Explicitly allowed by the issuer in the method configuration.
   // Otherwise the JWT is rejected.
   const std::string &service_name = context_->service_context()->service_name();
-  // Remove http/s header and trailing '/' for audiences.
-  std::set<std::string> aud;
-  for (auto &it : user_info_.audiences) {
-    aud.insert(utils::GetUrlContent(it));
-  }
-  if (aud.find(service_name) == aud.end() &&
-      !context_->method()->isAudienceAllowed(issuer, aud)) {
+  if (audiences_.find(service_name) == audiences_.end() &&
+      !context_->method()->isAudienceAllowed(issuer_, audiences_)) {
     Unauthorized("Audience not allowed");
     return;
   }
@@ -275,88 +452,63 @@ void AuthChecker::CheckAudience(bool cache_hit) {
 }
 
 void AuthChecker::InitKey() {
-  Certs &key_cache = context_->service_context()->certs();
-  auto cert = key_cache.GetCert(user_info_.issuer);
-
-  if (cert == nullptr || system_clock::now() > cert->second) {
-    // Key has not been fetched or has expired.
-    std::string url;
-    bool tryOpenId =
-        context_->service_context()->GetJwksUri(user_info_.issuer, &url);
-    if (url.empty()) {
-      Unauthenticated("Cannot determine the URI of the key");
-      return;
-    }
-
-    if (tryOpenId) {
-      DiscoverJwksUri(url);
-    } else {
-      // JwksUri is available. No need to try openID discovery.
-      FetchPubKey(url);
+  context::ServiceContext *service_context = context_->service_context();
+  auto cert = service_context->certs().GetCert(user_info_.issuer);
+  system_clock::time_point now = system_clock::now();
+
+  if (cert != nullptr && now <= cert->second) {
+    // Key is in the cache. If it is about to expire, refresh it in the
+    // background; this request goes on with the current key.
+    if (now + std::chrono::seconds(kPubKeyRefreshWindow) > cert->second) {
+      RefreshKey();
     }
-  } else {
-    // Key is in the cache, next step is to verify signature.
     VerifySignature();
+    return;
   }
-}
 
-void AuthChecker::DiscoverJwksUri(const std::string &url) {
-  auto pChecker = GetPtr();
-  HttpFetch(url, [pChecker](Status status, std::string &&body) {
-    pChecker->PostFetchJwksUri(status, std::move(body));
-  });
-}
-
-void AuthChecker::PostFetchJwksUri(Status status, std::string &&body) {
-  if (!status.ok()) {
-    context_->service_context()->SetJwksUri(user_info_.issuer, std::string(),
-                                            false);
-    FetchFailure("Unable to fetch URI of the key via OpenID discovery", status);
+  // Key has not been fetched or has expired.
+  std::string url;
+  bool tryOpenId = service_context->GetJwksUri(user_info_.issuer, &url);
+  if (url.empty()) {
+    Unauthenticated("Cannot determine the URI of the key");
     return;
   }
 
-  // Parse discovery doc and extract jwks_uri
-  grpc_json *discovery_json = grpc_json_parse_string_with_len(
-      const_cast<char *>(body.c_str()), body.size());
-  const char *jwks_uri;
-  if (discovery_json != nullptr) {
-    jwks_uri = GetStringValue(discovery_json, "jwks_uri");
-    grpc_json_destroy(discovery_json);
+  auto pChecker = GetPtr();
+  if (service_context->key_fetches().Enqueue(
+          user_info_.issuer, [pChecker](const Status &status) {
+            pChecker->PostFetchKey(status);
+          })) {
+    std::make_shared<KeyFetcher>(context_->shared_service_context(),
+                                 user_info_.issuer, trace_span_.get())
+        ->Fetch(url, tryOpenId);
   } else {
-    jwks_uri = nullptr;
+    TRACE(trace_span_) << "Waiting for the key fetch in flight.";
   }
+}
 
-  if (jwks_uri == nullptr) {
-    env_->LogError("OpenID discovery failed due to invalid doc format");
-    context_->service_context()->SetJwksUri(user_info_.issuer, std::string(),
-                                            false);
-    Unauthenticated("Unable to parse URI of the key via OpenID discovery");
+void AuthChecker::RefreshKey() {
+  context::ServiceContext *service_context = context_->service_context();
+  std::string url;
+  bool tryOpenId = service_context->GetJwksUri(user_info_.issuer, &url);
+  if (url.empty() ||
+      !service_context->key_fetches().Enqueue(user_info_.issuer, nullptr)) {
     return;
   }
-
-  // OpenID discovery completed. Set jwks_uri for the issuer in cache.
-  context_->service_context()->SetJwksUri(user_info_.issuer, jwks_uri, false);
-
-  FetchPubKey(jwks_uri);
+  env_->LogDebug(std::string("Refreshing the key of issuer: ") +
+                 user_info_.issuer);
+  // The fetch outlives this request, so it is not traced.
+  std::make_shared<KeyFetcher>(context_->shared_service_context(),
+                               user_info_.issuer, nullptr)
+      ->Fetch(url, tryOpenId);
 }
 
-void AuthChecker::FetchPubKey(const std::string &url) {
-  auto pChecker = GetPtr();
-  HttpFetch(url, [pChecker](Status status, std::string &&body) {
-    pChecker->PostFetchPubKey(status, std::move(body));
-  });
-}
-
-void AuthChecker::PostFetchPubKey(Status status, std::string &&body) {
-  if (!status.ok() || body.empty()) {
-    FetchFailure("Unable to fetch verification key", status);
+void AuthChecker::PostFetchKey(const Status &status) {
+  if (!status.ok()) {
+    trace_span_.reset();
+    on_done_(status);
     return;
   }
-
-  Certs &key_cache = context_->service_context()->certs();
-  key_cache.Update(
-      user_info_.issuer, std::move(body),
-      system_clock::now() + std::chrono::seconds(kPubKeyCacheDuration));
   VerifySignature();
 }
 
@@ -368,32 +520,34 @@ void AuthChecker::VerifySignature() {
     return;
   }
 
-  Status status =
-      validator_->VerifySignature(cert->first.c_str(), cert->first.size());
+  Status status = validator_->VerifySignature(*cert->first);
   if (!status.ok()) {
     Unauthenticated(status.message());
     return;
   }
 
-  // Inserts the entry to JwtCache.
+  // Encodes the user info header once, and inserts it with the entry to
+  // JwtCache so that cache hits can forward it as is.
+  user_info_header_ = EncodeUserInfoHeader(user_info_);
+  if (user_info_header_.empty()) {
+    Unauthenticated("Internal error");
+    return;
+  }
+  auth::JwtValue value;
+  value.user_info = user_info_;
+  value.user_info_header = user_info_header_;
+  value.issuer = issuer_;
+  value.audiences = audiences_;
   JwtCache &cache = context_->service_context()->jwt_cache();
-  cache.Insert(auth_token_, user_info_, validator_->GetExpirationTime(),
+  cache.Insert(auth_token_, value, validator_->GetExpirationTime(),
                system_clock::now());
 
   PassUserInfoOnSuccess();
 }
 
 void AuthChecker::PassUserInfoOnSuccess() {
-  char *json_buf = auth::WriteUserInfoToJson(user_info_);
-  if (json_buf == nullptr) {
-    return;
-  }
-  char *base64_json_buf = auth::esp_base64_encode(
-      json_buf, strlen(json_buf), true, false, true /*padding*/);
   context_->request()->AddHeaderToBackend(kEndpointApiUserInfo,
-                                          base64_json_buf);
-  auth::esp_grpc_free(json_buf);
-  auth::esp_grpc_free(base64_json_buf);
+                                          user_info_header_);
 
   TRACE(trace_span_) << "Authenticated.";
   trace_span_.reset();
@@ -403,53 +557,13 @@ void AuthChecker::PassUserInfoOnSuccess() {
 void AuthChecker::Unauthenticated(const std::string &error) {
   TRACE(trace_span_) << "Authentication failed: " << error;
   trace_span_.reset();
-  on_done_(Status(Code::UNAUTHENTICATED,
-                  std::string("JWT validation failed: ") + error,
-                  Status::AUTH));
+  on_done_(AuthFailure(Code::UNAUTHENTICATED, error));
 }
 
 void AuthChecker::Unauthorized(const std::string &error) {
   TRACE(trace_span_) << "Authorization failed: " << error;
   trace_span_.reset();
-  on_done_(Status(Code::PERMISSION_DENIED,
-                  std::string("JWT validation failed: ") + error,
-                  Status::AUTH));
-}
-
-void AuthChecker::FetchFailure(const std::string &error, Status status) {
-  // Append HTTP response code for the upstream statuses
-  trace_span_.reset();
-  on_done_(
-      Status(Code::UNAUTHENTICATED,
-             std::string("JWT validation failed: ") + error +
-                 (status.code() >= 300
-                      ? ". HTTP response code: " + std::to_string(status.code())
-                      : ""),
-             Status::AUTH));
-}
-
-void AuthChecker::HttpFetch(
-    const std::string &url,
-    std::function<void(Status, std::string &&)> continuation) {
-  std::shared_ptr<cloud_trace::CloudTraceSpan> fetch_span(
-      CreateChildSpan(trace_span_.get(), "HttpFetch"));
-  env_->LogDebug(std::string("http fetch: ") + url);
-  TRACE(fetch_span) << "Http request URL: " << url;
-
-  std::unique_ptr<HTTPRequest> request(
-      new HTTPRequest([continuation, fetch_span](
-          Status status, std::map<std::string, std::string> &&,
-          std::string &&body) {
-        TRACE(fetch_span) << "Http response status: " << status.ToString();
-        continuation(status, std::move(body));
-      }));
-  if (!request) {
-    continuation(Status(Code::INTERNAL, "Out of memory"), "");
-    return;
-  }
-
-  request->set_method("GET").set_url(url);
-  env_->RunHTTPRequest(std::move(request));
+  on_done_(AuthFailure(Code::PERMISSION_DENIED, error));
 }
 
 }  // namespace
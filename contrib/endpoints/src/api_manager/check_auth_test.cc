@@ -611,6 +611,102 @@ TEST_F(CheckAuthTest, TestHttpSlashAudience) {
   TestValidToken(kTokenHttpSlashAud);
 }
 
+// Concurrent requests for the keys of the same issuer share one fetch.
+TEST_F(CheckAuthTest, TestConcurrentKeyFetch) {
+  EXPECT_CALL(*raw_request_, FindHeader(kAuthHeader, _))
+      .WillOnce(Invoke([](const std::string &, std::string *token) {
+        *token = std::string(kBearer) + std::string(kToken);
+        return true;
+      }))
+      .WillOnce(Invoke([](const std::string &, std::string *token) {
+        *token = std::string(kBearer) + std::string(kToken2);
+        return true;
+      }));
+  EXPECT_CALL(*raw_request_, SetAuthToken(_)).Times(2);
+
+  int done = 0;
+  auto on_done = [&done](Status status) {
+    ASSERT_TRUE(status.ok());
+    ++done;
+  };
+  std::shared_ptr<context::RequestContext> context = context_;
+  EXPECT_CALL(*raw_env_, DoRunHTTPRequest(_))
+      .Times(2)
+      .WillOnce(Invoke([context, on_done, &done](HTTPRequest *req) {
+        EXPECT_EQ(req->url(), kIssuer1OpenIdUrl);
+        // A second request arrives while the key is being fetched. It sends
+        // no HTTP request and waits on the fetch in flight.
+        CheckAuth(context, on_done);
+        EXPECT_EQ(0, done);
+
+        std::string body(kOpenIdContent);
+        std::map<std::string, std::string> empty;
+        req->OnComplete(Status::OK, std::move(empty), std::move(body));
+      }))
+      .WillOnce(Invoke([](HTTPRequest *req) {
+        EXPECT_EQ(req->url(), kIssuer1PubkeyUrl);
+        std::string body(kPubkey);
+        std::map<std::string, std::string> empty;
+        req->OnComplete(Status::OK, std::move(empty), std::move(body));
+      }));
+  EXPECT_CALL(*raw_request_,
+              AddHeaderToBackend(kEndpointApiUserInfo, kUserInfo_kSub_kIss))
+      .WillOnce(Return(utils::Status::OK));
+  EXPECT_CALL(*raw_request_,
+              AddHeaderToBackend(kEndpointApiUserInfo, kUserInfo_kSub2_kIss))
+      .WillOnce(Return(utils::Status::OK));
+
+  CheckAuth(context_, on_done);
+  EXPECT_EQ(2, done);
+}
+
+// A key about to expire is refreshed in the background while the request
+// goes on with the current key.
+TEST_F(CheckAuthTest, TestKeyRefresh) {
+  std::chrono::system_clock::time_point exp =
+      std::chrono::system_clock::now() + std::chrono::seconds(10);
+  service_context_->certs().Update("https://issuer1.com", kPubkey, exp);
+
+  EXPECT_CALL(*raw_request_, FindHeader(kAuthHeader, _))
+      .WillOnce(Invoke([](const std::string &, std::string *token) {
+        *token = std::string(kBearer) + std::string(kToken);
+        return true;
+      }));
+  EXPECT_CALL(*raw_request_, SetAuthToken(kToken)).Times(1);
+  EXPECT_CALL(*raw_request_,
+              AddHeaderToBackend(kEndpointApiUserInfo, kUserInfo_kSub_kIss))
+      .WillOnce(Return(utils::Status::OK));
+
+  // The refresh fetches the keys again, via OpenID discovery.
+  EXPECT_CALL(*raw_env_, DoRunHTTPRequest(_))
+      .Times(2)
+      .WillOnce(Invoke([](HTTPRequest *req) {
+        EXPECT_EQ(req->url(), kIssuer1OpenIdUrl);
+        std::string body(kOpenIdContent);
+        std::map<std::string, std::string> empty;
+        req->OnComplete(Status::OK, std::move(empty), std::move(body));
+      }))
+      .WillOnce(Invoke([](HTTPRequest *req) {
+        EXPECT_EQ(req->url(), kIssuer1PubkeyUrl);
+        std::string body(kPubkey);
+        std::map<std::string, std::string> empty;
+        req->OnComplete(Status::OK, std::move(empty), std::move(body));
+      }));
+
+  bool done = false;
+  CheckAuth(context_, [&done](Status status) {
+    ASSERT_TRUE(status.ok());
+    done = true;
+  });
+  EXPECT_TRUE(done);
+
+  // The refreshed key has a new lifetime.
+  auto cert = service_context_->certs().GetCert("https://issuer1.com");
+  ASSERT_NE(nullptr, cert);
+  EXPECT_LT(exp, cert->second);
+  EXPECT_FALSE(service_context_->key_fetches().InFlight("https://issuer1.com"));
+}
+
 }  // namespace
 
 }  // namespace api_manager
@@ -18,11 +18,14 @@
 #include <sstream>
 #include "contrib/endpoints/src/api_manager/auth/lib/json_util.h"
 #include "contrib/endpoints/src/api_manager/firebase_rules/firebase_request.h"
+#include "contrib/endpoints/src/api_manager/firebase_rules/rules_cache.h"
 #include "contrib/endpoints/src/api_manager/utils/marshalling.h"
 
 using ::google::api_manager::auth::GetStringValue;
 using ::google::api_manager::firebase_rules::FirebaseRequest;
+using ::google::api_manager::firebase_rules::RulesCache;
 using ::google::api_manager::utils::Status;
+using std::chrono::system_clock;
 const char kFirebaseAudience[] =
     "https://staging-firebaserules.sandbox.googleapis.com/"
     "google.firebase.rules.v1.FirebaseRulesService";
@@ -46,17 +49,19 @@ const std::string kApplication = "application/json";
 
 std::string GetReleaseName(const context::RequestContext &context) {
   return context.service_context()->service_name() + ":" +
-         context.service_context()->service().apis(0).version();
+         context.config()->service().apis(0).version();
 }
 
 std::string GetReleaseUrl(const context::RequestContext &context) {
-  return context.service_context()->config()->GetFirebaseServer() + kV1 +
-         kProjects + "/" + context.service_context()->project_id() + kReleases +
-         "/" + GetReleaseName(context);
+  return context.config()->GetFirebaseServer() + kV1 + kProjects + "/" +
+         context.service_context()->project_id() + kReleases + "/" +
+         GetReleaseName(context);
 }
 
 // An AuthzChecker object is created for every incoming request. It does
-// authorizaiton by calling Firebase Rules service.
+// authorizaiton by calling Firebase Rules service. The ruleset id of the
+// release and, if enabled, the decisions are kept in the RulesCache of the
+// service, and concurrent requests missing the same entry share one call.
 class AuthzChecker : public std::enable_shared_from_this<AuthzChecker> {
  public:
   // Constructor
@@ -68,6 +73,21 @@ class AuthzChecker : public std::enable_shared_from_this<AuthzChecker> {
              std::function<void(Status status)> continuation);
 
  private:
+  // Fetches the ruleset id of the release, and completes the ruleset id
+  // fetch of the RulesCache with it.
+  void FetchRulesetId(std::shared_ptr<context::RequestContext> context);
+
+  // Checks the request against the ruleset, using the decision cache if it
+  // is enabled.
+  void CheckRuleset(std::shared_ptr<context::RequestContext> context,
+                    const std::string &ruleset_id,
+                    std::function<void(Status status)> continuation);
+
+  // Checks the request against the ruleset with the Firebase service.
+  void TestRuleset(std::shared_ptr<context::RequestContext> context,
+                   const std::string &ruleset_id,
+                   std::function<void(Status status)> continuation);
+
   // This method invokes the Firebase TestRuleset API endpoint as well as user
   // defined endpoints provided by the TestRulesetResponse.
   void CallNextRequest(std::function<void(Status status)> continuation);
@@ -107,12 +127,39 @@ void AuthzChecker::Check(
     return;
   }
 
+  // The release changes with the config snapshot of the request, so the
+  // ruleset id is cached and fetched by release name.
+  RulesCache &cache = context->service_context()->rules_cache();
+  std::string release_name = GetReleaseName(*context);
+  std::string ruleset_id;
+  if (cache.LookupRulesetId(release_name, system_clock::now(), &ruleset_id)) {
+    CheckRuleset(context, ruleset_id, final_continuation);
+    return;
+  }
+
+  auto checker = GetPtr();
+  if (cache.Enqueue(RulesCache::RulesetIdKey(release_name),
+                    [context, final_continuation, checker](
+                        const Status &status, const std::string &ruleset_id) {
+                      if (status.ok()) {
+                        checker->CheckRuleset(context, ruleset_id,
+                                              final_continuation);
+                      } else {
+                        final_continuation(status);
+                      }
+                    })) {
+    FetchRulesetId(context);
+  }
+}
+
+void AuthzChecker::FetchRulesetId(
+    std::shared_ptr<context::RequestContext> context) {
   // Fetch the Release attributes and get ruleset name.
   auto checker = GetPtr();
   HttpFetch(GetReleaseUrl(*context), kHttpGetMethod, "",
             auth::ServiceAccountToken::JWT_TOKEN_FOR_FIREBASE,
-            kFirebaseAudience, [context, final_continuation, checker](
-                                   Status status, std::string &&body) {
+            kFirebaseAudience,
+            [context, checker](Status status, std::string &&body) {
               std::string ruleset_id;
               if (status.ok()) {
                 checker->env_->LogDebug(
@@ -125,18 +172,61 @@ void AuthzChecker::Check(
                 status = Status(Code::INTERNAL, kFailedFirebaseReleaseFetch);
               }
 
-              // If the parsing of the release body is successful, then call the
-              // Test Api for firebase rules service.
+              RulesCache &cache = context->service_context()->rules_cache();
+              std::string release_name = GetReleaseName(*context);
               if (status.ok()) {
-                checker->request_handler_ = std::unique_ptr<FirebaseRequest>(
-                    new FirebaseRequest(ruleset_id, checker->env_, context));
-                checker->CallNextRequest(final_continuation);
-              } else {
-                final_continuation(status);
+                cache.SetRulesetId(release_name, ruleset_id,
+                                   system_clock::now());
               }
+              cache.Complete(RulesCache::RulesetIdKey(release_name), status,
+                             ruleset_id);
             });
 }
 
+void AuthzChecker::CheckRuleset(
+    std::shared_ptr<context::RequestContext> context,
+    const std::string &ruleset_id,
+    std::function<void(Status status)> continuation) {
+  RulesCache &cache = context->service_context()->rules_cache();
+  if (!cache.decisions_enabled()) {
+    TestRuleset(context, ruleset_id, continuation);
+    return;
+  }
+
+  std::string key = RulesCache::DecisionKey(
+      ruleset_id, context->request()->GetRequestHTTPMethod(),
+      context->request()->GetUnparsedRequestPath(), context->auth_claims());
+  Status decision = Status::OK;
+  if (cache.LookupDecision(key, system_clock::now(), &decision)) {
+    continuation(decision);
+    return;
+  }
+
+  if (!cache.Enqueue(key, [continuation](const Status &status,
+                                         const std::string &) {
+        continuation(status);
+      })) {
+    return;
+  }
+  auto checker = GetPtr();
+  TestRuleset(context, ruleset_id, [context, checker, key](Status status) {
+    RulesCache &cache = context->service_context()->rules_cache();
+    if (!checker->request_handler_->has_function_calls()) {
+      cache.SetDecision(key, status, system_clock::now());
+    }
+    cache.Complete(key, status, "");
+  });
+}
+
+void AuthzChecker::TestRuleset(
+    std::shared_ptr<context::RequestContext> context,
+    const std::string &ruleset_id,
+    std::function<void(Status status)> continuation) {
+  request_handler_ = std::unique_ptr<FirebaseRequest>(
+      new FirebaseRequest(ruleset_id, env_, context));
+  CallNextRequest(continuation);
+}
+
 void AuthzChecker::CallNextRequest(
     std::function<void(Status status)> continuation) {
   if (request_handler_->is_done()) {
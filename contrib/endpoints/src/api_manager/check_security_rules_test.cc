@@ -133,6 +133,12 @@ api_check_security_rules_config {
   firebase_server: "https://myfirebaseserver.com"
 })";
 
+static const char kServerConfigWithDecisionCache[] = R"(
+api_check_security_rules_config {
+  firebase_server: "https://myfirebaseserver.com"
+  decision_cache_expiration_sec: 60
+})";
+
 // The response to GetRelease call to firebase server.
 static const char kRelease[] = R"(
 {
@@ -523,6 +529,73 @@ TEST_F(CheckSecurityRulesTest, CheckAuthzSuccess) {
                      [](Status status) { ASSERT_TRUE(status.ok()); });
 }
 
+// Check that the ruleset id is cached by release.
+// 1. The first request fetches the release of the v1 config.
+// 2. The config is updated to v2, whose release is fetched for the next
+// request instead of using the ruleset id of the v1 release.
+TEST_F(CheckSecurityRulesTest, CheckAuthzAfterConfigUpdate) {
+  std::string service_config = std::string(kServiceName) + kProducerProjectId +
+                               kApis + kAuthentication + kHttp;
+  SetUp(service_config, kServerConfig);
+
+  request_context_->set_auth_claims(kJwtEmailPayload);
+  ExpectCall(release_url_, "GET", "", kRelease);
+  ExpectCall(ruleset_test_url_, "POST", kFirstRequest,
+             BuildTestRulesetResponse(true));
+  CheckSecurityRules(request_context_,
+                     [](Status status) { ASSERT_TRUE(status.ok()); });
+
+  std::string apis_v2 = kApis;
+  apis_v2.replace(apis_v2.find("\"v1\""), 4, "\"v2\"");
+  std::unique_ptr<Config> config_v2 = Config::Create(
+      raw_env_, std::string(kServiceName) + kProducerProjectId + apis_v2 +
+                    kAuthentication + kHttp,
+      kServerConfig);
+  ASSERT_TRUE(config_v2 != nullptr);
+  ASSERT_TRUE(service_context_->UpdateConfig(std::move(config_v2), nullptr)
+                  .ok());
+
+  std::unique_ptr<MockRequest> request(
+      new ::testing::NiceMock<MockRequest>());
+  ON_CALL(*request, GetRequestHTTPMethod())
+      .WillByDefault(Return(std::string("GET")));
+  ON_CALL(*request, GetUnparsedRequestPath())
+      .WillByDefault(Return(std::string("/ListShelves")));
+  auto request_context_v2 = std::make_shared<context::RequestContext>(
+      service_context_, std::move(request));
+  request_context_v2->set_auth_claims(kJwtEmailPayload);
+
+  ExpectCall(
+      "https://myfirebaseserver.com/v1/projects/myfirebaseapp/"
+      "releases/myfirebaseapp.appspot.com:v2",
+      "GET", "", kRelease);
+  ExpectCall(ruleset_test_url_, "POST", kFirstRequest,
+             BuildTestRulesetResponse(true));
+  CheckSecurityRules(request_context_v2,
+                     [](Status status) { ASSERT_TRUE(status.ok()); });
+}
+
+// Check that the ruleset id and the decision are cached.
+// 1. The first request fetches the release and invokes TestRuleset.
+// 2. The same request again is decided from the cache, without any HTTP call.
+TEST_F(CheckSecurityRulesTest, CheckAuthzCached) {
+  std::string service_config = std::string(kServiceName) + kProducerProjectId +
+                               kApis + kAuthentication + kHttp;
+  SetUp(service_config, kServerConfigWithDecisionCache);
+
+  request_context_->set_auth_claims(kJwtEmailPayload);
+  ExpectCall(release_url_, "GET", "", kRelease);
+  ExpectCall(ruleset_test_url_, "POST", kFirstRequest,
+             BuildTestRulesetResponse(false));
+
+  CheckSecurityRules(request_context_, [](Status status) {
+    ASSERT_TRUE(status.CanonicalCode() == Code::PERMISSION_DENIED);
+  });
+  CheckSecurityRules(request_context_, [](Status status) {
+    ASSERT_TRUE(status.CanonicalCode() == Code::PERMISSION_DENIED);
+  });
+}
+
 class CheckSecurityRulesFunctions : public CheckSecurityRulesTest,
                                     public ::testing::WithParamInterface<bool> {
  public:
@@ -15,54 +15,226 @@
 ////////////////////////////////////////////////////////////////////////////////
 
 #include "contrib/endpoints/src/api_manager/check_workflow.h"
+
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+
 #include "contrib/endpoints/src/api_manager/check_auth.h"
 #include "contrib/endpoints/src/api_manager/check_security_rules.h"
 #include "contrib/endpoints/src/api_manager/check_service_control.h"
 #include "contrib/endpoints/src/api_manager/fetch_metadata.h"
 #include "contrib/endpoints/src/api_manager/quota_control.h"
+#include "google/protobuf/stubs/logging.h"
 
 using ::google::api_manager::utils::Status;
+using std::chrono::steady_clock;
 
 namespace google {
 namespace api_manager {
 
-void CheckWorkflow::RegisterAll() {
-  // Fetchs GCE metadata.
-  Register(FetchGceMetadata);
-  // Fetchs service account token.
-  Register(FetchServiceAccountToken);
-  // Authentication checks.
-  Register(CheckAuth);
-  // Check Security Rules.
-  Register(CheckSecurityRules);
-  // Checks service control.
-  Register(CheckServiceControl);
-  // Quota control
-  Register(QuotaControl);
+namespace {
+
+const char kFetchGceMetadata[] = "FetchGceMetadata";
+const char kFetchServiceAccountToken[] = "FetchServiceAccountToken";
+const char kCheckAuth[] = "CheckAuth";
+const char kCheckSecurityRules[] = "CheckSecurityRules";
+const char kCheckServiceControl[] = "CheckServiceControl";
+const char kQuotaControl[] = "QuotaControl";
+
+}  // namespace
+
+// Tracks the stages of one request. Handlers may call their continuation
+// synchronously, so the mutex is never held while calling a handler or
+// completing the check.
+class CheckWorkflow::Execution
+    : public std::enable_shared_from_this<CheckWorkflow::Execution> {
+ public:
+  Execution(const std::vector<Stage> &stages,
+            std::shared_ptr<context::RequestContext> context)
+      : stages_(stages),
+        context_(context),
+        states_(stages.size()),
+        running_(0),
+        first_failure_(stages.size()),
+        completed_(false) {}
+
+  // Starts the ready stages, or completes the check if there are none and
+  // nothing is running.
+  void Advance();
+
+ private:
+  enum State { PENDING, RUNNING, DONE, SKIPPED };
+
+  struct StageState {
+    StageState() : state(PENDING), status(Status::OK) {}
+
+    State state;
+    Status status;
+    steady_clock::time_point start_time;
+    std::chrono::microseconds latency;
+  };
+
+  // Whether all the dependencies of the stage succeeded.
+  bool IsReady(size_t index) const;
+
+  // Called when the stage finishes.
+  void OnDone(size_t index, Status status);
+
+  // Sets the latency breakdown to the request context and completes the
+  // check.
+  void Complete();
+
+  const std::vector<Stage> &stages_;
+  std::shared_ptr<context::RequestContext> context_;
+
+  std::mutex mutex_;
+  std::vector<StageState> states_;
+  // The number of stages started and not done yet.
+  int running_;
+  // The index of the first registered stage which failed. Only the stages
+  // registered before it are still started, as they would have run if the
+  // stages ran one by one.
+  size_t first_failure_;
+  bool completed_;
+};
+
+bool CheckWorkflow::Execution::IsReady(size_t index) const {
+  for (size_t dependency : stages_[index].dependencies) {
+    if (states_[dependency].state != DONE ||
+        !states_[dependency].status.ok()) {
+      return false;
+    }
+  }
+  return true;
 }
 
-void CheckWorkflow::Register(CheckHandler handler) {
-  handlers_.push_back(handler);
+void CheckWorkflow::Execution::Advance() {
+  std::vector<size_t> ready;
+  bool complete = false;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (completed_) {
+      return;
+    }
+    for (size_t i = 0; i < first_failure_; ++i) {
+      if (states_[i].state == PENDING && IsReady(i)) {
+        states_[i].state = RUNNING;
+        ++running_;
+        ready.push_back(i);
+      }
+    }
+    if (ready.empty() && running_ == 0) {
+      completed_ = complete = true;
+    }
+  }
+  if (ready.empty()) {
+    // Either all stages are done now, or a running stage will call
+    // Advance() again when it finishes.
+    if (complete) {
+      Complete();
+    }
+    return;
+  }
+
+  auto self = shared_from_this();
+  bool skipped = false;
+  for (size_t index : ready) {
+    {
+      // A stage started before may have failed synchronously.
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (index > first_failure_) {
+        states_[index].state = SKIPPED;
+        --running_;
+        skipped = true;
+        continue;
+      }
+      states_[index].start_time = steady_clock::now();
+    }
+    stages_[index].handler(context_, [self, index](Status status) {
+      self->OnDone(index, status);
+    });
+  }
+  if (skipped) {
+    Advance();
+  }
 }
 
-void CheckWorkflow::Run(std::shared_ptr<context::RequestContext> context) {
-  if (!handlers_.empty()) {
-    RunOneHandler(context, 0);
-  } else {
-    // Empty check handler list means: not need to check.
-    context->CompleteCheck(Status::OK);
+void CheckWorkflow::Execution::OnDone(size_t index, Status status) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    StageState &state = states_[index];
+    state.state = DONE;
+    state.status = status;
+    state.latency = std::chrono::duration_cast<std::chrono::microseconds>(
+        steady_clock::now() - state.start_time);
+    --running_;
+    if (!status.ok() && index < first_failure_) {
+      first_failure_ = index;
+    }
   }
+  Advance();
 }
 
-void CheckWorkflow::RunOneHandler(
-    std::shared_ptr<context::RequestContext> context, size_t index) {
-  handlers_[index](context, [context, index, this](Status status) {
-    if (status.ok() && index + 1 < handlers_.size()) {
-      RunOneHandler(context, index + 1);
-    } else {
-      context->CompleteCheck(status);
+void CheckWorkflow::Execution::Complete() {
+  // Nothing is running any more, the states are not changed concurrently.
+  Status status = Status::OK;
+  context::RequestContext::StageLatencies latencies;
+  for (size_t i = 0; i < stages_.size(); ++i) {
+    const StageState &state = states_[i];
+    if (state.state != DONE) {
+      continue;
     }
-  });
+    latencies.emplace_back(stages_[i].name, state.latency);
+    if (status.ok() && !state.status.ok()) {
+      status = state.status;
+    }
+  }
+
+  context_->set_check_latencies(std::move(latencies));
+  context_->CompleteCheck(status);
+}
+
+void CheckWorkflow::RegisterAll() {
+  // Fetchs GCE metadata.
+  Register(kFetchGceMetadata, FetchGceMetadata, {});
+  // Fetchs service account token.
+  Register(kFetchServiceAccountToken, FetchServiceAccountToken,
+           {kFetchGceMetadata});
+  // Authentication checks. The keys of the issuers are fetched
+  // concurrently with the service control Check, so the Check is also
+  // called for requests which fail authentication.
+  Register(kCheckAuth, CheckAuth, {});
+  // Check Security Rules. They need the claims of the auth token.
+  Register(kCheckSecurityRules, CheckSecurityRules,
+           {kCheckAuth, kFetchServiceAccountToken});
+  // Checks service control. It needs the project id from the metadata.
+  Register(kCheckServiceControl, CheckServiceControl,
+           {kFetchServiceAccountToken});
+  // Quota control. It needs the api key validated by the Check, and is
+  // only charged for requests which passed the auth and rules checks.
+  Register(kQuotaControl, QuotaControl,
+           {kCheckAuth, kCheckSecurityRules, kCheckServiceControl});
+}
+
+void CheckWorkflow::Register(const std::string &name, CheckHandler handler,
+                             const std::vector<std::string> &dependencies) {
+  Stage stage;
+  stage.name = name;
+  stage.handler = handler;
+  for (const auto &dependency : dependencies) {
+    auto it = std::find_if(
+        stages_.begin(), stages_.end(),
+        [&dependency](const Stage &s) { return s.name == dependency; });
+    GOOGLE_CHECK(it != stages_.end());
+    stage.dependencies.push_back(it - stages_.begin());
+  }
+  stages_.push_back(stage);
+}
+
+void CheckWorkflow::Run(std::shared_ptr<context::RequestContext> context) {
+  // With no check handlers, the check is completed with OK right away.
+  std::make_shared<Execution>(stages_, context)->Advance();
 }
 
 }  // namespace api_manager
@@ -15,6 +15,9 @@
 #ifndef API_MANAGER_CHECK_WORKFLOW_H_
 #define API_MANAGER_CHECK_WORKFLOW_H_
 
+#include <string>
+#include <vector>
+
 #include "contrib/endpoints/include/api_manager/utils/status.h"
 #include "contrib/endpoints/src/api_manager/context/request_context.h"
 
@@ -26,7 +29,11 @@ typedef std::function<void(std::shared_ptr<context::RequestContext>,
                            std::function<void(utils::Status)>)>
     CheckHandler;
 
-// A workflow to run all CheckHandlers
+// A workflow to run all CheckHandlers. Each handler is a stage which
+// declares the stages it depends on. A stage is started once all its
+// dependencies succeeded, so independent stages run concurrently. After a
+// stage fails only the stages registered before it are started, and the
+// check is completed once the running ones finish.
 class CheckWorkflow {
  public:
   virtual ~CheckWorkflow() {}
@@ -34,20 +41,30 @@ class CheckWorkflow {
   // Registers all known check handlers.
   void RegisterAll();
 
-  // Runs the workflow to call each check handler sequentially.
+  // Registers a check handler which depends on the named stages. They
+  // must have been registered before.
+  void Register(const std::string &name, CheckHandler handler,
+                const std::vector<std::string> &dependencies);
+
+  // Runs the workflow for the request. The check is completed with the
+  // status of the first registered stage that failed, or OK.
   void Run(std::shared_ptr<context::RequestContext> context);
 
  private:
-  // Registers a check handler. The order is important.
-  // They will be executed in the order they are registered.
-  void Register(CheckHandler handler);
+  // A registered check handler.
+  struct Stage {
+    // The name used in the latency breakdown.
+    std::string name;
+    CheckHandler handler;
+    // The indexes of the stages it depends on.
+    std::vector<size_t> dependencies;
+  };
 
-  // Runs one check handler with index.
-  void RunOneHandler(std::shared_ptr<context::RequestContext> context,
-                     size_t index);
+  // The state of the workflow run for one request.
+  class Execution;
 
-  // A vector to store all check handlers.
-  std::vector<CheckHandler> handlers_;
+  // All stages, in the order they are registered.
+  std::vector<Stage> stages_;
 };
 
 }  // namespace api_manager
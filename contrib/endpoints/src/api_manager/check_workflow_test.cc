@@ -0,0 +1,200 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+#include "contrib/endpoints/src/api_manager/check_workflow.h"
+
+#include <map>
+
+#include "contrib/endpoints/src/api_manager/context/service_context.h"
+#include "contrib/endpoints/src/api_manager/mock_api_manager_environment.h"
+#include "contrib/endpoints/src/api_manager/mock_request.h"
+
+using ::google::api_manager::utils::Status;
+using ::google::protobuf::util::error::Code;
+
+namespace google {
+namespace api_manager {
+
+namespace {
+
+const char kServiceConfig[] = R"(
+{
+  "name": "endpoints-test.cloudendpointsapis.com"
+})";
+
+class CheckWorkflowTest : public ::testing::Test {
+ public:
+  void SetUp() {
+    std::unique_ptr<MockApiManagerEnvironment> env(
+        new ::testing::NiceMock<MockApiManagerEnvironment>());
+    std::unique_ptr<Config> config =
+        Config::Create(env.get(), kServiceConfig, "");
+    ASSERT_NE(config.get(), nullptr);
+
+    service_context_ = std::make_shared<context::ServiceContext>(
+        std::move(env), std::move(config));
+
+    std::unique_ptr<MockRequest> request(
+        new ::testing::NiceMock<MockRequest>());
+    context_ = std::make_shared<context::RequestContext>(service_context_,
+                                                         std::move(request));
+    context_->set_check_continuation([this](Status status) {
+      ++completed_;
+      status_ = status;
+    });
+  }
+
+  // Registers a stage which keeps its continuation until Finish() is
+  // called for it.
+  void RegisterDeferred(const std::string &name,
+                        const std::vector<std::string> &dependencies) {
+    workflow_.Register(
+        name,
+        [this, name](std::shared_ptr<context::RequestContext>,
+                     std::function<void(Status)> continuation) {
+          started_.push_back(name);
+          continuations_[name] = continuation;
+        },
+        dependencies);
+  }
+
+  // Registers a stage which finishes with status right away.
+  void RegisterSync(const std::string &name, Status status,
+                    const std::vector<std::string> &dependencies) {
+    workflow_.Register(
+        name,
+        [this, name, status](std::shared_ptr<context::RequestContext>,
+                             std::function<void(Status)> continuation) {
+          started_.push_back(name);
+          continuation(status);
+        },
+        dependencies);
+  }
+
+  void Finish(const std::string &name, Status status) {
+    auto continuation = continuations_[name];
+    continuations_.erase(name);
+    continuation(status);
+  }
+
+  std::vector<std::string> LatencyNames() const {
+    std::vector<std::string> names;
+    for (const auto &latency : context_->check_latencies()) {
+      names.push_back(latency.first);
+    }
+    return names;
+  }
+
+  std::shared_ptr<context::ServiceContext> service_context_;
+  std::shared_ptr<context::RequestContext> context_;
+  CheckWorkflow workflow_;
+
+  std::vector<std::string> started_;
+  std::map<std::string, std::function<void(Status)>> continuations_;
+  int completed_ = 0;
+  Status status_ = Status::OK;
+};
+
+TEST_F(CheckWorkflowTest, IndependentStagesOverlap) {
+  RegisterDeferred("first", {});
+  RegisterDeferred("second", {});
+  RegisterDeferred("third", {"first", "second"});
+
+  workflow_.Run(context_);
+  // Both independent stages are running.
+  ASSERT_EQ(std::vector<std::string>({"first", "second"}), started_);
+
+  Finish("second", Status::OK);
+  ASSERT_EQ(2u, started_.size());
+  Finish("first", Status::OK);
+  ASSERT_EQ(std::vector<std::string>({"first", "second", "third"}), started_);
+  ASSERT_EQ(0, completed_);
+
+  Finish("third", Status::OK);
+  ASSERT_EQ(1, completed_);
+  ASSERT_TRUE(status_.ok());
+}
+
+TEST_F(CheckWorkflowTest, FirstRegisteredFailureWins) {
+  RegisterDeferred("first", {});
+  RegisterDeferred("second", {});
+
+  workflow_.Run(context_);
+  Finish("second", Status(Code::UNAVAILABLE, "second failed"));
+  // The check waits for the stages still running.
+  ASSERT_EQ(0, completed_);
+
+  Finish("first", Status(Code::PERMISSION_DENIED, "first failed"));
+  ASSERT_EQ(1, completed_);
+  ASSERT_EQ(Code::PERMISSION_DENIED, status_.code());
+}
+
+TEST_F(CheckWorkflowTest, StagesAfterFailureAreSkipped) {
+  RegisterDeferred("first", {});
+  RegisterSync("second", Status(Code::UNAUTHENTICATED, "second failed"), {});
+  RegisterDeferred("third", {"first"});
+  RegisterDeferred("fourth", {"second"});
+
+  workflow_.Run(context_);
+  ASSERT_EQ(std::vector<std::string>({"first", "second"}), started_);
+
+  // The third stage is registered after the failed one, so it is not
+  // started even though its dependency succeeded.
+  Finish("first", Status::OK);
+  ASSERT_EQ(std::vector<std::string>({"first", "second"}), started_);
+  ASSERT_EQ(1, completed_);
+  ASSERT_EQ(Code::UNAUTHENTICATED, status_.code());
+  ASSERT_EQ(std::vector<std::string>({"first", "second"}), LatencyNames());
+}
+
+TEST_F(CheckWorkflowTest, SynchronousContinuations) {
+  RegisterSync("first", Status::OK, {});
+  RegisterSync("second", Status::OK, {"first"});
+  RegisterSync("third", Status::OK, {"first"});
+  RegisterSync("fourth", Status::OK, {"second", "third"});
+
+  // The check is completed once, before Run() returns.
+  workflow_.Run(context_);
+  ASSERT_EQ(std::vector<std::string>({"first", "second", "third", "fourth"}),
+            started_);
+  ASSERT_EQ(1, completed_);
+  ASSERT_TRUE(status_.ok());
+}
+
+TEST_F(CheckWorkflowTest, RecordsStageLatencies) {
+  RegisterSync("first", Status::OK, {});
+  RegisterDeferred("second", {"first"});
+
+  workflow_.Run(context_);
+  Finish("second", Status::OK);
+  ASSERT_EQ(1, completed_);
+  ASSERT_EQ(std::vector<std::string>({"first", "second"}), LatencyNames());
+  for (const auto &latency : context_->check_latencies()) {
+    ASSERT_GE(latency.second.count(), 0);
+  }
+}
+
+TEST_F(CheckWorkflowTest, NoStages) {
+  workflow_.Run(context_);
+  ASSERT_EQ(1, completed_);
+  ASSERT_TRUE(status_.ok());
+  ASSERT_TRUE(context_->check_latencies().empty());
+}
+
+}  // namespace
+
+}  // namespace api_manager
+}  // namespace google
@@ -19,10 +19,12 @@
 #include "contrib/endpoints/src/api_manager/utils/stl_util.h"
 #include "contrib/endpoints/src/api_manager/utils/url_util.h"
 
+#include <chrono>
 #include <iostream>
 #include <map>
 #include <sstream>
 #include <string>
+#include <thread>
 
 #include "google/protobuf/io/tokenizer.h"
 #include "google/protobuf/io/zero_copy_stream_impl_lite.h"
@@ -49,6 +51,12 @@ const string https_prefix = "https://";
 const string http_prefix = "http://";
 const string openid_config_path = ".well-known/openid-configuration";
 
+// Returns the number of threads used to parse http templates.
+size_t TemplateParseThreads() {
+  unsigned threads = std::thread::hardware_concurrency();
+  return threads > 0 ? threads : 1;
+}
+
 class NoOpErrorCollector : public ::google::protobuf::io::ErrorCollector {
   void AddError(int line, int column, const string &message) {}
 };
@@ -133,6 +141,8 @@ bool Config::LoadQuotaRule(ApiManagerEnvInterface *env) {
 bool Config::LoadHttpMethods(ApiManagerEnvInterface *env,
                              PathMatcherBuilder<MethodInfo *> *pmb) {
   std::set<std::string> all_urls, urls_with_options;
+  // The url and http method of each binding added to pmb.
+  std::vector<std::pair<const string *, const char *>> bindings;
   // By default, allow_cors is false. This means that the default behavior
   // of ESP is to reject all "OPTIONS" requests. If customers want to enable
   // CORS, they need to set "allow_cors" to true in swagger config.
@@ -186,22 +196,34 @@ bool Config::LoadHttpMethods(ApiManagerEnvInterface *env,
 
     MethodInfoImpl *mi = GetOrCreateMethodInfoImpl(selector, "", "");
 
-    if (!pmb->Register(http_method, *url, rule.body(), mi)) {
-      string error("Invalid HTTP template: ");
-      error += *url;
-      env->LogError(error.c_str());
-    } else if (allow_cors) {
-      all_urls.insert(*url);
-      if (strcmp(http_method, http_options) == 0) {
-        urls_with_options.insert(*url);
-      }
-    }
+    pmb->Add(http_method, *url, rule.body(), mi);
+    bindings.emplace_back(url, http_method);
+  }
+
+  std::vector<size_t> invalid = pmb->RegisterPending(TemplateParseThreads());
+  for (size_t i : invalid) {
+    string error("Invalid HTTP template: ");
+    error += *bindings[i].first;
+    env->LogError(error.c_str());
   }
 
   if (!allow_cors) {
     return true;
   }
 
+  auto next_invalid = invalid.begin();
+  for (size_t i = 0; i < bindings.size(); ++i) {
+    if (next_invalid != invalid.end() && *next_invalid == i) {
+      ++next_invalid;
+      continue;
+    }
+    const string &url = *bindings[i].first;
+    all_urls.insert(url);
+    if (strcmp(bindings[i].second, http_options) == 0) {
+      urls_with_options.insert(url);
+    }
+  }
+
   // Remove urls with options.
   for (auto url : urls_with_options) {
     all_urls.erase(url);
@@ -231,11 +253,14 @@ bool Config::AddOptionsMethodForAllUrls(ApiManagerEnvInterface *env,
   mi->set_auth(false);
   mi->set_allow_unregistered_calls(true);
 
-  for (auto url : all_urls) {
-    if (!pmb->Register(http_options, url, std::string(), mi)) {
-      env->LogError(
-          std::string("Failed to add http options template for url: " + url));
-    }
+  std::vector<const std::string *> urls;
+  for (const auto &url : all_urls) {
+    pmb->Add(http_options, url, std::string(), mi);
+    urls.push_back(&url);
+  }
+  for (size_t i : pmb->RegisterPending(TemplateParseThreads())) {
+    env->LogError(std::string("Failed to add http options template for url: " +
+                              *urls[i]));
   }
 
   return true;
@@ -243,6 +268,7 @@ bool Config::AddOptionsMethodForAllUrls(ApiManagerEnvInterface *env,
 
 bool Config::LoadRpcMethods(ApiManagerEnvInterface *env,
                             PathMatcherBuilder<MethodInfo *> *pmb) {
+  std::vector<MethodInfoImpl *> methods;
   for (const auto &api : service_.apis()) {
     if (api.name().empty()) {
       continue;
@@ -261,17 +287,43 @@ bool Config::LoadRpcMethods(ApiManagerEnvInterface *env,
       mi->set_response_type_url(method.response_type_url());
       mi->set_response_streaming(method.response_streaming());
 
-      if (!pmb->Register(http_post, mi->rpc_method_full_name(), std::string(),
-                         mi)) {
-        string error("Invalid method: ");
-        error += mi->selector();
-        env->LogError(error.c_str());
-      }
+      pmb->Add(http_post, mi->rpc_method_full_name(), std::string(), mi);
+      methods.push_back(mi);
     }
   }
+  std::vector<size_t> invalid = pmb->RegisterPending(TemplateParseThreads());
+  for (size_t i : invalid) {
+    string error("Invalid method: ");
+    error += methods[i]->selector();
+    env->LogError(error.c_str());
+  }
+
+  // Index the valid methods by full name for the gRPC fast path. invalid is
+  // sorted. Duplicates are removed by PruneRpcMethods().
+  rpc_method_map_.reserve(methods.size());
+  auto next_invalid = invalid.begin();
+  for (size_t i = 0; i < methods.size(); ++i) {
+    if (next_invalid != invalid.end() && *next_invalid == i) {
+      ++next_invalid;
+      continue;
+    }
+    rpc_method_map_.emplace(methods[i]->rpc_method_full_name(), methods[i]);
+  }
   return true;
 }
 
+void Config::PruneRpcMethods() {
+  // The fast path must find the same method as the path matcher, which
+  // resolves duplicate registrations of a path to no method.
+  for (auto it = rpc_method_map_.begin(); it != rpc_method_map_.end();) {
+    if (path_matcher_->Lookup(http_post, it->first) != it->second) {
+      it = rpc_method_map_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
 bool Config::LoadAuthentication(ApiManagerEnvInterface *env) {
   // Parsing auth config.
   const ::google::api::Authentication &auth = service_.authentication();
@@ -434,6 +486,7 @@ void Config::LoadServerConfig(ApiManagerEnvInterface *env,
 std::unique_ptr<Config> Config::Create(ApiManagerEnvInterface *env,
                                        const std::string &service_config,
                                        const std::string &server_config) {
+  auto start_time = std::chrono::steady_clock::now();
   std::unique_ptr<Config> config(new Config);
   if (!config->LoadService(env, service_config)) {
     return nullptr;
@@ -448,6 +501,7 @@ std::unique_ptr<Config> Config::Create(ApiManagerEnvInterface *env,
     return nullptr;
   }
   config->path_matcher_ = pmb.Build();
+  config->PruneRpcMethods();
   if (!config->LoadAuthentication(env)) {
     return nullptr;
   }
@@ -463,6 +517,15 @@ std::unique_ptr<Config> Config::Create(ApiManagerEnvInterface *env,
   if (!config->LoadQuotaRule(env)) {
     return nullptr;
   }
+
+  std::ostringstream message;
+  message << "Loaded service config for " << config->service_name() << " with "
+          << config->method_map_.size() << " methods in "
+          << std::chrono::duration_cast<std::chrono::milliseconds>(
+                 std::chrono::steady_clock::now() - start_time)
+                 .count()
+          << " ms.";
+  env->LogInfo(message.str());
   return config;
 }
 
@@ -486,6 +549,21 @@ MethodCallInfo Config::GetMethodCallInfo(
   return call_info;
 }
 
+MethodCallInfo Config::GetMethodCallInfo(
+    protocol::Protocol protocol, const std::string &http_method,
+    const std::string &url, const std::string &query_params) const {
+  if (protocol == protocol::GRPC && http_method == http_post) {
+    auto it = rpc_method_map_.find(url);
+    if (it != rpc_method_map_.end()) {
+      // RPC methods have neither variable bindings nor a body field path.
+      MethodCallInfo call_info;
+      call_info.method_info = it->second;
+      return call_info;
+    }
+  }
+  return GetMethodCallInfo(http_method, url, query_params);
+}
+
 bool Config::GetJwksUri(const string &issuer, string *url) const {
   std::string iss = utils::GetUrlContent(issuer);
   auto it = issuer_jwks_uri_map_.find(iss);
@@ -532,7 +610,7 @@ void Config::SetJwksUri(const string &issuer, const string &jwks_uri,
   }
 }
 
-std::string Config::GetFirebaseServer() {
+std::string Config::GetFirebaseServer() const {
   // Server config overwrites service config.
   if (server_config_ != nullptr &&
       server_config_->has_api_check_security_rules_config() &&
@@ -19,9 +19,11 @@
 #include <memory>
 #include <set>
 #include <string>
+#include <unordered_map>
 
 #include "contrib/endpoints/include/api_manager/env_interface.h"
 #include "contrib/endpoints/include/api_manager/method_call_info.h"
+#include "contrib/endpoints/include/api_manager/protocol.h"
 #include "contrib/endpoints/src/api_manager/method_impl.h"
 #include "contrib/endpoints/src/api_manager/path_matcher.h"
 #include "contrib/endpoints/src/api_manager/proto/server_config.pb.h"
@@ -60,6 +62,15 @@ class Config {
                                    const std::string &url,
                                    const std::string &query_params) const;
 
+  // Same as above for a request received over the given protocol. gRPC
+  // requests are first looked up by exact RPC method full name
+  // ("/package.Service/Method"); the PathMatcher is only consulted if that
+  // fails.
+  MethodCallInfo GetMethodCallInfo(protocol::Protocol protocol,
+                                   const std::string &http_method,
+                                   const std::string &url,
+                                   const std::string &query_params) const;
+
   const ::google::api::Service &service() const { return service_; }
 
   // TODO: Remove in favor of service().
@@ -72,20 +83,23 @@ class Config {
   // if openId discovery is not needed. This means either a valid jwksUri
   // already exists, or a previous attempt to fetch jwksUri via openId
   // discovery failed.
+  // The result only reflects the service config: jwksUri values discovered
+  // at runtime are tracked by ServiceContext, so a Config is read-only once
+  // created and can be shared between threads.
   bool GetJwksUri(const std::string &issuer, std::string *tryOpenId) const;
 
-  // Set jwskUri and openIdValid for a given issuer.
-  void SetJwksUri(const std::string &issuer, const std::string &jwks_uri,
-                  bool openid_valid);
-
   // Get the Firebase server from Server config
-  std::string GetFirebaseServer();
+  std::string GetFirebaseServer() const;
 
  private:
   GOOGLE_DISALLOW_EVIL_CONSTRUCTORS(Config);
 
   Config();
 
+  // Set jwskUri and openIdValid for a given issuer.
+  void SetJwksUri(const std::string &issuer, const std::string &jwks_uri,
+                  bool openid_valid);
+
   // Loads the service config into protobuf.
   bool LoadService(ApiManagerEnvInterface *env,
                    const std::string &service_config);
@@ -107,6 +121,11 @@ class Config {
   bool LoadRpcMethods(ApiManagerEnvInterface *env,
                       PathMatcherBuilder<MethodInfo *> *pmb);
 
+  // Removes the RPC methods which the path matcher does not resolve to the
+  // same method, e.g. duplicates, from rpc_method_map_. Called once
+  // path_matcher_ is built.
+  void PruneRpcMethods();
+
   // Load Authentication info to MethodInfo.
   bool LoadAuthentication(ApiManagerEnvInterface *env);
 
@@ -130,6 +149,8 @@ class Config {
   std::unique_ptr<proto::ServerConfig> server_config_;
   PathMatcherPtr<MethodInfo *> path_matcher_;
   std::map<std::string, MethodInfoImplPtr> method_map_;
+  // Maps RPC method full name to the RPC method, for gRPC requests.
+  std::unordered_map<std::string, MethodInfoImpl *> rpc_method_map_;
   // Maps issuer to {jwksUri, openIdValid} pair.
   // jwksUri is populated either from service config, or by openId discovery.
   // openIdValid means whether or not we need to try openId discovery to fetch
@@ -562,6 +562,93 @@ TEST(Config, RpcMethodsWithHttpRules) {
   EXPECT_EQ(create_shelves, config->GetMethodInfo("POST", "/shelves"));
 }
 
+TEST(Config, GrpcMethodCallInfo) {
+  MockApiManagerEnvironmentWithLog env;
+
+  const char config_text[] = R"(
+    name : "BookstoreApi"
+    apis {
+      name: "Bookstore"
+      methods {
+        name: "ListShelves"
+        request_type_url: "types.googleapis.com/google.protobuf.Empty"
+        response_type_url: "types.googleapis.com/Bookstore.ListShelvesResponse"
+      }
+    }
+    http {
+      rules {
+        selector: "Bookstore.ListShelves"
+        get: "/shelves"
+      }
+      rules {
+        selector: "Bookstore.GetShelf"
+        post: "/{shelf=*}/{name=*}"
+        body: "*"
+      }
+    }
+  )";
+
+  std::unique_ptr<Config> config = Config::Create(&env, config_text, "");
+  ASSERT_TRUE(config);
+
+  // gRPC requests are matched by the RPC method full name.
+  MethodCallInfo grpc = config->GetMethodCallInfo(
+      protocol::GRPC, "POST", "/Bookstore/ListShelves", "");
+  ASSERT_NE(nullptr, grpc.method_info);
+  EXPECT_EQ("Bookstore.ListShelves", grpc.method_info->selector());
+  EXPECT_EQ("", grpc.body_field_path);
+  EXPECT_EQ(0u, grpc.variable_bindings.size());
+
+  // Unknown RPC methods fall back to the http rules.
+  MethodCallInfo grpc_unknown = config->GetMethodCallInfo(
+      protocol::GRPC, "POST", "/Bookstore/DeleteShelf", "");
+  ASSERT_NE(nullptr, grpc_unknown.method_info);
+  EXPECT_EQ("Bookstore.GetShelf", grpc_unknown.method_info->selector());
+  EXPECT_EQ(2u, grpc_unknown.variable_bindings.size());
+
+  // REST requests only use the http rules.
+  MethodCallInfo rest = config->GetMethodCallInfo(
+      protocol::HTTP, "POST", "/Bookstore/ListShelves", "");
+  ASSERT_NE(nullptr, rest.method_info);
+  EXPECT_EQ("Bookstore.ListShelves", rest.method_info->selector());
+  MethodCallInfo rest_get =
+      config->GetMethodCallInfo(protocol::HTTP, "GET", "/shelves", "");
+  ASSERT_NE(nullptr, rest_get.method_info);
+  EXPECT_EQ("Bookstore.ListShelves", rest_get.method_info->selector());
+}
+
+TEST(Config, GrpcDuplicateMethod) {
+  MockApiManagerEnvironmentWithLog env;
+
+  const char config_text[] = R"(
+    name : "BookstoreApi"
+    apis {
+      name: "Bookstore"
+      methods {
+        name: "ListShelves"
+        request_type_url: "types.googleapis.com/google.protobuf.Empty"
+        response_type_url: "types.googleapis.com/Bookstore.ListShelvesResponse"
+      }
+    }
+    http {
+      rules {
+        selector: "Bookstore.CreateShelf"
+        post: "/Bookstore/ListShelves"
+      }
+    }
+  )";
+
+  std::unique_ptr<Config> config = Config::Create(&env, config_text, "");
+  ASSERT_TRUE(config);
+
+  // The path is registered twice, so neither the path matcher nor the gRPC
+  // fast path resolves it.
+  EXPECT_EQ(nullptr, config->GetMethodInfo("POST", "/Bookstore/ListShelves"));
+  MethodCallInfo grpc = config->GetMethodCallInfo(
+      protocol::GRPC, "POST", "/Bookstore/ListShelves", "");
+  EXPECT_EQ(nullptr, grpc.method_info);
+}
+
 TEST(Config, RpcMethodsWithHttpRulesAndVariableBindings) {
   MockApiManagerEnvironmentWithLog env;
 
@@ -83,6 +83,7 @@ using context::ServiceContext;
 RequestContext::RequestContext(std::shared_ptr<ServiceContext> service_context,
                                std::unique_ptr<Request> request)
     : service_context_(service_context),
+      config_(service_context->config()),
       request_(std::move(request)),
       is_first_report_(true),
       last_request_bytes_(0),
@@ -94,7 +95,7 @@ RequestContext::RequestContext(std::shared_ptr<ServiceContext> service_context,
   const std::string &path = request_->GetUnparsedRequestPath();
   std::string query_params = request_->GetQueryParameters();
 
-  // In addition to matching the method, service_context_->GetMethodCallInfo()
+  // In addition to matching the method, ServiceContext::GetMethodCallInfo()
   // will extract the variable bindings from the url. We need variable bindings
   // only when we need to do transcoding. If this turns out to be a performance
   // problem for non-transcoded calls, we have a couple of options:
@@ -104,8 +105,8 @@ RequestContext::RequestContext(std::shared_ptr<ServiceContext> service_context,
   //    http template variables, url path parts) in MethodCallInfo and extract
   //    variables lazily when needed.
 
-  method_call_ =
-      service_context_->GetMethodCallInfo(method, path, query_params);
+  method_call_ = ServiceContext::GetMethodCallInfo(
+      *config_, request_->GetRequestProtocol(), method, path, query_params);
 
   if (method_call_.method_info) {
     ExtractApiKey();
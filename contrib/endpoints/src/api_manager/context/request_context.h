@@ -18,6 +18,9 @@
 #include <time.h>
 #include <chrono>
 #include <memory>
+#include <string>
+#include <utility>
+#include <vector>
 
 #include "contrib/endpoints/include/api_manager/method.h"
 #include "contrib/endpoints/include/api_manager/request.h"
@@ -33,6 +36,11 @@ namespace context {
 // Stores request related data to be used by CheckHandler.
 class RequestContext {
  public:
+  // The latency of each check stage which ran, in the order the stages are
+  // registered.
+  typedef std::vector<std::pair<std::string, std::chrono::microseconds>>
+      StageLatencies;
+
   RequestContext(std::shared_ptr<context::ServiceContext> service_context,
                  std::unique_ptr<Request> request);
 
@@ -41,6 +49,17 @@ class RequestContext {
     return service_context_.get();
   }
 
+  // Get a shared pointer to the service context, for work which may
+  // outlive the request.
+  std::shared_ptr<context::ServiceContext> shared_service_context() const {
+    return service_context_;
+  }
+
+  // Get the service config snapshot the request was matched against. It
+  // stays the same for the lifetime of the request even if the service
+  // config is updated in the meantime.
+  const Config *config() const { return config_.get(); }
+
   // Get the request object.
   Request *request() const { return request_.get(); }
 
@@ -129,6 +148,14 @@ class RequestContext {
   // Get the auth claims.
   const std::string &auth_claims() const { return auth_claims_; }
 
+  // Set the latency breakdown of the check stages.
+  void set_check_latencies(StageLatencies latencies) {
+    check_latencies_ = std::move(latencies);
+  }
+
+  // Get the latency breakdown of the check stages.
+  const StageLatencies &check_latencies() const { return check_latencies_; }
+
  private:
   // Fill OperationInfo
   void FillOperationInfo(service_control::OperationInfo *info);
@@ -148,6 +175,9 @@ class RequestContext {
   // The ApiManagerImpl object.
   std::shared_ptr<context::ServiceContext> service_context_;
 
+  // The service config snapshot. It owns the MethodInfo in method_call_.
+  std::shared_ptr<const Config> config_;
+
   // request object to encapsulate request data.
   std::unique_ptr<Request> request_;
 
@@ -183,6 +213,9 @@ class RequestContext {
   // Auth Claims: This is the decoded payload of the JWT token
   std::string auth_claims_;
 
+  // The latency breakdown of the check stages.
+  StageLatencies check_latencies_;
+
   // Used by cloud tracing.
   std::unique_ptr<cloud_trace::CloudTrace> cloud_trace_;
 
@@ -16,7 +16,14 @@
 //
 #include "contrib/endpoints/src/api_manager/context/service_context.h"
 
+#include <algorithm>
+
+#include "contrib/endpoints/src/api_manager/http_connection_pool.h"
 #include "contrib/endpoints/src/api_manager/service_control/aggregated.h"
+#include "contrib/endpoints/src/api_manager/utils/url_util.h"
+
+using ::google::api_manager::utils::Status;
+using ::google::protobuf::util::error::Code;
 
 namespace google {
 namespace api_manager {
@@ -41,77 +48,206 @@ const double kDefaultTraceSampleQps = 0.1;
 // Default to 10s.
 const int kIntermediateReportInterval = 10;
 
+// Default time the Firebase ruleset id is cached, in seconds.
+const int kRulesetCacheExpirationSec = 60;
+
+// Default maximum number of cached Firebase Rules decisions.
+const int kDecisionCacheEntries = 10000;
+
 const char kHTTPHeadMethod[] = "HEAD";
 const char kHTTPGetMethod[] = "GET";
 const char kFirebaseAudience[] =
     "https://staging-firebaserules.sandbox.googleapis.com/"
     "google.firebase.rules.v1.FirebaseRulesService";
+
+// Tags the HTTP requests of the service with persistent connection hints
+// if the server config has a http client config. Otherwise env is returned
+// as is.
+std::unique_ptr<ApiManagerEnvInterface> CreateHttpConnectionPool(
+    std::unique_ptr<ApiManagerEnvInterface> env, const Config &config) {
+  const auto *server_config = config.server_config();
+  if (server_config == nullptr || !server_config->has_http_client_config()) {
+    return env;
+  }
+  return std::unique_ptr<ApiManagerEnvInterface>(new HttpConnectionPool(
+      std::move(env), HttpConnectionPool::GetOptions(server_config)));
+}
 }
 
 ServiceContext::ServiceContext(std::unique_ptr<ApiManagerEnvInterface> env,
                                std::unique_ptr<Config> config)
-    : env_(std::move(env)),
-      config_(std::move(config)),
+    : env_(CreateHttpConnectionPool(std::move(env), *config)),
+      base_config_(std::move(config)),
+      config_(base_config_),
+      config_version_(1),
+      jwt_cache_(CreateJwtCache()),
+      rules_cache_(CreateRulesCache()),
       service_account_token_(env_.get()),
       service_control_(CreateInterface()),
       cloud_trace_aggregator_(CreateCloudTraceAggregator()),
       is_auth_force_disabled_(
-          config_->server_config() &&
-          config_->server_config()->has_api_authentication_config() &&
-          config_->server_config()
+          base_config_->server_config() &&
+          base_config_->server_config()->has_api_authentication_config() &&
+          base_config_->server_config()
               ->api_authentication_config()
               .force_disable()) {
   intermediate_report_interval_ = kIntermediateReportInterval;
 
   // Check server_config override.
-  if (config_->server_config() &&
-      config_->server_config()->has_service_control_config() &&
-      config_->server_config()
+  if (base_config_->server_config() &&
+      base_config_->server_config()->has_service_control_config() &&
+      base_config_->server_config()
           ->service_control_config()
           .intermediate_report_min_interval()) {
-    intermediate_report_interval_ = config_->server_config()
-                                        ->service_control_config()
-                                        .intermediate_report_min_interval();
+    intermediate_report_interval_ = base_config_->server_config()
+                                         ->service_control_config()
+                                         .intermediate_report_min_interval();
   }
 }
 
+Status ServiceContext::UpdateConfig(std::unique_ptr<Config> config,
+                                    uint64_t* version) {
+  if (config == nullptr) {
+    return Status(Code::INVALID_ARGUMENT, "Invalid service config");
+  }
+  if (config->service_name() != service_name()) {
+    return Status(Code::INVALID_ARGUMENT,
+                  "Service name mismatch: expected " + service_name() +
+                      ", got " + config->service_name());
+  }
+
+  std::shared_ptr<const Config> snapshot(std::move(config));
+  std::shared_ptr<const Config> old;
+  uint64_t new_version;
+  {
+    std::lock_guard<std::mutex> lock(config_mutex_);
+    old = std::atomic_exchange(&config_, snapshot);
+    new_version = ++config_version_;
+  }
+  // The old snapshot, if no request holds it anymore, is destroyed here
+  // outside of the lock.
+  old.reset();
+
+  env_->LogInfo("Service config for " + service_name() + " updated to " +
+                snapshot->service().id() + ", version " +
+                std::to_string(new_version) + ".");
+  if (version) {
+    *version = new_version;
+  }
+  return Status::OK;
+}
+
 MethodCallInfo ServiceContext::GetMethodCallInfo(
+    const Config& config, protocol::Protocol protocol,
     const std::string& http_method, const std::string& url,
-    const std::string& query_params) const {
-  if (config_ == nullptr) {
-    return MethodCallInfo();
-  }
+    const std::string& query_params) {
   MethodCallInfo method_call_info =
-      config_->GetMethodCallInfo(http_method, url, query_params);
+      config.GetMethodCallInfo(protocol, http_method, url, query_params);
   // HEAD should be treated as GET unless it is specified from service_config.
   if (method_call_info.method_info == nullptr &&
       http_method == kHTTPHeadMethod) {
     method_call_info =
-        config_->GetMethodCallInfo(kHTTPGetMethod, url, query_params);
+        config.GetMethodCallInfo(kHTTPGetMethod, url, query_params);
   }
   return method_call_info;
 }
 
+bool ServiceContext::GetJwksUri(const std::string& issuer, std::string* url) {
+  if (!config()->GetJwksUri(issuer, url)) {
+    return false;
+  }
+  // The service config asks for openId discovery. Check if it has been done.
+  std::lock_guard<std::mutex> lock(config_mutex_);
+  auto it = discovered_jwks_uris_.find(utils::GetUrlContent(issuer));
+  if (it == discovered_jwks_uris_.end()) {
+    return true;
+  }
+  *url = it->second;
+  return false;
+}
+
+void ServiceContext::SetJwksUri(const std::string& issuer,
+                                const std::string& jwks_uri,
+                                bool openid_valid) {
+  std::string iss = utils::GetUrlContent(issuer);
+  if (iss.empty()) {
+    return;
+  }
+  std::lock_guard<std::mutex> lock(config_mutex_);
+  if (openid_valid) {
+    // Allows openId discovery to be tried again.
+    discovered_jwks_uris_.erase(iss);
+  } else {
+    discovered_jwks_uris_[iss] = jwks_uri;
+  }
+}
+
 const std::string& ServiceContext::project_id() const {
   if (gce_metadata_.has_valid_data() && !gce_metadata_.project_id().empty()) {
     return gce_metadata_.project_id();
   } else {
-    return config_->service().producer_project_id();
+    return base_config_->service().producer_project_id();
   }
 }
 
 std::unique_ptr<service_control::Interface> ServiceContext::CreateInterface() {
   return std::unique_ptr<service_control::Interface>(
-      service_control::Aggregated::Create(config_->service(),
-                                          config_->server_config(), env_.get(),
-                                          &service_account_token_));
+      service_control::Aggregated::Create(
+          base_config_->service(), base_config_->server_config(), env_.get(),
+          &service_account_token_));
+}
+
+std::unique_ptr<auth::JwtCache> ServiceContext::CreateJwtCache() {
+  // Zero values select the cache defaults.
+  int cache_entries = 0;
+  int expiration_sec = 0;
+  int num_shards = 0;
+  if (base_config_->server_config() &&
+      base_config_->server_config()->has_api_authentication_config() &&
+      base_config_->server_config()
+          ->api_authentication_config()
+          .has_jwt_cache_config()) {
+    const auto &cache_config = base_config_->server_config()
+                                   ->api_authentication_config()
+                                   .jwt_cache_config();
+    cache_entries = std::max(cache_config.cache_entries(), 0);
+    expiration_sec = std::max(cache_config.expiration_sec(), 0);
+    num_shards = std::max(cache_config.num_shards(), 0);
+  }
+  return std::unique_ptr<auth::JwtCache>(
+      new auth::JwtCache(cache_entries, std::chrono::seconds(expiration_sec),
+                         num_shards));
+}
+
+std::unique_ptr<firebase_rules::RulesCache>
+ServiceContext::CreateRulesCache() {
+  int ruleset_expiration_sec = kRulesetCacheExpirationSec;
+  int decision_expiration_sec = 0;
+  int decision_entries = kDecisionCacheEntries;
+  if (base_config_->server_config() &&
+      base_config_->server_config()->has_api_check_security_rules_config()) {
+    const auto &rules_config =
+        base_config_->server_config()->api_check_security_rules_config();
+    if (rules_config.ruleset_cache_expiration_sec() > 0) {
+      ruleset_expiration_sec = rules_config.ruleset_cache_expiration_sec();
+    }
+    decision_expiration_sec =
+        std::max(rules_config.decision_cache_expiration_sec(), 0);
+    if (rules_config.decision_cache_entries() > 0) {
+      decision_entries = rules_config.decision_cache_entries();
+    }
+  }
+  return std::unique_ptr<firebase_rules::RulesCache>(
+      new firebase_rules::RulesCache(
+          std::chrono::seconds(ruleset_expiration_sec),
+          std::chrono::seconds(decision_expiration_sec), decision_entries));
 }
 
 std::unique_ptr<cloud_trace::Aggregator>
 ServiceContext::CreateCloudTraceAggregator() {
   // If force_disable is set in server config, completely disable tracing.
-  if (config_->server_config() &&
-      config_->server_config()->cloud_tracing_config().force_disable()) {
+  if (base_config_->server_config() &&
+      base_config_->server_config()->cloud_tracing_config().force_disable()) {
     env()->LogInfo(
         "Cloud Trace is force disabled. There will be no trace written.");
     return std::unique_ptr<cloud_trace::Aggregator>();
@@ -121,11 +257,11 @@ ServiceContext::CreateCloudTraceAggregator() {
   int aggregate_time_millisec = kDefaultAggregateTimeMillisec;
   int cache_max_size = kDefaultTraceCacheMaxSize;
   double minimum_qps = kDefaultTraceSampleQps;
-  if (config_->server_config() &&
-      config_->server_config()->has_cloud_tracing_config()) {
+  if (base_config_->server_config() &&
+      base_config_->server_config()->has_cloud_tracing_config()) {
     // If url_override is set in server config, use it to query Cloud Trace.
     const auto& tracing_config =
-        config_->server_config()->cloud_tracing_config();
+        base_config_->server_config()->cloud_tracing_config();
     if (!tracing_config.url_override().empty()) {
       url = tracing_config.url_override();
     }
@@ -16,14 +16,21 @@
 #define API_MANAGER_CONTEXT_SERVICE_CONTEXT_H_
 
 #include "contrib/endpoints/include/api_manager/method.h"
+#include "contrib/endpoints/include/api_manager/utils/status.h"
 #include "contrib/endpoints/src/api_manager/auth/certs.h"
+#include "contrib/endpoints/src/api_manager/auth/inflight_key_fetches.h"
 #include "contrib/endpoints/src/api_manager/auth/jwt_cache.h"
 #include "contrib/endpoints/src/api_manager/auth/service_account_token.h"
 #include "contrib/endpoints/src/api_manager/cloud_trace/cloud_trace.h"
 #include "contrib/endpoints/src/api_manager/config.h"
+#include "contrib/endpoints/src/api_manager/firebase_rules/rules_cache.h"
 #include "contrib/endpoints/src/api_manager/gce_metadata.h"
 #include "contrib/endpoints/src/api_manager/service_control/interface.h"
 
+#include <map>
+#include <memory>
+#include <mutex>
+
 namespace google {
 namespace api_manager {
 
@@ -31,6 +38,13 @@ namespace context {
 
 // Shared context across request for every service
 // Each RequestContext will hold a refcount to this object.
+//
+// The service config is held as an immutable, versioned snapshot. A new
+// snapshot can be built off the request path with Config::Create() and
+// swapped in with UpdateConfig(); readers take a reference with config()
+// and keep using that snapshot for as long as they hold it, so a rollout
+// neither pauses traffic nor invalidates MethodInfo pointers held by
+// in-flight requests.
 class ServiceContext {
  public:
   ServiceContext(std::unique_ptr<ApiManagerEnvInterface> env,
@@ -38,9 +52,17 @@ class ServiceContext {
 
   bool Enabled() const { return RequireAuth() || service_control_; }
 
-  const std::string &service_name() const { return config_->service_name(); }
+  // The service name never changes across config updates.
+  const std::string &service_name() const {
+    return base_config_->service_name();
+  }
 
-  const ::google::api::Service &service() const { return config_->service(); }
+  // Returns the service config this context was created with. Service
+  // control and cloud trace keep using it across config updates; use
+  // config() to get the latest snapshot.
+  const ::google::api::Service &service() const {
+    return base_config_->service();
+  }
 
   void SetMetadataServer(const std::string &server) {
     metadata_server_ = server;
@@ -51,36 +73,62 @@ class ServiceContext {
   }
 
   ApiManagerEnvInterface *env() { return env_.get(); }
-  Config *config() { return config_.get(); }
 
-  MethodCallInfo GetMethodCallInfo(const std::string &http_method,
-                                   const std::string &url,
-                                   const std::string &query_params) const;
+  // Returns the current config snapshot. Called for every request, so it
+  // does not take config_mutex_.
+  std::shared_ptr<const Config> config() const {
+    return std::atomic_load(&config_);
+  }
+
+  // Returns the version of the current config snapshot. The config passed to
+  // the constructor is version 1.
+  uint64_t config_version() const {
+    std::lock_guard<std::mutex> lock(config_mutex_);
+    return config_version_;
+  }
+
+  // Atomically replaces the current config snapshot. The new config must be
+  // for the same service. On success, the version of the new snapshot is
+  // returned in version if it is not nullptr.
+  utils::Status UpdateConfig(std::unique_ptr<Config> config,
+                             uint64_t *version);
+
+  // Looks up the method in the given config snapshot. The returned
+  // MethodInfo is owned by the snapshot.
+  static MethodCallInfo GetMethodCallInfo(const Config &config,
+                                          protocol::Protocol protocol,
+                                          const std::string &http_method,
+                                          const std::string &url,
+                                          const std::string &query_params);
 
   service_control::Interface *service_control() const {
     return service_control_.get();
   }
 
   bool RequireAuth() const {
-    return !is_auth_force_disabled_ && config_->HasAuth();
+    return !is_auth_force_disabled_ && config()->HasAuth();
   }
 
   bool IsRulesCheckEnabled() const {
-    return RequireAuth() && service().apis_size() > 0 &&
-           !config_->GetFirebaseServer().empty();
+    std::shared_ptr<const Config> config = this->config();
+    return !is_auth_force_disabled_ && config->HasAuth() &&
+           config->service().apis_size() > 0 &&
+           !config->GetFirebaseServer().empty();
   }
 
   auth::Certs &certs() { return certs_; }
-  auth::JwtCache &jwt_cache() { return jwt_cache_; }
+  auth::InflightKeyFetches &key_fetches() { return key_fetches_; }
+  auth::JwtCache &jwt_cache() { return *jwt_cache_; }
+  firebase_rules::RulesCache &rules_cache() { return *rules_cache_; }
 
-  bool GetJwksUri(const std::string &issuer, std::string *url) {
-    return config_->GetJwksUri(issuer, url);
-  }
+  // Same as Config::GetJwksUri(), but also takes the jwksUri discovered with
+  // SetJwksUri() into account.
+  bool GetJwksUri(const std::string &issuer, std::string *url);
 
+  // Records the result of openId discovery for the issuer. The result is
+  // kept across config updates.
   void SetJwksUri(const std::string &issuer, const std::string &jwks_uri,
-                  bool openid_valid) {
-    config_->SetJwksUri(issuer, jwks_uri, openid_valid);
-  }
+                  bool openid_valid);
 
   const std::string &metadata_server() const { return metadata_server_; }
   GceMetadata *gce_metadata() { return &gce_metadata_; }
@@ -90,9 +138,10 @@ class ServiceContext {
   }
 
   bool DisableLogStatus() {
-    if (config_->server_config() &&
-        config_->server_config()->has_experimental()) {
-      const auto &experimental = config_->server_config()->experimental();
+    std::shared_ptr<const Config> config = this->config();
+    if (config->server_config() &&
+        config->server_config()->has_experimental()) {
+      const auto &experimental = config->server_config()->experimental();
       return experimental.disable_log_status();
     }
     return false;
@@ -107,11 +156,35 @@ class ServiceContext {
 
   std::unique_ptr<cloud_trace::Aggregator> CreateCloudTraceAggregator();
 
+  std::unique_ptr<auth::JwtCache> CreateJwtCache();
+
+  std::unique_ptr<firebase_rules::RulesCache> CreateRulesCache();
+
   std::unique_ptr<ApiManagerEnvInterface> env_;
-  std::unique_ptr<Config> config_;
+
+  // The config this context was created with. Service control and cloud
+  // trace keep pointers into it.
+  std::shared_ptr<const Config> base_config_;
+
+  // Protects config_version_ and discovered_jwks_uris_, and serializes the
+  // config updates.
+  mutable std::mutex config_mutex_;
+  // The current config snapshot. Only accessed with std::atomic_load() and
+  // std::atomic_exchange().
+  std::shared_ptr<const Config> config_;
+  // The version of config_.
+  uint64_t config_version_;
+
+  // Maps issuer to the jwksUri fetched by openId discovery. An empty jwksUri
+  // means that the discovery failed.
+  std::map<std::string, std::string> discovered_jwks_uris_;
 
   auth::Certs certs_;
-  auth::JwtCache jwt_cache_;
+  // The verification key fetches in flight, by issuer.
+  auth::InflightKeyFetches key_fetches_;
+  std::unique_ptr<auth::JwtCache> jwt_cache_;
+  // The results of the Firebase Rules service calls.
+  std::unique_ptr<firebase_rules::RulesCache> rules_cache_;
 
   // service account tokens
   auth::ServiceAccountToken service_account_token_;
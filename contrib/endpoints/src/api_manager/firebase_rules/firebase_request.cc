@@ -87,8 +87,7 @@ FirebaseRequest::FirebaseRequest(
     : env_(env),
       context_(context),
       ruleset_name_(ruleset_name),
-      firebase_server_(
-          context->service_context()->config()->GetFirebaseServer()),
+      firebase_server_(context->config()->GetFirebaseServer()),
       current_status_(Status::OK),
       is_done_(false),
       next_request_(nullptr) {
@@ -117,6 +117,10 @@ class FirebaseRequest {
   // The response for previous HttpRequest.
   void UpdateResponse(const std::string &body);
 
+  // Whether any user defined function call was made. The outcome of such a
+  // request depends on more than the ruleset and the request itself.
+  bool has_function_calls() const { return !funcs_with_result_.empty(); }
+
  private:
   utils::Status UpdateRulesetRequestBody(
       const ::google::protobuf::RepeatedPtrField<
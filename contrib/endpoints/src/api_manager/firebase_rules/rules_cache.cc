@@ -0,0 +1,169 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////
+#include "contrib/endpoints/src/api_manager/firebase_rules/rules_cache.h"
+
+#include <openssl/sha.h>
+#include <stdint.h>
+
+using ::google::api_manager::utils::Status;
+using ::google::protobuf::util::error::Code;
+using std::chrono::system_clock;
+
+namespace google {
+namespace api_manager {
+namespace firebase_rules {
+
+namespace {
+
+// The prefixes of the keys, which keep the ruleset id keys apart from the
+// decision keys.
+const char kRulesetIdPrefix[] = "r";
+const char kDecisionPrefix[] = "d";
+
+// Adds the length prefixed value to the digest, so that the concatenation
+// of the values is unambiguous.
+void AddToDigest(SHA256_CTX *ctx, const std::string &value) {
+  uint64_t size = value.size();
+  SHA256_Update(ctx, &size, sizeof(size));
+  SHA256_Update(ctx, value.data(), value.size());
+}
+
+}  // namespace
+
+RulesCache::RulesCache(std::chrono::seconds ruleset_id_ttl,
+                       std::chrono::seconds decision_ttl, size_t max_decisions)
+    : ruleset_id_ttl_(ruleset_id_ttl),
+      decision_ttl_(decision_ttl),
+      max_decisions_(max_decisions) {}
+
+bool RulesCache::LookupRulesetId(const std::string &release_name,
+                                 const system_clock::time_point &now,
+                                 std::string *ruleset_id) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (ruleset_id_.empty() || release_name_ != release_name ||
+      now >= ruleset_id_exp_) {
+    return false;
+  }
+  *ruleset_id = ruleset_id_;
+  return true;
+}
+
+void RulesCache::SetRulesetId(const std::string &release_name,
+                              const std::string &ruleset_id,
+                              const system_clock::time_point &now) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  release_name_ = release_name;
+  ruleset_id_ = ruleset_id;
+  ruleset_id_exp_ = now + ruleset_id_ttl_;
+}
+
+std::string RulesCache::RulesetIdKey(const std::string &release_name) {
+  return kRulesetIdPrefix + release_name;
+}
+
+std::string RulesCache::DecisionKey(const std::string &ruleset_id,
+                                    const std::string &http_method,
+                                    const std::string &path,
+                                    const std::string &claims) {
+  SHA256_CTX ctx;
+  SHA256_Init(&ctx);
+  AddToDigest(&ctx, ruleset_id);
+  AddToDigest(&ctx, http_method);
+  AddToDigest(&ctx, path);
+  AddToDigest(&ctx, claims);
+  unsigned char digest[SHA256_DIGEST_LENGTH];
+  SHA256_Final(digest, &ctx);
+  return kDecisionPrefix +
+         std::string(reinterpret_cast<const char *>(digest), sizeof(digest));
+}
+
+bool RulesCache::LookupDecision(const std::string &key,
+                                const system_clock::time_point &now,
+                                Status *decision) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = decision_index_.find(key);
+  if (it == decision_index_.end()) {
+    return false;
+  }
+  if (now >= it->second->second.exp) {
+    decisions_.erase(it->second);
+    decision_index_.erase(it);
+    return false;
+  }
+  // Moves the entry to the front of the LRU list.
+  decisions_.splice(decisions_.begin(), decisions_, it->second);
+  *decision = it->second->second.status;
+  return true;
+}
+
+void RulesCache::SetDecision(const std::string &key, const Status &decision,
+                             const system_clock::time_point &now) {
+  if (!decisions_enabled() || max_decisions_ == 0 ||
+      (!decision.ok() && decision.code() != Code::PERMISSION_DENIED)) {
+    return;
+  }
+  Decision value{decision, now + decision_ttl_};
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = decision_index_.find(key);
+  if (it != decision_index_.end()) {
+    it->second->second = value;
+    decisions_.splice(decisions_.begin(), decisions_, it->second);
+    return;
+  }
+  if (decisions_.size() >= max_decisions_) {
+    decision_index_.erase(decisions_.back().first);
+    decisions_.pop_back();
+  }
+  decisions_.emplace_front(key, value);
+  decision_index_.emplace(key, decisions_.begin());
+}
+
+bool RulesCache::Enqueue(const std::string &key, Callback callback) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = inflight_.find(key);
+  bool first = it == inflight_.end();
+  if (first) {
+    it = inflight_.emplace(key, std::vector<Callback>()).first;
+  }
+  if (callback) {
+    it->second.push_back(std::move(callback));
+  }
+  return first;
+}
+
+void RulesCache::Complete(const std::string &key, const Status &status,
+                          const std::string &value) {
+  std::vector<Callback> callbacks;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = inflight_.find(key);
+    if (it == inflight_.end()) {
+      return;
+    }
+    callbacks.swap(it->second);
+    inflight_.erase(it);
+  }
+  // The callbacks are invoked outside of the lock, since they may make new
+  // calls for the key.
+  for (const auto &callback : callbacks) {
+    callback(status, value);
+  }
+}
+
+}  // namespace firebase_rules
+}  // namespace api_manager
+}  // namespace google
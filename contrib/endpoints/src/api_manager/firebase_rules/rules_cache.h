@@ -0,0 +1,135 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////
+
+#ifndef FIREBASE_RULES_RULES_CACHE_H_
+#define FIREBASE_RULES_RULES_CACHE_H_
+
+#include <chrono>
+#include <functional>
+#include <list>
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "contrib/endpoints/include/api_manager/utils/status.h"
+
+namespace google {
+namespace api_manager {
+namespace firebase_rules {
+
+// Caches the results of the Firebase Rules service calls of a service, so
+// that security rules enforcement does not add upstream round trips to
+// every request:
+//  -- The ruleset id of the release, for ruleset_id_ttl. Only the release
+//  looked up last is kept, since it changes with the service config.
+//  -- Optionally, the authorization decisions by ruleset id, HTTP method,
+//  HTTP path and auth claims, for decision_ttl. Only decisions reached
+//  without user defined function calls should be cached, since the results
+//  of those calls may change at any time.
+// Concurrent requests missing the same entry are coalesced with Enqueue()
+// and Complete(), so that only one of them calls the Firebase service.
+class RulesCache {
+ public:
+  // Called with the status and the value of a coalesced call.
+  typedef std::function<void(const utils::Status &status,
+                             const std::string &value)>
+      Callback;
+
+  // A zero decision_ttl disables the decision cache. At most max_decisions
+  // decisions are cached, the least recently used are evicted first.
+  RulesCache(std::chrono::seconds ruleset_id_ttl,
+             std::chrono::seconds decision_ttl, size_t max_decisions);
+
+  // Looks up the ruleset id of the release. Returns false if it is missing
+  // or expired.
+  bool LookupRulesetId(const std::string &release_name,
+                       const std::chrono::system_clock::time_point &now,
+                       std::string *ruleset_id);
+
+  // Sets the ruleset id of the release fetched at now. Replaces the ruleset
+  // id of any other release.
+  void SetRulesetId(const std::string &release_name,
+                    const std::string &ruleset_id,
+                    const std::chrono::system_clock::time_point &now);
+
+  // Whether decisions are cached.
+  bool decisions_enabled() const { return decision_ttl_.count() > 0; }
+
+  // Returns the key of the decision for the request. The claims are the
+  // JSON claims of the auth token.
+  static std::string DecisionKey(const std::string &ruleset_id,
+                                 const std::string &http_method,
+                                 const std::string &path,
+                                 const std::string &claims);
+
+  // Looks up the decision. Returns false if it is missing or expired.
+  bool LookupDecision(const std::string &key,
+                      const std::chrono::system_clock::time_point &now,
+                      utils::Status *decision);
+
+  // Caches the decision made at now. Only OK and PERMISSION_DENIED are
+  // cached, other statuses are errors which may not happen again.
+  void SetDecision(const std::string &key, const utils::Status &decision,
+                   const std::chrono::system_clock::time_point &now);
+
+  // Returns the key used to coalesce the ruleset id fetches of the release.
+  // It never equals a decision key.
+  static std::string RulesetIdKey(const std::string &release_name);
+
+  // Adds the callback to the call in flight for the key. Returns true if
+  // no call was in flight, in which case the caller must make the call and
+  // then call Complete(). The callback may be empty.
+  bool Enqueue(const std::string &key, Callback callback);
+
+  // Completes the call for the key, invoking the callbacks added to it.
+  void Complete(const std::string &key, const utils::Status &status,
+                const std::string &value);
+
+ private:
+  struct Decision {
+    utils::Status status;
+    std::chrono::system_clock::time_point exp;
+  };
+  typedef std::list<std::pair<std::string, Decision>> DecisionList;
+
+  std::chrono::seconds ruleset_id_ttl_;
+  std::chrono::seconds decision_ttl_;
+  size_t max_decisions_;
+
+  // Protects all the members below.
+  std::mutex mutex_;
+
+  std::string release_name_;
+  std::string ruleset_id_;
+  std::chrono::system_clock::time_point ruleset_id_exp_;
+
+  // The decisions, most recently used first.
+  DecisionList decisions_;
+  // Maps key to its entry in decisions_.
+  std::unordered_map<std::string, DecisionList::iterator> decision_index_;
+
+  // The callbacks waiting for the calls in flight, by key.
+  std::map<std::string, std::vector<Callback>> inflight_;
+};
+
+}  // namespace firebase_rules
+}  // namespace api_manager
+}  // namespace google
+
+#endif  // FIREBASE_RULES_RULES_CACHE_H_
@@ -0,0 +1,137 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////
+#include "contrib/endpoints/src/api_manager/firebase_rules/rules_cache.h"
+
+#include "gtest/gtest.h"
+
+using ::google::api_manager::utils::Status;
+using ::google::protobuf::util::error::Code;
+using std::chrono::system_clock;
+
+namespace google {
+namespace api_manager {
+namespace firebase_rules {
+namespace {
+
+TEST(RulesCacheTest, RulesetId) {
+  RulesCache cache(std::chrono::seconds(60), std::chrono::seconds(0), 0);
+  system_clock::time_point now = system_clock::now();
+  std::string ruleset_id;
+  ASSERT_FALSE(cache.LookupRulesetId("release1", now, &ruleset_id));
+
+  cache.SetRulesetId("release1", "ruleset1", now);
+  ASSERT_TRUE(cache.LookupRulesetId(
+      "release1", now + std::chrono::seconds(59), &ruleset_id));
+  ASSERT_EQ("ruleset1", ruleset_id);
+  ASSERT_FALSE(cache.LookupRulesetId(
+      "release1", now + std::chrono::seconds(60), &ruleset_id));
+}
+
+TEST(RulesCacheTest, RulesetIdByRelease) {
+  RulesCache cache(std::chrono::seconds(60), std::chrono::seconds(0), 0);
+  system_clock::time_point now = system_clock::now();
+  std::string ruleset_id;
+  cache.SetRulesetId("release1", "ruleset1", now);
+  ASSERT_FALSE(cache.LookupRulesetId("release2", now, &ruleset_id));
+
+  // The ruleset id of the new release replaces the old one.
+  cache.SetRulesetId("release2", "ruleset2", now);
+  ASSERT_TRUE(cache.LookupRulesetId("release2", now, &ruleset_id));
+  ASSERT_EQ("ruleset2", ruleset_id);
+  ASSERT_FALSE(cache.LookupRulesetId("release1", now, &ruleset_id));
+
+  ASSERT_NE(RulesCache::RulesetIdKey("release1"),
+            RulesCache::RulesetIdKey("release2"));
+}
+
+TEST(RulesCacheTest, DecisionKey) {
+  std::string key = RulesCache::DecisionKey("ruleset1", "GET", "/a", "{}");
+  ASSERT_EQ(key, RulesCache::DecisionKey("ruleset1", "GET", "/a", "{}"));
+  ASSERT_NE(key, RulesCache::DecisionKey("ruleset2", "GET", "/a", "{}"));
+  ASSERT_NE(key, RulesCache::DecisionKey("ruleset1", "POST", "/a", "{}"));
+  ASSERT_NE(key, RulesCache::DecisionKey("ruleset1", "GET", "/b", "{}"));
+  ASSERT_NE(key, RulesCache::DecisionKey("ruleset1", "GET", "/a", "{\"a\":1}"));
+  // The fields are not simply concatenated.
+  ASSERT_NE(RulesCache::DecisionKey("a", "b", "", ""),
+            RulesCache::DecisionKey("ab", "", "", ""));
+}
+
+TEST(RulesCacheTest, Decisions) {
+  RulesCache cache(std::chrono::seconds(60), std::chrono::seconds(10), 2);
+  ASSERT_TRUE(cache.decisions_enabled());
+  system_clock::time_point now = system_clock::now();
+  Status decision = Status::OK;
+  ASSERT_FALSE(cache.LookupDecision("key1", now, &decision));
+
+  cache.SetDecision("key1", Status::OK, now);
+  cache.SetDecision("key2", Status(Code::PERMISSION_DENIED, "denied"), now);
+  // Errors are not cached.
+  cache.SetDecision("key3", Status(Code::INTERNAL, "error"), now);
+  ASSERT_FALSE(cache.LookupDecision("key3", now, &decision));
+
+  ASSERT_TRUE(cache.LookupDecision("key1", now, &decision));
+  ASSERT_TRUE(decision.ok());
+  ASSERT_TRUE(cache.LookupDecision("key2", now, &decision));
+  ASSERT_EQ(Code::PERMISSION_DENIED, decision.code());
+
+  // key1 is the least recently used, and evicted.
+  cache.SetDecision("key4", Status::OK, now);
+  ASSERT_FALSE(cache.LookupDecision("key1", now, &decision));
+  ASSERT_TRUE(cache.LookupDecision("key4", now, &decision));
+
+  ASSERT_FALSE(
+      cache.LookupDecision("key4", now + std::chrono::seconds(10), &decision));
+}
+
+TEST(RulesCacheTest, DecisionsDisabled) {
+  RulesCache cache(std::chrono::seconds(60), std::chrono::seconds(0), 100);
+  ASSERT_FALSE(cache.decisions_enabled());
+  system_clock::time_point now = system_clock::now();
+  cache.SetDecision("key1", Status::OK, now);
+  Status decision = Status::OK;
+  ASSERT_FALSE(cache.LookupDecision("key1", now, &decision));
+}
+
+TEST(RulesCacheTest, Coalescing) {
+  RulesCache cache(std::chrono::seconds(60), std::chrono::seconds(0), 0);
+  std::vector<std::string> values;
+  auto callback = [&values](const Status &status, const std::string &value) {
+    ASSERT_TRUE(status.ok());
+    values.push_back(value);
+  };
+
+  std::string key = RulesCache::RulesetIdKey("release1");
+  ASSERT_TRUE(cache.Enqueue(key, callback));
+  ASSERT_FALSE(cache.Enqueue(key, callback));
+  // The fetches of another release are not coalesced with it.
+  ASSERT_TRUE(cache.Enqueue(RulesCache::RulesetIdKey("release2"), nullptr));
+  ASSERT_TRUE(cache.Enqueue("key1", nullptr));
+  ASSERT_FALSE(cache.Enqueue("key1", callback));
+
+  cache.Complete(key, Status::OK, "ruleset1");
+  ASSERT_EQ(std::vector<std::string>({"ruleset1", "ruleset1"}), values);
+
+  cache.Complete("key1", Status::OK, "");
+  ASSERT_EQ(3u, values.size());
+
+  // The next call for the key is a new one.
+  ASSERT_TRUE(cache.Enqueue("key1", callback));
+}
+
+}  // namespace
+}  // namespace firebase_rules
+}  // namespace api_manager
+}  // namespace google
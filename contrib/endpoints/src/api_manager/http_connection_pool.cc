@@ -0,0 +1,102 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////
+#include "contrib/endpoints/src/api_manager/http_connection_pool.h"
+
+#include <algorithm>
+#include <cctype>
+
+namespace google {
+namespace api_manager {
+
+HttpConnectionPool::Options HttpConnectionPool::GetOptions(
+    const proto::ServerConfig *server_config) {
+  Options options;
+  if (server_config && server_config->has_http_client_config()) {
+    options.http2 = server_config->http_client_config().enable_http2();
+  }
+  return options;
+}
+
+HttpConnectionPool::HttpConnectionPool(
+    std::unique_ptr<ApiManagerEnvInterface> env, const Options &options)
+    : env_(std::move(env)), options_(options) {}
+
+void HttpConnectionPool::Log(LogLevel level, const char *message) {
+  env_->Log(level, message);
+}
+
+std::unique_ptr<PeriodicTimer> HttpConnectionPool::StartPeriodicTimer(
+    std::chrono::milliseconds interval, std::function<void()> continuation) {
+  return env_->StartPeriodicTimer(interval, continuation);
+}
+
+void HttpConnectionPool::RunHTTPRequest(std::unique_ptr<HTTPRequest> request) {
+  std::string origin = GetOrigin(request->url());
+  if (!origin.empty()) {
+    request->set_connection_key(origin).set_http2(options_.http2);
+  }
+  env_->RunHTTPRequest(std::move(request));
+}
+
+void HttpConnectionPool::RunGRPCRequest(std::unique_ptr<GRPCRequest> request) {
+  env_->RunGRPCRequest(std::move(request));
+}
+
+std::string HttpConnectionPool::GetOrigin(const std::string &url) {
+  static const char kSeparator[] = "://";
+  size_t scheme_end = url.find(kSeparator);
+  if (scheme_end == std::string::npos || scheme_end == 0) {
+    return "";
+  }
+  std::string scheme = url.substr(0, scheme_end);
+  std::transform(scheme.begin(), scheme.end(), scheme.begin(), ::tolower);
+  const char *default_port;
+  if (scheme == "https") {
+    default_port = "443";
+  } else if (scheme == "http") {
+    default_port = "80";
+  } else {
+    return "";
+  }
+
+  size_t host_begin = scheme_end + sizeof(kSeparator) - 1;
+  size_t host_end = url.find_first_of("/?#", host_begin);
+  if (host_end == std::string::npos) {
+    host_end = url.size();
+  }
+  std::string host = url.substr(host_begin, host_end - host_begin);
+  // Drops the user info, which does not identify the connection.
+  size_t at = host.rfind('@');
+  if (at != std::string::npos) {
+    host.erase(0, at + 1);
+  }
+  if (host.empty()) {
+    return "";
+  }
+  std::transform(host.begin(), host.end(), host.begin(), ::tolower);
+  // The colon of the port follows the closing bracket of IPv6 literals.
+  size_t colon = host.rfind(':');
+  size_t bracket = host.rfind(']');
+  if (colon == std::string::npos ||
+      (bracket != std::string::npos && colon < bracket)) {
+    host += ":";
+    host += default_port;
+  }
+  return scheme + kSeparator + host;
+}
+
+}  // namespace api_manager
+}  // namespace google
@@ -0,0 +1,76 @@
+/* Copyright 2017 Google Inc. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef API_MANAGER_HTTP_CONNECTION_POOL_H_
+#define API_MANAGER_HTTP_CONNECTION_POOL_H_
+
+#include <memory>
+#include <string>
+
+#include "contrib/endpoints/include/api_manager/env_interface.h"
+#include "contrib/endpoints/src/api_manager/proto/server_config.pb.h"
+
+namespace google {
+namespace api_manager {
+
+// An environment tagging the HTTP requests of the API Manager with hints
+// for the persistent connections of the underlying environment, so that
+// service control, key fetches, metadata and Firebase calls to the same
+// upstream host can share keep-alive connections instead of paying for a
+// TCP and TLS handshake each.
+//
+// Requests to the same origin get the same connection key, and are marked
+// as HTTP/2 if it is enabled. The underlying environment owns the sockets
+// and decides how many connections to keep per key; the requests are not
+// limited or queued here. All the other calls are forwarded to the
+// underlying environment.
+//
+// The service context only installs it if the server config has a
+// http_client_config.
+class HttpConnectionPool : public ApiManagerEnvInterface {
+ public:
+  struct Options {
+    Options() : http2(false) {}
+
+    bool http2;
+  };
+
+  // Returns the options in the server config, which may be nullptr.
+  static Options GetOptions(const proto::ServerConfig *server_config);
+
+  HttpConnectionPool(std::unique_ptr<ApiManagerEnvInterface> env,
+                     const Options &options);
+  virtual ~HttpConnectionPool() {}
+
+  virtual void Log(LogLevel level, const char *message);
+  virtual std::unique_ptr<PeriodicTimer> StartPeriodicTimer(
+      std::chrono::milliseconds interval, std::function<void()> continuation);
+  virtual void RunHTTPRequest(std::unique_ptr<HTTPRequest> request);
+  virtual void RunGRPCRequest(std::unique_ptr<GRPCRequest> request);
+
+  // Returns the origin of an absolute http or https URL as
+  // "scheme://host:port", with the default port made explicit, or an empty
+  // string if the URL has no host. Requests with the same origin share the
+  // connections.
+  static std::string GetOrigin(const std::string &url);
+
+ private:
+  std::unique_ptr<ApiManagerEnvInterface> env_;
+  Options options_;
+};
+
+}  // namespace api_manager
+}  // namespace google
+
+#endif  // API_MANAGER_HTTP_CONNECTION_POOL_H_
@@ -0,0 +1,149 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////
+#include "contrib/endpoints/src/api_manager/http_connection_pool.h"
+
+#include "gtest/gtest.h"
+
+using ::google::api_manager::utils::Status;
+
+namespace google {
+namespace api_manager {
+namespace {
+
+// A mock environment, which keeps the requests it receives until they are
+// answered. It only checks the hints set on them, no connection is opened.
+class MockEnvironment : public ApiManagerEnvInterface {
+ public:
+  void Log(LogLevel level, const char *message) {}
+  std::unique_ptr<PeriodicTimer> StartPeriodicTimer(
+      std::chrono::milliseconds interval, std::function<void()> continuation) {
+    return std::unique_ptr<PeriodicTimer>();
+  }
+  void RunHTTPRequest(std::unique_ptr<HTTPRequest> request) {
+    requests_.push_back(std::move(request));
+  }
+  void RunGRPCRequest(std::unique_ptr<GRPCRequest> request) {}
+
+  size_t size() const { return requests_.size(); }
+  const HTTPRequest &request(size_t i) const { return *requests_[i]; }
+
+  // Answers the request and drops it.
+  void Respond(size_t i, const std::string &body) {
+    std::unique_ptr<HTTPRequest> request = std::move(requests_[i]);
+    requests_.erase(requests_.begin() + i);
+    request->OnComplete(Status(200, ""), std::map<std::string, std::string>(),
+                        std::string(body));
+  }
+
+ private:
+  std::vector<std::unique_ptr<HTTPRequest>> requests_;
+};
+
+class HttpConnectionPoolTest : public ::testing::Test {
+ protected:
+  void CreatePool(const HttpConnectionPool::Options &options) {
+    env_ = new MockEnvironment();
+    pool_.reset(new HttpConnectionPool(
+        std::unique_ptr<ApiManagerEnvInterface>(env_), options));
+  }
+
+  void Send(const std::string &url) {
+    std::unique_ptr<HTTPRequest> request(new HTTPRequest(
+        [this](Status status, std::map<std::string, std::string> &&,
+               std::string &&body) { responses_.push_back(body); }));
+    request->set_url(url).set_method("POST");
+    pool_->RunHTTPRequest(std::move(request));
+  }
+
+  std::vector<std::string> responses_;
+  MockEnvironment *env_;
+  std::unique_ptr<HttpConnectionPool> pool_;
+};
+
+TEST(HttpConnectionPoolOriginTest, GetOrigin) {
+  EXPECT_EQ("https://servicecontrol.googleapis.com:443",
+            HttpConnectionPool::GetOrigin(
+                "https://servicecontrol.googleapis.com/v1/services/a:check"));
+  EXPECT_EQ("http://metadata:80",
+            HttpConnectionPool::GetOrigin("HTTP://Metadata?recursive=true"));
+  EXPECT_EQ("http://localhost:8080",
+            HttpConnectionPool::GetOrigin("http://user@localhost:8080/a"));
+  EXPECT_EQ("https://[::1]:443",
+            HttpConnectionPool::GetOrigin("https://[::1]/a"));
+  EXPECT_EQ("https://[::1]:8443",
+            HttpConnectionPool::GetOrigin("https://[::1]:8443"));
+  EXPECT_EQ("", HttpConnectionPool::GetOrigin("/relative/path"));
+  EXPECT_EQ("", HttpConnectionPool::GetOrigin("ftp://host/file"));
+  EXPECT_EQ("", HttpConnectionPool::GetOrigin("https:///path"));
+}
+
+TEST(HttpConnectionPoolOriginTest, GetOptions) {
+  HttpConnectionPool::Options options = HttpConnectionPool::GetOptions(nullptr);
+  EXPECT_FALSE(options.http2);
+
+  proto::ServerConfig server_config;
+  server_config.mutable_http_client_config()->set_enable_http2(true);
+  options = HttpConnectionPool::GetOptions(&server_config);
+  EXPECT_TRUE(options.http2);
+}
+
+TEST_F(HttpConnectionPoolTest, SetsConnectionHints) {
+  CreatePool(HttpConnectionPool::Options());
+  Send("https://servicecontrol.googleapis.com/v1/services/a:check");
+  Send("https://ServiceControl.googleapis.com:443/v1/services/a:report");
+  Send("http://metadata/computeMetadata/v1/");
+  ASSERT_EQ(3u, env_->size());
+  EXPECT_EQ("https://servicecontrol.googleapis.com:443",
+            env_->request(0).connection_key());
+  EXPECT_EQ("https://servicecontrol.googleapis.com:443",
+            env_->request(1).connection_key());
+  EXPECT_EQ("http://metadata:80", env_->request(2).connection_key());
+  EXPECT_FALSE(env_->request(0).http2());
+
+  env_->Respond(1, "report");
+  env_->Respond(0, "check");
+  EXPECT_EQ(std::vector<std::string>({"report", "check"}), responses_);
+}
+
+TEST_F(HttpConnectionPoolTest, MarksHttp2Requests) {
+  HttpConnectionPool::Options options;
+  options.http2 = true;
+  CreatePool(options);
+  Send("https://a.com/");
+  ASSERT_EQ(1u, env_->size());
+  EXPECT_TRUE(env_->request(0).http2());
+}
+
+TEST_F(HttpConnectionPoolTest, DoesNotLimitRequestsInFlight) {
+  CreatePool(HttpConnectionPool::Options());
+  for (int i = 0; i < 100; ++i) {
+    Send("https://a.com/");
+  }
+  EXPECT_EQ(100u, env_->size());
+}
+
+TEST_F(HttpConnectionPoolTest, ForwardsRequestsWithoutHost) {
+  CreatePool(HttpConnectionPool::Options());
+  Send("/relative");
+  ASSERT_EQ(1u, env_->size());
+  EXPECT_EQ("", env_->request(0).connection_key());
+  env_->Respond(0, "ok");
+  EXPECT_EQ(std::vector<std::string>({"ok"}), responses_);
+}
+
+}  // namespace
+}  // namespace api_manager
+}  // namespace google
@@ -376,5 +376,58 @@ HttpTemplate *HttpTemplate::Parse(const std::string &ht) {
                           std::move(p.variables()));
 }
 
+bool HttpTemplate::ParseIntoPool(const std::string &ht,
+                                 HttpTemplateStringPool *pool,
+                                 PooledHttpTemplate *result) {
+  Parser p(ht);
+  if (!p.Parse() || !p.ValidateParts()) {
+    return false;
+  }
+  InternParts(p.segments(), p.verb(), p.variables(), pool, result);
+  return true;
+}
+
+void HttpTemplate::InternIntoPool(const HttpTemplate &ht,
+                                  HttpTemplateStringPool *pool,
+                                  PooledHttpTemplate *result) {
+  InternParts(ht.segments_, ht.verb_, ht.variables_, pool, result);
+}
+
+void HttpTemplate::InternParts(const std::vector<std::string> &segments,
+                               const std::string &verb,
+                               const std::vector<Variable> &variables,
+                               HttpTemplateStringPool *pool,
+                               PooledHttpTemplate *result) {
+  result->segments.clear();
+  result->segments.reserve(segments.size());
+  for (const auto &segment : segments) {
+    result->segments.push_back(pool->Intern(segment));
+  }
+  result->verb = verb.empty() ? nullptr : pool->Intern(verb);
+  result->variables.clear();
+  result->variables.reserve(variables.size());
+  for (const auto &var : variables) {
+    result->variables.push_back(PooledHttpTemplate::Variable{
+        var.start_segment, var.end_segment, pool->Intern(var.field_path),
+        var.has_wildcard_path});
+  }
+}
+
+const std::string *HttpTemplateStringPool::Intern(const std::string &s) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return &*strings_.insert(s).first;
+}
+
+const std::vector<std::string> *HttpTemplateStringPool::Intern(
+    const std::vector<std::string> &field_path) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return &*field_paths_.insert(field_path).first;
+}
+
+size_t HttpTemplateStringPool::size() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return strings_.size() + field_paths_.size();
+}
+
 }  // namespace api_manager
 }  // namespace google
@@ -15,15 +15,73 @@
 #ifndef API_MANAGER_HTTP_TEMPLATE_H_
 #define API_MANAGER_HTTP_TEMPLATE_H_
 
+#include <mutex>
+#include <set>
 #include <string>
+#include <unordered_set>
 #include <vector>
 
 namespace google {
 namespace api_manager {
 
+// A pool of interned strings and field paths shared by all templates parsed
+// with HttpTemplate::ParseIntoPool(), e.g. all templates of a service config.
+// Each distinct segment, verb and field path is stored only once. Pointers
+// returned by the pool stay valid for the lifetime of the pool.
+//
+// Thread safe.
+class HttpTemplateStringPool {
+ public:
+  // Returns the pooled copy of s.
+  const std::string *Intern(const std::string &s);
+
+  // Returns the pooled copy of field_path.
+  const std::vector<std::string> *Intern(
+      const std::vector<std::string> &field_path);
+
+  // Returns the number of distinct strings and field paths in the pool.
+  size_t size() const;
+
+ private:
+  mutable std::mutex mutex_;
+  std::unordered_set<std::string> strings_;
+  std::set<std::vector<std::string>> field_paths_;
+};
+
+// A http template parsed with HttpTemplate::ParseIntoPool(). It references the
+// strings of its pool instead of owning copies of them.
+struct PooledHttpTemplate {
+  // Same as HttpTemplate::Variable, with the field path kept in the pool.
+  struct Variable {
+    int start_segment;
+    int end_segment;
+    const std::vector<std::string> *field_path;
+    bool has_wildcard_path;
+  };
+
+  std::vector<const std::string *> segments;
+  // nullptr if the template has no verb.
+  const std::string *verb;
+  std::vector<Variable> variables;
+};
+
 class HttpTemplate {
  public:
   static HttpTemplate *Parse(const std::string &ht);
+
+  // Parses ht into result, interning its segments, verb and variable field
+  // paths in pool. Unlike Parse(), does not allocate a HttpTemplate. Returns
+  // false if ht is not a valid template.
+  static bool ParseIntoPool(const std::string &ht, HttpTemplateStringPool *pool,
+                            PooledHttpTemplate *result);
+
+  // Interns the segments, verb and variable field paths of ht, parsed with
+  // Parse(), in pool. Lets templates be parsed concurrently and interned
+  // afterwards on a single thread.
+  static void InternIntoPool(const HttpTemplate &ht,
+                             HttpTemplateStringPool *pool,
+                             PooledHttpTemplate *result);
+
   const std::vector<std::string> &segments() const { return segments_; }
   const std::string &verb() const { return verb_; }
 
@@ -54,6 +112,13 @@ class HttpTemplate {
   static const char kWildCardPathKey[];
 
  private:
+  // Interns the parts of a parsed template in pool into result.
+  static void InternParts(const std::vector<std::string> &segments,
+                          const std::string &verb,
+                          const std::vector<Variable> &variables,
+                          HttpTemplateStringPool *pool,
+                          PooledHttpTemplate *result);
+
   HttpTemplate(std::vector<std::string> &&segments, std::string &&verb,
                std::vector<Variable> &&variables)
       : segments_(std::move(segments)),
@@ -510,5 +510,53 @@ TEST(HttpTemplate, ParseNonVerbTest) {
   ASSERT_EQ(nullptr, HttpTemplate::Parse("/a/{b=*}/**:"));
 }
 
+TEST(HttpTemplate, ParseIntoPoolTest) {
+  HttpTemplateStringPool pool;
+  PooledHttpTemplate ht1;
+  ASSERT_TRUE(HttpTemplate::ParseIntoPool("/shelves/{shelf}/books/{book.id}",
+                                          &pool, &ht1));
+  ASSERT_EQ(4, ht1.segments.size());
+  ASSERT_EQ("shelves", *ht1.segments[0]);
+  ASSERT_EQ("*", *ht1.segments[1]);
+  ASSERT_EQ("books", *ht1.segments[2]);
+  ASSERT_EQ("*", *ht1.segments[3]);
+  ASSERT_EQ(nullptr, ht1.verb);
+  ASSERT_EQ(2, ht1.variables.size());
+  ASSERT_EQ(1, ht1.variables[0].start_segment);
+  ASSERT_EQ(2, ht1.variables[0].end_segment);
+  ASSERT_EQ(FieldPath({"shelf"}), *ht1.variables[0].field_path);
+  ASSERT_FALSE(ht1.variables[0].has_wildcard_path);
+  ASSERT_EQ(3, ht1.variables[1].start_segment);
+  ASSERT_EQ(4, ht1.variables[1].end_segment);
+  ASSERT_EQ(FieldPath({"book", "id"}), *ht1.variables[1].field_path);
+
+  PooledHttpTemplate ht2;
+  ASSERT_TRUE(HttpTemplate::ParseIntoPool("/shelves/{shelf}/{name=**}:move",
+                                          &pool, &ht2));
+  ASSERT_EQ(3, ht2.segments.size());
+  ASSERT_NE(nullptr, ht2.verb);
+  ASSERT_EQ("move", *ht2.verb);
+  ASSERT_EQ(2, ht2.variables.size());
+  ASSERT_EQ(-2, ht2.variables[1].end_segment);
+  ASSERT_TRUE(ht2.variables[1].has_wildcard_path);
+
+  // Identical strings and field paths are shared between templates.
+  ASSERT_EQ(ht1.segments[0], ht2.segments[0]);
+  ASSERT_EQ(ht1.segments[1], ht2.segments[1]);
+  ASSERT_EQ(ht1.segments[1], ht1.segments[3]);
+  ASSERT_EQ(ht1.variables[0].field_path, ht2.variables[0].field_path);
+  // "shelves", "*", "books", "**", "move", {shelf}, {book.id}, {name}
+  ASSERT_EQ(8, pool.size());
+}
+
+TEST(HttpTemplate, ParseIntoPoolInvalidTest) {
+  HttpTemplateStringPool pool;
+  PooledHttpTemplate ht;
+  ASSERT_FALSE(HttpTemplate::ParseIntoPool("", &pool, &ht));
+  ASSERT_FALSE(HttpTemplate::ParseIntoPool("/a/{b", &pool, &ht));
+  ASSERT_FALSE(HttpTemplate::ParseIntoPool("/a/**/*", &pool, &ht));
+  ASSERT_FALSE(HttpTemplate::ParseIntoPool("/a/:", &pool, &ht));
+}
+
 }  // namespace api_manager
 }  // namespace google
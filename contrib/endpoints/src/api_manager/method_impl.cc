@@ -51,7 +51,7 @@ void MethodInfoImpl::addAudiencesForIssuer(const string &issuer,
   if (iss.empty()) {
     return;
   }
-  set<string> &audiences = issuer_audiences_map_[iss];
+  std::unordered_set<string> &audiences = issuer_audiences_map_[iss];
   stringstream ss(audiences_list);
   string audience;
   // Audience list is comma-delimited.
@@ -72,10 +72,14 @@ bool MethodInfoImpl::isIssuerAllowed(const std::string &issuer) const {
 
 bool MethodInfoImpl::isAudienceAllowed(
     const string &issuer, const std::set<string> &jwt_audiences) const {
-  if (issuer.empty() || jwt_audiences.empty() || !isIssuerAllowed(issuer)) {
+  if (issuer.empty() || jwt_audiences.empty()) {
     return false;
   }
-  const set<string> &audiences = issuer_audiences_map_.at(issuer);
+  auto audiences_it = issuer_audiences_map_.find(issuer);
+  if (audiences_it == issuer_audiences_map_.end()) {
+    return false;
+  }
+  const std::unordered_set<string> &audiences = audiences_it->second;
   for (const auto &it : jwt_audiences) {
     if (audiences.find(it) != audiences.end()) {
       return true;
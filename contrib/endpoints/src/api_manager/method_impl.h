@@ -18,6 +18,8 @@
 #include <map>
 #include <memory>
 #include <set>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include "contrib/endpoints/include/api_manager/method.h"
@@ -147,8 +149,11 @@ class MethodInfoImpl : public MethodInfo {
   // Does the method allow unregistered callers (callers without client identity
   // such as API Key)?
   bool allow_unregistered_calls_;
-  // Issuers to allowed audiences map.
-  std::map<std::string, std::set<std::string>> issuer_audiences_map_;
+  // Issuers to allowed audiences map. Both are normalized with
+  // utils::GetUrlContent() when the config is loaded, so the checks are plain
+  // hash lookups.
+  std::unordered_map<std::string, std::unordered_set<std::string>>
+      issuer_audiences_map_;
 
   // system parameter map of parameter name to http_header name.
   std::map<std::string, std::vector<std::string>> http_header_parameters_;
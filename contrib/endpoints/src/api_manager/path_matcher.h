@@ -15,15 +15,20 @@
 #ifndef API_MANAGER_PATH_MATCHER_H_
 #define API_MANAGER_PATH_MATCHER_H_
 
+#include <algorithm>
 #include <cstddef>
+#include <functional>
 #include <memory>
 #include <set>
 #include <sstream>
 #include <string>
+#include <thread>
 #include <unordered_map>
+#include <vector>
 
 #include "contrib/endpoints/src/api_manager/http_template.h"
 #include "contrib/endpoints/src/api_manager/path_matcher_node.h"
+#include "contrib/endpoints/src/api_manager/utils/url_escape.h"
 
 namespace google {
 namespace api_manager {
@@ -71,10 +76,12 @@ class PathMatcher {
   std::unique_ptr<PathMatcherNode> root_ptr_;
   // Holds the set of custom verbs found in configured templates.
   std::set<std::string> custom_verbs_;
+  // The strings shared by all registered templates.
+  std::unique_ptr<HttpTemplateStringPool> string_pool_;
   // Data we store per each registered method
   struct MethodData {
     Method method;
-    std::vector<HttpTemplate::Variable> variables;
+    std::vector<PooledHttpTemplate::Variable> variables;
     std::string body_field_path;
   };
   // The info associated with each method. The path matcher nodes
@@ -106,6 +113,20 @@ class PathMatcherBuilder {
   bool Register(std::string http_method, std::string path,
                 std::string body_field_path, Method method);
 
+  // Queues a method for registration by RegisterPending(). Prefer this to
+  // Register() when loading many methods at once, e.g. from a large service
+  // config.
+  void Add(std::string http_method, std::string path,
+           std::string body_field_path, Method method);
+
+  // Registers all methods queued by Add() with the same semantics as calling
+  // Register() for each of them in the order they were added. Templates are
+  // parsed on up to max_threads threads, then the trie is built in a single
+  // pass over the paths sorted so that shared prefixes are only walked once.
+  // Returns the positions (in the order of Add() calls since the last
+  // RegisterPending()) of the methods with an invalid http template.
+  std::vector<size_t> RegisterPending(size_t max_threads);
+
   // Returns a unique_ptr to a thread safe PathMatcher that contains all
   // registered path-WrapperGraph pairs. Note the PathMatchBuilder instance
   // will be moved so cannot use after invoking Build().
@@ -124,9 +145,24 @@ class PathMatcherBuilder {
   // be multiple templates in different services on a server. Consider moving
   // this to PathMatcherNode.
   std::set<std::string> custom_verbs_;
+  // The strings shared by all registered templates. Variable field paths in
+  // MethodData point into it.
+  std::unique_ptr<HttpTemplateStringPool> string_pool_;
   typedef typename PathMatcher<Method>::MethodData MethodData;
   std::vector<std::unique_ptr<MethodData>> methods_;
 
+  // A method queued by Add().
+  struct PendingMethod {
+    std::string http_method;
+    std::string http_template;
+    std::unique_ptr<MethodData> method_data;
+    // The parsed template, null if it is invalid.
+    std::unique_ptr<HttpTemplate> parsed;
+    // The trie path of the parsed template, empty if the template is invalid.
+    std::vector<const std::string*> path;
+  };
+  std::vector<PendingMethod> pending_;
+
   friend class PathMatcher<Method>;
 };
 
@@ -142,118 +178,11 @@ std::vector<std::string>& split(const std::string& s, char delim,
   return elems;
 }
 
-inline bool IsReservedChar(char c) {
-  // Reserved characters according to RFC 6570
-  switch (c) {
-    case '!':
-    case '#':
-    case '$':
-    case '&':
-    case '\'':
-    case '(':
-    case ')':
-    case '*':
-    case '+':
-    case ',':
-    case '/':
-    case ':':
-    case ';':
-    case '=':
-    case '?':
-    case '@':
-    case '[':
-    case ']':
-      return true;
-    default:
-      return false;
-  }
-}
-
-// Check if an ASCII character is a hex digit.  We can't use ctype's
-// isxdigit() because it is affected by locale. This function is applied
-// to the escaped characters in a url, not to natural-language
-// strings, so locale should not be taken into account.
-inline bool ascii_isxdigit(char c) {
-  return ('a' <= c && c <= 'f') || ('A' <= c && c <= 'F') ||
-         ('0' <= c && c <= '9');
-}
-
-inline int hex_digit_to_int(char c) {
-  /* Assume ASCII. */
-  int x = static_cast<unsigned char>(c);
-  if (x > '9') {
-    x += 9;
-  }
-  return x & 0xf;
-}
-
-// This is a helper function for UrlUnescapeString. It takes a string and
-// the index of where we are within that string.
-//
-// The function returns true if the next three characters are of the format:
-// "%[0-9A-Fa-f]{2}".
-//
-// If the next three characters are an escaped character then this function will
-// also return what character is escaped.
-bool GetEscapedChar(const std::string& src, size_t i,
-                    bool unescape_reserved_chars, char* out) {
-  if (i + 2 < src.size() && src[i] == '%') {
-    if (ascii_isxdigit(src[i + 1]) && ascii_isxdigit(src[i + 2])) {
-      char c =
-          (hex_digit_to_int(src[i + 1]) << 4) | hex_digit_to_int(src[i + 2]);
-      if (!unescape_reserved_chars && IsReservedChar(c)) {
-        return false;
-      }
-      *out = c;
-      return true;
-    }
-  }
-  return false;
-}
-
-// Unescapes string 'part' and returns the unescaped string. Reserved characters
-// (as specified in RFC 6570) are not escaped if unescape_reserved_chars is
-// false.
-std::string UrlUnescapeString(const std::string& part,
-                              bool unescape_reserved_chars) {
-  std::string unescaped;
-  // Check whether we need to escape at all.
-  bool needs_unescaping = false;
-  char ch = '\0';
-  for (size_t i = 0; i < part.size(); ++i) {
-    if (GetEscapedChar(part, i, unescape_reserved_chars, &ch)) {
-      needs_unescaping = true;
-      break;
-    }
-  }
-  if (!needs_unescaping) {
-    unescaped = part;
-    return unescaped;
-  }
-
-  unescaped.resize(part.size());
-
-  char* begin = &(unescaped)[0];
-  char* p = begin;
-
-  for (size_t i = 0; i < part.size();) {
-    if (GetEscapedChar(part, i, unescape_reserved_chars, &ch)) {
-      *p++ = ch;
-      i += 3;
-    } else {
-      *p++ = part[i];
-      i += 1;
-    }
-  }
-
-  unescaped.resize(p - begin);
-  return unescaped;
-}
-
 template <class VariableBinding>
-void ExtractBindingsFromPath(const std::vector<HttpTemplate::Variable>& vars,
-                             const std::vector<std::string>& parts,
-                             std::vector<VariableBinding>* bindings) {
+void ExtractBindingsFromPath(
+    const std::vector<PooledHttpTemplate::Variable>& vars,
+    const std::vector<std::string>& parts,
+    std::vector<VariableBinding>* bindings) {
   for (const auto& var : vars) {
     // Determine the subpath bound to the variable based on the
     // [start_segment, end_segment) segment range of the variable.
@@ -261,7 +190,7 @@ void ExtractBindingsFromPath(const std::vector<HttpTemplate::Variable>& vars,
     // In case of matching "**" - end_segment is negative and is relative to
     // the end such that end_segment = -1 will match all subsequent segments.
     VariableBinding binding;
-    binding.field_path = var.field_path;
+    binding.field_path = *var.field_path;
     // Calculate the absolute index of the ending segment in case it's negative.
     size_t end_segment = (var.end_segment >= 0)
                              ? var.end_segment
@@ -274,7 +203,8 @@ void ExtractBindingsFromPath(const std::vector<HttpTemplate::Variable>& vars,
     // Joins parts with "/"  to form a path string.
     for (size_t i = var.start_segment; i < end_segment; ++i) {
       // For multipart matches only unescape non-reserved characters.
-      binding.value += UrlUnescapeString(parts[i], !is_multipart);
+      utils::AppendUrlUnescaped(parts[i].data(), parts[i].size(),
+                                !is_multipart, &binding.value);
       if (i < end_segment - 1) {
         binding.value += "/";
       }
@@ -306,7 +236,8 @@ void ExtractBindingsFromQueryParameters(
         // in the request, e.g. `book.author.name`.
         VariableBinding binding;
         split(name, '.', binding.field_path);
-        binding.value = UrlUnescapeString(param.substr(pos + 1), true);
+        utils::AppendUrlUnescaped(param.data() + pos + 1,
+                                  param.size() - pos - 1, true, &binding.value);
         bindings->emplace_back(std::move(binding));
       }
     }
@@ -356,14 +287,17 @@ PathMatcherLookupResult LookupInPathMatcherNode(
   return result;
 }
 
-PathMatcherNode::PathInfo TransformHttpTemplate(const HttpTemplate& ht) {
+// Templates are only parsed in parallel if each thread gets at least this many.
+const size_t kMinTemplatesPerParseThread = 256;
+
+PathMatcherNode::PathInfo TransformHttpTemplate(const PooledHttpTemplate& ht) {
   PathMatcherNode::PathInfo::Builder builder;
 
-  for (const std::string& part : ht.segments()) {
-    builder.AppendLiteralNode(part);
+  for (const std::string* part : ht.segments) {
+    builder.AppendLiteralNode(*part);
   }
-  if (!ht.verb().empty()) {
-    builder.AppendLiteralNode(ht.verb());
+  if (ht.verb != nullptr) {
+    builder.AppendLiteralNode(*ht.verb);
   }
 
   return builder.Build();
@@ -375,6 +309,7 @@ template <class Method>
 PathMatcher<Method>::PathMatcher(PathMatcherBuilder<Method>&& builder)
     : root_ptr_(std::move(builder.root_ptr_)),
       custom_verbs_(std::move(builder.custom_verbs_)),
+      string_pool_(std::move(builder.string_pool_)),
       methods_(std::move(builder.methods_)) {}
 
 // Lookup is a wrapper method for the recursive node Lookup. First, the wrapper
@@ -445,7 +380,8 @@ Method PathMatcher<Method>::Lookup(const std::string& http_method,
 // Initializes the builder with a root Path Segment
 template <class Method>
 PathMatcherBuilder<Method>::PathMatcherBuilder()
-    : root_ptr_(new PathMatcherNode()) {}
+    : root_ptr_(new PathMatcherNode()),
+      string_pool_(new HttpTemplateStringPool()) {}
 
 template <class Method>
 PathMatcherPtr<Method> PathMatcherBuilder<Method>::Build() {
@@ -471,11 +407,11 @@ bool PathMatcherBuilder<Method>::Register(std::string http_method,
                                           std::string http_template,
                                           std::string body_field_path,
                                           Method method) {
-  std::unique_ptr<HttpTemplate> ht(HttpTemplate::Parse(http_template));
-  if (nullptr == ht) {
+  PooledHttpTemplate ht;
+  if (!HttpTemplate::ParseIntoPool(http_template, string_pool_.get(), &ht)) {
     return false;
   }
-  PathMatcherNode::PathInfo path_info = TransformHttpTemplate(*ht);
+  PathMatcherNode::PathInfo path_info = TransformHttpTemplate(ht);
   if (path_info.path_info().size() == 0) {
     return false;
   }
@@ -483,7 +419,7 @@ bool PathMatcherBuilder<Method>::Register(std::string http_method,
   // into the path matcher trie.
   auto method_data = std::unique_ptr<MethodData>(new MethodData());
   method_data->method = method;
-  method_data->variables = std::move(ht->Variables());
+  method_data->variables = std::move(ht.variables);
   method_data->body_field_path = std::move(body_field_path);
 
   InsertPathToNode(path_info, method_data.get(), http_method, true,
@@ -493,6 +429,107 @@ bool PathMatcherBuilder<Method>::Register(std::string http_method,
   return true;
 }
 
+template <class Method>
+void PathMatcherBuilder<Method>::Add(std::string http_method,
+                                     std::string http_template,
+                                     std::string body_field_path,
+                                     Method method) {
+  PendingMethod pending;
+  pending.http_method = std::move(http_method);
+  pending.http_template = std::move(http_template);
+  pending.method_data = std::unique_ptr<MethodData>(new MethodData());
+  pending.method_data->method = method;
+  pending.method_data->body_field_path = std::move(body_field_path);
+  pending_.emplace_back(std::move(pending));
+}
+
+template <class Method>
+std::vector<size_t> PathMatcherBuilder<Method>::RegisterPending(
+    size_t max_threads) {
+  // Parses the templates of pending_[i] for i = first, first + step, ...
+  // The threads do not share any state, the strings are interned afterwards.
+  auto parse = [this](size_t first, size_t step) {
+    for (size_t i = first; i < pending_.size(); i += step) {
+      pending_[i].parsed.reset(HttpTemplate::Parse(pending_[i].http_template));
+    }
+  };
+
+  size_t num_threads =
+      std::min(max_threads, pending_.size() / kMinTemplatesPerParseThread);
+  if (num_threads > 1) {
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < num_threads; ++i) {
+      threads.emplace_back(parse, i, num_threads);
+    }
+    parse(0, num_threads);
+    for (auto& thread : threads) {
+      thread.join();
+    }
+  } else {
+    parse(0, 1);
+  }
+
+  for (PendingMethod& pending : pending_) {
+    if (!pending.parsed) {
+      continue;
+    }
+    PooledHttpTemplate ht;
+    HttpTemplate::InternIntoPool(*pending.parsed, string_pool_.get(), &ht);
+    pending.parsed.reset();
+    pending.path = std::move(ht.segments);
+    if (ht.verb != nullptr) {
+      pending.path.push_back(ht.verb);
+    }
+    pending.method_data->variables = std::move(ht.variables);
+  }
+
+  // Sorts the valid templates by path, keeping the registration order of
+  // identical paths so that duplicates are resolved as in Register(). Path
+  // parts are pooled, so comparing their addresses is enough to group paths
+  // with common prefixes together.
+  std::vector<size_t> invalid;
+  std::vector<PendingMethod*> sorted;
+  sorted.reserve(pending_.size());
+  for (size_t i = 0; i < pending_.size(); ++i) {
+    if (pending_[i].path.empty()) {
+      invalid.push_back(i);
+    } else {
+      sorted.push_back(&pending_[i]);
+    }
+  }
+  std::stable_sort(sorted.begin(), sorted.end(),
+                   [](const PendingMethod* a, const PendingMethod* b) {
+                     return std::lexicographical_compare(
+                         a->path.begin(), a->path.end(), b->path.begin(),
+                         b->path.end(), std::less<const std::string*>());
+                   });
+
+  // nodes[k] is the node reached by the first k parts of the previous path.
+  std::vector<PathMatcherNode*> nodes(1, root_ptr_.get());
+  const std::vector<const std::string*>* previous = nullptr;
+  for (PendingMethod* pending : sorted) {
+    const std::vector<const std::string*>& path = pending->path;
+    size_t common = 0;
+    if (previous != nullptr) {
+      auto mismatch =
+          std::mismatch(previous->begin(), previous->end(), path.begin());
+      // Sorted order guarantees path is not a strict prefix of previous.
+      common = mismatch.first - previous->begin();
+    }
+    nodes.resize(common + 1);
+    for (size_t i = common; i < path.size(); ++i) {
+      nodes.push_back(nodes.back()->GetOrCreateChild(*path[i]));
+    }
+    nodes.back()->InsertResult(pending->http_method,
+                               pending->method_data.get(), true);
+    methods_.emplace_back(std::move(pending->method_data));
+    previous = &path;
+  }
+
+  pending_.clear();
+  return invalid;
+}
+
 }  // namespace api_manager
 }  // namespace google
 
@@ -197,29 +197,37 @@ bool PathMatcherNode::InsertTemplate(
     const std::vector<std::string>::const_iterator end, HttpMethod http_method,
     void* method_data, bool mark_duplicates) {
   if (current == end) {
-    PathMatcherLookupResult* const existing = InsertOrReturnExisting(
-        &result_map_, http_method, PathMatcherLookupResult(method_data, false));
-    if (existing != nullptr) {
-      existing->data = method_data;
-      if (mark_duplicates) {
+    return InsertResult(http_method, method_data, mark_duplicates);
+  }
+  return GetOrCreateChild(*current)->InsertTemplate(
+      current + 1, end, http_method, method_data, mark_duplicates);
+}
+
+PathMatcherNode* PathMatcherNode::GetOrCreateChild(const std::string& part) {
+  std::unique_ptr<PathMatcherNode>& child = LookupOrInsertNew(&children_, part);
+  if (part == HttpTemplate::kWildCardPathKey) {
+    child->set_wildcard(true);
+  }
+  return child.get();
+}
+
+bool PathMatcherNode::InsertResult(HttpMethod http_method, void* method_data,
+                                   bool mark_duplicates) {
+  PathMatcherLookupResult* const existing = InsertOrReturnExisting(
+      &result_map_, http_method, PathMatcherLookupResult(method_data, false));
+  if (existing != nullptr) {
+    existing->data = method_data;
+    if (mark_duplicates) {
 #if 0
-        LOG(WARNING) << "The HTTP path '" << http_method << ":"
-                     << ConvertHttpRuleToString(*wrapper_graph->http_rule())
-                     << "' has already been registered.";
+      LOG(WARNING) << "The HTTP path '" << http_method << ":"
+                   << ConvertHttpRuleToString(*wrapper_graph->http_rule())
+                   << "' has already been registered.";
 #endif
-        existing->is_multiple = true;
-      }
-      return false;
+      existing->is_multiple = true;
     }
-    return true;
-  }
-  std::unique_ptr<PathMatcherNode>& child =
-      LookupOrInsertNew(&children_, *current);
-  if (*current == HttpTemplate::kWildCardPathKey) {
-    child->set_wildcard(true);
+    return false;
   }
-  return child->InsertTemplate(current + 1, end, http_method, method_data,
-                               mark_duplicates);
+  return true;
 }
 
 bool PathMatcherNode::LookupPathFromChild(
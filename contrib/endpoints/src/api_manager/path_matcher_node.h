@@ -137,6 +137,16 @@ class PathMatcherNode {
   bool InsertPath(const PathInfo& node_path_info, std::string http_method,
                   void* method_data, bool mark_duplicates);
 
+  // Returns the child node matching the given path part, creating it if it
+  // doesn't exist yet. Used together with InsertResult() by callers that
+  // insert many paths and want to walk shared prefixes only once.
+  PathMatcherNode* GetOrCreateChild(const std::string& part);
+
+  // Registers method_data for http_method at this node. Returns true and
+  // marks duplicates the same way as InsertPath().
+  bool InsertResult(HttpMethod http_method, void* method_data,
+                    bool mark_duplicates);
+
   void set_wildcard(bool wildcard) { wildcard_ = wildcard; }
 
  private:
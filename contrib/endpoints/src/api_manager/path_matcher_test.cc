@@ -122,6 +122,19 @@ class PathMatcherTest : public ::testing::Test {
 
   MethodInfo* AddGetPath(std::string path) { return AddPath("GET", path); }
 
+  MethodInfo* AddPending(std::string http_method, std::string http_template) {
+    auto method = new MethodInfo();
+    ON_CALL(*method, system_query_parameter_names())
+        .WillByDefault(ReturnRef(empty_set_));
+    builder_.Add(http_method, http_template, std::string(), method);
+    stored_methods_.emplace_back(method);
+    return method;
+  }
+
+  std::vector<size_t> RegisterPending(size_t max_threads) {
+    return builder_.RegisterPending(max_threads);
+  }
+
   void Build() { matcher_ = builder_.Build(); }
 
   MethodInfo* LookupWithBodyFieldPath(std::string method, std::string path,
@@ -743,6 +756,84 @@ TEST_F(PathMatcherTest, VariableBindingsWithQueryParamsAndSystemParams) {
       bindings);
 }
 
+TEST_F(PathMatcherTest, RegisterPending) {
+  MethodInfo* a = AddPending("GET", "/a");
+  MethodInfo* a_b = AddPending("GET", "/a/{x}/b");
+  MethodInfo* a_b_c = AddPending("GET", "/a/{x}/b/{y}/c");
+  MethodInfo* a__ = AddPending("GET", "/a/**");
+  MethodInfo* a_verb = AddPending("POST", "/a/{x}:verb");
+  AddPending("GET", "invalid");
+  MethodInfo* c = AddPending("POST", "/c");
+  AddPending("GET", "/a/**/*");
+  EXPECT_EQ(std::vector<size_t>({5, 7}), RegisterPending(1));
+  Build();
+
+  Bindings bindings;
+  EXPECT_EQ(LookupNoBindings("GET", "/a"), a);
+  EXPECT_EQ(Lookup("GET", "/a/book/b", &bindings), a_b);
+  EXPECT_EQ(Bindings({Binding{FieldPath{"x"}, "book"}}), bindings);
+  EXPECT_EQ(Lookup("GET", "/a/hello/b/endpoints/c", &bindings), a_b_c);
+  EXPECT_EQ(Bindings({
+                Binding{FieldPath{"x"}, "hello"},
+                Binding{FieldPath{"y"}, "endpoints"},
+            }),
+            bindings);
+  EXPECT_EQ(LookupNoBindings("GET", "/a/b/c/d"), a__);
+  EXPECT_EQ(Lookup("POST", "/a/x:verb", &bindings), a_verb);
+  EXPECT_EQ(LookupNoBindings("POST", "/c"), c);
+  EXPECT_EQ(LookupNoBindings("GET", "/c"), nullptr);
+}
+
+TEST_F(PathMatcherTest, RegisterPendingMarksDuplicates) {
+  MethodInfo* first = AddPending("GET", "/foo/bar");
+  MethodInfo* second = AddPending("GET", "/foo/bar");
+  MethodInfo* other = AddPending("GET", "/foo/{x}");
+  EXPECT_TRUE(RegisterPending(1).empty());
+  Build();
+
+  EXPECT_NE(first, LookupNoBindings("GET", "/foo/bar"));
+  EXPECT_NE(second, LookupNoBindings("GET", "/foo/bar"));
+  Bindings bindings;
+  EXPECT_EQ(Lookup("GET", "/foo/baz", &bindings), other);
+}
+
+TEST_F(PathMatcherTest, RegisterPendingMixedWithRegister) {
+  MethodInfo* a = AddGetPath("/a/b");
+  MethodInfo* a_c = AddPending("GET", "/a/c");
+  EXPECT_TRUE(RegisterPending(1).empty());
+  MethodInfo* a_d = AddGetPath("/a/d");
+  Build();
+
+  EXPECT_EQ(LookupNoBindings("GET", "/a/b"), a);
+  EXPECT_EQ(LookupNoBindings("GET", "/a/c"), a_c);
+  EXPECT_EQ(LookupNoBindings("GET", "/a/d"), a_d);
+}
+
+TEST_F(PathMatcherTest, RegisterPendingInParallel) {
+  const int kMethods = 5000;
+  std::vector<MethodInfo*> methods;
+  for (int i = 0; i < kMethods; ++i) {
+    std::ostringstream path;
+    path << "/v1/shelves/{shelf}/books" << i % 50 << "/{book}/pages" << i;
+    methods.push_back(AddPending("GET", path.str()));
+  }
+  AddPending("GET", "/v1/{invalid");
+  EXPECT_EQ(std::vector<size_t>({kMethods}), RegisterPending(8));
+  Build();
+
+  for (int i = 0; i < kMethods; ++i) {
+    std::ostringstream path;
+    path << "/v1/shelves/s1/books" << i % 50 << "/b2/pages" << i;
+    Bindings bindings;
+    EXPECT_EQ(Lookup("GET", path.str(), &bindings), methods[i]);
+    EXPECT_EQ(Bindings({
+                  Binding{FieldPath{"shelf"}, "s1"},
+                  Binding{FieldPath{"book"}, "b2"},
+              }),
+              bindings);
+  }
+}
+
 }  // namespace
 
 }  // namespace api_manager
@@ -19,6 +19,8 @@
 #include <sstream>
 #include <typeinfo>
 #include "contrib/endpoints/src/api_manager/service_control/logs_metrics_loader.h"
+#include "contrib/endpoints/src/api_manager/utils/buffer_chain_stream.h"
+#include "google/protobuf/arena.h"
 
 using ::google::api::servicecontrol::v1::CheckRequest;
 using ::google::api::servicecontrol::v1::CheckResponse;
@@ -27,7 +29,10 @@ using ::google::api::servicecontrol::v1::AllocateQuotaResponse;
 using ::google::api::servicecontrol::v1::ReportRequest;
 using ::google::api::servicecontrol::v1::ReportResponse;
 using ::google::api_manager::proto::ServerConfig;
+using ::google::api_manager::proto::ServiceControlConfig;
 using ::google::api_manager::utils::Status;
+using ::google::protobuf::Arena;
+using ::google::protobuf::ArenaOptions;
 using ::google::protobuf::util::error::Code;
 
 using ::google::service_control_client::CheckAggregationOptions;
@@ -46,6 +51,11 @@ namespace {
 const int kQuotaAggregationEntries = 10000;
 const int kQuotaAggregationRefreshMs = 1000;
 
+// Default config for the quota prefetch. Prefetched tokens left unused
+// after the TTL are dropped.
+const int kQuotaPrefetchMaxChunk = 1000;
+const int kQuotaPrefetchTokenTtlMs = 10000;
+
 // Default config for check aggregator
 const int kCheckAggregationEntries = 10000;
 // Check doesn't support quota yet. It is safe to increase
@@ -58,6 +68,13 @@ const int kCheckAggregationExpirationMs = 300000;
 const int kReportAggregationEntries = 10000;
 const int kReportAggregationFlushIntervalMs = 1000;
 
+// Default config for the local report pre-aggregation. The flush interval
+// and the batch size adapt to the load between the min and max values.
+const int kLocalReportAggregationEntries = 10000;
+const int kLocalReportAggregationMinEntries = 100;
+const int kLocalReportAggregationFlushIntervalMs = 100;
+const int kLocalReportAggregationMaxFlushIntervalMs = 1000;
+
 // The default connection timeout for check requests.
 const int kCheckDefaultTimeoutInMs = 5000;
 // The default connection timeout for allocate quota requests.
@@ -65,10 +82,12 @@ const int kAllocateQuotaDefaultTimeoutInMs = 1000;
 // The default connection timeout for report requests.
 const int kReportDefaultTimeoutInMs = 15000;
 
-// The maximum protobuf pool size. All usages of pool alloc() and free() are
-// within a function frame. If no con-current usage, pool size of 1 is enough.
-// This number should correspond to maximum of concurrent calls.
-const int kProtoPoolMaxSize = 100;
+// The default maximum size of report requests, larger ones are split.
+const int kMaxReportSizeBytes = 1000000;
+
+// The size of the first block of the per-thread request arenas. It is kept
+// across resets, and fits the requests of typical calls.
+const size_t kArenaInitialBlockSize = 16 * 1024;
 
 // Defines protobuf content type.
 const char application_proto[] = "application/x-protobuf";
@@ -81,6 +100,11 @@ const char servicecontrol_service[] =
 const char quotacontrol_service[] =
     "/google.api.servicecontrol.v1.QuotaController";
 
+// The gRPC methods of the service_control and quota_control services.
+const char check_method[] = "Check";
+const char report_method[] = "Report";
+const char allocate_quota_method[] = "AllocateQuota";
+
 // Generates CheckAggregationOptions.
 CheckAggregationOptions GetCheckAggregationOptions(
     const ServerConfig* server_config) {
@@ -115,6 +139,27 @@ QuotaAggregationOptions GetQuotaAggregationOptions(
   return option;
 }
 
+// Returns whether quota is prefetched.
+bool IsQuotaPrefetchEnabled(const ServerConfig* server_config) {
+  return server_config && server_config->has_service_control_config() &&
+         server_config->service_control_config()
+             .quota_aggregator_config()
+             .enable_prefetch();
+}
+
+// Returns the maximum amount of a quota prefetch.
+int GetQuotaPrefetchMaxChunk(const ServerConfig* server_config) {
+  if (server_config && server_config->has_service_control_config()) {
+    int max_chunk = server_config->service_control_config()
+                        .quota_aggregator_config()
+                        .prefetch_max_chunk();
+    if (max_chunk > 0) {
+      return max_chunk;
+    }
+  }
+  return kQuotaPrefetchMaxChunk;
+}
+
 // Generates ReportAggregationOptions.
 ReportAggregationOptions GetReportAggregationOptions(
     const ServerConfig* server_config) {
@@ -129,27 +174,140 @@ ReportAggregationOptions GetReportAggregationOptions(
                                   kReportAggregationFlushIntervalMs);
 }
 
-}  // namespace
+// Returns the maximum size of report requests.
+size_t GetMaxReportSizeBytes(const ServerConfig* server_config) {
+  if (server_config && server_config->has_service_control_config() &&
+      server_config->service_control_config().max_report_size_bytes() > 0) {
+    return server_config->service_control_config().max_report_size_bytes();
+  }
+  return kMaxReportSizeBytes;
+}
 
-template <class Type>
-std::unique_ptr<Type> Aggregated::ProtoPool<Type>::Alloc() {
-  std::lock_guard<std::mutex> lock(mutex_);
-  if (!pool_.empty()) {
-    auto item = std::move(pool_.front());
-    pool_.pop_front();
-    item->Clear();
-    return item;
-  } else {
-    return std::unique_ptr<Type>(new Type);
+// Returns whether the calls to service control are made with gRPC.
+bool UseGRPCTransport(const ServerConfig* server_config) {
+  return server_config && server_config->has_service_control_config() &&
+         server_config->service_control_config().transport() ==
+             ServiceControlConfig::GRPC;
+}
+
+// Returns the content encoding of report requests.
+ServiceControlConfig::ContentEncoding GetReportContentEncoding(
+    const ServerConfig* server_config) {
+  if (server_config && server_config->has_service_control_config()) {
+    return server_config->service_control_config().report_content_encoding();
   }
+  return ServiceControlConfig::IDENTITY;
 }
 
-template <class Type>
-void Aggregated::ProtoPool<Type>::Free(std::unique_ptr<Type> item) {
-  std::lock_guard<std::mutex> lock(mutex_);
-  if (pool_.size() < kProtoPoolMaxSize) {
-    pool_.push_back(std::move(item));
+// The state of a report request split into several calls.
+struct SplitReportCall {
+  // The calls not done yet.
+  int pending;
+  // The status of the first failed call, if any.
+  ::google::protobuf::util::Status status;
+  // The responses of the calls.
+  std::vector<ReportResponse> responses;
+};
+
+// The protobuf arena used by a thread to build its requests.
+class ThreadArena {
+ public:
+  ThreadArena()
+      : initial_block_(new char[kArenaInitialBlockSize]),
+        arena_(Options(initial_block_.get())),
+        users_(0) {}
+
+  // Returns the arena of the calling thread.
+  static ThreadArena* Get() {
+    static thread_local ThreadArena thread_arena;
+    return &thread_arena;
   }
+
+  // Creates a message on the arena.
+  template <class Type>
+  Type* Create() {
+    ++users_;
+    return Arena::CreateMessage<Type>(&arena_);
+  }
+
+  // Releases a message created on the arena. The arena is reset when no
+  // message is left, which keeps the initial block for the next requests.
+  void Release() {
+    if (--users_ == 0) {
+      arena_.Reset();
+    }
+  }
+
+ private:
+  static ArenaOptions Options(char* initial_block) {
+    ArenaOptions options;
+    options.initial_block = initial_block;
+    options.initial_block_size = kArenaInitialBlockSize;
+    return options;
+  }
+
+  std::unique_ptr<char[]> initial_block_;
+  Arena arena_;
+  // The number of messages created on the arena and not released yet.
+  int users_;
+};
+
+// Returns the number of entries of the local report pre-aggregation, 0 if it
+// is disabled.
+int GetLocalReportAggregationEntries(const ServerConfig* server_config) {
+  if (server_config && server_config->has_service_control_config() &&
+      server_config->service_control_config().has_report_aggregator_config()) {
+    const auto& config =
+        server_config->service_control_config().report_aggregator_config();
+    if (config.disable_local_aggregation()) {
+      return 0;
+    }
+    if (config.local_cache_entries() > 0) {
+      return config.local_cache_entries();
+    }
+  }
+  return kLocalReportAggregationEntries;
+}
+
+// Returns the flush interval of the local report pre-aggregation.
+int GetLocalReportAggregationFlushIntervalMs(
+    const ServerConfig* server_config) {
+  if (server_config && server_config->has_service_control_config() &&
+      server_config->service_control_config().has_report_aggregator_config()) {
+    int flush_interval_ms = server_config->service_control_config()
+                                .report_aggregator_config()
+                                .local_flush_interval_ms();
+    if (flush_interval_ms > 0) {
+      return flush_interval_ms;
+    }
+  }
+  return kLocalReportAggregationFlushIntervalMs;
+}
+
+// Returns the maximum flush interval of the local report pre-aggregation.
+int GetLocalReportAggregationMaxFlushIntervalMs(
+    const ServerConfig* server_config) {
+  if (server_config && server_config->has_service_control_config() &&
+      server_config->service_control_config().has_report_aggregator_config()) {
+    int flush_interval_ms = server_config->service_control_config()
+                                .report_aggregator_config()
+                                .local_max_flush_interval_ms();
+    if (flush_interval_ms > 0) {
+      return flush_interval_ms;
+    }
+  }
+  return kLocalReportAggregationMaxFlushIntervalMs;
+}
+
+}  // namespace
+
+template <class Type>
+Aggregated::ArenaProto<Type>::ArenaProto()
+    : proto_(ThreadArena::Get()->Create<Type>()) {}
+
+template <class Type>
+Aggregated::ArenaProto<Type>::~ArenaProto() {
+  ThreadArena::Get()->Release();
 }
 
 Aggregated::Aggregated(const ::google::api::Service& service,
@@ -166,9 +324,20 @@ Aggregated::Aggregated(const ::google::api::Service& service,
       service_control_proto_(logs, metrics, labels, service.name(),
                              service.id()),
       url_(service_, server_config),
+      grpc_transport_(UseGRPCTransport(server_config)),
       mismatched_check_config_id(service.id()),
       mismatched_report_config_id(service.id()),
-      max_report_size_(0) {
+      max_report_size_(0),
+      max_report_bytes_(GetMaxReportSizeBytes(server_config)),
+      compress_reports_(GetReportContentEncoding(server_config) !=
+                        ServiceControlConfig::IDENTITY),
+      report_content_encoding_(GetReportContentEncoding(server_config) ==
+                                       ServiceControlConfig::DEFLATE
+                                   ? DEFLATE
+                                   : GZIP),
+      send_report_splits_(0),
+      send_report_bytes_(0),
+      send_report_compressed_bytes_(0) {
   if (sa_token_) {
     sa_token_->SetAudience(
         auth::ServiceAccountToken::JWT_TOKEN_FOR_SERVICE_CONTROL,
@@ -188,10 +357,17 @@ Aggregated::Aggregated(const std::set<std::string>& logs,
       sa_token_(nullptr),
       service_control_proto_(logs, "", ""),
       url_(service_, server_config_),
+      grpc_transport_(false),
       client_(std::move(client)),
-      max_report_size_(0) {}
+      max_report_size_(0),
+      max_report_bytes_(kMaxReportSizeBytes),
+      compress_reports_(false),
+      report_content_encoding_(GZIP),
+      send_report_splits_(0),
+      send_report_bytes_(0),
+      send_report_compressed_bytes_(0) {}
 
-Aggregated::~Aggregated() {}
+Aggregated::~Aggregated() { Close(); }
 
 Status Aggregated::Init() {
   // Init() can be called repeatedly.
@@ -227,7 +403,7 @@ Status Aggregated::Init() {
 
   options.report_transport = [this](
       const ReportRequest& request, ReportResponse* response,
-      TransportDoneFunc on_done) { Call(request, response, on_done, nullptr); };
+      TransportDoneFunc on_done) { CallReport(request, response, on_done); };
 
   options.periodic_timer = [this](int interval_ms,
                                   std::function<void()> callback)
@@ -238,28 +414,114 @@ Status Aggregated::Init() {
       };
   client_ = ::google::service_control_client::CreateServiceControlClient(
       service_->name(), service_->id(), options);
+
+  int local_entries = GetLocalReportAggregationEntries(server_config_);
+  if (local_entries > 0) {
+    int min_interval_ms =
+        GetLocalReportAggregationFlushIntervalMs(server_config_);
+    int max_interval_ms =
+        GetLocalReportAggregationMaxFlushIntervalMs(server_config_);
+    std::stringstream ss;
+    ss << "Local_report_aggregation_options: "
+       << "num_entries: " << local_entries
+       << ", flush_interval_ms: " << min_interval_ms
+       << ", max_flush_interval_ms: " << max_interval_ms;
+    env_->LogInfo(ss.str().c_str());
+
+    report_aggregator_.reset(
+        new ReportAggregator(&service_control_proto_, local_entries));
+    report_flush_controller_.reset(new ReportFlushController(
+        min_interval_ms, max_interval_ms, kLocalReportAggregationMinEntries,
+        local_entries, std::chrono::steady_clock::now()));
+    // The timer ticks at the minimum interval, the controller decides which
+    // ticks flush.
+    report_flush_timer_ = env_->StartPeriodicTimer(
+        std::chrono::milliseconds(min_interval_ms),
+        [this]() { MaybeFlushAggregatedReports(); });
+  }
+
+  if (IsQuotaPrefetchEnabled(server_config_)) {
+    const auto& quota_options = options.quota_options;
+    int refresh_interval_ms = quota_options.refresh_interval_ms > 0
+                                  ? quota_options.refresh_interval_ms
+                                  : kQuotaAggregationRefreshMs;
+    int max_buckets = quota_options.num_entries > 0
+                          ? quota_options.num_entries
+                          : kQuotaAggregationEntries;
+    int max_chunk = GetQuotaPrefetchMaxChunk(server_config_);
+    std::stringstream ss;
+    ss << "Quota_prefetch_options: "
+       << "refresh_interval_ms: " << refresh_interval_ms
+       << ", token_ttl_ms: " << kQuotaPrefetchTokenTtlMs
+       << ", max_chunk: " << max_chunk << ", max_buckets: " << max_buckets;
+    env_->LogInfo(ss.str().c_str());
+
+    quota_prefetcher_.reset(new QuotaPrefetcher(
+        refresh_interval_ms, kQuotaPrefetchTokenTtlMs, max_chunk, max_buckets));
+  }
   return Status::OK;
 }
 
 Status Aggregated::Close() {
+  if (report_flush_timer_) {
+    report_flush_timer_->Stop();
+    report_flush_timer_.reset();
+  }
+  if (report_aggregator_ && client_) {
+    FlushAggregatedReports();
+  }
+  report_aggregator_.reset();
+  report_flush_controller_.reset();
+  quota_prefetcher_.reset();
   // Just destroy the client to flush all its cache.
   client_.reset();
   return Status::OK;
 }
 
+void Aggregated::FlushAggregatedReports() {
+  ReportRequest request;
+  size_t reports = 0;
+  Status status = report_aggregator_->Flush(&request, &reports);
+  if (!status.ok()) {
+    env_->LogError(std::string("Failed to flush aggregated reports. ") +
+                   status.ToString());
+  }
+  report_flush_controller_->OnFlush(std::chrono::steady_clock::now(), reports,
+                                    request.operations_size());
+  if (request.operations_size() > 0) {
+    SendReport(request);
+  }
+}
+
+void Aggregated::MaybeFlushAggregatedReports() {
+  if (report_flush_controller_->ShouldFlush(std::chrono::steady_clock::now(),
+                                            report_aggregator_->size())) {
+    FlushAggregatedReports();
+  }
+}
+
 Status Aggregated::Report(const ReportRequestInfo& info) {
   if (!client_) {
     return Status(Code::INTERNAL, "Missing service control client");
   }
-  auto request = report_pool_.Alloc();
+  if (report_aggregator_ && report_aggregator_->Add(info)) {
+    return Status::OK;
+  }
+  ArenaProto<ReportRequest> request;
   Status status = service_control_proto_.FillReportRequest(info, request.get());
   if (!status.ok()) {
-    report_pool_.Free(std::move(request));
     return status;
   }
+  SendReport(*request);
+  // There is no reference to request anymore at this point and it is safe to
+  // free request when it goes out of scope.
+  return Status::OK;
+}
+
+void Aggregated::SendReport(const ReportRequest& request) {
   ReportResponse* response = new ReportResponse;
   client_->Report(
-      *request, response,
+      request, response,
       [this, response](const ::google::protobuf::util::Status& status) {
         if (service_control_proto_.service_config_id() !=
             response->service_config_id()) {
@@ -278,10 +540,43 @@ Status Aggregated::Report(const ReportRequestInfo& info) {
         }
         delete response;
       });
-  // There is no reference to request anymore at this point and it is safe to
-  // free request now.
-  report_pool_.Free(std::move(request));
-  return Status::OK;
+}
+
+void Aggregated::CallReport(const ReportRequest& request,
+                            ReportResponse* response,
+                            TransportDoneFunc on_done) {
+  if (request.operations_size() <= 1 ||
+      static_cast<size_t>(request.ByteSize()) <= max_report_bytes_) {
+    Call(request, response, on_done, nullptr);
+    return;
+  }
+
+  std::vector<ReportRequest> requests;
+  Proto::SplitReportRequest(request, max_report_bytes_, &requests);
+  send_report_splits_ += requests.size() - 1;
+
+  // The response merges the responses of all the calls, which are done once
+  // all the calls are.
+  std::shared_ptr<SplitReportCall> split(new SplitReportCall);
+  split->pending = requests.size();
+  split->responses.resize(requests.size());
+  for (size_t i = 0; i < requests.size(); ++i) {
+    Call(requests[i], &split->responses[i],
+         [split, response,
+          on_done](const ::google::protobuf::util::Status& status) {
+           if (!status.ok() && split->status.ok()) {
+             split->status = status;
+           }
+           if (--split->pending > 0) {
+             return;
+           }
+           for (const ReportResponse& part : split->responses) {
+             response->MergeFrom(part);
+           }
+           on_done(split->status);
+         },
+         nullptr);
+  }
 }
 
 void Aggregated::Check(
@@ -295,11 +590,10 @@ void Aggregated::Check(
             dummy_response_info);
     return;
   }
-  auto request = check_pool_.Alloc();
+  ArenaProto<CheckRequest> request;
   Status status = service_control_proto_.FillCheckRequest(info, request.get());
   if (!status.ok()) {
     on_done(status, dummy_response_info);
-    check_pool_.Free(std::move(request));
     return;
   }
 
@@ -358,8 +652,7 @@ void Aggregated::Check(
         Call(request, response, on_done, trace_span.get());
       });
   // There is no reference to request anymore at this point and it is safe to
-  // free request now.
-  check_pool_.Free(std::move(request));
+  // free request when it goes out of scope.
 }
 
 void Aggregated::Quota(const QuotaRequestInfo& info,
@@ -373,13 +666,17 @@ void Aggregated::Quota(const QuotaRequestInfo& info,
     return;
   }
 
-  auto request = quota_pool_.Alloc();
+  if (quota_prefetcher_ && info.metric_cost_vector) {
+    QuotaFromPrefetch(info, trace_span, on_done);
+    return;
+  }
+
+  ArenaProto<AllocateQuotaRequest> request;
 
   Status status =
       service_control_proto_.FillAllocateQuotaRequest(info, request.get());
   if (!status.ok()) {
     on_done(status);
-    quota_pool_.Free(std::move(request));
     return;
   }
 
@@ -409,8 +706,89 @@ void Aggregated::Quota(const QuotaRequestInfo& info,
                  });
 
   // There is no reference to request anymore at this point and it is safe to
-  // free request now.
-  quota_pool_.Free(std::move(request));
+  // free request when it goes out of scope.
+}
+
+void Aggregated::QuotaFromPrefetch(
+    const QuotaRequestInfo& info,
+    std::shared_ptr<cloud_trace::CloudTraceSpan> trace_span,
+    std::function<void(utils::Status)> on_done) {
+  std::string consumer = info.api_key.ToString();
+  const QuotaPrefetcher::MetricCosts& costs = *info.metric_cost_vector;
+  std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+
+  Status status = Status::OK;
+  bool covered = quota_prefetcher_->Acquire(consumer, costs, now, &status);
+  QuotaPrefetcher::MetricCosts amounts;
+  if (quota_prefetcher_->StartFetch(consumer, costs, now, &amounts)) {
+    PrefetchQuota(info, consumer, amounts, trace_span);
+  }
+
+  if (!covered) {
+    // E.g. the first requests of the consumer, before a prefetch is granted.
+    TRACE(trace_span) << "Quota not covered by the prefetched tokens";
+    AllocateQuota(info, costs, trace_span, on_done);
+    return;
+  }
+  TRACE(trace_span) << "Quota answered from the prefetched tokens with "
+                    << "status " << status.ToString();
+  on_done(status);
+}
+
+void Aggregated::PrefetchQuota(
+    const QuotaRequestInfo& info, const std::string& consumer,
+    const QuotaPrefetcher::MetricCosts& amounts,
+    std::shared_ptr<cloud_trace::CloudTraceSpan> trace_span) {
+  // The prefetch has its own operation id, so that service control does not
+  // take it for a retry of the allocation made for the request itself.
+  std::string operation_id = info.operation_id.ToString() + ":prefetch";
+  QuotaRequestInfo prefetch_info = info;
+  prefetch_info.operation_id = operation_id;
+  AllocateQuota(prefetch_info, amounts, trace_span,
+                [this, consumer, amounts](Status status) {
+                  // The prefetcher is gone if the client was closed
+                  // meanwhile.
+                  if (quota_prefetcher_) {
+                    quota_prefetcher_->OnFetchDone(
+                        consumer, amounts, status,
+                        std::chrono::steady_clock::now());
+                  }
+                });
+}
+
+void Aggregated::AllocateQuota(
+    const QuotaRequestInfo& info, const QuotaPrefetcher::MetricCosts& amounts,
+    std::shared_ptr<cloud_trace::CloudTraceSpan> trace_span,
+    std::function<void(utils::Status)> on_done) {
+  ArenaProto<AllocateQuotaRequest> request;
+  QuotaRequestInfo amounts_info = info;
+  amounts_info.metric_cost_vector = &amounts;
+  Status status = service_control_proto_.FillAllocateQuotaRequest(
+      amounts_info, request.get());
+  if (!status.ok()) {
+    on_done(status);
+    return;
+  }
+  // All or nothing, so that the tokens allocated are the ones requested.
+  request->mutable_allocate_operation()->set_quota_mode(
+      ::google::api::servicecontrol::v1::QuotaOperation_QuotaMode::
+          QuotaOperation_QuotaMode_NORMAL);
+
+  AllocateQuotaResponse* response = new AllocateQuotaResponse();
+  auto allocate_on_done = [this, response, on_done, trace_span](
+      const ::google::protobuf::util::Status& status) {
+    TRACE(trace_span) << "AllocateQuotaRequest returned with status: "
+                      << status.ToString();
+    Status result =
+        status.ok()
+            ? Proto::ConvertAllocateQuotaResponse(
+                  *response, service_control_proto_.service_name())
+            : Status(status.error_code(), status.error_message(),
+                     Status::SERVICE_CONTROL);
+    delete response;
+    on_done(result);
+  };
+  Call(*request, response, allocate_on_done, trace_span.get());
 }
 
 Status Aggregated::GetStatistics(Statistics* esp_stat) const {
@@ -433,6 +811,17 @@ Status Aggregated::GetStatistics(Statistics* esp_stat) const {
   esp_stat->send_reports_in_flight = client_stat.send_reports_in_flight;
   esp_stat->send_report_operations = client_stat.send_report_operations;
   esp_stat->max_report_size = max_report_size_;
+  esp_stat->send_report_splits = send_report_splits_;
+  esp_stat->send_report_bytes = send_report_bytes_;
+  esp_stat->send_report_compressed_bytes = send_report_compressed_bytes_;
+  if (report_flush_controller_) {
+    esp_stat->report_flush_interval_ms =
+        report_flush_controller_->interval_ms();
+    esp_stat->report_flush_entries = report_flush_controller_->batch_entries();
+  } else {
+    esp_stat->report_flush_interval_ms = 0;
+    esp_stat->report_flush_entries = 0;
+  }
 
   return Status::OK;
 }
@@ -448,6 +837,27 @@ const std::string& Aggregated::GetApiReqeustUrl() {
   }
 }
 
+template <class RequestType>
+const char* Aggregated::GetGRPCService() {
+  // The service names are the JWT audiences without the leading '/'.
+  if (typeid(RequestType) == typeid(AllocateQuotaRequest)) {
+    return quotacontrol_service + 1;
+  } else {
+    return servicecontrol_service + 1;
+  }
+}
+
+template <class RequestType>
+const char* Aggregated::GetGRPCMethod() {
+  if (typeid(RequestType) == typeid(CheckRequest)) {
+    return check_method;
+  } else if (typeid(RequestType) == typeid(AllocateQuotaRequest)) {
+    return allocate_quota_method;
+  } else {
+    return report_method;
+  }
+}
+
 template <class RequestType>
 int Aggregated::GetHttpRequestTimeout() {
   int timeout_ms = 0;
@@ -483,7 +893,7 @@ int Aggregated::GetHttpRequestTimeout() {
 }
 
 template <class RequestType>
-const std::string& Aggregated::GetAuthToken() {
+std::string Aggregated::GetAuthToken() {
   if (sa_token_) {
     if (typeid(RequestType) == typeid(AllocateQuotaRequest)) {
       return sa_token_->GetAuthToken(
@@ -493,8 +903,7 @@ const std::string& Aggregated::GetAuthToken() {
           auth::ServiceAccountToken::JWT_TOKEN_FOR_SERVICE_CONTROL);
     }
   } else {
-    static std::string empty;
-    return empty;
+    return std::string();
   }
 }
 
@@ -505,23 +914,29 @@ void Aggregated::Call(const RequestType& request, ResponseType* response,
   std::shared_ptr<cloud_trace::CloudTraceSpan> trace_span(
       CreateChildSpan(parent_span, "Call ServiceControl server"));
 
+  if (grpc_transport_) {
+    CallGRPC(request, response, on_done, trace_span);
+    return;
+  }
+
   const std::string& url = GetApiReqeustUrl<RequestType>();
   TRACE(trace_span) << "Http request URL: " << url;
 
-  std::unique_ptr<HTTPRequest> http_request(new HTTPRequest([url, response,
-                                                             on_done,
-                                                             trace_span, this](
-      Status status, std::map<std::string, std::string>&&, std::string&& body) {
+  // The response is parsed from the buffers it was received in.
+  HTTPRequest::BufferChainCallback callback = [url, response, on_done,
+                                               trace_span, this](
+      Status status, std::map<std::string, std::string>&&, BufferChain&& body) {
     TRACE(trace_span) << "HTTP response status: " << status.ToString();
     if (status.ok()) {
       // Handle 200 response
-      if (!response->ParseFromString(body)) {
+      if (!utils::ParseFromBufferChain(body, response)) {
         status =
             Status(Code::INVALID_ARGUMENT, std::string("Invalid response"));
       }
     } else {
       env_->LogError(std::string("Failed to call ") + url + ", Error: " +
-                     status.ToString() + ", Response body: " + body);
+                     status.ToString() + ", Response body: " +
+                     body.ToString());
 
       // Handle NGX error as opposed to pass-through error code
       if (status.code() < 0) {
@@ -535,27 +950,99 @@ void Aggregated::Call(const RequestType& request, ResponseType* response,
       }
     }
     on_done(status.ToProto());
-  }));
-
-  std::string request_body;
-  request.SerializeToString(&request_body);
+  };
+  std::unique_ptr<HTTPRequest> http_request(new HTTPRequest(callback));
 
-  if ((typeid(RequestType) == typeid(ReportRequest)) &&
-      (request_body.size() > max_report_size_)) {
-    max_report_size_ = request_body.size();
-  }
+  // The request is serialized into the buffer handed to the environment.
+  BufferChain request_body;
+  utils::SerializeToBufferChain(request, &request_body);
 
   http_request->set_url(url)
       .set_method("POST")
       .set_auth_token(GetAuthToken<RequestType>())
       .set_header("Content-Type", application_proto)
-      .set_body(request_body);
+      .set_body(std::move(request_body));
+
+  if (typeid(RequestType) == typeid(ReportRequest)) {
+    uint64_t size = http_request->body_chain().size();
+    if (size > max_report_size_) {
+      max_report_size_ = size;
+    }
+    send_report_bytes_ += size;
+    if (compress_reports_) {
+      std::string compressed;
+      Status status = Compress(report_content_encoding_, http_request->body(),
+                               &compressed);
+      if (status.ok()) {
+        http_request->set_header("Content-Encoding",
+                                 ContentEncodingName(report_content_encoding_));
+        http_request->set_body(std::move(compressed));
+      } else {
+        env_->LogError("Failed to compress the report request, sending it "
+                       "uncompressed. " +
+                       status.ToString());
+      }
+    }
+    send_report_compressed_bytes_ += http_request->body_chain().size();
+  }
 
   http_request->set_timeout_ms(GetHttpRequestTimeout<RequestType>());
 
   env_->RunHTTPRequest(std::move(http_request));
 }
 
+template <class RequestType, class ResponseType>
+void Aggregated::CallGRPC(const RequestType& request, ResponseType* response,
+                          TransportDoneFunc on_done,
+                          std::shared_ptr<cloud_trace::CloudTraceSpan>
+                              trace_span) {
+  const char* service = GetGRPCService<RequestType>();
+  const char* method = GetGRPCMethod<RequestType>();
+  TRACE(trace_span) << "gRPC request: " << service << "/" << method;
+
+  std::function<void(Status, std::string&&)> callback = [service, method,
+                                                         response, on_done,
+                                                         trace_span, this](
+      Status status, std::string&& body) {
+    TRACE(trace_span) << "gRPC response status: " << status.ToString();
+    if (status.ok()) {
+      if (!response->ParseFromString(body)) {
+        status =
+            Status(Code::INVALID_ARGUMENT, std::string("Invalid response"));
+      }
+    } else {
+      env_->LogError(std::string("Failed to call ") + service + "/" + method +
+                     ", Error: " + status.ToString());
+      status = Status(Code::UNAVAILABLE,
+                      "Service control gRPC call failed: " + status.message());
+    }
+    on_done(status.ToProto());
+  };
+  std::unique_ptr<GRPCRequest> grpc_request(new GRPCRequest(callback));
+
+  std::string request_body;
+  request.SerializeToString(&request_body);
+  if (typeid(RequestType) == typeid(ReportRequest)) {
+    uint64_t size = request_body.size();
+    if (size > max_report_size_) {
+      max_report_size_ = size;
+    }
+    send_report_bytes_ += size;
+    // gRPC messages are not compressed by the API Manager.
+    send_report_compressed_bytes_ += size;
+  }
+
+  grpc_request->set_server(url_.grpc_server())
+      .set_use_tls(url_.grpc_use_tls())
+      .set_service(service)
+      .set_method(method)
+      .set_auth_token(GetAuthToken<RequestType>())
+      .set_body(std::move(request_body))
+      .set_timeout_ms(GetHttpRequestTimeout<RequestType>());
+
+  env_->RunGRPCRequest(std::move(grpc_request));
+}
+
 Interface* Aggregated::Create(const ::google::api::Service& service,
                               const ServerConfig* server_config,
                               ApiManagerEnvInterface* env,
@@ -19,17 +19,18 @@
 #include "contrib/endpoints/src/api_manager/auth/service_account_token.h"
 #include "contrib/endpoints/src/api_manager/cloud_trace/cloud_trace.h"
 #include "contrib/endpoints/src/api_manager/proto/server_config.pb.h"
+#include "contrib/endpoints/src/api_manager/service_control/compression.h"
 #include "contrib/endpoints/src/api_manager/service_control/interface.h"
 #include "contrib/endpoints/src/api_manager/service_control/proto.h"
+#include "contrib/endpoints/src/api_manager/service_control/quota_prefetcher.h"
+#include "contrib/endpoints/src/api_manager/service_control/report_aggregator.h"
+#include "contrib/endpoints/src/api_manager/service_control/report_flush_controller.h"
 #include "contrib/endpoints/src/api_manager/service_control/url.h"
 #include "google/api/service.pb.h"
 #include "google/api/servicecontrol/v1/quota_controller.pb.h"
 #include "google/api/servicecontrol/v1/service_controller.pb.h"
 #include "include/service_control_client.h"
 
-#include <list>
-#include <mutex>
-
 namespace google {
 namespace api_manager {
 namespace service_control {
@@ -77,23 +78,24 @@ class Aggregated : public Interface {
     std::unique_ptr<::google::api_manager::PeriodicTimer> esp_timer_;
   };
 
-  // The protobuf pool to reuse protobuf. Performance tests showed that reusing
-  // protobuf is faster than allocating a new protobuf.
+  // A request protobuf created on the protobuf arena of the calling thread.
+  // The arena is reset once the last protobuf created on it is destroyed,
+  // so building and discarding a request is a few bump pointer allocations
+  // in reused memory, instead of freeing all its nested messages one by one.
+  // Requests may be nested, e.g. when a Check is done synchronously and its
+  // callback calls Quota.
   template <class Type>
-  class ProtoPool {
+  class ArenaProto {
    public:
-    // Allocates a protobuf. If there is one in the pool, uses it, otherwise
-    // creates a new one.
-    std::unique_ptr<Type> Alloc();
-    // Frees a protobuf. If pool did not reach maximum size, stores it in the
-    // pool, otherwise frees it.
-    void Free(std::unique_ptr<Type> item);
+    ArenaProto();
+    ~ArenaProto();
+
+    Type* get() const { return proto_; }
+    Type& operator*() const { return *proto_; }
 
    private:
-    // Protobuf pool to store used protobufs.
-    std::list<std::unique_ptr<Type>> pool_;
-    // Mutex to protect the protobuf pool.
-    std::mutex mutex_;
+    // Owned by the arena.
+    Type* proto_;
   };
 
   friend class AggregatedTestWithMockedClient;
@@ -116,17 +118,67 @@ class Aggregated : public Interface {
             ::google::service_control_client::TransportDoneFunc on_done,
             cloud_trace::CloudTraceSpan* parent_span);
 
+  // Calls to service control server with gRPC.
+  template <class RequestType, class ResponseType>
+  void CallGRPC(const RequestType& request, ResponseType* response,
+                ::google::service_control_client::TransportDoneFunc on_done,
+                std::shared_ptr<cloud_trace::CloudTraceSpan> trace_span);
+
+  // Calls to service control server with the report request, split into
+  // several calls if it is too large.
+  void CallReport(
+      const ::google::api::servicecontrol::v1::ReportRequest& request,
+      ::google::api::servicecontrol::v1::ReportResponse* response,
+      ::google::service_control_client::TransportDoneFunc on_done);
+
+  // Answers the quota request from the prefetched tokens, or from the
+  // server if they do not cover it, and prefetches more if needed.
+  void QuotaFromPrefetch(
+      const QuotaRequestInfo& info,
+      std::shared_ptr<cloud_trace::CloudTraceSpan> trace_span,
+      std::function<void(utils::Status)> on_done);
+
+  // Allocates the amounts of quota for the consumer, on behalf of the
+  // request, and adds them to quota_prefetcher_.
+  void PrefetchQuota(const QuotaRequestInfo& info, const std::string& consumer,
+                     const QuotaPrefetcher::MetricCosts& amounts,
+                     std::shared_ptr<cloud_trace::CloudTraceSpan> trace_span);
+
+  // Allocates the amounts of quota on behalf of the request, bypassing the
+  // quota cache, and calls on_done with the result.
+  void AllocateQuota(const QuotaRequestInfo& info,
+                     const QuotaPrefetcher::MetricCosts& amounts,
+                     std::shared_ptr<cloud_trace::CloudTraceSpan> trace_span,
+                     std::function<void(utils::Status)> on_done);
+
+  // Sends the report request to the service control client.
+  void SendReport(const ::google::api::servicecontrol::v1::ReportRequest&
+                      request);
+
+  // Sends the reports aggregated by report_aggregator_.
+  void FlushAggregatedReports();
+
+  // Sends the reports aggregated by report_aggregator_ if
+  // report_flush_controller_ decides so.
+  void MaybeFlushAggregatedReports();
+
   // Returns API request url based on RequestType
   template <class RequestType>
   const std::string& GetApiReqeustUrl();
 
+  // Returns the gRPC service and method names based on RequestType
+  template <class RequestType>
+  const char* GetGRPCService();
+  template <class RequestType>
+  const char* GetGRPCMethod();
+
   // Returns API request timeout in ms based on RequestType
   template <class RequestType>
   int GetHttpRequestTimeout();
 
   // Returns API request auth token based on RequestType
   template <class RequestType>
-  const std::string& GetAuthToken();
+  std::string GetAuthToken();
 
   // the sevice config.
   const ::google::api::Service* service_;
@@ -145,18 +197,22 @@ class Aggregated : public Interface {
   // Stores service control urls.
   Url url_;
 
+  // Whether the calls to service control are made with gRPC instead of HTTP.
+  bool grpc_transport_;
+
   // The service control client instance.
   std::unique_ptr<::google::service_control_client::ServiceControlClient>
       client_;
 
-  // The protobuf pool to reuse AllocateQuotaRequest protobuf.
-  ProtoPool<::google::api::servicecontrol::v1::AllocateQuotaRequest>
-      quota_pool_;
+  // Aggregates the reports before they are sent to client_, if enabled.
+  std::unique_ptr<ReportAggregator> report_aggregator_;
+  // Decides when report_aggregator_ is flushed.
+  std::unique_ptr<ReportFlushController> report_flush_controller_;
+  // The timer to check whether report_aggregator_ should be flushed.
+  std::unique_ptr<::google::api_manager::PeriodicTimer> report_flush_timer_;
 
-  // The protobuf pool to reuse CheckRequest protobuf.
-  ProtoPool<::google::api::servicecontrol::v1::CheckRequest> check_pool_;
-  // The protobuf pool to reuse ReportRequest protobuf.
-  ProtoPool<::google::api::servicecontrol::v1::ReportRequest> report_pool_;
+  // Answers the quota requests from prefetched tokens, if enabled.
+  std::unique_ptr<QuotaPrefetcher> quota_prefetcher_;
 
   // Mismatched config ID received for a check request
   std::string mismatched_check_config_id;
@@ -166,6 +222,18 @@ class Aggregated : public Interface {
 
   // Maximum report size send to server.
   uint64_t max_report_size_;
+
+  // Report requests larger than this are split.
+  size_t max_report_bytes_;
+  // Whether report requests are compressed, and how.
+  bool compress_reports_;
+  ContentEncoding report_content_encoding_;
+
+  // The additional report requests sent by splitting.
+  uint64_t send_report_splits_;
+  // The total size of the report requests, before and after compression.
+  uint64_t send_report_bytes_;
+  uint64_t send_report_compressed_bytes_;
 };
 
 }  // namespace service_control
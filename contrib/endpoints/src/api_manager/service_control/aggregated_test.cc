@@ -197,6 +197,32 @@ TEST_F(AggregatedTestWithMockedClient, FailedCheckTest) {
                  });
 }
 
+TEST_F(AggregatedTestWithMockedClient, ReportInCheckCallbackTest) {
+  // The Check request is still in use when the callback makes the Report
+  // request on the same thread.
+  EXPECT_CALL(*mock_client_, Check(_, _, _, _))
+      .WillOnce(Invoke([this](const CheckRequest& req, CheckResponse* res,
+                              ServiceControlClient::DoneCallback on_done,
+                              TransportCheckFunc transport) {
+        on_done(::google::protobuf::util::Status::OK);
+        EXPECT_EQ("operation_id", req.operation().operation_id());
+        EXPECT_EQ("operation_name", req.operation().operation_name());
+      }));
+  EXPECT_CALL(*mock_client_, Report(_, _, _))
+      .WillOnce(Invoke(this, &AggregatedTestWithMockedClient::Report));
+
+  CheckRequestInfo info;
+  FillOperationInfo(&info);
+  done_status_ = ::google::protobuf::util::Status::OK;
+  sc_lib_->Check(info, nullptr,
+                 [this](Status status, const CheckResponseInfo& info) {
+                   ReportRequestInfo report_info;
+                   FillOperationInfo(&report_info);
+                   report_info.operation_id = "report_operation_id";
+                   ASSERT_TRUE(sc_lib_->Report(report_info).ok());
+                 });
+}
+
 class AggregatedTestWithRealClient : public ::testing::Test {
  public:
   void SetUp() {
@@ -239,6 +265,9 @@ TEST_F(AggregatedTestWithRealClient, CheckOKTest) {
   EXPECT_EQ(stat.send_checks_by_flush, 0);
   EXPECT_EQ(stat.send_checks_in_flight, 1);
   EXPECT_EQ(stat.send_report_operations, 0);
+  // The initial values of the adaptive local report aggregation.
+  EXPECT_EQ(stat.report_flush_interval_ms, 100);
+  EXPECT_EQ(stat.report_flush_entries, 100);
 }
 
 class QuotaAllocationTestWithRealClient : public ::testing::Test {
@@ -333,6 +362,209 @@ TEST_F(QuotaAllocationTestWithRealClient, AllocateQuotaFailedTest) {
   });
 }
 
+class QuotaPrefetchTestWithRealClient : public ::testing::Test {
+ public:
+  void SetUp() {
+    service_.set_name("test_service");
+    service_.mutable_control()->set_environment(
+        "servicecontrol.googleapis.com");
+    server_config_.mutable_service_control_config()
+        ->mutable_quota_aggregator_config()
+        ->set_enable_prefetch(true);
+    env_.reset(new ::testing::NiceMock<MockApiManagerEnvironment>);
+    sc_lib_.reset(
+        Aggregated::Create(service_, &server_config_, env_.get(), nullptr));
+    ASSERT_TRUE((bool)(sc_lib_));
+    sc_lib_->Init();
+
+    metric_cost_vector_ = {{"metric_first", 1}, {"metric_second", 2}};
+    response_ = kAllocateQuotaResponse;
+  }
+
+  void DoRunHTTPRequest(HTTPRequest* request) {
+    AllocateQuotaRequest quota_request;
+    ASSERT_TRUE(quota_request.ParseFromString(request->body()));
+    ASSERT_EQ(::google::api::servicecontrol::v1::QuotaOperation::NORMAL,
+              quota_request.allocate_operation().quota_mode());
+    operation_ids_.push_back(
+        quota_request.allocate_operation().operation_id());
+    amounts_.clear();
+    for (const auto& metric :
+         quota_request.allocate_operation().quota_metrics()) {
+      amounts_[metric.metric_name()] = metric.metric_values(0).int64_value();
+    }
+
+    AllocateQuotaResponse quota_response;
+    ::google::protobuf::TextFormat::ParseFromString(response_,
+                                                    &quota_response);
+    request->OnComplete(Status::OK, std::map<std::string, std::string>(),
+                        quota_response.SerializeAsString());
+  }
+
+  Status Quota() {
+    QuotaRequestInfo info;
+    info.metric_cost_vector = &metric_cost_vector_;
+    FillOperationInfo(&info);
+    Status result = Status::OK;
+    sc_lib_->Quota(info, nullptr,
+                   [&result](Status status) { result = status; });
+    return result;
+  }
+
+  ::google::api::Service service_;
+  proto::ServerConfig server_config_;
+  std::unique_ptr<MockApiManagerEnvironment> env_;
+  std::unique_ptr<Interface> sc_lib_;
+  std::vector<std::pair<std::string, int>> metric_cost_vector_;
+  const char* response_;
+  std::map<std::string, int64_t> amounts_;
+  std::vector<std::string> operation_ids_;
+};
+
+TEST_F(QuotaPrefetchTestWithRealClient, AnswersFromPrefetchedTokens) {
+  EXPECT_CALL(*env_, DoRunHTTPRequest(_))
+      .WillRepeatedly(
+          Invoke(this, &QuotaPrefetchTestWithRealClient::DoRunHTTPRequest));
+
+  // The first request is allocated on its own, after the first prefetch of
+  // its cost.
+  ASSERT_TRUE(Quota().ok());
+  ASSERT_EQ((std::map<std::string, int64_t>{{"metric_first", 1},
+                                            {"metric_second", 2}}),
+            amounts_);
+  // The prefetch is not a retry of the allocation for the request.
+  ASSERT_EQ(std::vector<std::string>({"operation_id:prefetch", "operation_id"}),
+            operation_ids_);
+
+  // The prefetched amounts grow with the rate of the requests.
+  ASSERT_TRUE(Quota().ok());
+  ASSERT_GT(amounts_["metric_first"], 1);
+
+  // The next requests are answered from the prefetched tokens.
+  amounts_.clear();
+  ASSERT_TRUE(Quota().ok());
+  ASSERT_TRUE(Quota().ok());
+  ASSERT_TRUE(amounts_.empty());
+}
+
+TEST_F(QuotaPrefetchTestWithRealClient, QuotaExhausted) {
+  EXPECT_CALL(*env_, DoRunHTTPRequest(_))
+      .WillRepeatedly(
+          Invoke(this, &QuotaPrefetchTestWithRealClient::DoRunHTTPRequest));
+  response_ = kAllocateQuotaResponseErrorExhausted;
+
+  // The first requests are refused by the server, as are the prefetch and
+  // its retry for the cost of one request.
+  ASSERT_EQ(Code::RESOURCE_EXHAUSTED, Quota().code());
+  ASSERT_EQ(Code::RESOURCE_EXHAUSTED, Quota().code());
+
+  // The next requests are refused locally.
+  amounts_.clear();
+  ASSERT_EQ(Code::RESOURCE_EXHAUSTED, Quota().code());
+  ASSERT_TRUE(amounts_.empty());
+}
+
+class ReportCompressionTestWithRealClient : public ::testing::Test {
+ public:
+  void SetUp() {
+    service_.set_name("test_service");
+    service_.mutable_control()->set_environment(
+        "servicecontrol.googleapis.com");
+    auto* config = server_config_.mutable_service_control_config();
+    config->set_report_content_encoding(proto::ServiceControlConfig::GZIP);
+    // Sends the reports without aggregating them.
+    config->mutable_report_aggregator_config()->set_cache_entries(0);
+    config->mutable_report_aggregator_config()->set_disable_local_aggregation(
+        true);
+    env_.reset(new ::testing::NiceMock<MockApiManagerEnvironment>);
+    sc_lib_.reset(
+        Aggregated::Create(service_, &server_config_, env_.get(), nullptr));
+    ASSERT_TRUE((bool)(sc_lib_));
+    sc_lib_->Init();
+  }
+
+  void DoRunHTTPRequest(HTTPRequest* request) {
+    ASSERT_EQ("gzip", request->request_headers().at("Content-Encoding"));
+    // The gzip magic number.
+    ASSERT_EQ("\x1f\x8b", request->body().substr(0, 2));
+    std::map<std::string, std::string> headers;
+    std::string body;
+    request->OnComplete(Status::OK, std::move(headers), std::move(body));
+  }
+
+  ::google::api::Service service_;
+  proto::ServerConfig server_config_;
+  std::unique_ptr<MockApiManagerEnvironment> env_;
+  std::unique_ptr<Interface> sc_lib_;
+};
+
+TEST_F(ReportCompressionTestWithRealClient, GzipReportTest) {
+  EXPECT_CALL(*env_, DoRunHTTPRequest(_))
+      .WillOnce(Invoke(this,
+                       &ReportCompressionTestWithRealClient::DoRunHTTPRequest));
+
+  ReportRequestInfo info;
+  FillOperationInfo(&info);
+  ASSERT_TRUE(sc_lib_->Report(info).ok());
+
+  Statistics stat;
+  ASSERT_TRUE(sc_lib_->GetStatistics(&stat).ok());
+  EXPECT_EQ(stat.send_report_splits, 0);
+  EXPECT_EQ(stat.send_report_bytes, stat.max_report_size);
+  EXPECT_GT(stat.send_report_compressed_bytes, 0);
+}
+
+class GRPCTransportTestWithRealClient : public ::testing::Test {
+ public:
+  void SetUp() {
+    service_.set_name("test_service");
+    service_.mutable_control()->set_environment(
+        "servicecontrol.googleapis.com");
+    server_config_.mutable_service_control_config()->set_transport(
+        proto::ServiceControlConfig::GRPC);
+    env_.reset(new ::testing::NiceMock<MockApiManagerEnvironment>);
+    sc_lib_.reset(
+        Aggregated::Create(service_, &server_config_, env_.get(), nullptr));
+    ASSERT_TRUE((bool)(sc_lib_));
+    sc_lib_->Init();
+  }
+
+  void DoRunGRPCRequest(GRPCRequest* request) {
+    ASSERT_EQ("servicecontrol.googleapis.com:443", request->server());
+    ASSERT_TRUE(request->use_tls());
+    ASSERT_EQ("google.api.servicecontrol.v1.ServiceController",
+              request->service());
+    ASSERT_EQ("Check", request->method());
+    ASSERT_EQ(5000, request->timeout_ms());
+    CheckRequest check_request;
+    ASSERT_TRUE(check_request.ParseFromString(request->body()));
+    ASSERT_EQ("test_service", check_request.service_name());
+    request->OnComplete(Status::OK, CheckResponse().SerializeAsString());
+  }
+
+  ::google::api::Service service_;
+  proto::ServerConfig server_config_;
+  std::unique_ptr<MockApiManagerEnvironment> env_;
+  std::unique_ptr<Interface> sc_lib_;
+};
+
+TEST_F(GRPCTransportTestWithRealClient, CheckTest) {
+  EXPECT_CALL(*env_, DoRunHTTPRequest(_)).Times(0);
+  EXPECT_CALL(*env_, DoRunGRPCRequest(_))
+      .WillOnce(
+          Invoke(this, &GRPCTransportTestWithRealClient::DoRunGRPCRequest));
+
+  CheckRequestInfo info;
+  FillOperationInfo(&info);
+  bool done = false;
+  sc_lib_->Check(info, nullptr,
+                 [&done](Status status, const CheckResponseInfo& info) {
+                   ASSERT_TRUE(status.ok());
+                   done = true;
+                 });
+  ASSERT_TRUE(done);
+}
+
 TEST(AggregatedServiceControlTest, Create) {
   // Verify that invalid service config yields nullptr.
   ::google::api::Service
@@ -0,0 +1,80 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+#include "contrib/endpoints/src/api_manager/service_control/compression.h"
+
+#include <stdlib.h>
+
+#include "zlib.h"
+
+using ::google::api_manager::utils::Status;
+using ::google::protobuf::util::error::Code;
+
+namespace google {
+namespace api_manager {
+namespace service_control {
+
+namespace {
+
+// zlib is built with Z_SOLO, which has no default allocation functions.
+voidpf Alloc(voidpf /*opaque*/, uInt items, uInt size) {
+  return calloc(items, size);
+}
+
+void Free(voidpf /*opaque*/, voidpf address) { free(address); }
+
+// The window bits of deflateInit2() for the gzip and zlib formats.
+const int kGzipWindowBits = 15 + 16;
+const int kZlibWindowBits = 15;
+
+}  // namespace
+
+const char* ContentEncodingName(ContentEncoding encoding) {
+  return encoding == GZIP ? "gzip" : "deflate";
+}
+
+Status Compress(ContentEncoding encoding, const std::string& data,
+                std::string* compressed) {
+  z_stream stream = z_stream();
+  stream.zalloc = Alloc;
+  stream.zfree = Free;
+  // The HTTP deflate content encoding is the zlib format.
+  int ret = deflateInit2(&stream, Z_BEST_SPEED, Z_DEFLATED,
+                         encoding == GZIP ? kGzipWindowBits : kZlibWindowBits,
+                         8, Z_DEFAULT_STRATEGY);
+  if (ret != Z_OK) {
+    return Status(Code::INTERNAL, "Failed to initialize compression");
+  }
+
+  compressed->resize(deflateBound(&stream, data.size()));
+  stream.next_in =
+      reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+  stream.avail_in = data.size();
+  stream.next_out = reinterpret_cast<Bytef*>(&(*compressed)[0]);
+  stream.avail_out = compressed->size();
+  // The output buffer is large enough to compress all the data at once.
+  ret = deflate(&stream, Z_FINISH);
+  compressed->resize(stream.total_out);
+  deflateEnd(&stream);
+  if (ret != Z_STREAM_END) {
+    return Status(Code::INTERNAL, "Failed to compress");
+  }
+  return Status::OK;
+}
+
+}  // namespace service_control
+}  // namespace api_manager
+}  // namespace google
@@ -0,0 +1,41 @@
+/* Copyright 2017 Google Inc. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef API_MANAGER_SERVICE_CONTROL_COMPRESSION_H_
+#define API_MANAGER_SERVICE_CONTROL_COMPRESSION_H_
+
+#include <string>
+
+#include "contrib/endpoints/include/api_manager/utils/status.h"
+
+namespace google {
+namespace api_manager {
+namespace service_control {
+
+// The HTTP content encodings of compressed request bodies.
+enum ContentEncoding { GZIP = 0, DEFLATE = 1 };
+
+// Returns the value of the Content-Encoding header for the encoding.
+const char* ContentEncodingName(ContentEncoding encoding);
+
+// Compresses data with the encoding into compressed. The compression favors
+// speed over size, since it runs on the request path.
+utils::Status Compress(ContentEncoding encoding, const std::string& data,
+                       std::string* compressed);
+
+}  // namespace service_control
+}  // namespace api_manager
+}  // namespace google
+
+#endif  // API_MANAGER_SERVICE_CONTROL_COMPRESSION_H_
@@ -0,0 +1,95 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+#include "contrib/endpoints/src/api_manager/service_control/compression.h"
+
+#include <stdlib.h>
+
+#include "gtest/gtest.h"
+#include "zlib.h"
+
+namespace google {
+namespace api_manager {
+namespace service_control {
+
+namespace {
+
+voidpf Alloc(voidpf opaque, uInt items, uInt size) {
+  return calloc(items, size);
+}
+
+void Free(voidpf opaque, voidpf address) { free(address); }
+
+// Decompresses data in the gzip or zlib format.
+std::string Decompress(const std::string& data) {
+  z_stream stream = z_stream();
+  stream.zalloc = Alloc;
+  stream.zfree = Free;
+  // Detects the gzip and zlib headers.
+  EXPECT_EQ(Z_OK, inflateInit2(&stream, 15 + 32));
+  std::string result(1024 * 1024, '\0');
+  stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+  stream.avail_in = data.size();
+  stream.next_out = reinterpret_cast<Bytef*>(&result[0]);
+  stream.avail_out = result.size();
+  EXPECT_EQ(Z_STREAM_END, inflate(&stream, Z_FINISH));
+  result.resize(stream.total_out);
+  inflateEnd(&stream);
+  return result;
+}
+
+std::string TestData() {
+  std::string data;
+  for (int i = 0; i < 1000; ++i) {
+    data += "operation_" + std::to_string(i % 10) + ";";
+  }
+  return data;
+}
+
+TEST(CompressionTest, Gzip) {
+  std::string data = TestData();
+  std::string compressed;
+  ASSERT_TRUE(Compress(GZIP, data, &compressed).ok());
+  ASSERT_LT(compressed.size(), data.size());
+  // The gzip magic number.
+  ASSERT_EQ('\x1f', compressed[0]);
+  ASSERT_EQ('\x8b', compressed[1]);
+  ASSERT_EQ(data, Decompress(compressed));
+  ASSERT_STREQ("gzip", ContentEncodingName(GZIP));
+}
+
+TEST(CompressionTest, Deflate) {
+  std::string data = TestData();
+  std::string compressed;
+  ASSERT_TRUE(Compress(DEFLATE, data, &compressed).ok());
+  ASSERT_LT(compressed.size(), data.size());
+  // The zlib header of the deflate method.
+  ASSERT_EQ(8, compressed[0] & 0x0f);
+  ASSERT_EQ(data, Decompress(compressed));
+  ASSERT_STREQ("deflate", ContentEncodingName(DEFLATE));
+}
+
+TEST(CompressionTest, Empty) {
+  std::string compressed;
+  ASSERT_TRUE(Compress(GZIP, "", &compressed).ok());
+  ASSERT_EQ("", Decompress(compressed));
+}
+
+}  // namespace
+
+}  // namespace service_control
+}  // namespace api_manager
+}  // namespace google
@@ -0,0 +1,79 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+#include "contrib/endpoints/src/api_manager/service_control/distribution_buckets.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace google {
+namespace api_manager {
+namespace service_control {
+
+DistributionBuckets::DistributionBuckets(int num_finite_buckets,
+                                         double growth_factor, double scale)
+    : num_finite_buckets_(num_finite_buckets),
+      growth_factor_(growth_factor),
+      scale_(scale) {
+  const double infinity = std::numeric_limits<double>::infinity();
+  size_t size = 1;
+  while (size < static_cast<size_t>(num_finite_buckets + 1)) {
+    size *= 2;
+  }
+  bounds_.resize(size, infinity);
+
+  // The lower bound of bucket i is the smallest value FindSlow() puts in
+  // bucket i or above, so that both always agree, even where log() rounds
+  // values close to scale * growth_factor^(i - 1) the other way.
+  for (int bucket = 1; bucket <= num_finite_buckets + 1; ++bucket) {
+    double bound = scale * std::pow(growth_factor, bucket - 1);
+    while (FindSlow(std::nextafter(bound, 0)) >= bucket) {
+      bound = std::nextafter(bound, 0);
+    }
+    while (FindSlow(bound) < bucket) {
+      bound = std::nextafter(bound, infinity);
+    }
+    bounds_[bucket - 1] = bound;
+  }
+}
+
+int DistributionBuckets::Find(double value) const {
+  // Counts the bounds less than or equal to the value by binary search over
+  // the power of two sized bounds. The steps do not depend on the value, and
+  // the conditional adds compile to selects.
+  const double* bounds = bounds_.data();
+  size_t bucket = 0;
+  for (size_t step = bounds_.size() / 2; step > 0; step /= 2) {
+    bucket += bounds[bucket + step - 1] <= value ? step : 0;
+  }
+  bucket += bounds[bucket] <= value ? 1 : 0;
+  // Only an infinite value is above the padding.
+  return std::min(static_cast<int>(bucket), num_finite_buckets_ + 1);
+}
+
+int DistributionBuckets::FindSlow(double value) const {
+  if (value < scale_) {
+    return 0;
+  }
+  int bucket = 1 + static_cast<int>(std::floor(std::log(value / scale_) /
+                                                std::log(growth_factor_)));
+  return std::min(bucket, num_finite_buckets_ + 1);
+}
+
+}  // namespace service_control
+}  // namespace api_manager
+}  // namespace google
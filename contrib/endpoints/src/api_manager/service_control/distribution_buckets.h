@@ -0,0 +1,64 @@
+/* Copyright 2017 Google Inc. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef API_MANAGER_SERVICE_CONTROL_DISTRIBUTION_BUCKETS_H_
+#define API_MANAGER_SERVICE_CONTROL_DISTRIBUTION_BUCKETS_H_
+
+#include <vector>
+
+namespace google {
+namespace api_manager {
+namespace service_control {
+
+// The exponential buckets of a Distribution metric, with their lower bounds
+// precomputed so that the bucket of a value is found by a fixed number of
+// comparisons, without calling log() or branching on the value.
+//
+// The buckets are the ones of DistributionHelper::AddSample(): bucket 0 is
+// the underflow bucket, buckets 1 to num_finite_buckets are the finite
+// buckets, and the last one is the overflow bucket.
+class DistributionBuckets {
+ public:
+  DistributionBuckets(int num_finite_buckets, double growth_factor,
+                      double scale);
+
+  int num_finite_buckets() const { return num_finite_buckets_; }
+  double growth_factor() const { return growth_factor_; }
+  double scale() const { return scale_; }
+
+  // The number of buckets, including the underflow and overflow ones.
+  int size() const { return num_finite_buckets_ + 2; }
+
+  // Returns the bucket of the value.
+  int Find(double value) const;
+
+ private:
+  // Returns the bucket of the value computed with log(), as
+  // DistributionHelper does.
+  int FindSlow(double value) const;
+
+  int num_finite_buckets_;
+  double growth_factor_;
+  double scale_;
+
+  // The lower bounds of buckets 1 to num_finite_buckets + 1, padded with
+  // infinity to a power of two.
+  std::vector<double> bounds_;
+};
+
+}  // namespace service_control
+}  // namespace api_manager
+}  // namespace google
+
+#endif  // API_MANAGER_SERVICE_CONTROL_DISTRIBUTION_BUCKETS_H_
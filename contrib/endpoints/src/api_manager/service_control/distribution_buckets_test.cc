@@ -0,0 +1,87 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+#include "contrib/endpoints/src/api_manager/service_control/distribution_buckets.h"
+
+#include <cmath>
+#include <limits>
+
+#include "gtest/gtest.h"
+#include "utils/distribution_helper.h"
+
+using ::google::api::servicecontrol::v1::Distribution;
+using ::google::service_control_client::DistributionHelper;
+
+namespace google {
+namespace api_manager {
+namespace service_control {
+
+namespace {
+
+// Returns the bucket DistributionHelper::AddSample() adds the value to.
+int HelperBucket(const DistributionBuckets& buckets, double value) {
+  Distribution distribution;
+  EXPECT_TRUE(DistributionHelper::InitExponential(
+                  buckets.num_finite_buckets(), buckets.growth_factor(),
+                  buckets.scale(), &distribution)
+                  .ok());
+  EXPECT_TRUE(DistributionHelper::AddSample(value, &distribution).ok());
+  for (int i = 0; i < distribution.bucket_counts_size(); ++i) {
+    if (distribution.bucket_counts(i) > 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+void ExpectSameAsHelper(const DistributionBuckets& buckets) {
+  ASSERT_EQ(buckets.num_finite_buckets() + 2, buckets.size());
+  for (int i = 0; i <= buckets.num_finite_buckets() + 2; ++i) {
+    double bound = buckets.scale() * std::pow(buckets.growth_factor(), i);
+    for (double value :
+         {bound, std::nextafter(bound, 0.0),
+          std::nextafter(bound, std::numeric_limits<double>::infinity()),
+          bound * 1.5}) {
+      ASSERT_EQ(HelperBucket(buckets, value), buckets.Find(value)) << value;
+    }
+  }
+  for (double value : {-1.0, 0.0, 1e-9, 0.001, 0.5, 999.0, 1000.0, 1e12}) {
+    ASSERT_EQ(HelperBucket(buckets, value), buckets.Find(value)) << value;
+  }
+}
+
+TEST(DistributionBucketsTest, TimeBuckets) {
+  ExpectSameAsHelper(DistributionBuckets(29, 2.0, 1e-6));
+}
+
+TEST(DistributionBucketsTest, SizeBuckets) {
+  ExpectSameAsHelper(DistributionBuckets(8, 10.0, 1));
+}
+
+TEST(DistributionBucketsTest, Overflow) {
+  DistributionBuckets buckets(8, 10.0, 1);
+  ASSERT_EQ(0, buckets.Find(0.5));
+  ASSERT_EQ(1, buckets.Find(1));
+  ASSERT_EQ(9, buckets.Find(1e8));
+  ASSERT_EQ(9, buckets.Find(std::numeric_limits<double>::max()));
+  ASSERT_EQ(9, buckets.Find(std::numeric_limits<double>::infinity()));
+}
+
+}  // namespace
+
+}  // namespace service_control
+}  // namespace api_manager
+}  // namespace google
@@ -16,7 +16,10 @@
 //
 #include "contrib/endpoints/src/api_manager/service_control/proto.h"
 
+#include <algorithm>
+#include <cmath>
 #include <functional>
+#include <tuple>
 
 #include <time.h>
 #include <chrono>
@@ -26,8 +29,9 @@
 #include "contrib/endpoints/src/api_manager/auth/lib/auth_token.h"
 #include "contrib/endpoints/src/api_manager/auth/lib/base64.h"
 #include "google/api/metric.pb.h"
+#include "google/protobuf/io/coded_stream.h"
+#include "google/protobuf/stubs/logging.h"
 #include "google/protobuf/timestamp.pb.h"
-#include "utils/distribution_helper.h"
 
 using ::google::api::servicecontrol::v1::CheckError;
 using ::google::api::servicecontrol::v1::QuotaError;
@@ -41,10 +45,10 @@ using ::google::api::servicecontrol::v1::Operation;
 using ::google::api::servicecontrol::v1::ReportRequest;
 using ::google::api_manager::utils::Status;
 using ::google::protobuf::Map;
+using ::google::protobuf::io::CodedOutputStream;
 using ::google::protobuf::StringPiece;
 using ::google::protobuf::Timestamp;
 using ::google::protobuf::util::error::Code;
-using ::google::service_control_client::DistributionHelper;
 
 namespace google {
 namespace api_manager {
@@ -55,6 +59,13 @@ const char kConsumerQuotaUsedCount[] =
 
 const char kQuotaName[] = "/quota_name";
 
+// The parameters to initialize DistributionHelper
+struct DistributionHelperOptions {
+  int buckets;
+  double growth;
+  double scale;
+};
+
 struct SupportedMetric {
   const char* name;
   ::google::api::MetricDescriptor_MetricKind metric_kind;
@@ -64,8 +75,12 @@ struct SupportedMetric {
   enum Tag { START = 0, INTERMEDIATE = 1, FINAL = 2 };
   Tag tag;
   Mark mark;
-  Status (*set)(const SupportedMetric& m, const ReportRequestInfo& info,
-                Operation* operation);
+
+  // Gets the value of the metric for the report. Returns false if the report
+  // has no value for it.
+  bool (*get)(const ReportRequestInfo& info, double* value);
+  // The buckets of DISTRIBUTION metrics.
+  const DistributionHelperOptions* distribution;
 };
 
 struct SupportedLabel {
@@ -77,6 +92,11 @@ struct SupportedLabel {
 
   Status (*set)(const SupportedLabel& l, const ReportRequestInfo& info,
                 Map<std::string, std::string>* labels);
+
+  // The reports the label is set for. PROCESS labels have the same value for
+  // all reports, which is rendered once by Proto.
+  enum Scope { ALL_REPORTS = 0, FINAL_REPORTS = 1, PROCESS = 2 };
+  Scope scope;
 };
 
 namespace {
@@ -95,150 +115,74 @@ void AddInt64Metric(const char* metric_name, int64_t value,
   metric_value->set_int64_value(value);
 }
 
-// The parameters to initialize DistributionHelper
-struct DistributionHelperOptions {
-  int buckets;
-  double growth;
-  double scale;
-};
-
 const DistributionHelperOptions time_distribution = {29, 2.0, 1e-6};
 const DistributionHelperOptions size_distribution = {8, 10.0, 1};
 const double kMsToSecs = 1e-3;
 
-Status AddDistributionMetric(const DistributionHelperOptions& options,
-                             const char* metric_name, double value,
-                             Operation* operation) {
-  MetricValue* metric_value = AddMetricValue(metric_name, operation);
-  Distribution distribution;
-  ::google::protobuf::util::Status proto_status =
-      DistributionHelper::InitExponential(options.buckets, options.growth,
-                                          options.scale, &distribution);
-  if (!proto_status.ok()) return Status::FromProto(proto_status);
-  proto_status = DistributionHelper::AddSample(value, &distribution);
-  if (!proto_status.ok()) return Status::FromProto(proto_status);
-  *metric_value->mutable_distribution_value() = distribution;
-  return Status::OK;
-}
-
 // Metrics supported by ESP.
 
-Status set_int64_metric_to_constant_1(const SupportedMetric& m,
-                                      const ReportRequestInfo& info,
-                                      Operation* operation) {
-  AddInt64Metric(m.name, 1l, operation);
-  return Status::OK;
+bool get_constant_1(const ReportRequestInfo& info, double* value) {
+  *value = 1;
+  return true;
 }
 
-Status set_int64_metric_to_constant_1_if_http_error(
-    const SupportedMetric& m, const ReportRequestInfo& info,
-    Operation* operation) {
+bool get_constant_1_if_http_error(const ReportRequestInfo& info,
+                                  double* value) {
   // Use status code >= 400 to determine request failed.
-  if (info.response_code >= 400) {
-    AddInt64Metric(m.name, 1l, operation);
-  }
-  return Status::OK;
+  *value = 1;
+  return info.response_code >= 400;
 }
 
-Status set_distribution_metric_to_request_size(const SupportedMetric& m,
-                                               const ReportRequestInfo& info,
-                                               Operation* operation) {
-  if (info.request_size >= 0) {
-    return AddDistributionMetric(size_distribution, m.name, info.request_size,
-                                 operation);
-  }
-  return Status::OK;
+bool get_request_size(const ReportRequestInfo& info, double* value) {
+  *value = info.request_size;
+  return info.request_size >= 0;
 }
 
-Status set_distribution_metric_to_response_size(const SupportedMetric& m,
-                                                const ReportRequestInfo& info,
-                                                Operation* operation) {
-  if (info.response_size >= 0) {
-    return AddDistributionMetric(size_distribution, m.name, info.response_size,
-                                 operation);
-  }
-  return Status::OK;
+bool get_response_size(const ReportRequestInfo& info, double* value) {
+  *value = info.response_size;
+  return info.response_size >= 0;
 }
 
-// TODO: Consider refactoring following 3 functions to avoid duplicate code
-Status set_distribution_metric_to_request_time(const SupportedMetric& m,
-                                               const ReportRequestInfo& info,
-                                               Operation* operation) {
-  if (info.latency.request_time_ms >= 0) {
-    double request_time_secs = info.latency.request_time_ms * kMsToSecs;
-    return AddDistributionMetric(time_distribution, m.name, request_time_secs,
-                                 operation);
-  }
-  return Status::OK;
+bool get_request_time(const ReportRequestInfo& info, double* value) {
+  *value = info.latency.request_time_ms * kMsToSecs;
+  return info.latency.request_time_ms >= 0;
 }
 
-Status set_distribution_metric_to_backend_time(const SupportedMetric& m,
-                                               const ReportRequestInfo& info,
-                                               Operation* operation) {
-  if (info.latency.backend_time_ms >= 0) {
-    double backend_time_secs = info.latency.backend_time_ms * kMsToSecs;
-    return AddDistributionMetric(time_distribution, m.name, backend_time_secs,
-                                 operation);
-  }
-  return Status::OK;
+bool get_backend_time(const ReportRequestInfo& info, double* value) {
+  *value = info.latency.backend_time_ms * kMsToSecs;
+  return info.latency.backend_time_ms >= 0;
 }
 
-Status set_distribution_metric_to_overhead_time(const SupportedMetric& m,
-                                                const ReportRequestInfo& info,
-                                                Operation* operation) {
-  if (info.latency.overhead_time_ms >= 0) {
-    double overhead_time_secs = info.latency.overhead_time_ms * kMsToSecs;
-    return AddDistributionMetric(time_distribution, m.name, overhead_time_secs,
-                                 operation);
-  }
-  return Status::OK;
+bool get_overhead_time(const ReportRequestInfo& info, double* value) {
+  *value = info.latency.overhead_time_ms * kMsToSecs;
+  return info.latency.overhead_time_ms >= 0;
 }
 
-Status set_int64_metric_to_request_bytes(const SupportedMetric& m,
-                                         const ReportRequestInfo& info,
-                                         Operation* operation) {
-  if (info.request_bytes > 0) {
-    AddInt64Metric(m.name, info.request_bytes, operation);
-  }
-  return Status::OK;
+bool get_request_bytes(const ReportRequestInfo& info, double* value) {
+  *value = info.request_bytes;
+  return info.request_bytes > 0;
 }
 
-Status set_int64_metric_to_response_bytes(const SupportedMetric& m,
-                                          const ReportRequestInfo& info,
-                                          Operation* operation) {
-  if (info.response_bytes > 0) {
-    AddInt64Metric(m.name, info.response_bytes, operation);
-  }
-  return Status::OK;
+bool get_response_bytes(const ReportRequestInfo& info, double* value) {
+  *value = info.response_bytes;
+  return info.response_bytes > 0;
 }
 
-Status set_distribution_metric_to_streaming_request_message_counts(
-    const SupportedMetric& m, const ReportRequestInfo& info,
-    Operation* operation) {
-  if (info.streaming_request_message_counts > 0) {
-    AddDistributionMetric(size_distribution, m.name,
-                          info.streaming_request_message_counts, operation);
-  }
-  return Status::OK;
+bool get_streaming_request_message_counts(const ReportRequestInfo& info,
+                                          double* value) {
+  *value = info.streaming_request_message_counts;
+  return info.streaming_request_message_counts > 0;
 }
-Status set_distribution_metric_to_streaming_response_message_counts(
-    const SupportedMetric& m, const ReportRequestInfo& info,
-    Operation* operation) {
-  if (info.streaming_response_message_counts > 0) {
-    AddDistributionMetric(size_distribution, m.name,
-                          info.streaming_response_message_counts, operation);
-  }
-  return Status::OK;
+
+bool get_streaming_response_message_counts(const ReportRequestInfo& info,
+                                           double* value) {
+  *value = info.streaming_response_message_counts;
+  return info.streaming_response_message_counts > 0;
 }
 
-Status set_distribution_metric_to_streaming_durations(
-    const SupportedMetric& m, const ReportRequestInfo& info,
-    Operation* operation) {
-  if (info.streaming_durations > 0) {
-    AddDistributionMetric(time_distribution, m.name, info.streaming_durations,
-                          operation);
-  }
-  return Status::OK;
+bool get_streaming_durations(const ReportRequestInfo& info, double* value) {
+  *value = info.streaming_durations;
+  return info.streaming_durations > 0;
 }
 // Currently unsupported metrics:
 //
@@ -247,123 +191,123 @@ const SupportedMetric supported_metrics[] = {
         "serviceruntime.googleapis.com/api/consumer/request_count",
         ::google::api::MetricDescriptor_MetricKind_DELTA,
         ::google::api::MetricDescriptor_ValueType_INT64, SupportedMetric::START,
-        SupportedMetric::CONSUMER, set_int64_metric_to_constant_1,
+        SupportedMetric::CONSUMER, get_constant_1, nullptr,
     },
     {
         "serviceruntime.googleapis.com/api/producer/request_count",
         ::google::api::MetricDescriptor_MetricKind_DELTA,
         ::google::api::MetricDescriptor_ValueType_INT64, SupportedMetric::START,
-        SupportedMetric::PRODUCER, set_int64_metric_to_constant_1,
+        SupportedMetric::PRODUCER, get_constant_1, nullptr,
     },
     {
         "serviceruntime.googleapis.com/api/consumer/request_sizes",
         ::google::api::MetricDescriptor_MetricKind_DELTA,
         ::google::api::MetricDescriptor_ValueType_DISTRIBUTION,
         SupportedMetric::FINAL, SupportedMetric::CONSUMER,
-        set_distribution_metric_to_request_size,
+        get_request_size, &size_distribution,
     },
     {
         "serviceruntime.googleapis.com/api/producer/request_sizes",
         ::google::api::MetricDescriptor_MetricKind_DELTA,
         ::google::api::MetricDescriptor_ValueType_DISTRIBUTION,
         SupportedMetric::FINAL, SupportedMetric::PRODUCER,
-        set_distribution_metric_to_request_size,
+        get_request_size, &size_distribution,
     },
     {
         "serviceruntime.googleapis.com/api/consumer/response_sizes",
         ::google::api::MetricDescriptor_MetricKind_DELTA,
         ::google::api::MetricDescriptor_ValueType_DISTRIBUTION,
         SupportedMetric::FINAL, SupportedMetric::CONSUMER,
-        set_distribution_metric_to_response_size,
+        get_response_size, &size_distribution,
     },
     {
         "serviceruntime.googleapis.com/api/producer/response_sizes",
         ::google::api::MetricDescriptor_MetricKind_DELTA,
         ::google::api::MetricDescriptor_ValueType_DISTRIBUTION,
         SupportedMetric::FINAL, SupportedMetric::PRODUCER,
-        set_distribution_metric_to_response_size,
+        get_response_size, &size_distribution,
     },
     {
         "serviceruntime.googleapis.com/api/consumer/request_bytes",
         ::google::api::MetricDescriptor_MetricKind_DELTA,
         ::google::api::MetricDescriptor_ValueType_INT64,
         SupportedMetric::INTERMEDIATE, SupportedMetric::CONSUMER,
-        set_int64_metric_to_request_bytes,
+        get_request_bytes, nullptr,
     },
     {
         "serviceruntime.googleapis.com/api/consumer/response_bytes",
         ::google::api::MetricDescriptor_MetricKind_DELTA,
         ::google::api::MetricDescriptor_ValueType_INT64,
         SupportedMetric::INTERMEDIATE, SupportedMetric::CONSUMER,
-        set_int64_metric_to_response_bytes,
+        get_response_bytes, nullptr,
     },
     {
         "serviceruntime.googleapis.com/api/producer/request_bytes",
         ::google::api::MetricDescriptor_MetricKind_DELTA,
         ::google::api::MetricDescriptor_ValueType_INT64,
         SupportedMetric::INTERMEDIATE, SupportedMetric::PRODUCER,
-        set_int64_metric_to_request_bytes,
+        get_request_bytes, nullptr,
     },
     {
         "serviceruntime.googleapis.com/api/producer/response_bytes",
         ::google::api::MetricDescriptor_MetricKind_DELTA,
         ::google::api::MetricDescriptor_ValueType_INT64,
         SupportedMetric::INTERMEDIATE, SupportedMetric::PRODUCER,
-        set_int64_metric_to_response_bytes,
+        get_response_bytes, nullptr,
     },
     {
         "serviceruntime.googleapis.com/api/consumer/error_count",
         ::google::api::MetricDescriptor_MetricKind_DELTA,
         ::google::api::MetricDescriptor_ValueType_INT64, SupportedMetric::FINAL,
-        SupportedMetric::CONSUMER, set_int64_metric_to_constant_1_if_http_error,
+        SupportedMetric::CONSUMER, get_constant_1_if_http_error, nullptr,
     },
     {
         "serviceruntime.googleapis.com/api/producer/error_count",
         ::google::api::MetricDescriptor_MetricKind_DELTA,
         ::google::api::MetricDescriptor_ValueType_INT64, SupportedMetric::FINAL,
-        SupportedMetric::PRODUCER, set_int64_metric_to_constant_1_if_http_error,
+        SupportedMetric::PRODUCER, get_constant_1_if_http_error, nullptr,
     },
     {
         "serviceruntime.googleapis.com/api/consumer/total_latencies",
         ::google::api::MetricDescriptor_MetricKind_DELTA,
         ::google::api::MetricDescriptor_ValueType_DISTRIBUTION,
         SupportedMetric::FINAL, SupportedMetric::CONSUMER,
-        set_distribution_metric_to_request_time,
+        get_request_time, &time_distribution,
     },
     {
         "serviceruntime.googleapis.com/api/producer/total_latencies",
         ::google::api::MetricDescriptor_MetricKind_DELTA,
         ::google::api::MetricDescriptor_ValueType_DISTRIBUTION,
         SupportedMetric::FINAL, SupportedMetric::PRODUCER,
-        set_distribution_metric_to_request_time,
+        get_request_time, &time_distribution,
     },
     {
         "serviceruntime.googleapis.com/api/consumer/backend_latencies",
         ::google::api::MetricDescriptor_MetricKind_DELTA,
         ::google::api::MetricDescriptor_ValueType_DISTRIBUTION,
         SupportedMetric::FINAL, SupportedMetric::CONSUMER,
-        set_distribution_metric_to_backend_time,
+        get_backend_time, &time_distribution,
     },
     {
         "serviceruntime.googleapis.com/api/producer/backend_latencies",
         ::google::api::MetricDescriptor_MetricKind_DELTA,
         ::google::api::MetricDescriptor_ValueType_DISTRIBUTION,
         SupportedMetric::FINAL, SupportedMetric::PRODUCER,
-        set_distribution_metric_to_backend_time,
+        get_backend_time, &time_distribution,
     },
     {
         "serviceruntime.googleapis.com/api/consumer/request_overhead_latencies",
         ::google::api::MetricDescriptor_MetricKind_DELTA,
         ::google::api::MetricDescriptor_ValueType_DISTRIBUTION,
         SupportedMetric::FINAL, SupportedMetric::CONSUMER,
-        set_distribution_metric_to_overhead_time,
+        get_overhead_time, &time_distribution,
     },
     {
         "serviceruntime.googleapis.com/api/producer/request_overhead_latencies",
         ::google::api::MetricDescriptor_MetricKind_DELTA,
         ::google::api::MetricDescriptor_ValueType_DISTRIBUTION,
         SupportedMetric::FINAL, SupportedMetric::PRODUCER,
-        set_distribution_metric_to_overhead_time,
+        get_overhead_time, &time_distribution,
     },
     {
         "serviceruntime.googleapis.com/api/consumer/"
@@ -371,7 +315,7 @@ const SupportedMetric supported_metrics[] = {
         ::google::api::MetricDescriptor_MetricKind_DELTA,
         ::google::api::MetricDescriptor_ValueType_DISTRIBUTION,
         SupportedMetric::FINAL, SupportedMetric::CONSUMER,
-        set_distribution_metric_to_streaming_request_message_counts,
+        get_streaming_request_message_counts, &size_distribution,
     },
     {
         "serviceruntime.googleapis.com/api/producer/"
@@ -379,7 +323,7 @@ const SupportedMetric supported_metrics[] = {
         ::google::api::MetricDescriptor_MetricKind_DELTA,
         ::google::api::MetricDescriptor_ValueType_DISTRIBUTION,
         SupportedMetric::FINAL, SupportedMetric::PRODUCER,
-        set_distribution_metric_to_streaming_request_message_counts,
+        get_streaming_request_message_counts, &size_distribution,
     },
     {
         "serviceruntime.googleapis.com/api/consumer/"
@@ -387,7 +331,7 @@ const SupportedMetric supported_metrics[] = {
         ::google::api::MetricDescriptor_MetricKind_DELTA,
         ::google::api::MetricDescriptor_ValueType_DISTRIBUTION,
         SupportedMetric::FINAL, SupportedMetric::CONSUMER,
-        set_distribution_metric_to_streaming_response_message_counts,
+        get_streaming_response_message_counts, &size_distribution,
     },
     {
         "serviceruntime.googleapis.com/api/producer/"
@@ -395,7 +339,7 @@ const SupportedMetric supported_metrics[] = {
         ::google::api::MetricDescriptor_MetricKind_DELTA,
         ::google::api::MetricDescriptor_ValueType_DISTRIBUTION,
         SupportedMetric::FINAL, SupportedMetric::PRODUCER,
-        set_distribution_metric_to_streaming_response_message_counts,
+        get_streaming_response_message_counts, &size_distribution,
     },
     {
         "serviceruntime.googleapis.com/api/consumer/"
@@ -403,7 +347,7 @@ const SupportedMetric supported_metrics[] = {
         ::google::api::MetricDescriptor_MetricKind_DELTA,
         ::google::api::MetricDescriptor_ValueType_DISTRIBUTION,
         SupportedMetric::FINAL, SupportedMetric::CONSUMER,
-        set_distribution_metric_to_streaming_durations,
+        get_streaming_durations, &time_distribution,
     },
     {
         "serviceruntime.googleapis.com/api/producer/"
@@ -411,7 +355,7 @@ const SupportedMetric supported_metrics[] = {
         ::google::api::MetricDescriptor_MetricKind_DELTA,
         ::google::api::MetricDescriptor_ValueType_DISTRIBUTION,
         SupportedMetric::FINAL, SupportedMetric::PRODUCER,
-        set_distribution_metric_to_streaming_durations,
+        get_streaming_durations, &time_distribution,
     },
 
 };
@@ -516,7 +460,6 @@ Status set_referer(const SupportedLabel& l, const ReportRequestInfo& info,
 // /response_code
 Status set_response_code(const SupportedLabel& l, const ReportRequestInfo& info,
                          Map<std::string, std::string>* labels) {
-  if (!info.is_final_report) return Status::OK;
   char response_code_buf[20];
   snprintf(response_code_buf, sizeof(response_code_buf), "%d",
            info.response_code);
@@ -528,7 +471,6 @@ Status set_response_code(const SupportedLabel& l, const ReportRequestInfo& info,
 Status set_response_code_class(const SupportedLabel& l,
                                const ReportRequestInfo& info,
                                Map<std::string, std::string>* labels) {
-  if (!info.is_final_report) return Status::OK;
   (*labels)[l.name] = error_types[(info.response_code / 100) % 10];
   return Status::OK;
 }
@@ -536,7 +478,6 @@ Status set_response_code_class(const SupportedLabel& l,
 // /status_code
 Status set_status_code(const SupportedLabel& l, const ReportRequestInfo& info,
                        Map<std::string, std::string>* labels) {
-  if (!info.is_final_report) return Status::OK;
   char status_code_buf[20];
   snprintf(status_code_buf, sizeof(status_code_buf), "%d",
            info.status.CanonicalCode());
@@ -596,6 +537,7 @@ const SupportedLabel supported_labels[] = {
     {
         "/credential_id", ::google::api::LabelDescriptor_ValueType_STRING,
         SupportedLabel::USER, set_credential_id,
+        SupportedLabel::ALL_REPORTS,
     },
     {
         "/end_user", ::google::api::LabelDescriptor_ValueType_STRING,
@@ -608,26 +550,30 @@ const SupportedLabel supported_labels[] = {
     {
         "/error_type", ::google::api::LabelDescriptor_ValueType_STRING,
         SupportedLabel::USER, set_error_type,
+        SupportedLabel::ALL_REPORTS,
     },
     {
         "/protocol", ::google::api::LabelDescriptor::STRING,
         SupportedLabel::USER, set_protocol,
+        SupportedLabel::ALL_REPORTS,
     },
     {
         "/referer", ::google::api::LabelDescriptor_ValueType_STRING,
         SupportedLabel::USER, set_referer,
+        SupportedLabel::ALL_REPORTS,
     },
     {
         "/response_code", ::google::api::LabelDescriptor_ValueType_STRING,
-        SupportedLabel::USER, set_response_code,
+        SupportedLabel::USER, set_response_code, SupportedLabel::FINAL_REPORTS,
     },
     {
         "/response_code_class", ::google::api::LabelDescriptor::STRING,
         SupportedLabel::USER, set_response_code_class,
+        SupportedLabel::FINAL_REPORTS,
     },
     {
         "/status_code", ::google::api::LabelDescriptor_ValueType_STRING,
-        SupportedLabel::USER, set_status_code,
+        SupportedLabel::USER, set_status_code, SupportedLabel::FINAL_REPORTS,
     },
     {
         "appengine.googleapis.com/clone_id",
@@ -652,7 +598,7 @@ const SupportedLabel supported_labels[] = {
     {
         "cloud.googleapis.com/location",
         ::google::api::LabelDescriptor_ValueType_STRING, SupportedLabel::SYSTEM,
-        set_location,
+        set_location, SupportedLabel::ALL_REPORTS,
     },
     {
         "cloud.googleapis.com/project",
@@ -692,12 +638,12 @@ const SupportedLabel supported_labels[] = {
     {
         "serviceruntime.googleapis.com/api_method",
         ::google::api::LabelDescriptor_ValueType_STRING, SupportedLabel::USER,
-        set_api_method,
+        set_api_method, SupportedLabel::ALL_REPORTS,
     },
     {
         "serviceruntime.googleapis.com/api_version",
         ::google::api::LabelDescriptor_ValueType_STRING, SupportedLabel::USER,
-        set_api_version,
+        set_api_version, SupportedLabel::ALL_REPORTS,
     },
     {
         kServiceControlCallerIp,
@@ -711,17 +657,17 @@ const SupportedLabel supported_labels[] = {
     {
         kServiceControlServiceAgent,
         ::google::api::LabelDescriptor_ValueType_STRING, SupportedLabel::SYSTEM,
-        set_service_agent,
+        set_service_agent, SupportedLabel::PROCESS,
     },
     {
         kServiceControlUserAgent,
         ::google::api::LabelDescriptor_ValueType_STRING, SupportedLabel::SYSTEM,
-        set_user_agent,
+        set_user_agent, SupportedLabel::PROCESS,
     },
     {
         kServiceControlPlatform,
         ::google::api::LabelDescriptor_ValueType_STRING, SupportedLabel::SYSTEM,
-        set_platform,
+        set_platform, SupportedLabel::ALL_REPORTS,
     },
 };
 
@@ -869,6 +815,14 @@ void FillLogEntry(const ReportRequestInfo& info, const std::string& name,
   }
 }
 
+// Adds the length prefixed value to the signature, so that the concatenation
+// of the values is unambiguous.
+void AddToSignature(StringPiece value, std::string* signature) {
+  uint32_t size = value.size();
+  signature->append(reinterpret_cast<const char*>(&size), sizeof(size));
+  signature->append(value.data(), value.size());
+}
+
 template <class Element>
 std::vector<const Element*> FilterPointers(
     const Element* first, const Element* last,
@@ -890,12 +844,14 @@ Proto::Proto(const std::set<std::string>& logs, const std::string& service_name,
     : logs_(logs.begin(), logs.end()),
       metrics_(FilterPointers<SupportedMetric>(
           supported_metrics, supported_metrics + supported_metrics_count,
-          [](const struct SupportedMetric* m) { return m->set != nullptr; })),
+          [](const struct SupportedMetric* m) { return m->get != nullptr; })),
       labels_(FilterPointers<SupportedLabel>(
           supported_labels, supported_labels + supported_labels_count,
           [](const struct SupportedLabel* l) { return l->set != nullptr; })),
       service_name_(service_name),
-      service_config_id_(service_config_id) {}
+      service_config_id_(service_config_id) {
+  BuildFillPlans();
+}
 
 Proto::Proto(const std::set<std::string>& logs,
              const std::set<std::string>& metrics,
@@ -906,7 +862,7 @@ Proto::Proto(const std::set<std::string>& logs,
       metrics_(FilterPointers<SupportedMetric>(
           supported_metrics, supported_metrics + supported_metrics_count,
           [&metrics](const struct SupportedMetric* m) {
-            return m->set && metrics.find(m->name) != metrics.end();
+            return m->get && metrics.find(m->name) != metrics.end();
           })),
       labels_(FilterPointers<SupportedLabel>(
           supported_labels, supported_labels + supported_labels_count,
@@ -915,7 +871,84 @@ Proto::Proto(const std::set<std::string>& logs,
                               labels.find(l->name) != labels.end());
           })),
       service_name_(service_name),
-      service_config_id_(service_config_id) {}
+      service_config_id_(service_config_id) {
+  BuildFillPlans();
+}
+
+int Proto::FillPlanIndex(bool is_first_report, bool is_final_report,
+                         bool send_consumer_metric) {
+  return (is_first_report ? 1 : 0) | (is_final_report ? 2 : 0) |
+         (send_consumer_metric ? 4 : 0);
+}
+
+const Proto::FillPlan& Proto::GetFillPlan(const ReportRequestInfo& info) const {
+  // Not to send consumer metrics if api_key is empty.
+  // api_key is empty in one of following cases:
+  // 1) api_key is not provided,
+  // 2) api_key is invalid determined by the server from the Check call.
+  // 3) the service is not activated for the consumer project.
+  return fill_plans_[FillPlanIndex(info.is_first_report, info.is_final_report,
+                                   !info.api_key.empty())];
+}
+
+const DistributionBuckets* Proto::GetDistributionBuckets(
+    const SupportedMetric* m) {
+  if (!m->distribution) {
+    return nullptr;
+  }
+  const DistributionHelperOptions* options = m->distribution;
+  auto it = distribution_buckets_.find(options);
+  if (it == distribution_buckets_.end()) {
+    it = distribution_buckets_
+             .emplace(std::piecewise_construct, std::forward_as_tuple(options),
+                      std::forward_as_tuple(options->buckets, options->growth,
+                                            options->scale))
+             .first;
+  }
+  return &it->second;
+}
+
+void Proto::BuildFillPlans() {
+  service_agent_ = kServiceAgentPrefix + utils::Version::instance().get();
+
+  ReportRequestInfo empty_info;
+  for (const SupportedLabel* l : labels_) {
+    if (l->scope != SupportedLabel::PROCESS) continue;
+    Map<std::string, std::string> labels;
+    Status status = (l->set)(*l, empty_info, &labels);
+    GOOGLE_CHECK(status.ok());
+    for (const auto& label : labels) {
+      constant_labels_.emplace_back(label.first, label.second);
+    }
+  }
+
+  for (int index = 0; index < 8; ++index) {
+    bool is_first_report = index & 1;
+    bool is_final_report = index & 2;
+    bool send_consumer_metric = index & 4;
+    FillPlan& plan = fill_plans_[index];
+
+    for (const SupportedLabel* l : labels_) {
+      if (l->scope == SupportedLabel::ALL_REPORTS ||
+          (l->scope == SupportedLabel::FINAL_REPORTS && is_final_report)) {
+        plan.labels.push_back(l);
+      }
+    }
+
+    for (const SupportedMetric* m : metrics_) {
+      if (!send_consumer_metric && m->mark == SupportedMetric::CONSUMER) {
+        continue;
+      }
+      if ((is_first_report && m->tag == SupportedMetric::START) ||
+          (is_final_report && (m->tag == SupportedMetric::FINAL ||
+                               m->tag == SupportedMetric::INTERMEDIATE)) ||
+          (!is_final_report && m->tag == SupportedMetric::INTERMEDIATE)) {
+        plan.metrics.push_back(m);
+        plan.buckets.push_back(GetDistributionBuckets(m));
+      }
+    }
+  }
+}
 
 utils::Status Proto::FillAllocateQuotaRequest(
     const QuotaRequestInfo& info,
@@ -957,8 +990,7 @@ utils::Status Proto::FillAllocateQuotaRequest(
     (*labels)[kServiceControlReferer] = info.referer;
   }
   (*labels)[kServiceControlUserAgent] = kUserAgent;
-  (*labels)[kServiceControlServiceAgent] =
-      kServiceAgentPrefix + utils::Version::instance().get();
+  (*labels)[kServiceControlServiceAgent] = service_agent_;
 
   if (info.metric_cost_vector) {
     for (auto metric : *info.metric_cost_vector) {
@@ -994,8 +1026,7 @@ Status Proto::FillCheckRequest(const CheckRequestInfo& info,
     (*labels)[kServiceControlReferer] = info.referer;
   }
   (*labels)[kServiceControlUserAgent] = kUserAgent;
-  (*labels)[kServiceControlServiceAgent] =
-      kServiceAgentPrefix + utils::Version::instance().get();
+  (*labels)[kServiceControlServiceAgent] = service_agent_;
 
   if (!info.android_package_name.empty()) {
     (*labels)[kServiceControlAndroidPackageName] = info.android_package_name;
@@ -1020,45 +1051,59 @@ Status Proto::FillReportRequest(const ReportRequestInfo& info,
   request->set_service_name(service_name_);
   request->set_service_config_id(service_config_id_);
 
-  Timestamp current_time = GetCurrentTimestamp();
   Operation* op = request->add_operations();
+  status = FillReportOperation(info, op);
+  if (!status.ok()) {
+    return status;
+  }
+
+  // The metrics of a single report are filled in the same way as the
+  // aggregated ones.
+  MetricAccumulator metrics;
+  AccumulateMetrics(info, &metrics);
+  return FillAccumulatedMetrics(metrics, op);
+}
+
+std::string Proto::ReportSignature(const ReportRequestInfo& info) const {
+  // All the fields of info used to fill the operation and its labels, but
+  // not the log entries.
+  std::string signature;
+  AddToSignature(info.operation_name, &signature);
+  AddToSignature(info.api_key, &signature);
+  AddToSignature(info.auth_issuer, &signature);
+  AddToSignature(info.auth_audience, &signature);
+  AddToSignature(info.referer, &signature);
+  AddToSignature(info.location, &signature);
+  AddToSignature(info.api_method, &signature);
+  AddToSignature(info.api_version, &signature);
+  int32_t values[] = {
+      info.operation_id.empty() ? 0 : 1,
+      FillPlanIndex(info.is_first_report, info.is_final_report,
+                    !info.api_key.empty()),
+      info.response_code,
+      info.status.CanonicalCode(),
+      info.protocol,
+      info.compute_platform,
+  };
+  signature.append(reinterpret_cast<const char*>(values), sizeof(values));
+  return signature;
+}
+
+Status Proto::FillReportOperation(const ReportRequestInfo& info,
+                                  Operation* op) const {
+  Timestamp current_time = GetCurrentTimestamp();
   SetOperationCommonFields(info, current_time, op);
 
-  // Only populate metrics if we can associate them with a method/operation.
+  // Only populate labels if we can associate them with a method/operation.
   if (!info.operation_id.empty() && !info.operation_name.empty()) {
-    Map<std::string, std::string>* labels = op->mutable_labels();
     // Set all labels.
-    for (auto it = labels_.begin(), end = labels_.end(); it != end; it++) {
-      const SupportedLabel* l = *it;
-      if (l->set) {
-        status = (l->set)(*l, info, labels);
-        if (!status.ok()) return status;
-      }
+    Map<std::string, std::string>* labels = op->mutable_labels();
+    for (const auto& label : constant_labels_) {
+      (*labels)[label.first] = label.second;
     }
-
-    // Not to send consumer metrics if api_key is empty.
-    // api_key is empty in one of following cases:
-    // 1) api_key is not provided,
-    // 2) api_key is invalid determined by the server from the Check call.
-    // 3) the service is not activated for the consumer project.
-    bool send_consumer_metric = !info.api_key.empty();
-
-    // Populate all metrics.
-    for (auto it = metrics_.begin(), end = metrics_.end(); it != end; it++) {
-      const SupportedMetric* m = *it;
-      if (send_consumer_metric || m->mark != SupportedMetric::CONSUMER) {
-        if (m->set) {
-          if ((info.is_first_report && m->tag == SupportedMetric::START) ||
-              (info.is_final_report &&
-               (m->tag == SupportedMetric::FINAL ||
-                m->tag == SupportedMetric::INTERMEDIATE)) ||
-              (!info.is_final_report &&
-               m->tag == SupportedMetric::INTERMEDIATE)) {
-            status = (m->set)(*m, info, op);
-            if (!status.ok()) return status;
-          }
-        }
-      }
+    for (const SupportedLabel* l : GetFillPlan(info).labels) {
+      Status status = (l->set)(*l, info, labels);
+      if (!status.ok()) return status;
     }
   }
 
@@ -1072,6 +1117,124 @@ Status Proto::FillReportRequest(const ReportRequestInfo& info,
   return Status::OK;
 }
 
+void Proto::MergeReportOperation(const ReportRequestInfo& info,
+                                 Operation* op) const {
+  Timestamp current_time = GetCurrentTimestamp();
+  *op->mutable_end_time() = current_time;
+
+  if (info.is_final_report) {
+    for (auto it = logs_.begin(), end = logs_.end(); it != end; it++) {
+      FillLogEntry(info, *it, current_time, op->add_log_entries());
+    }
+  }
+}
+
+void Proto::AccumulateMetrics(const ReportRequestInfo& info,
+                              MetricAccumulator* metrics) const {
+  if (info.operation_id.empty() || info.operation_name.empty()) {
+    return;
+  }
+  int index = FillPlanIndex(info.is_first_report, info.is_final_report,
+                            !info.api_key.empty());
+  const FillPlan& plan = fill_plans_[index];
+  if (metrics->plan < 0) {
+    metrics->plan = index;
+    metrics->values.resize(plan.metrics.size());
+  }
+
+  for (size_t i = 0; i < plan.metrics.size(); ++i) {
+    const SupportedMetric* m = plan.metrics[i];
+    double value;
+    if (!(m->get)(info, &value)) {
+      continue;
+    }
+    MetricAccumulator::Value& v = metrics->values[i];
+    const DistributionBuckets* buckets = plan.buckets[i];
+    if (buckets) {
+      // The same statistics as DistributionHelper::AddSample().
+      if (v.bucket_counts.empty()) {
+        v.bucket_counts.resize(buckets->size());
+      }
+      ++v.bucket_counts[buckets->Find(value)];
+      if (v.count == 0) {
+        v.mean = v.minimum = v.maximum = value;
+      } else {
+        double mean = v.mean + (value - v.mean) / (v.count + 1);
+        v.sum_of_squared_deviation += (value - v.mean) * (value - mean);
+        v.mean = mean;
+        v.minimum = std::min(v.minimum, value);
+        v.maximum = std::max(v.maximum, value);
+      }
+    } else {
+      v.int64_sum += static_cast<int64_t>(value);
+    }
+    ++v.count;
+  }
+}
+
+Status Proto::FillAccumulatedMetrics(const MetricAccumulator& metrics,
+                                     Operation* op) const {
+  if (metrics.plan < 0) {
+    return Status::OK;
+  }
+  const FillPlan& plan = fill_plans_[metrics.plan];
+  for (size_t i = 0; i < plan.metrics.size(); ++i) {
+    const SupportedMetric* m = plan.metrics[i];
+    const MetricAccumulator::Value& v = metrics.values[i];
+    if (v.count == 0) {
+      continue;
+    }
+    const DistributionBuckets* buckets = plan.buckets[i];
+    if (!buckets) {
+      AddInt64Metric(m->name, v.int64_sum, op);
+      continue;
+    }
+    // The same Distribution as DistributionHelper::InitExponential() and
+    // AddSample().
+    Distribution* distribution =
+        AddMetricValue(m->name, op)->mutable_distribution_value();
+    Distribution::ExponentialBuckets* exponential =
+        distribution->mutable_exponential_buckets();
+    exponential->set_num_finite_buckets(buckets->num_finite_buckets());
+    exponential->set_growth_factor(buckets->growth_factor());
+    exponential->set_scale(buckets->scale());
+    distribution->set_count(v.count);
+    distribution->set_mean(v.mean);
+    distribution->set_minimum(v.minimum);
+    distribution->set_maximum(v.maximum);
+    distribution->set_sum_of_squared_deviation(v.sum_of_squared_deviation);
+    distribution->mutable_bucket_counts()->Reserve(v.bucket_counts.size());
+    for (int64_t count : v.bucket_counts) {
+      distribution->add_bucket_counts(count);
+    }
+  }
+  return Status::OK;
+}
+
+void Proto::SplitReportRequest(const ReportRequest& request, size_t max_bytes,
+                               std::vector<ReportRequest>* requests) {
+  ReportRequest header;
+  header.set_service_name(request.service_name());
+  header.set_service_config_id(request.service_config_id());
+  const size_t header_bytes = header.ByteSize();
+
+  const size_t first = requests->size();
+  size_t bytes = 0;
+  for (const Operation& operation : request.operations()) {
+    // The size of the operation field: its tag, length and value.
+    size_t operation_bytes = operation.ByteSize();
+    operation_bytes +=
+        1 + CodedOutputStream::VarintSize32(
+                static_cast<uint32_t>(operation_bytes));
+    if (requests->size() == first || bytes + operation_bytes > max_bytes) {
+      requests->push_back(header);
+      bytes = header_bytes;
+    }
+    *requests->back().add_operations() = operation;
+    bytes += operation_bytes;
+  }
+}
+
 Status Proto::ConvertAllocateQuotaResponse(
     const ::google::api::servicecontrol::v1::AllocateQuotaResponse& response,
     const std::string& service_name) {
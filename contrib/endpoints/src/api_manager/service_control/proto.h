@@ -15,7 +15,14 @@
 #ifndef API_MANAGER_SERVICE_CONTROL_PROTO_H_
 #define API_MANAGER_SERVICE_CONTROL_PROTO_H_
 
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
 #include "contrib/endpoints/include/api_manager/utils/status.h"
+#include "contrib/endpoints/src/api_manager/service_control/distribution_buckets.h"
 #include "contrib/endpoints/src/api_manager/service_control/info.h"
 #include "google/api/label.pb.h"
 #include "google/api/metric.pb.h"
@@ -26,6 +33,38 @@ namespace google {
 namespace api_manager {
 namespace service_control {
 
+// The metric values of the reports merged into one operation, accumulated in
+// plain structs until the operation is built. Filled by Proto.
+struct MetricAccumulator {
+  struct Value {
+    Value()
+        : count(0),
+          int64_sum(0),
+          mean(0),
+          sum_of_squared_deviation(0),
+          minimum(0),
+          maximum(0) {}
+
+    // The number of values.
+    int64_t count;
+    // The sum of the values of INT64 metrics.
+    int64_t int64_sum;
+    // The statistics and the bucket counts of DISTRIBUTION metrics.
+    double mean;
+    double sum_of_squared_deviation;
+    double minimum;
+    double maximum;
+    std::vector<int64_t> bucket_counts;
+  };
+
+  MetricAccumulator() : plan(-1) {}
+
+  // The fill plan of the reports, -1 if none was added.
+  int plan;
+  // The values of the metrics of the fill plan, in order.
+  std::vector<Value> values;
+};
+
 class Proto final {
  public:
   // Initializes Proto with all supported metrics and labels.
@@ -60,6 +99,31 @@ class Proto final {
       const ReportRequestInfo& info,
       ::google::api::servicecontrol::v1::ReportRequest* request);
 
+  // Returns the signature of the operation filled for the report. Reports
+  // with the same signature have the same operation name, consumer, labels
+  // and metrics, so that they can be merged into one operation.
+  std::string ReportSignature(const ReportRequestInfo& info) const;
+
+  // Fills the operation for the report, without its metrics.
+  utils::Status FillReportOperation(
+      const ReportRequestInfo& info,
+      ::google::api::servicecontrol::v1::Operation* operation) const;
+
+  // Merges the report into the operation filled for a report with the same
+  // signature: extends its end time and adds the log entries of the report.
+  void MergeReportOperation(
+      const ReportRequestInfo& info,
+      ::google::api::servicecontrol::v1::Operation* operation) const;
+
+  // Adds the metric values of the report to metrics.
+  void AccumulateMetrics(const ReportRequestInfo& info,
+                         MetricAccumulator* metrics) const;
+
+  // Adds the accumulated metrics to the operation.
+  utils::Status FillAccumulatedMetrics(
+      const MetricAccumulator& metrics,
+      ::google::api::servicecontrol::v1::Operation* operation) const;
+
   // Converts the response status information in the CheckResponse protocol
   // buffer into utils::Status and returns and returns 'check_response_info'
   // subtracted from this CheckResponse.
@@ -73,17 +137,61 @@ class Proto final {
       const ::google::api::servicecontrol::v1::AllocateQuotaResponse& response,
       const std::string& service_name);
 
+  // Splits the report request into requests whose serialized size is at
+  // most max_bytes, each with a consecutive part of its operations. An
+  // operation larger than max_bytes is sent in a request of its own.
+  static void SplitReportRequest(
+      const ::google::api::servicecontrol::v1::ReportRequest& request,
+      size_t max_bytes,
+      std::vector<::google::api::servicecontrol::v1::ReportRequest>* requests);
+
   static bool IsMetricSupported(const ::google::api::MetricDescriptor& metric);
   static bool IsLabelSupported(const ::google::api::LabelDescriptor& label);
   const std::string& service_name() const { return service_name_; }
   const std::string& service_config_id() const { return service_config_id_; }
 
  private:
+  // What to fill for one kind of report.
+  struct FillPlan {
+    // The metrics to add, in order.
+    std::vector<const struct SupportedMetric*> metrics;
+    // The labels whose values depend on the report.
+    std::vector<const struct SupportedLabel*> labels;
+    // The buckets of the metrics, in the same order, null for INT64 metrics.
+    std::vector<const DistributionBuckets*> buckets;
+  };
+
+  // Computes the fill plans and renders the constant labels.
+  void BuildFillPlans();
+
+  // Returns the index of the fill plan for a report.
+  static int FillPlanIndex(bool is_first_report, bool is_final_report,
+                           bool send_consumer_metric);
+
+  // Returns the fill plan for the report.
+  const FillPlan& GetFillPlan(const ReportRequestInfo& info) const;
+
+  // Returns the buckets of the metric, null if it is not a DISTRIBUTION
+  // metric. The buckets are built once for all the metrics using them.
+  const DistributionBuckets* GetDistributionBuckets(
+      const struct SupportedMetric* m);
+
   const std::vector<std::string> logs_;
   const std::vector<const struct SupportedMetric*> metrics_;
   const std::vector<const struct SupportedLabel*> labels_;
   const std::string service_name_;
   const std::string service_config_id_;
+
+  // The fill plans of first, intermediate and final reports, with and
+  // without consumer metrics, by FillPlanIndex().
+  FillPlan fill_plans_[8];
+  // The labels with the same value for all the reports of the process.
+  std::vector<std::pair<std::string, std::string>> constant_labels_;
+  // The service agent label value.
+  std::string service_agent_;
+  // The buckets of the DISTRIBUTION metrics, by their options.
+  std::map<const struct DistributionHelperOptions*, DistributionBuckets>
+      distribution_buckets_;
 };
 
 }  // namespace service_control
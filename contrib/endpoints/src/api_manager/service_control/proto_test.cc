@@ -394,6 +394,38 @@ TEST_F(ProtoTest, CredentailIdIssuerAudienceTest) {
             "jwtauth:issuer=YXV0aC1pc3N1ZXI&audience=YXV0aC1hdWRpZW5jZQ");
 }
 
+TEST_F(ProtoTest, SplitReportRequestTest) {
+  gasv1::ReportRequest request;
+  for (int i = 0; i < 10; ++i) {
+    ReportRequestInfo info;
+    FillOperationInfo(&info);
+    info.operation_id = "operation_" + std::to_string(i);
+    ASSERT_TRUE(scp_.FillReportRequest(info, &request).ok());
+  }
+  ASSERT_EQ(10, request.operations_size());
+  size_t max_bytes = request.ByteSize() / 3;
+
+  std::vector<gasv1::ReportRequest> requests;
+  Proto::SplitReportRequest(request, max_bytes, &requests);
+  ASSERT_EQ(4, requests.size());
+  int operations = 0;
+  for (const auto& part : requests) {
+    ASSERT_EQ(request.service_name(), part.service_name());
+    ASSERT_EQ(request.service_config_id(), part.service_config_id());
+    ASSERT_LE(part.ByteSize(), max_bytes);
+    for (const auto& operation : part.operations()) {
+      ASSERT_EQ(request.operations(operations++).operation_id(),
+                operation.operation_id());
+    }
+  }
+  ASSERT_EQ(10, operations);
+
+  // An operation larger than the limit is sent on its own.
+  requests.clear();
+  Proto::SplitReportRequest(request, 1, &requests);
+  ASSERT_EQ(10, requests.size());
+}
+
 }  // namespace
 
 }  // namespace service_control
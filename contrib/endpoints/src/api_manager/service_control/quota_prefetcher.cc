@@ -0,0 +1,208 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+#include "contrib/endpoints/src/api_manager/service_control/quota_prefetcher.h"
+
+#include <algorithm>
+#include <limits>
+
+using ::google::api_manager::utils::Status;
+using ::google::protobuf::util::error::Code;
+using std::chrono::duration_cast;
+using std::chrono::milliseconds;
+
+namespace google {
+namespace api_manager {
+namespace service_control {
+
+namespace {
+
+// Returns the cost charged for the metric, as in the AllocateQuota requests.
+int GetCost(const std::pair<std::string, int> &metric) {
+  return metric.second <= 0 ? 1 : metric.second;
+}
+
+}  // namespace
+
+QuotaPrefetcher::Bucket::Bucket()
+    : tokens(0),
+      chunk(1),
+      cost(1),
+      used(0),
+      fetching(false),
+      granted(false),
+      probe(false),
+      denial(Status::OK) {}
+
+QuotaPrefetcher::QuotaPrefetcher(int refresh_interval_ms, int token_ttl_ms,
+                                 int max_chunk, size_t max_buckets)
+    : refresh_interval_(refresh_interval_ms),
+      token_ttl_(token_ttl_ms),
+      max_chunk_(std::max(max_chunk, 1)),
+      max_buckets_(max_buckets),
+      cleanup_size_(max_buckets) {}
+
+bool QuotaPrefetcher::Acquire(const std::string &consumer,
+                              const MetricCosts &costs, TimePoint now,
+                              Status *status) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  RemoveIdleBuckets(now);
+  *status = Status::OK;
+
+  std::vector<Bucket *> buckets;
+  buckets.reserve(costs.size());
+  for (const auto &metric : costs) {
+    Bucket *bucket = &buckets_[Key(consumer, metric.first)];
+    if (now < bucket->denied_until) {
+      *status = bucket->denial;
+      return true;
+    }
+    buckets.push_back(bucket);
+  }
+
+  // The shortfall may reach one chunk once a refill was granted, so that
+  // requests are not held up while the next refill is in flight.
+  bool covered = true;
+  for (size_t i = 0; i < costs.size(); ++i) {
+    Bucket *bucket = buckets[i];
+    Expire(bucket, now);
+    bucket->cost = GetCost(costs[i]);
+    int64_t max_shortfall = bucket->granted ? bucket->chunk : 0;
+    if (bucket->tokens - bucket->cost < -max_shortfall) {
+      covered = false;
+    }
+  }
+  for (Bucket *bucket : buckets) {
+    if (covered) {
+      bucket->tokens -= bucket->cost;
+    }
+    // The requests sent to the server count for the rate too.
+    bucket->used += bucket->cost;
+    bucket->last_used = now;
+  }
+  return covered;
+}
+
+bool QuotaPrefetcher::StartFetch(const std::string &consumer,
+                                 const MetricCosts &costs, TimePoint now,
+                                 MetricCosts *amounts) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (const auto &metric : costs) {
+    auto it = buckets_.find(Key(consumer, metric.first));
+    if (it == buckets_.end()) {
+      continue;
+    }
+    Bucket &bucket = it->second;
+    Expire(&bucket, now);
+    if (bucket.fetching || now < bucket.denied_until ||
+        (bucket.tokens > 0 && bucket.tokens >= bucket.chunk / 2)) {
+      continue;
+    }
+
+    // The tokens needed for a refresh interval at the rate observed since
+    // the previous refill, and the shortfall. A refill following one refused
+    // for being too large only asks for the cost of one request, and the
+    // shortfall.
+    int64_t amount = bucket.cost;
+    if (!bucket.probe) {
+      int64_t needed = bucket.cost;
+      if (bucket.last_fetch != TimePoint()) {
+        int64_t elapsed_ms = std::max<int64_t>(
+            duration_cast<milliseconds>(now - bucket.last_fetch).count(), 1);
+        needed = bucket.used * refresh_interval_.count() / elapsed_ms;
+      }
+      needed = std::min<int64_t>(needed, max_chunk_);
+      bucket.chunk = static_cast<int>(std::max<int64_t>(needed, bucket.cost));
+      amount = bucket.chunk;
+    }
+    amount += std::max<int64_t>(-bucket.tokens, 0);
+    amount = std::min<int64_t>(amount, std::numeric_limits<int>::max());
+    amounts->emplace_back(metric.first, static_cast<int>(amount));
+    bucket.used = 0;
+    bucket.last_fetch = now;
+    bucket.fetching = true;
+  }
+  return !amounts->empty();
+}
+
+void QuotaPrefetcher::OnFetchDone(const std::string &consumer,
+                                  const MetricCosts &amounts,
+                                  const Status &status, TimePoint now) {
+  // Fails open only when the server is unavailable, as quota control does.
+  bool granted = status.ok() || status.code() == Code::UNAVAILABLE;
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (const auto &amount : amounts) {
+    auto it = buckets_.find(Key(consumer, amount.first));
+    if (it == buckets_.end()) {
+      continue;
+    }
+    Bucket &bucket = it->second;
+    bucket.fetching = false;
+    bool probe = bucket.probe;
+    bucket.probe = false;
+    if (granted) {
+      bucket.tokens += amount.second;
+      bucket.expire = now + token_ttl_;
+      bucket.granted = true;
+      continue;
+    }
+
+    // The shortfall, at most one chunk, is kept and charged to the next
+    // refill. The smaller chunk sends the requests to the server sooner.
+    bucket.chunk = bucket.cost;
+    if (status.code() == Code::RESOURCE_EXHAUSTED && !probe) {
+      // The quota left may still be enough for smaller refills.
+      bucket.probe = true;
+      continue;
+    }
+    bucket.denial = status;
+    bucket.denied_until = now + refresh_interval_;
+  }
+}
+
+size_t QuotaPrefetcher::size() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return buckets_.size();
+}
+
+void QuotaPrefetcher::Expire(Bucket *bucket, TimePoint now) const {
+  if (bucket->tokens > 0 && now >= bucket->expire) {
+    bucket->tokens = 0;
+  }
+}
+
+void QuotaPrefetcher::RemoveIdleBuckets(TimePoint now) {
+  if (buckets_.size() <= cleanup_size_) {
+    return;
+  }
+  for (auto it = buckets_.begin(); it != buckets_.end();) {
+    const Bucket &bucket = it->second;
+    if (!bucket.fetching && now >= bucket.denied_until &&
+        now - bucket.last_used >= token_ttl_) {
+      it = buckets_.erase(it);
+    } else {
+      ++it;
+    }
+  }
+  // The buckets are scanned again only once they have doubled, so that the
+  // cost of the scans is amortized when most of them are busy.
+  cleanup_size_ = std::max(max_buckets_, 2 * buckets_.size());
+}
+
+}  // namespace service_control
+}  // namespace api_manager
+}  // namespace google
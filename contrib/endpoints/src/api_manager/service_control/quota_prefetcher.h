@@ -0,0 +1,138 @@
+/* Copyright 2017 Google Inc. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef API_MANAGER_SERVICE_CONTROL_QUOTA_PREFETCHER_H_
+#define API_MANAGER_SERVICE_CONTROL_QUOTA_PREFETCHER_H_
+
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "contrib/endpoints/include/api_manager/utils/status.h"
+
+namespace google {
+namespace api_manager {
+namespace service_control {
+
+// Answers quota requests locally from token buckets per consumer and quota
+// metric, which are refilled ahead of time by AllocateQuota calls, so that
+// quota enforcement does not wait for the service control server:
+//  -- Acquire() takes the cost of a request from the buckets. Once a refill
+//  was granted, requests are allowed while tokens are short by up to one
+//  chunk, e.g. while the next refill is in flight, and the shortfall is
+//  charged to the next refill. The other requests, e.g. the first ones of
+//  a consumer, are left to the server. They are refused with the error of
+//  the last refill while it holds.
+//  -- StartFetch() returns the amounts to allocate for the buckets running
+//  low, and OnFetchDone() adds the allocated tokens to them. The amounts are
+//  sized to last refresh_interval_ms at the rate observed since the previous
+//  refill, between the cost of one request and max_chunk.
+//  -- Tokens left unused token_ttl_ms after their refill are dropped, and
+//  the refills shrink with the rate, so that the quota held but not used
+//  stays small.
+class QuotaPrefetcher {
+ public:
+  typedef std::chrono::steady_clock::time_point TimePoint;
+  // The quota metrics and their amounts, as in
+  // QuotaRequestInfo::metric_cost_vector.
+  typedef std::vector<std::pair<std::string, int>> MetricCosts;
+
+  // At most about max_buckets buckets are kept, the idle ones are removed
+  // first.
+  QuotaPrefetcher(int refresh_interval_ms, int token_ttl_ms, int max_chunk,
+                  size_t max_buckets);
+
+  // Takes the costs of a request of the consumer from its buckets at now.
+  // Returns false if the buckets cannot cover them, and the request must be
+  // allocated by the server. Otherwise returns true, with the error of the
+  // last refill refused for one of the metrics while it holds, or OK, in
+  // status.
+  bool Acquire(const std::string &consumer, const MetricCosts &costs,
+               TimePoint now, utils::Status *status);
+
+  // Returns in amounts the tokens to allocate for the buckets of the metrics
+  // in costs which are running low and have no refill in flight. Returns
+  // false if there are none. The caller must call OnFetchDone() with the
+  // same amounts once the allocation is done.
+  bool StartFetch(const std::string &consumer, const MetricCosts &costs,
+                  TimePoint now, MetricCosts *amounts);
+
+  // Completes the allocation of amounts at now with its status. The tokens
+  // are added to the buckets if it is OK, or UNAVAILABLE, the only error
+  // quota control fails open on. Otherwise, e.g. for the INTERNAL error of
+  // unsupported quota errors, the status is returned by Acquire() for
+  // refresh_interval_ms, except for a refill refused with
+  // RESOURCE_EXHAUSTED, which is first retried with the cost of one request.
+  void OnFetchDone(const std::string &consumer, const MetricCosts &amounts,
+                   const utils::Status &status, TimePoint now);
+
+  // The number of buckets.
+  size_t size() const;
+
+ private:
+  struct Bucket {
+    Bucket();
+
+    // The tokens available, negative for a shortfall.
+    int64_t tokens;
+    // The amount of the next refill.
+    int chunk;
+    // The cost of the last request.
+    int cost;
+    // The tokens taken since the last refill started.
+    int64_t used;
+    // The start of the last refill.
+    TimePoint last_fetch;
+    // When the unused tokens of the last refill are dropped.
+    TimePoint expire;
+    // The last time tokens were taken.
+    TimePoint last_used;
+    bool fetching;
+    // Whether a refill was ever granted.
+    bool granted;
+    // Whether the next or current refill only asks for the cost of one
+    // request, after a refill was refused for being too large.
+    bool probe;
+    // The error of the last refill, returned until denied_until.
+    utils::Status denial;
+    TimePoint denied_until;
+  };
+  typedef std::pair<std::string, std::string> Key;
+
+  // Drops the expired tokens of the bucket.
+  void Expire(Bucket *bucket, TimePoint now) const;
+
+  // Removes the idle buckets if there are too many.
+  void RemoveIdleBuckets(TimePoint now);
+
+  const std::chrono::milliseconds refresh_interval_;
+  const std::chrono::milliseconds token_ttl_;
+  const int max_chunk_;
+  const size_t max_buckets_;
+
+  // Protects the members below.
+  mutable std::mutex mutex_;
+  std::map<Key, Bucket> buckets_;
+  // The number of buckets above which the idle ones are removed.
+  size_t cleanup_size_;
+};
+
+}  // namespace service_control
+}  // namespace api_manager
+}  // namespace google
+
+#endif  // API_MANAGER_SERVICE_CONTROL_QUOTA_PREFETCHER_H_
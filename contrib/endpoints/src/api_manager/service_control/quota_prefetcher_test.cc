@@ -0,0 +1,293 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+#include "contrib/endpoints/src/api_manager/service_control/quota_prefetcher.h"
+
+#include "gtest/gtest.h"
+
+using ::google::api_manager::utils::Status;
+using ::google::protobuf::util::error::Code;
+using std::chrono::milliseconds;
+using std::chrono::steady_clock;
+
+namespace google {
+namespace api_manager {
+namespace service_control {
+
+namespace {
+
+typedef QuotaPrefetcher::MetricCosts MetricCosts;
+
+const MetricCosts kCosts = {{"metric_first", 1}, {"metric_second", 2}};
+
+// Returned by Acquire() for the requests left to the server.
+const int kServer = -1;
+
+// Returns the code of the status of a request answered from the buckets,
+// or kServer.
+int Acquire(QuotaPrefetcher *prefetcher, const std::string &consumer,
+            const MetricCosts &costs, steady_clock::time_point now) {
+  Status status = Status::OK;
+  if (!prefetcher->Acquire(consumer, costs, now, &status)) {
+    return kServer;
+  }
+  return status.code();
+}
+
+TEST(QuotaPrefetcherTest, AnswersLocallyAfterRefill) {
+  steady_clock::time_point now = steady_clock::now();
+  QuotaPrefetcher prefetcher(1000, 10000, 1000, 100);
+
+  // The first requests are left to the server until a refill is granted.
+  ASSERT_EQ(kServer, Acquire(&prefetcher, "consumer", kCosts, now));
+  MetricCosts amounts;
+  ASSERT_TRUE(prefetcher.StartFetch("consumer", kCosts, now, &amounts));
+  ASSERT_EQ(MetricCosts({{"metric_first", 1}, {"metric_second", 2}}),
+            amounts);
+
+  // A refill is in flight.
+  ASSERT_EQ(kServer, Acquire(&prefetcher, "consumer", kCosts, now));
+  MetricCosts more;
+  ASSERT_FALSE(prefetcher.StartFetch("consumer", kCosts, now, &more));
+
+  prefetcher.OnFetchDone("consumer", amounts, Status::OK, now);
+  ASSERT_EQ(Code::OK, Acquire(&prefetcher, "consumer", kCosts, now));
+  ASSERT_EQ(2u, prefetcher.size());
+}
+
+TEST(QuotaPrefetcherTest, ShortfallIsBoundedByOneChunk) {
+  steady_clock::time_point now = steady_clock::now();
+  QuotaPrefetcher prefetcher(1000, 10000, 1000, 100);
+  const MetricCosts costs = {{"metric", 1}};
+
+  ASSERT_EQ(kServer, Acquire(&prefetcher, "consumer", costs, now));
+  MetricCosts amounts;
+  ASSERT_TRUE(prefetcher.StartFetch("consumer", costs, now, &amounts));
+  prefetcher.OnFetchDone("consumer", amounts, Status::OK, now);
+
+  // The token granted is taken, and a refill of 2000 per second, capped to
+  // max_chunk, is started.
+  ASSERT_EQ(Code::OK, Acquire(&prefetcher, "consumer", costs, now));
+  amounts.clear();
+  ASSERT_TRUE(prefetcher.StartFetch("consumer", costs, now, &amounts));
+  ASSERT_EQ(MetricCosts({{"metric", 1000}}), amounts);
+
+  // While it is in flight, up to one chunk is allowed.
+  for (int i = 0; i < 1000; ++i) {
+    ASSERT_EQ(Code::OK, Acquire(&prefetcher, "consumer", costs, now));
+  }
+  ASSERT_EQ(kServer, Acquire(&prefetcher, "consumer", costs, now));
+
+  // A refused refill does not forgive the shortfall.
+  prefetcher.OnFetchDone("consumer", amounts,
+                         Status(Code::RESOURCE_EXHAUSTED, "exhausted"), now);
+  ASSERT_EQ(kServer, Acquire(&prefetcher, "consumer", costs, now));
+  amounts.clear();
+  ASSERT_TRUE(prefetcher.StartFetch("consumer", costs, now, &amounts));
+  ASSERT_EQ(MetricCosts({{"metric", 1001}}), amounts);
+}
+
+TEST(QuotaPrefetcherTest, DeniedConsumerFirstBurst) {
+  steady_clock::time_point now = steady_clock::now();
+  QuotaPrefetcher prefetcher(1000, 10000, 1000, 100);
+  const MetricCosts costs = {{"metric", 1}};
+
+  // None of the requests sent before the first refill returns is allowed
+  // locally.
+  MetricCosts amounts;
+  for (int i = 0; i < 100; ++i) {
+    ASSERT_EQ(kServer, Acquire(&prefetcher, "consumer", costs, now));
+    MetricCosts more;
+    if (prefetcher.StartFetch("consumer", costs, now, &more)) {
+      ASSERT_TRUE(amounts.empty());
+      amounts = more;
+    }
+  }
+  ASSERT_EQ(MetricCosts({{"metric", 1}}), amounts);
+
+  prefetcher.OnFetchDone("consumer", amounts,
+                         Status(Code::PERMISSION_DENIED, "API key invalid."),
+                         now);
+  ASSERT_EQ(Code::PERMISSION_DENIED,
+            Acquire(&prefetcher, "consumer", costs, now));
+
+  // Same for a consumer without quota left.
+  Status exhausted(Code::RESOURCE_EXHAUSTED, "Quota allocation failed.");
+  for (int i = 0; i < 2; ++i) {
+    ASSERT_EQ(kServer, Acquire(&prefetcher, "other", costs, now));
+    amounts.clear();
+    ASSERT_TRUE(prefetcher.StartFetch("other", costs, now, &amounts));
+    prefetcher.OnFetchDone("other", amounts, exhausted, now);
+  }
+  ASSERT_EQ(Code::RESOURCE_EXHAUSTED,
+            Acquire(&prefetcher, "other", costs, now));
+}
+
+TEST(QuotaPrefetcherTest, ChunksFollowTheRate) {
+  steady_clock::time_point now = steady_clock::now();
+  QuotaPrefetcher prefetcher(1000, 10000, 500, 100);
+  const MetricCosts costs = {{"metric", 1}};
+
+  // 100 requests per 100ms, i.e. 1000 per refresh interval.
+  int refills = 0;
+  int last_amount = 0;
+  int server = 0;
+  for (int i = 0; i < 2000; ++i) {
+    if (i % 100 == 0) {
+      now += milliseconds(100);
+    }
+    int code = Acquire(&prefetcher, "consumer", costs, now);
+    if (code == kServer) {
+      ++server;
+    } else {
+      ASSERT_EQ(Code::OK, code);
+    }
+    MetricCosts amounts;
+    if (prefetcher.StartFetch("consumer", costs, now, &amounts)) {
+      ++refills;
+      last_amount = amounts[0].second;
+      prefetcher.OnFetchDone("consumer", amounts, Status::OK, now);
+    }
+  }
+  // The chunks grow to max_chunk, so most requests are answered from the
+  // buckets.
+  ASSERT_EQ(1, server);
+  ASSERT_GE(last_amount, 500);
+  ASSERT_LT(refills, 20);
+
+  // At 1 request per 100ms, they shrink down to 10 per refresh interval.
+  now += milliseconds(10000);
+  for (int i = 0; i < 100; ++i) {
+    now += milliseconds(100);
+    ASSERT_EQ(Code::OK, Acquire(&prefetcher, "consumer", costs, now));
+    MetricCosts amounts;
+    if (prefetcher.StartFetch("consumer", costs, now, &amounts)) {
+      last_amount = amounts[0].second;
+      prefetcher.OnFetchDone("consumer", amounts, Status::OK, now);
+    }
+  }
+  ASSERT_LE(last_amount, 20);
+}
+
+TEST(QuotaPrefetcherTest, UnusedTokensExpire) {
+  steady_clock::time_point now = steady_clock::now();
+  QuotaPrefetcher prefetcher(1000, 10000, 1000, 100);
+  const MetricCosts costs = {{"metric", 1}};
+
+  ASSERT_EQ(kServer, Acquire(&prefetcher, "consumer", costs, now));
+  MetricCosts amounts;
+  ASSERT_TRUE(prefetcher.StartFetch("consumer", costs, now, &amounts));
+  prefetcher.OnFetchDone("consumer", {{"metric", 100}}, Status::OK, now);
+
+  ASSERT_EQ(Code::OK, Acquire(&prefetcher, "consumer", costs, now));
+  amounts.clear();
+  ASSERT_FALSE(prefetcher.StartFetch("consumer", costs, now, &amounts));
+
+  // The tokens left are dropped, and the bucket refilled.
+  now += milliseconds(10000);
+  ASSERT_EQ(Code::OK, Acquire(&prefetcher, "consumer", costs, now));
+  ASSERT_TRUE(prefetcher.StartFetch("consumer", costs, now, &amounts));
+}
+
+TEST(QuotaPrefetcherTest, RefusedRefills) {
+  steady_clock::time_point now = steady_clock::now();
+  QuotaPrefetcher prefetcher(1000, 10000, 1000, 100);
+  const MetricCosts costs = {{"metric", 1}};
+  Status exhausted(Code::RESOURCE_EXHAUSTED, "Quota allocation failed.");
+
+  ASSERT_EQ(kServer, Acquire(&prefetcher, "consumer", costs, now));
+  MetricCosts amounts;
+  ASSERT_TRUE(prefetcher.StartFetch("consumer", costs, now, &amounts));
+  prefetcher.OnFetchDone("consumer", {{"metric", 10}}, Status::OK, now);
+  for (int i = 0; i < 10; ++i) {
+    ASSERT_EQ(Code::OK, Acquire(&prefetcher, "consumer", costs, now));
+  }
+
+  // A large refill refused is retried with the cost of one request, and the
+  // shortfall.
+  amounts.clear();
+  ASSERT_TRUE(prefetcher.StartFetch("consumer", costs, now, &amounts));
+  ASSERT_GT(amounts[0].second, 1);
+  ASSERT_EQ(Code::OK, Acquire(&prefetcher, "consumer", costs, now));
+  prefetcher.OnFetchDone("consumer", amounts, exhausted, now);
+  ASSERT_EQ(kServer, Acquire(&prefetcher, "consumer", costs, now));
+
+  amounts.clear();
+  ASSERT_TRUE(prefetcher.StartFetch("consumer", costs, now, &amounts));
+  ASSERT_EQ(MetricCosts({{"metric", 2}}), amounts);
+  prefetcher.OnFetchDone("consumer", amounts, exhausted, now);
+
+  // The requests are refused until the refresh interval is over.
+  ASSERT_EQ(Code::RESOURCE_EXHAUSTED,
+            Acquire(&prefetcher, "consumer", costs,
+                    now + milliseconds(999)));
+  // Other consumers are not affected.
+  ASSERT_EQ(kServer, Acquire(&prefetcher, "other", costs, now));
+  ASSERT_EQ(kServer, Acquire(&prefetcher, "consumer", costs,
+                             now + milliseconds(1000)));
+}
+
+TEST(QuotaPrefetcherTest, FailsOpenWhenUnavailable) {
+  steady_clock::time_point now = steady_clock::now();
+  QuotaPrefetcher prefetcher(1000, 10000, 1000, 100);
+  const MetricCosts costs = {{"metric", 1}};
+
+  ASSERT_EQ(kServer, Acquire(&prefetcher, "consumer", costs, now));
+  MetricCosts amounts;
+  ASSERT_TRUE(prefetcher.StartFetch("consumer", costs, now, &amounts));
+  prefetcher.OnFetchDone("consumer", amounts,
+                         Status(Code::UNAVAILABLE, "unavailable"), now);
+  ASSERT_EQ(Code::OK, Acquire(&prefetcher, "consumer", costs, now));
+
+  amounts.clear();
+  ASSERT_TRUE(prefetcher.StartFetch("consumer", costs, now, &amounts));
+  prefetcher.OnFetchDone("consumer", amounts,
+                         Status(Code::PERMISSION_DENIED, "Project suspended."),
+                         now);
+  ASSERT_EQ(Code::PERMISSION_DENIED,
+            Acquire(&prefetcher, "consumer", costs, now));
+
+  // Unsupported quota errors block the requests.
+  ASSERT_EQ(kServer, Acquire(&prefetcher, "other", costs, now));
+  amounts.clear();
+  ASSERT_TRUE(prefetcher.StartFetch("other", costs, now, &amounts));
+  prefetcher.OnFetchDone(
+      "other", amounts,
+      Status(Code::INTERNAL, "Request blocked due to unsupported error code."),
+      now);
+  ASSERT_EQ(Code::INTERNAL, Acquire(&prefetcher, "other", costs, now));
+}
+
+TEST(QuotaPrefetcherTest, RemovesIdleBuckets) {
+  steady_clock::time_point now = steady_clock::now();
+  QuotaPrefetcher prefetcher(1000, 10000, 1000, 2);
+  const MetricCosts costs = {{"metric", 1}};
+
+  Acquire(&prefetcher, "consumer1", costs, now);
+  Acquire(&prefetcher, "consumer2", costs, now);
+  Acquire(&prefetcher, "consumer3", costs, now);
+  ASSERT_EQ(3u, prefetcher.size());
+
+  now += milliseconds(10000);
+  Acquire(&prefetcher, "consumer4", costs, now);
+  ASSERT_EQ(1u, prefetcher.size());
+}
+
+}  // namespace
+
+}  // namespace service_control
+}  // namespace api_manager
+}  // namespace google
@@ -0,0 +1,105 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+#include "contrib/endpoints/src/api_manager/service_control/report_aggregator.h"
+
+using ::google::api::servicecontrol::v1::Operation;
+using ::google::api::servicecontrol::v1::ReportRequest;
+using ::google::api_manager::utils::Status;
+
+namespace google {
+namespace api_manager {
+namespace service_control {
+
+ReportAggregator::ReportAggregator(const Proto* proto, size_t max_entries)
+    : proto_(proto), max_entries_(max_entries), reports_(0) {}
+
+bool ReportAggregator::Add(const ReportRequestInfo& info) {
+  std::string signature = proto_->ReportSignature(info);
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto it = entries_.find(signature);
+  if (it != entries_.end()) {
+    proto_->MergeReportOperation(info, it->second.operation.get());
+    proto_->AccumulateMetrics(info, &it->second.metrics);
+    ++reports_;
+    return true;
+  }
+
+  if (entries_.size() >= max_entries_) {
+    return false;
+  }
+  std::unique_ptr<Operation> operation(new Operation);
+  if (!proto_->FillReportOperation(info, operation.get()).ok()) {
+    return false;
+  }
+  Entry& entry = entries_[signature];
+  entry.operation = std::move(operation);
+  proto_->AccumulateMetrics(info, &entry.metrics);
+  ++reports_;
+  return true;
+}
+
+Status ReportAggregator::Flush(ReportRequest* request, size_t* reports) {
+  std::unordered_map<std::string, Entry> entries;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    entries.swap(entries_);
+    if (reports) {
+      *reports = reports_;
+    }
+    reports_ = 0;
+  }
+  if (entries.empty()) {
+    return Status::OK;
+  }
+
+  request->set_service_name(proto_->service_name());
+  request->set_service_config_id(proto_->service_config_id());
+  // An operation which cannot be filled is dropped, the others are still
+  // flushed.
+  Status first_error = Status::OK;
+  size_t dropped = 0;
+  for (auto& it : entries) {
+    Entry& entry = it.second;
+    Status status =
+        proto_->FillAccumulatedMetrics(entry.metrics, entry.operation.get());
+    if (!status.ok()) {
+      if (first_error.ok()) {
+        first_error = status;
+      }
+      ++dropped;
+      continue;
+    }
+    request->mutable_operations()->AddAllocated(entry.operation.release());
+  }
+  if (!first_error.ok()) {
+    return Status(first_error.code(),
+                  "Dropped " + std::to_string(dropped) + " of " +
+                      std::to_string(entries.size()) +
+                      " aggregated operations: " + first_error.message());
+  }
+  return Status::OK;
+}
+
+size_t ReportAggregator::size() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return entries_.size();
+}
+
+}  // namespace service_control
+}  // namespace api_manager
+}  // namespace google
@@ -0,0 +1,78 @@
+/* Copyright 2017 Google Inc. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef API_MANAGER_SERVICE_CONTROL_REPORT_AGGREGATOR_H_
+#define API_MANAGER_SERVICE_CONTROL_REPORT_AGGREGATOR_H_
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "contrib/endpoints/include/api_manager/utils/status.h"
+#include "contrib/endpoints/src/api_manager/service_control/info.h"
+#include "contrib/endpoints/src/api_manager/service_control/proto.h"
+#include "google/api/servicecontrol/v1/service_controller.pb.h"
+
+namespace google {
+namespace api_manager {
+namespace service_control {
+
+// Aggregates the reports by operation signature before they are handed to
+// the service control client. The operation of a signature, with its labels,
+// is filled once from its first report. The metric values of all its reports
+// are accumulated in plain structs, and only added to the operation when the
+// aggregated reports are flushed.
+class ReportAggregator {
+ public:
+  // Aggregates at most max_entries signatures between flushes.
+  ReportAggregator(const Proto* proto, size_t max_entries);
+
+  // Adds the report. Returns false if it was not added, because the
+  // aggregator is full or the operation could not be filled, in which case
+  // the report should be sent on its own.
+  bool Add(const ReportRequestInfo& info);
+
+  // Moves the aggregated operations, if any, to the request. If reports is
+  // not null, it is set to the number of reports merged into them. The
+  // operations which cannot be filled are dropped, and an error with their
+  // number is returned; the other operations are still moved.
+  utils::Status Flush(::google::api::servicecontrol::v1::ReportRequest* request,
+                      size_t* reports = nullptr);
+
+  // Returns the number of aggregated signatures.
+  size_t size() const;
+
+ private:
+  struct Entry {
+    std::unique_ptr<::google::api::servicecontrol::v1::Operation> operation;
+    MetricAccumulator metrics;
+  };
+
+  const Proto* proto_;
+  size_t max_entries_;
+
+  // Protects entries_ and reports_.
+  mutable std::mutex mutex_;
+  // The aggregated reports by signature.
+  std::unordered_map<std::string, Entry> entries_;
+  // The number of reports added since the last flush.
+  size_t reports_;
+};
+
+}  // namespace service_control
+}  // namespace api_manager
+}  // namespace google
+
+#endif  // API_MANAGER_SERVICE_CONTROL_REPORT_AGGREGATOR_H_
@@ -0,0 +1,208 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+#include "contrib/endpoints/src/api_manager/service_control/report_aggregator.h"
+#include "gtest/gtest.h"
+#include "utils/distribution_helper.h"
+
+using ::google::api::servicecontrol::v1::Distribution;
+using ::google::api::servicecontrol::v1::MetricValueSet;
+using ::google::api::servicecontrol::v1::Operation;
+using ::google::api::servicecontrol::v1::ReportRequest;
+using ::google::service_control_client::DistributionHelper;
+
+namespace google {
+namespace api_manager {
+namespace service_control {
+
+namespace {
+
+const char kRequestCount[] =
+    "serviceruntime.googleapis.com/api/producer/request_count";
+const char kRequestSizes[] =
+    "serviceruntime.googleapis.com/api/producer/request_sizes";
+
+void FillReportRequestInfo(ReportRequestInfo* info) {
+  info->operation_id = "operation_id";
+  info->operation_name = "operation_name";
+  info->api_key = "api_key_x";
+  info->producer_project_id = "project_id";
+  info->referer = "referer";
+  info->response_code = 200;
+  info->location = "some_location";
+  info->api_name = "api_name";
+  info->api_version = "api_version";
+  info->api_method = "api_method";
+  info->method = "GET";
+  info->request_size = 100;
+  info->response_size = 1024 * 1024;
+  info->latency.request_time_ms = 10;
+  info->latency.backend_time_ms = 8;
+  info->latency.overhead_time_ms = 2;
+}
+
+const MetricValueSet* FindMetric(const Operation& operation,
+                                 const std::string& name) {
+  for (const auto& metric : operation.metric_value_sets()) {
+    if (metric.metric_name() == name) {
+      return &metric;
+    }
+  }
+  return nullptr;
+}
+
+class ReportAggregatorTest : public ::testing::Test {
+ protected:
+  ReportAggregatorTest()
+      : proto_({"local_test_log"}, "test_service", "2016-09-19r0"),
+        aggregator_(&proto_, 2) {}
+
+  Proto proto_;
+  ReportAggregator aggregator_;
+};
+
+TEST_F(ReportAggregatorTest, MergeSameSignature) {
+  ReportRequestInfo info1;
+  FillReportRequestInfo(&info1);
+  ReportRequestInfo info2;
+  FillReportRequestInfo(&info2);
+  info2.operation_id = "operation_id2";
+  info2.request_size = 1000;
+
+  ASSERT_TRUE(aggregator_.Add(info1));
+  ASSERT_TRUE(aggregator_.Add(info2));
+  ASSERT_EQ(1, aggregator_.size());
+
+  ReportRequest request;
+  size_t reports = 0;
+  ASSERT_TRUE(aggregator_.Flush(&request, &reports).ok());
+  ASSERT_EQ(0, aggregator_.size());
+  ASSERT_EQ(2, reports);
+  ASSERT_EQ("test_service", request.service_name());
+  ASSERT_EQ(1, request.operations_size());
+
+  const Operation& operation = request.operations(0);
+  ASSERT_EQ("operation_id", operation.operation_id());
+  ASSERT_EQ(2, operation.log_entries_size());
+
+  const MetricValueSet* request_count = FindMetric(operation, kRequestCount);
+  ASSERT_TRUE(request_count != nullptr);
+  ASSERT_EQ(2, request_count->metric_values(0).int64_value());
+
+  const MetricValueSet* request_sizes = FindMetric(operation, kRequestSizes);
+  ASSERT_TRUE(request_sizes != nullptr);
+  const Distribution& sizes =
+      request_sizes->metric_values(0).distribution_value();
+  ASSERT_EQ(2, sizes.count());
+  ASSERT_EQ(100, sizes.minimum());
+  ASSERT_EQ(1000, sizes.maximum());
+  ASSERT_EQ(550, sizes.mean());
+}
+
+TEST_F(ReportAggregatorTest, DifferentSignatures) {
+  ReportRequestInfo info1;
+  FillReportRequestInfo(&info1);
+  ReportRequestInfo info2;
+  FillReportRequestInfo(&info2);
+  info2.response_code = 503;
+  ReportRequestInfo info3;
+  FillReportRequestInfo(&info3);
+  info3.api_key = "api_key_y";
+
+  ASSERT_TRUE(aggregator_.Add(info1));
+  ASSERT_TRUE(aggregator_.Add(info2));
+  // The aggregator is full.
+  ASSERT_FALSE(aggregator_.Add(info3));
+  // Reports with a known signature are still merged.
+  ASSERT_TRUE(aggregator_.Add(info1));
+
+  ReportRequest request;
+  ASSERT_TRUE(aggregator_.Flush(&request).ok());
+  ASSERT_EQ(2, request.operations_size());
+
+  // Flushing an empty aggregator does nothing.
+  ReportRequest empty;
+  ASSERT_TRUE(aggregator_.Flush(&empty).ok());
+  ASSERT_EQ(0, empty.operations_size());
+}
+
+TEST_F(ReportAggregatorTest, SameAsReportRequest) {
+  // The metrics of a single report are the same as the ones filled by
+  // FillReportRequest().
+  ReportRequestInfo info;
+  FillReportRequestInfo(&info);
+  ASSERT_TRUE(aggregator_.Add(info));
+  ReportRequest aggregated;
+  ASSERT_TRUE(aggregator_.Flush(&aggregated).ok());
+
+  ReportRequest expected;
+  ASSERT_TRUE(proto_.FillReportRequest(info, &expected).ok());
+
+  const Operation& operation = aggregated.operations(0);
+  const Operation& expected_operation = expected.operations(0);
+  ASSERT_EQ(expected_operation.labels().size(), operation.labels().size());
+  for (const auto& label : expected_operation.labels()) {
+    ASSERT_EQ(label.second, operation.labels().at(label.first));
+  }
+  ASSERT_EQ(expected_operation.metric_value_sets_size(),
+            operation.metric_value_sets_size());
+  for (const auto& metric : expected_operation.metric_value_sets()) {
+    const MetricValueSet* actual = FindMetric(operation, metric.metric_name());
+    ASSERT_TRUE(actual != nullptr) << metric.metric_name();
+    ASSERT_EQ(metric.SerializeAsString(), actual->SerializeAsString())
+        << metric.metric_name();
+  }
+}
+
+TEST_F(ReportAggregatorTest, DistributionBuckets) {
+  // The buckets are the same as DistributionHelper::AddSample().
+  std::vector<int64_t> sizes = {0, 1, 9, 10, 11, 99, 100, 12345, 1000000000};
+  Distribution expected;
+  ASSERT_TRUE(DistributionHelper::InitExponential(8, 10.0, 1, &expected).ok());
+  for (int64_t size : sizes) {
+    ReportRequestInfo info;
+    FillReportRequestInfo(&info);
+    info.request_size = size;
+    ASSERT_TRUE(aggregator_.Add(info));
+    ASSERT_TRUE(DistributionHelper::AddSample(size, &expected).ok());
+  }
+
+  ReportRequest request;
+  ASSERT_TRUE(aggregator_.Flush(&request).ok());
+  const MetricValueSet* request_sizes =
+      FindMetric(request.operations(0), kRequestSizes);
+  ASSERT_TRUE(request_sizes != nullptr);
+  const Distribution& actual =
+      request_sizes->metric_values(0).distribution_value();
+
+  ASSERT_EQ(expected.count(), actual.count());
+  ASSERT_DOUBLE_EQ(expected.mean(), actual.mean());
+  ASSERT_DOUBLE_EQ(expected.minimum(), actual.minimum());
+  ASSERT_DOUBLE_EQ(expected.maximum(), actual.maximum());
+  ASSERT_NEAR(expected.sum_of_squared_deviation(),
+              actual.sum_of_squared_deviation(),
+              expected.sum_of_squared_deviation() * 1e-9);
+  ASSERT_EQ(expected.bucket_counts_size(), actual.bucket_counts_size());
+  for (int i = 0; i < expected.bucket_counts_size(); ++i) {
+    ASSERT_EQ(expected.bucket_counts(i), actual.bucket_counts(i)) << i;
+  }
+}
+
+}  // namespace
+
+}  // namespace service_control
+}  // namespace api_manager
+}  // namespace google
@@ -0,0 +1,75 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+#include "contrib/endpoints/src/api_manager/service_control/report_flush_controller.h"
+
+#include <algorithm>
+
+namespace google {
+namespace api_manager {
+namespace service_control {
+
+ReportFlushController::ReportFlushController(int min_interval_ms,
+                                             int max_interval_ms,
+                                             size_t min_entries,
+                                             size_t max_entries, TimePoint now)
+    : min_interval_ms_(min_interval_ms),
+      max_interval_ms_(std::max(min_interval_ms, max_interval_ms)),
+      min_entries_(std::max<size_t>(1, std::min(min_entries, max_entries))),
+      max_entries_(std::max<size_t>(1, max_entries)),
+      interval_ms_(min_interval_ms_),
+      batch_entries_(min_entries_),
+      last_flush_(now) {}
+
+bool ReportFlushController::ShouldFlush(TimePoint now, size_t entries) const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return entries >= batch_entries_ ||
+         now - last_flush_ >= std::chrono::milliseconds(interval_ms_);
+}
+
+void ReportFlushController::OnFlush(TimePoint now, size_t reports,
+                                    size_t entries) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  last_flush_ = now;
+
+  if (reports >= 2 * entries && reports > 0) {
+    // Most reports were merged, waiting longer merges more of them.
+    interval_ms_ = std::min(interval_ms_ * 2, max_interval_ms_);
+  } else if (reports <= entries) {
+    // No report was merged, waiting only delays them.
+    interval_ms_ = std::max(interval_ms_ / 2, min_interval_ms_);
+  }
+
+  if (entries >= batch_entries_) {
+    batch_entries_ = std::min(batch_entries_ * 2, max_entries_);
+  } else if (entries < batch_entries_ / 4) {
+    batch_entries_ = std::max(batch_entries_ / 2, min_entries_);
+  }
+}
+
+int ReportFlushController::interval_ms() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return interval_ms_;
+}
+
+size_t ReportFlushController::batch_entries() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return batch_entries_;
+}
+
+}  // namespace service_control
+}  // namespace api_manager
+}  // namespace google
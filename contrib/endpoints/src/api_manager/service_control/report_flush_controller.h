@@ -0,0 +1,72 @@
+/* Copyright 2017 Google Inc. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef API_MANAGER_SERVICE_CONTROL_REPORT_FLUSH_CONTROLLER_H_
+#define API_MANAGER_SERVICE_CONTROL_REPORT_FLUSH_CONTROLLER_H_
+
+#include <chrono>
+#include <mutex>
+
+namespace google {
+namespace api_manager {
+namespace service_control {
+
+// Decides when the locally aggregated reports are flushed, adapting the
+// flush interval and the batch size to the load:
+//  -- The interval grows while waiting longer merges more reports into the
+//  same operations, up to max_interval_ms, the staleness budget. It shrinks
+//  when the reports are not merged, e.g. when idle, down to min_interval_ms.
+//  -- The batch size, the number of aggregated operations which triggers a
+//  flush before the interval, grows when the batches fill up before the
+//  interval, up to max_entries, the memory budget. It shrinks when the
+//  batches are mostly empty, down to min_entries.
+class ReportFlushController {
+ public:
+  typedef std::chrono::steady_clock::time_point TimePoint;
+
+  ReportFlushController(int min_interval_ms, int max_interval_ms,
+                        size_t min_entries, size_t max_entries,
+                        TimePoint now);
+
+  // Returns whether the reports should be flushed at now, with entries
+  // operations aggregated.
+  bool ShouldFlush(TimePoint now, size_t entries) const;
+
+  // Records the flush at now of reports merged into entries operations,
+  // and adapts the interval and the batch size.
+  void OnFlush(TimePoint now, size_t reports, size_t entries);
+
+  // The current flush interval.
+  int interval_ms() const;
+  // The current batch size.
+  size_t batch_entries() const;
+
+ private:
+  const int min_interval_ms_;
+  const int max_interval_ms_;
+  const size_t min_entries_;
+  const size_t max_entries_;
+
+  // Protects the members below.
+  mutable std::mutex mutex_;
+  int interval_ms_;
+  size_t batch_entries_;
+  TimePoint last_flush_;
+};
+
+}  // namespace service_control
+}  // namespace api_manager
+}  // namespace google
+
+#endif  // API_MANAGER_SERVICE_CONTROL_REPORT_FLUSH_CONTROLLER_H_
@@ -0,0 +1,84 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+#include "contrib/endpoints/src/api_manager/service_control/report_flush_controller.h"
+
+#include "gtest/gtest.h"
+
+using std::chrono::milliseconds;
+using std::chrono::steady_clock;
+
+namespace google {
+namespace api_manager {
+namespace service_control {
+
+namespace {
+
+TEST(ReportFlushControllerTest, FlushTriggers) {
+  steady_clock::time_point now = steady_clock::now();
+  ReportFlushController controller(100, 1000, 10, 1000, now);
+  ASSERT_EQ(100, controller.interval_ms());
+  ASSERT_EQ(10, controller.batch_entries());
+
+  ASSERT_FALSE(controller.ShouldFlush(now + milliseconds(99), 9));
+  ASSERT_TRUE(controller.ShouldFlush(now + milliseconds(100), 0));
+  // The batch is full.
+  ASSERT_TRUE(controller.ShouldFlush(now + milliseconds(10), 10));
+
+  controller.OnFlush(now + milliseconds(10), 10, 10);
+  ASSERT_FALSE(controller.ShouldFlush(now + milliseconds(109), 0));
+  ASSERT_TRUE(controller.ShouldFlush(now + milliseconds(110), 0));
+}
+
+TEST(ReportFlushControllerTest, GrowsUnderLoad) {
+  steady_clock::time_point now = steady_clock::now();
+  ReportFlushController controller(100, 1000, 10, 50, now);
+
+  // Merged reports filling up the batches.
+  for (int i = 0; i < 10; ++i) {
+    controller.OnFlush(now, 1000, controller.batch_entries());
+  }
+  // Bounded by the staleness and memory budgets.
+  ASSERT_EQ(1000, controller.interval_ms());
+  ASSERT_EQ(50, controller.batch_entries());
+}
+
+TEST(ReportFlushControllerTest, ShrinksWhenIdle) {
+  steady_clock::time_point now = steady_clock::now();
+  ReportFlushController controller(100, 1000, 10, 1000, now);
+  for (int i = 0; i < 4; ++i) {
+    controller.OnFlush(now, 1000, controller.batch_entries());
+  }
+  ASSERT_EQ(1000, controller.interval_ms());
+  ASSERT_EQ(160, controller.batch_entries());
+
+  // Some merged reports in half full batches keep the current values.
+  controller.OnFlush(now, 100, 80);
+  ASSERT_EQ(1000, controller.interval_ms());
+  ASSERT_EQ(160, controller.batch_entries());
+
+  for (int i = 0; i < 10; ++i) {
+    controller.OnFlush(now, 0, 0);
+  }
+  ASSERT_EQ(100, controller.interval_ms());
+  ASSERT_EQ(10, controller.batch_entries());
+}
+
+}  // namespace
+
+}  // namespace service_control
+}  // namespace api_manager
+}  // namespace google
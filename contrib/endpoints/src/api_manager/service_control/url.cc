@@ -52,7 +52,8 @@ const std::string& GetServiceControlAddress(
 }  // namespace
 
 Url::Url(const ::google::api::Service* service,
-         const proto::ServerConfig* server_config) {
+         const proto::ServerConfig* server_config)
+    : grpc_use_tls_(true) {
   // Precompute check and report URLs
   if (service) {
     service_control_ = GetServiceControlAddress(service, server_config);
@@ -68,6 +69,16 @@ Url::Url(const ::google::api::Service* service,
     check_url_ = path + check_verb;
     report_url_ = path + report_verb;
     quota_url_ = path + quota_verb;
+
+    grpc_use_tls_ = service_control_.compare(0, sizeof(https) - 1, https) == 0;
+    size_t host_begin = grpc_use_tls_ ? sizeof(https) - 1 : sizeof(http) - 1;
+    grpc_server_ = service_control_.substr(
+        host_begin, service_control_.find('/', host_begin) - host_begin);
+    // The colon of the port follows the closing bracket of IPv6 literals.
+    if (grpc_server_.find(':', grpc_server_.rfind(']') + 1) ==
+        std::string::npos) {
+      grpc_server_ += grpc_use_tls_ ? ":443" : ":80";
+    }
   }
 }
 
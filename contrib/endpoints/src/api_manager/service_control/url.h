@@ -34,12 +34,20 @@ class Url {
   const std::string& quota_url() const { return quota_url_; }
   const std::string& report_url() const { return report_url_; }
 
+  // The "host:port" address of the service control gRPC server, and whether
+  // the channel to it uses TLS.
+  const std::string& grpc_server() const { return grpc_server_; }
+  bool grpc_use_tls() const { return grpc_use_tls_; }
+
  private:
   // Pre-computed url for service control methods.
   std::string service_control_;
   std::string check_url_;
   std::string quota_url_;
   std::string report_url_;
+
+  std::string grpc_server_;
+  bool grpc_use_tls_;
 };
 
 }  // namespace service_control
@@ -61,6 +61,8 @@ TEST(UrlTest, PrependHttps) {
       "https://servicecontrol.googleapis.com/v1/services/"
       "https-config:allocateQuota",
       url.quota_url());
+  ASSERT_EQ("servicecontrol.googleapis.com:443", url.grpc_server());
+  ASSERT_TRUE(url.grpc_use_tls());
 }
 
 TEST(UrlTest, ServerControlOverride) {
@@ -75,6 +77,17 @@ TEST(UrlTest, ServerControlOverride) {
             url.service_control());
 }
 
+TEST(UrlTest, GrpcServer) {
+  ::google::api::Service service;
+  service.set_name("grpc-config");
+  proto::ServerConfig server_config;
+  server_config.mutable_service_control_config()->set_url_override(
+      "http://localhost:8081/");
+  Url url(&service, &server_config);
+  ASSERT_EQ("localhost:8081", url.grpc_server());
+  ASSERT_FALSE(url.grpc_use_tls());
+}
+
 }  // namespace
 
 }  // namespace service_control
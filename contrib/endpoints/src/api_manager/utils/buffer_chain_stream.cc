@@ -0,0 +1,130 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+#include "contrib/endpoints/src/api_manager/utils/buffer_chain_stream.h"
+
+#include <algorithm>
+
+#include "google/protobuf/io/coded_stream.h"
+
+using ::google::protobuf::int64;
+using ::google::protobuf::io::CodedOutputStream;
+
+namespace google {
+namespace api_manager {
+namespace utils {
+
+BufferChainOutputStream::BufferChainOutputStream(BufferChain* chain,
+                                                 int block_size)
+    : chain_(chain),
+      block_size_(std::max(block_size, 1)),
+      used_(0),
+      flushed_(0) {}
+
+BufferChainOutputStream::~BufferChainOutputStream() { Flush(); }
+
+bool BufferChainOutputStream::Next(void** data, int* size) {
+  if (used_ == static_cast<int>(block_.size())) {
+    Flush();
+    block_.resize(block_size_);
+  }
+  *data = &block_[used_];
+  *size = block_.size() - used_;
+  used_ = block_.size();
+  return true;
+}
+
+void BufferChainOutputStream::BackUp(int count) { used_ -= count; }
+
+int64 BufferChainOutputStream::ByteCount() const { return flushed_ + used_; }
+
+void BufferChainOutputStream::Flush() {
+  if (used_ > 0) {
+    block_.resize(used_);
+    chain_->Append(std::move(block_));
+    flushed_ += used_;
+  }
+  block_.clear();
+  used_ = 0;
+}
+
+BufferChainInputStream::BufferChainInputStream(const BufferChain& chain)
+    : chain_(chain), buffer_(0), position_(0), byte_count_(0) {}
+
+bool BufferChainInputStream::Next(const void** data, int* size) {
+  const auto& buffers = chain_.buffers();
+  while (buffer_ < buffers.size() && position_ == buffers[buffer_]->size()) {
+    ++buffer_;
+    position_ = 0;
+  }
+  if (buffer_ == buffers.size()) {
+    return false;
+  }
+  const std::string& buffer = *buffers[buffer_];
+  *data = buffer.data() + position_;
+  *size = buffer.size() - position_;
+  position_ = buffer.size();
+  byte_count_ += *size;
+  return true;
+}
+
+void BufferChainInputStream::BackUp(int count) {
+  // Only the data returned by the last Next() can be backed up.
+  position_ -= count;
+  byte_count_ -= count;
+}
+
+bool BufferChainInputStream::Skip(int count) {
+  const auto& buffers = chain_.buffers();
+  while (count > 0) {
+    if (buffer_ == buffers.size()) {
+      return false;
+    }
+    size_t available = buffers[buffer_]->size() - position_;
+    if (static_cast<size_t>(count) <= available) {
+      position_ += count;
+      byte_count_ += count;
+      return true;
+    }
+    count -= available;
+    byte_count_ += available;
+    ++buffer_;
+    position_ = 0;
+  }
+  return true;
+}
+
+int64 BufferChainInputStream::ByteCount() const { return byte_count_; }
+
+void SerializeToBufferChain(const ::google::protobuf::MessageLite& message,
+                            BufferChain* chain) {
+  int size = message.ByteSize();
+  BufferChainOutputStream stream(chain, size);
+  // The coded stream backs up its unused bytes when it is destroyed, before
+  // the buffer chain stream is.
+  CodedOutputStream coded(&stream);
+  message.SerializeWithCachedSizes(&coded);
+}
+
+bool ParseFromBufferChain(const BufferChain& chain,
+                          ::google::protobuf::MessageLite* message) {
+  BufferChainInputStream stream(chain);
+  return message->ParseFromZeroCopyStream(&stream);
+}
+
+}  // namespace utils
+}  // namespace api_manager
+}  // namespace google
@@ -0,0 +1,87 @@
+/* Copyright 2017 Google Inc. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef API_MANAGER_UTILS_BUFFER_CHAIN_STREAM_H_
+#define API_MANAGER_UTILS_BUFFER_CHAIN_STREAM_H_
+
+#include <string>
+
+#include "contrib/endpoints/include/api_manager/buffer_chain.h"
+#include "google/protobuf/io/zero_copy_stream.h"
+#include "google/protobuf/message_lite.h"
+
+namespace google {
+namespace api_manager {
+namespace utils {
+
+// Writes to the buffers of a chain, so that protobufs are serialized
+// directly into the body of a request. The buffers are block_size bytes,
+// except the last one, which is trimmed. The data is appended to the chain
+// as the buffers are filled, and when the stream is destroyed.
+class BufferChainOutputStream
+    : public ::google::protobuf::io::ZeroCopyOutputStream {
+ public:
+  BufferChainOutputStream(BufferChain* chain, int block_size);
+  virtual ~BufferChainOutputStream();
+
+  virtual bool Next(void** data, int* size);
+  virtual void BackUp(int count);
+  virtual ::google::protobuf::int64 ByteCount() const;
+
+ private:
+  // Appends the used part of the current block to the chain.
+  void Flush();
+
+  BufferChain* chain_;
+  int block_size_;
+  // The block being written, and the bytes used in it.
+  std::string block_;
+  int used_;
+  // The bytes appended to the chain by the stream.
+  ::google::protobuf::int64 flushed_;
+};
+
+// Reads the buffers of a chain, so that protobufs are parsed directly from
+// the body of a response.
+class BufferChainInputStream
+    : public ::google::protobuf::io::ZeroCopyInputStream {
+ public:
+  explicit BufferChainInputStream(const BufferChain& chain);
+
+  virtual bool Next(const void** data, int* size);
+  virtual void BackUp(int count);
+  virtual bool Skip(int count);
+  virtual ::google::protobuf::int64 ByteCount() const;
+
+ private:
+  const BufferChain& chain_;
+  // The buffer being read, and the bytes read from it.
+  size_t buffer_;
+  size_t position_;
+  ::google::protobuf::int64 byte_count_;
+};
+
+// Serializes the message into the chain, in a single buffer.
+void SerializeToBufferChain(const ::google::protobuf::MessageLite& message,
+                            BufferChain* chain);
+
+// Parses the message from the chain. Returns false if it is invalid.
+bool ParseFromBufferChain(const BufferChain& chain,
+                          ::google::protobuf::MessageLite* message);
+
+}  // namespace utils
+}  // namespace api_manager
+}  // namespace google
+
+#endif  // API_MANAGER_UTILS_BUFFER_CHAIN_STREAM_H_
@@ -0,0 +1,113 @@
+// Copyright 2017 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+#include "contrib/endpoints/src/api_manager/utils/buffer_chain_stream.h"
+
+#include "gtest/gtest.h"
+#include "google/protobuf/io/coded_stream.h"
+#include "google/protobuf/wrappers.pb.h"
+
+using ::google::protobuf::StringValue;
+using ::google::protobuf::io::CodedOutputStream;
+
+namespace google {
+namespace api_manager {
+namespace utils {
+
+namespace {
+
+StringValue TestMessage() {
+  StringValue message;
+  for (int i = 0; i < 1000; ++i) {
+    message.mutable_value()->append(std::to_string(i));
+  }
+  return message;
+}
+
+TEST(BufferChainStreamTest, SerializeToSingleBuffer) {
+  StringValue message = TestMessage();
+  BufferChain chain;
+  SerializeToBufferChain(message, &chain);
+  ASSERT_EQ(1, chain.buffers().size());
+  ASSERT_EQ(message.SerializeAsString(), *chain.buffers()[0]);
+
+  StringValue parsed;
+  ASSERT_TRUE(ParseFromBufferChain(chain, &parsed));
+  ASSERT_EQ(message.value(), parsed.value());
+}
+
+TEST(BufferChainStreamTest, SerializeToBlocks) {
+  StringValue message = TestMessage();
+  BufferChain chain;
+  {
+    BufferChainOutputStream stream(&chain, 100);
+    CodedOutputStream coded(&stream);
+    ASSERT_TRUE(message.SerializeToCodedStream(&coded));
+  }
+  ASSERT_EQ(message.ByteSize(), chain.size());
+  ASSERT_EQ((chain.size() + 99) / 100, chain.buffers().size());
+  for (const auto& buffer : chain.buffers()) {
+    ASSERT_LE(buffer->size(), 100);
+  }
+  ASSERT_EQ(message.SerializeAsString(), chain.ToString());
+}
+
+TEST(BufferChainStreamTest, ParseFromBlocks) {
+  StringValue message = TestMessage();
+  std::string data = message.SerializeAsString();
+  BufferChain chain;
+  for (size_t i = 0; i < data.size(); i += 7) {
+    chain.Append(data.substr(i, 7));
+  }
+
+  StringValue parsed;
+  ASSERT_TRUE(ParseFromBufferChain(chain, &parsed));
+  ASSERT_EQ(message.value(), parsed.value());
+
+  // A truncated message is invalid.
+  BufferChain truncated;
+  truncated.Append(data.substr(0, data.size() / 2));
+  ASSERT_FALSE(ParseFromBufferChain(truncated, &parsed));
+}
+
+TEST(BufferChainStreamTest, InputStream) {
+  BufferChain chain;
+  chain.Append(std::string("abc"));
+  chain.Append(std::string());
+  chain.Append(std::string("defg"));
+  ASSERT_EQ(2, chain.buffers().size());
+  ASSERT_EQ(7, chain.size());
+
+  BufferChainInputStream stream(chain);
+  const void* data;
+  int size;
+  ASSERT_TRUE(stream.Next(&data, &size));
+  ASSERT_EQ("abc", std::string(static_cast<const char*>(data), size));
+  stream.BackUp(1);
+  ASSERT_EQ(2, stream.ByteCount());
+  ASSERT_TRUE(stream.Skip(2));
+  ASSERT_TRUE(stream.Next(&data, &size));
+  ASSERT_EQ("efg", std::string(static_cast<const char*>(data), size));
+  ASSERT_EQ(7, stream.ByteCount());
+  ASSERT_FALSE(stream.Next(&data, &size));
+  ASSERT_FALSE(stream.Skip(1));
+}
+
+}  // namespace
+
+}  // namespace utils
+}  // namespace api_manager
+}  // namespace google
@@ -0,0 +1,168 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+#include "contrib/endpoints/src/api_manager/utils/url_escape.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace google {
+namespace api_manager {
+namespace utils {
+
+namespace {
+
+// Check if an ASCII character is a hex digit.  We can't use ctype's
+// isxdigit() because it is affected by locale. This function is applied
+// to the escaped characters in a url, not to natural-language
+// strings, so locale should not be taken into account.
+inline bool ascii_isxdigit(char c) {
+  return ('a' <= c && c <= 'f') || ('A' <= c && c <= 'F') ||
+         ('0' <= c && c <= '9');
+}
+
+inline int hex_digit_to_int(char c) {
+  /* Assume ASCII. */
+  int x = static_cast<unsigned char>(c);
+  if (x > '9') {
+    x += 9;
+  }
+  return x & 0xf;
+}
+
+// Returns true if the three characters at data[i] are of the format
+// "%[0-9A-Fa-f]{2}" and the escaped character may be unescaped. The escaped
+// character is returned in out.
+inline bool GetEscapedChar(const char *data, size_t size, size_t i,
+                           bool unescape_reserved_chars, char *out) {
+  if (i + 2 < size && data[i] == '%' && ascii_isxdigit(data[i + 1]) &&
+      ascii_isxdigit(data[i + 2])) {
+    char c =
+        (hex_digit_to_int(data[i + 1]) << 4) | hex_digit_to_int(data[i + 2]);
+    if (!unescape_reserved_chars && IsReservedChar(c)) {
+      return false;
+    }
+    *out = c;
+    return true;
+  }
+  return false;
+}
+
+}  // namespace
+
+size_t FindPercent(const char *data, size_t size) {
+  size_t i = 0;
+#if defined(__AVX2__)
+  const __m256i percent32 = _mm256_set1_epi8('%');
+  for (; i + 32 <= size; i += 32) {
+    __m256i block =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + i));
+    unsigned mask = static_cast<unsigned>(
+        _mm256_movemask_epi8(_mm256_cmpeq_epi8(block, percent32)));
+    if (mask != 0) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+#endif
+#if defined(__SSE2__)
+  const __m128i percent16 = _mm_set1_epi8('%');
+  for (; i + 16 <= size; i += 16) {
+    __m128i block =
+        _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+    unsigned mask = static_cast<unsigned>(
+        _mm_movemask_epi8(_mm_cmpeq_epi8(block, percent16)));
+    if (mask != 0) {
+      return i + __builtin_ctz(mask);
+    }
+  }
+#endif
+  for (; i < size; ++i) {
+    if (data[i] == '%') {
+      return i;
+    }
+  }
+  return size;
+}
+
+bool IsReservedChar(char c) {
+  // Reserved characters according to RFC 6570
+  switch (c) {
+    case '!':
+    case '#':
+    case '$':
+    case '&':
+    case '\'':
+    case '(':
+    case ')':
+    case '*':
+    case '+':
+    case ',':
+    case '/':
+    case ':':
+    case ';':
+    case '=':
+    case '?':
+    case '@':
+    case '[':
+    case ']':
+      return true;
+    default:
+      return false;
+  }
+}
+
+void AppendUrlUnescaped(const char *data, size_t size,
+                        bool unescape_reserved_chars, std::string *out) {
+  size_t i = FindPercent(data, size);
+  if (i == size) {
+    // Fast path: nothing to unescape.
+    out->append(data, size);
+    return;
+  }
+
+  out->reserve(out->size() + size);
+  // Start of the run of literal characters not yet copied to out.
+  size_t run = 0;
+  while (i < size) {
+    char c;
+    if (GetEscapedChar(data, size, i, unescape_reserved_chars, &c)) {
+      out->append(data + run, i - run);
+      out->push_back(c);
+      i += 3;
+      run = i;
+    } else {
+      // Not a decodable escape, keep the '%' as a literal.
+      ++i;
+    }
+    i += FindPercent(data + i, size - i);
+  }
+  out->append(data + run, size - run);
+}
+
+std::string UrlUnescapeString(const std::string &part,
+                              bool unescape_reserved_chars) {
+  std::string unescaped;
+  AppendUrlUnescaped(part.data(), part.size(), unescape_reserved_chars,
+                     &unescaped);
+  return unescaped;
+}
+
+}  // namespace utils
+}  // namespace api_manager
+}  // namespace google
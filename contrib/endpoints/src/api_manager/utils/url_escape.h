@@ -0,0 +1,53 @@
+/* Copyright 2016 Google Inc. All Rights Reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#ifndef API_MANAGER_UTILS_URL_ESCAPE_H_
+#define API_MANAGER_UTILS_URL_ESCAPE_H_
+
+#include <cstddef>
+#include <string>
+
+namespace google {
+namespace api_manager {
+namespace utils {
+
+// Returns the offset of the first '%' in [data, data + size), or size if there
+// is none. The scan uses AVX2 or SSE2 when the target supports them and falls
+// back to a byte-by-byte loop otherwise.
+size_t FindPercent(const char *data, size_t size);
+
+// Returns true if c is a reserved character according to RFC 6570.
+bool IsReservedChar(char c);
+
+// Percent-decodes [data, data + size) and appends the result to out. Only
+// well-formed "%[0-9A-Fa-f]{2}" sequences are decoded; anything else is copied
+// verbatim. Reserved characters (as specified in RFC 6570) are left escaped if
+// unescape_reserved_chars is false.
+//
+// The input is scanned only once: runs of literal characters between escapes
+// are located with FindPercent() and copied in bulk.
+void AppendUrlUnescaped(const char *data, size_t size,
+                        bool unescape_reserved_chars, std::string *out);
+
+// Unescapes string 'part' and returns the unescaped string. Reserved characters
+// (as specified in RFC 6570) are not escaped if unescape_reserved_chars is
+// false.
+std::string UrlUnescapeString(const std::string &part,
+                              bool unescape_reserved_chars);
+
+}  // namespace utils
+}  // namespace api_manager
+}  // namespace google
+
+#endif  // API_MANAGER_UTILS_URL_ESCAPE_H_
@@ -0,0 +1,150 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+// Microbenchmark for URL unescaping. Compares the single-pass unescaper in
+// url_escape.cc with the previous two-pass, byte-by-byte implementation on a
+// set of path segments and query values typical for REST APIs.
+//
+// Usage:
+//   bazel run -c opt //contrib/endpoints/src/api_manager/utils:url_escape_benchmark
+//
+#include "contrib/endpoints/src/api_manager/utils/url_escape.h"
+
+#include <chrono>
+#include <cstdio>
+#include <iterator>
+#include <string>
+#include <vector>
+
+using ::google::api_manager::utils::IsReservedChar;
+using ::google::api_manager::utils::UrlUnescapeString;
+
+namespace {
+
+const int kIterations = 200000;
+
+const char *kInputs[] = {
+    "shelves",
+    "books",
+    "1234567890",
+    "v1",
+    "projects",
+    "my-project-id-1234",
+    "Neal%20Stephenson",
+    "The%20Hitchhiker%27s%20Guide%20to%20the%20Galaxy",
+    "users%2Fjohn.doe%40example.com",
+    "AIzaSyAz7fhBkC35D2MAIzaSyAz7fhBkC35D2M",
+    "2017-03-20T10%3A15%3A00Z",
+    "a-long-resource-name-without-any-escapes-but-many-characters-in-it",
+};
+
+// The previous implementation, kept here as the baseline.
+bool LegacyIsXDigit(char c) {
+  return ('a' <= c && c <= 'f') || ('A' <= c && c <= 'F') ||
+         ('0' <= c && c <= '9');
+}
+
+int LegacyHexDigitToInt(char c) {
+  int x = static_cast<unsigned char>(c);
+  if (x > '9') {
+    x += 9;
+  }
+  return x & 0xf;
+}
+
+bool LegacyGetEscapedChar(const std::string &src, size_t i,
+                          bool unescape_reserved_chars, char *out) {
+  if (i + 2 < src.size() && src[i] == '%') {
+    if (LegacyIsXDigit(src[i + 1]) && LegacyIsXDigit(src[i + 2])) {
+      char c = (LegacyHexDigitToInt(src[i + 1]) << 4) |
+               LegacyHexDigitToInt(src[i + 2]);
+      if (!unescape_reserved_chars && IsReservedChar(c)) {
+        return false;
+      }
+      *out = c;
+      return true;
+    }
+  }
+  return false;
+}
+
+std::string LegacyUrlUnescapeString(const std::string &part,
+                                    bool unescape_reserved_chars) {
+  std::string unescaped;
+  bool needs_unescaping = false;
+  char ch = '\0';
+  for (size_t i = 0; i < part.size(); ++i) {
+    if (LegacyGetEscapedChar(part, i, unescape_reserved_chars, &ch)) {
+      needs_unescaping = true;
+      break;
+    }
+  }
+  if (!needs_unescaping) {
+    unescaped = part;
+    return unescaped;
+  }
+  unescaped.resize(part.size());
+  char *begin = &(unescaped)[0];
+  char *p = begin;
+  for (size_t i = 0; i < part.size();) {
+    if (LegacyGetEscapedChar(part, i, unescape_reserved_chars, &ch)) {
+      *p++ = ch;
+      i += 3;
+    } else {
+      *p++ = part[i];
+      i += 1;
+    }
+  }
+  unescaped.resize(p - begin);
+  return unescaped;
+}
+
+template <class F>
+double Run(const std::vector<std::string> &inputs, F unescape) {
+  size_t total = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < kIterations; ++i) {
+    for (const auto &input : inputs) {
+      total += unescape(input, true).size();
+    }
+  }
+  auto end = std::chrono::steady_clock::now();
+  // Keeps the loop from being optimized away.
+  if (total == 0) {
+    fprintf(stderr, "unexpected empty output\n");
+  }
+  return std::chrono::duration<double, std::nano>(end - start).count() /
+         (static_cast<double>(kIterations) * inputs.size());
+}
+
+}  // namespace
+
+int main() {
+  std::vector<std::string> inputs(std::begin(kInputs), std::end(kInputs));
+  for (const auto &input : inputs) {
+    if (LegacyUrlUnescapeString(input, true) !=
+        UrlUnescapeString(input, true)) {
+      fprintf(stderr, "mismatch for input: %s\n", input.c_str());
+      return 1;
+    }
+  }
+
+  double legacy = Run(inputs, LegacyUrlUnescapeString);
+  double current = Run(inputs, UrlUnescapeString);
+  printf("two-pass unescape:    %8.2f ns/segment\n", legacy);
+  printf("single-pass unescape: %8.2f ns/segment\n", current);
+  return 0;
+}
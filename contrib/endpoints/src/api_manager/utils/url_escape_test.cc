@@ -0,0 +1,107 @@
+// Copyright 2016 Google Inc. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//    http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+////////////////////////////////////////////////////////////////////////////////
+//
+#include "contrib/endpoints/src/api_manager/utils/url_escape.h"
+
+#include "gtest/gtest.h"
+
+namespace google {
+namespace api_manager {
+namespace utils {
+
+TEST(UrlEscape, FindPercent) {
+  EXPECT_EQ(0, FindPercent("", 0));
+  EXPECT_EQ(3, FindPercent("abc", 3));
+  EXPECT_EQ(0, FindPercent("%", 1));
+
+  // Exercise every position across the vectorized block boundaries.
+  for (size_t size = 1; size < 100; ++size) {
+    for (size_t pos = 0; pos < size; ++pos) {
+      std::string s(size, 'a');
+      s[pos] = '%';
+      EXPECT_EQ(pos, FindPercent(s.data(), s.size())) << size << " " << pos;
+      if (pos + 1 < size) {
+        s[size - 1] = '%';
+        EXPECT_EQ(pos, FindPercent(s.data(), s.size())) << size << " " << pos;
+      }
+    }
+    std::string s(size, 'a');
+    EXPECT_EQ(size, FindPercent(s.data(), s.size()));
+  }
+}
+
+TEST(UrlEscape, UnescapeNoEscapes) {
+  EXPECT_EQ("", UrlUnescapeString("", true));
+  EXPECT_EQ("shelves", UrlUnescapeString("shelves", true));
+  EXPECT_EQ("a-very-long-segment-without-any-escapes-in-it",
+            UrlUnescapeString("a-very-long-segment-without-any-escapes-in-it",
+                              false));
+}
+
+TEST(UrlEscape, UnescapeAll) {
+  EXPECT_EQ(" ", UrlUnescapeString("%20", true));
+  EXPECT_EQ("Neal Stephenson", UrlUnescapeString("Neal%20Stephenson", true));
+  EXPECT_EQ("a/b?c", UrlUnescapeString("a%2Fb%3fc", true));
+  EXPECT_EQ("%%", UrlUnescapeString("%25%25", true));
+  EXPECT_EQ("\xff", UrlUnescapeString("%FF", true));
+}
+
+TEST(UrlEscape, UnescapeKeepsReserved) {
+  EXPECT_EQ("a%2Fb c", UrlUnescapeString("a%2Fb%20c", false));
+  EXPECT_EQ("%21%23%24%26%27%28%29%2A%2B%2C%2F%3A%3B%3D%3F%40%5B%5D",
+            UrlUnescapeString(
+                "%21%23%24%26%27%28%29%2A%2B%2C%2F%3A%3B%3D%3F%40%5B%5D",
+                false));
+  EXPECT_EQ("!#$&'()*+,/:;=?@[]",
+            UrlUnescapeString(
+                "%21%23%24%26%27%28%29%2A%2B%2C%2F%3A%3B%3D%3F%40%5B%5D",
+                true));
+}
+
+TEST(UrlEscape, UnescapeMalformed) {
+  EXPECT_EQ("%", UrlUnescapeString("%", true));
+  EXPECT_EQ("%2", UrlUnescapeString("%2", true));
+  EXPECT_EQ("%zz", UrlUnescapeString("%zz", true));
+  EXPECT_EQ("%2g ", UrlUnescapeString("%2g%20", true));
+  EXPECT_EQ("% ", UrlUnescapeString("%%20", true));
+  EXPECT_EQ("abc%", UrlUnescapeString("abc%", true));
+  EXPECT_EQ("abc%4", UrlUnescapeString("abc%4", true));
+}
+
+TEST(UrlEscape, UnescapeLong) {
+  std::string escaped;
+  std::string expected;
+  for (int i = 0; i < 50; ++i) {
+    escaped += "segment%20";
+    expected += "segment ";
+  }
+  EXPECT_EQ(expected, UrlUnescapeString(escaped, true));
+}
+
+TEST(UrlEscape, AppendUnescaped) {
+  std::string out = "prefix/";
+  const char part[] = "x%20y";
+  AppendUrlUnescaped(part, sizeof(part) - 1, true, &out);
+  EXPECT_EQ("prefix/x y", out);
+
+  const char plain[] = "plain";
+  AppendUrlUnescaped(plain, sizeof(plain) - 1, true, &out);
+  EXPECT_EQ("prefix/x yplain", out);
+}
+
+}  // namespace utils
+}  // namespace api_manager
+}  // namespace google